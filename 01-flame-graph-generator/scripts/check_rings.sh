@@ -0,0 +1,40 @@
+#!/bin/sh
+# check_rings.sh — A/B check that shared rings keep their wakeups
+#
+# Profiles 1 and then 8 workload processes on cpu-clock at the same rate.
+# With 8 targets every CPU's ring is fed by 8 events through SET_OUTPUT,
+# and their samples must still be drained as fully as one target's: a
+# lost watermark wakeup leaves the ring full and the count drops sharply.
+# Needs perf_event_paranoid <= 1 (or root). Run by `make check`.
+#
+# Usage: scripts/check_rings.sh [bindir]
+set -e
+BIN=${1:-bin}
+HZ=4000
+SECS=3
+
+samples() {
+    pids=
+    for i in $(seq "$1"); do
+        "$BIN/workload" $((SECS + 2)) > /dev/null &
+        pids="$pids${pids:+,}$!"
+    done
+    sleep 0.2
+    "$BIN/profiler" -p "$pids" -d $SECS -f $HZ -o /dev/null 2>&1 |
+        tee /dev/stderr | sed -n 's/^profiler: collected \([0-9]*\) samples$/\1/p'
+    wait
+}
+
+one=$(samples 1)
+eight=$(samples 8)
+echo "check_rings: 1 target $one samples, 8 targets $eight samples"
+if [ -z "$one" ] || [ -z "$eight" ] || [ "$one" -eq 0 ]; then
+    echo "check_rings: profiler failed"
+    exit 1
+fi
+# 8 targets use at least the CPU time one does; allow 20% for scheduling
+if [ $((eight * 10)) -lt $((one * 8)) ]; then
+    echo "check_rings: 8 targets lost samples (ring wakeups missed?)"
+    exit 1
+fi
+echo "check_rings: ok"
@@ -3,14 +3,17 @@
 flamediff.py — Milestone 4: Differential Flame Graph
 
 Compares two folded stack profiles and generates a differential SVG
-where colors indicate regression (red) vs improvement (blue).
+where colors indicate regression (red) vs improvement (blue). Either
+side may also be a binary .fgp profile (see src/fgprof.h).
 
 Usage:
     python3 flamediff.py before.folded after.folded -o diff.svg
     python3 flamediff.py -a before.folded -b after.folded --title "v1 vs v2"
+    python3 flamediff.py --from 1760000000 --to 1760000600 mon.fgp tue.fgp
 """
 
 import sys
+import struct
 import argparse
 from collections import defaultdict
 
@@ -85,6 +88,61 @@ def parse_folded(lines):
     return stacks, total
 
 
+# ── Parse binary .fgp profiles ─────────────────────────────────
+
+FGP_MAGIC = b'FGPROF01'
+
+
+def parse_fgp(data, from_ns=0, to_ns=None):
+    """Parse a .fgp profile, keeping samples in [from_ns, to_ns).
+    Returns the same ({stack_string: count}, total) as parse_folded."""
+    pos = 8 + 8 + 8 + 4 + 4
+    start_ns, _end_ns, _freq, _ = struct.unpack_from('<QQII', data, 8)
+
+    def varint():
+        nonlocal pos
+        v = shift = 0
+        while True:
+            b = data[pos]
+            pos += 1
+            v |= (b & 0x7f) << shift
+            if b < 0x80:
+                return v
+            shift += 7
+
+    strings = []
+    for _ in range(varint()):
+        n = varint()
+        strings.append(data[pos:pos + n].decode('utf-8', 'replace'))
+        pos += n
+
+    names = []
+    for _ in range(varint()):
+        depth = varint()
+        names.append(';'.join(strings[varint()] for _ in range(depth)))
+
+    stacks = defaultdict(int)
+    total = 0
+    t = start_ns // 1000000 * 1000000   # deltas are from the start's whole ms, as in fgprof.c
+    for _ in range(varint()):
+        stack_id = varint()
+        t += varint() * 1000000
+        count = varint()
+        if t >= from_ns and (to_ns is None or t < to_ns):
+            stacks[names[stack_id]] += count
+            total += count
+    return stacks, total
+
+
+def load_profile(path, from_ns=0, to_ns=None):
+    """Load folded text or a binary .fgp profile, by content."""
+    with open(path, 'rb') as f:
+        data = f.read()
+    if data.startswith(FGP_MAGIC):
+        return parse_fgp(data, from_ns, to_ns)
+    return parse_folded(data.decode('utf-8', 'replace').splitlines())
+
+
 def build_diff_tree(stacks_a, total_a, stacks_b, total_b):
     """Build a merged differential frame tree from two stack profiles."""
     root = DiffFrame("root")
@@ -337,6 +395,10 @@ def main():
     parser.add_argument('-t', '--title', default='Differential Flame Graph',
                         help='Graph title')
     parser.add_argument('-w', '--width', type=int, default=1200, help='SVG width')
+    parser.add_argument('--from', dest='from_s', type=float, default=0,
+                        help='Only .fgp samples at or after this time (epoch seconds)')
+    parser.add_argument('--to', dest='to_s', type=float,
+                        help='Only .fgp samples before this time (epoch seconds)')
     args = parser.parse_args()
 
     # Resolve input files
@@ -352,10 +414,10 @@ def main():
     if not before_file or not after_file:
         parser.error("Need two input files: before.folded after.folded")
 
-    with open(before_file) as f:
-        stacks_a, total_a = parse_folded(f.readlines())
-    with open(after_file) as f:
-        stacks_b, total_b = parse_folded(f.readlines())
+    from_ns = int(args.from_s * 1e9)
+    to_ns = int(args.to_s * 1e9) if args.to_s is not None else None
+    stacks_a, total_a = load_profile(before_file, from_ns, to_ns)
+    stacks_b, total_b = load_profile(after_file, from_ns, to_ns)
 
     if total_a == 0:
         print(f"flamediff.py: no samples in {before_file}", file=sys.stderr)
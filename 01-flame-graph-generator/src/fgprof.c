@@ -0,0 +1,397 @@
+/*
+ * fgprof.c — Compact binary profile format (.fgp), see fgprof.h
+ *
+ * The writer interns frame names and stacks in open-addressing hash
+ * tables and buffers samples; fgp_write sorts samples by time and emits
+ * everything varint-coded in one pass. The reader decodes a whole image
+ * into flat arrays.
+ */
+#define _GNU_SOURCE
+#include "fgprof.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* ── Growable arrays / byte buffer ──────────────────────────── */
+
+static void *grow(void *p, size_t *cap, size_t need, size_t elem)
+{
+    if (need <= *cap)
+        return p;
+    size_t c = *cap ? *cap : 256;
+    while (c < need) c *= 2;
+    void *q = realloc(p, c * elem);
+    if (!q) { perror("realloc"); exit(1); }
+    *cap = c;
+    return q;
+}
+
+struct buf {
+    unsigned char *data;
+    size_t len, cap;
+};
+
+static void buf_put(struct buf *b, const void *p, size_t n)
+{
+    b->data = grow(b->data, &b->cap, b->len + n, 1);
+    memcpy(b->data + b->len, p, n);
+    b->len += n;
+}
+
+static void buf_varint(struct buf *b, uint64_t v)
+{
+    unsigned char tmp[10];
+    int n = 0;
+    do {
+        tmp[n] = v & 0x7f;
+        v >>= 7;
+        if (v) tmp[n] |= 0x80;
+        n++;
+    } while (v);
+    buf_put(b, tmp, n);
+}
+
+static uint64_t hash_mix(uint64_t h, uint64_t v)
+{
+    h ^= v;
+    h *= 0x100000001b3ULL;
+    return h ^ (h >> 31);
+}
+
+/* ── Writer ─────────────────────────────────────────────────── */
+
+struct fgp_writer {
+    uint64_t  start_ns;
+    uint32_t  sample_freq;
+
+    /* strings: ids → bytes, plus hash slots (id + 1, 0 = empty) */
+    char    **strings;
+    uint32_t *string_len;
+    size_t    n_strings, cap_strings, cap_string_len;
+    uint32_t *string_slots;
+    size_t    string_slots_size;
+
+    /* stacks: frames[stack_off[i] .. stack_off[i+1]) */
+    uint32_t *frames;
+    size_t    n_frames, cap_frames;
+    uint32_t *stack_off;
+    size_t    n_stacks, cap_stack_off;
+    uint64_t *stack_hash;
+    size_t    cap_stack_hash;
+    uint32_t *stack_slots;
+    size_t    stack_slots_size;
+
+    struct fgp_sample *samples;
+    size_t    n_samples, cap_samples;
+};
+
+struct fgp_writer *fgp_writer_new(uint64_t start_ns, uint32_t sample_freq)
+{
+    struct fgp_writer *w = calloc(1, sizeof(*w));
+    if (!w)
+        return NULL;
+    w->start_ns = start_ns;
+    w->sample_freq = sample_freq;
+    w->stack_off = grow(NULL, &w->cap_stack_off, 1, sizeof(*w->stack_off));
+    w->stack_off[0] = 0;
+    return w;
+}
+
+static uint64_t string_hash(const char *s, size_t len)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; i++)
+        h = (h ^ (unsigned char)s[i]) * 0x100000001b3ULL;
+    return h;
+}
+
+static void slots_rehash(uint32_t **slots, size_t *size, size_t n,
+                         uint64_t (*hash_of)(struct fgp_writer *, uint32_t),
+                         struct fgp_writer *w)
+{
+    free(*slots);
+    *size = *size ? *size * 2 : 1024;
+    *slots = calloc(*size, sizeof(**slots));
+    if (!*slots) { perror("calloc"); exit(1); }
+    for (uint32_t id = 0; id < n; id++) {
+        size_t i = hash_of(w, id) & (*size - 1);
+        while ((*slots)[i]) i = (i + 1) & (*size - 1);
+        (*slots)[i] = id + 1;
+    }
+}
+
+static uint64_t string_hash_of(struct fgp_writer *w, uint32_t id)
+{
+    return string_hash(w->strings[id], w->string_len[id]);
+}
+
+static uint64_t stack_hash_of(struct fgp_writer *w, uint32_t id)
+{
+    return w->stack_hash[id];
+}
+
+static uint32_t intern_string(struct fgp_writer *w, const char *s, size_t len)
+{
+    if ((w->n_strings + 1) * 2 > w->string_slots_size)
+        slots_rehash(&w->string_slots, &w->string_slots_size, w->n_strings,
+                     string_hash_of, w);
+
+    size_t mask = w->string_slots_size - 1;
+    size_t i = string_hash(s, len) & mask;
+    for (; w->string_slots[i]; i = (i + 1) & mask) {
+        uint32_t id = w->string_slots[i] - 1;
+        if (w->string_len[id] == len && memcmp(w->strings[id], s, len) == 0)
+            return id;
+    }
+
+    uint32_t id = (uint32_t)w->n_strings++;
+    w->strings = grow(w->strings, &w->cap_strings, w->n_strings, sizeof(*w->strings));
+    w->string_len = grow(w->string_len, &w->cap_string_len, w->n_strings,
+                         sizeof(*w->string_len));
+    w->strings[id] = malloc(len + 1);
+    if (!w->strings[id]) { perror("malloc"); exit(1); }
+    memcpy(w->strings[id], s, len);
+    w->strings[id][len] = '\0';
+    w->string_len[id] = (uint32_t)len;
+    w->string_slots[i] = id + 1;
+    return id;
+}
+
+uint32_t fgp_add_stack(struct fgp_writer *w, const char *folded)
+{
+    /* Append the frames tentatively; drop them again if the stack exists */
+    size_t first = w->n_frames;
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (const char *p = folded; *p; ) {
+        const char *semi = strchr(p, ';');
+        size_t len = semi ? (size_t)(semi - p) : strlen(p);
+        if (len > 0) {
+            uint32_t id = intern_string(w, p, len);
+            w->frames = grow(w->frames, &w->cap_frames, w->n_frames + 1, sizeof(*w->frames));
+            w->frames[w->n_frames++] = id;
+            h = hash_mix(h, id);
+        }
+        p += len + (semi != NULL);
+    }
+    size_t depth = w->n_frames - first;
+
+    if ((w->n_stacks + 1) * 2 > w->stack_slots_size)
+        slots_rehash(&w->stack_slots, &w->stack_slots_size, w->n_stacks,
+                     stack_hash_of, w);
+
+    size_t mask = w->stack_slots_size - 1;
+    size_t i = h & mask;
+    for (; w->stack_slots[i]; i = (i + 1) & mask) {
+        uint32_t id = w->stack_slots[i] - 1;
+        size_t off = w->stack_off[id], d = w->stack_off[id + 1] - off;
+        if (w->stack_hash[id] == h && d == depth &&
+            memcmp(&w->frames[off], &w->frames[first], depth * sizeof(uint32_t)) == 0) {
+            w->n_frames = first;
+            return id;
+        }
+    }
+
+    uint32_t id = (uint32_t)w->n_stacks++;
+    w->stack_off = grow(w->stack_off, &w->cap_stack_off, w->n_stacks + 1,
+                        sizeof(*w->stack_off));
+    w->stack_off[id + 1] = (uint32_t)w->n_frames;
+    w->stack_hash = grow(w->stack_hash, &w->cap_stack_hash, w->n_stacks,
+                         sizeof(*w->stack_hash));
+    w->stack_hash[id] = h;
+    w->stack_slots[i] = id + 1;
+    return id;
+}
+
+void fgp_add_sample(struct fgp_writer *w, uint32_t stack_id,
+                    uint64_t time_ns, uint64_t count)
+{
+    w->samples = grow(w->samples, &w->cap_samples, w->n_samples + 1, sizeof(*w->samples));
+    w->samples[w->n_samples++] = (struct fgp_sample){ stack_id, time_ns, count };
+}
+
+static int cmp_sample(const void *a, const void *b)
+{
+    const struct fgp_sample *x = a, *y = b;
+    if (x->time_ns != y->time_ns)
+        return x->time_ns < y->time_ns ? -1 : 1;
+    return (x->stack > y->stack) - (x->stack < y->stack);
+}
+
+static void writer_free(struct fgp_writer *w)
+{
+    for (size_t i = 0; i < w->n_strings; i++)
+        free(w->strings[i]);
+    free(w->strings);
+    free(w->string_len);
+    free(w->string_slots);
+    free(w->frames);
+    free(w->stack_off);
+    free(w->stack_hash);
+    free(w->stack_slots);
+    free(w->samples);
+    free(w);
+}
+
+long fgp_write(struct fgp_writer *w, const char *path, uint64_t end_ns)
+{
+    struct buf b = { 0 };
+
+    buf_put(&b, FGP_MAGIC, FGP_MAGIC_LEN);
+    uint32_t reserved = 0;
+    buf_put(&b, &w->start_ns, sizeof(w->start_ns));
+    buf_put(&b, &end_ns, sizeof(end_ns));
+    buf_put(&b, &w->sample_freq, sizeof(w->sample_freq));
+    buf_put(&b, &reserved, sizeof(reserved));
+
+    buf_varint(&b, w->n_strings);
+    for (size_t i = 0; i < w->n_strings; i++) {
+        buf_varint(&b, w->string_len[i]);
+        buf_put(&b, w->strings[i], w->string_len[i]);
+    }
+
+    buf_varint(&b, w->n_stacks);
+    for (size_t i = 0; i < w->n_stacks; i++) {
+        uint32_t off = w->stack_off[i], end = w->stack_off[i + 1];
+        buf_varint(&b, end - off);
+        for (uint32_t j = off; j < end; j++)
+            buf_varint(&b, w->frames[j]);
+    }
+
+    qsort(w->samples, w->n_samples, sizeof(*w->samples), cmp_sample);
+    buf_varint(&b, w->n_samples);
+    uint64_t prev_ms = w->start_ns / 1000000;
+    for (size_t i = 0; i < w->n_samples; i++) {
+        uint64_t ms = w->samples[i].time_ns / 1000000;
+        if (ms < prev_ms) ms = prev_ms;  /* samples before start_ns clamp */
+        buf_varint(&b, w->samples[i].stack);
+        buf_varint(&b, ms - prev_ms);
+        buf_varint(&b, w->samples[i].count);
+        prev_ms = ms;
+    }
+
+    long written = -1;
+    FILE *f = fopen(path, "wb");
+    if (f) {
+        if (fwrite(b.data, 1, b.len, f) == b.len)
+            written = (long)b.len;
+        if (fclose(f) != 0)
+            written = -1;
+    }
+    if (written < 0)
+        perror(path);
+
+    free(b.data);
+    writer_free(w);
+    return written;
+}
+
+/* ── Reader ─────────────────────────────────────────────────── */
+
+struct cursor {
+    const unsigned char *p, *end;
+    int bad;
+};
+
+static uint64_t get_varint(struct cursor *c)
+{
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (c->p >= c->end) { c->bad = 1; return 0; }
+        unsigned char byte = *c->p++;
+        v |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return v;
+    }
+    c->bad = 1;
+    return 0;
+}
+
+static void get_bytes(struct cursor *c, void *out, size_t n)
+{
+    if ((size_t)(c->end - c->p) < n) { c->bad = 1; memset(out, 0, n); return; }
+    memcpy(out, c->p, n);
+    c->p += n;
+}
+
+int fgp_is_profile(const void *data, size_t size)
+{
+    return size >= FGP_MAGIC_LEN && memcmp(data, FGP_MAGIC, FGP_MAGIC_LEN) == 0;
+}
+
+int fgp_parse(const void *data, size_t size, struct fgp_profile *p)
+{
+    memset(p, 0, sizeof(*p));
+    if (!fgp_is_profile(data, size))
+        return -1;
+
+    struct cursor c = { (const unsigned char *)data + FGP_MAGIC_LEN,
+                        (const unsigned char *)data + size, 0 };
+    uint32_t reserved;
+    get_bytes(&c, &p->start_ns, sizeof(p->start_ns));
+    get_bytes(&c, &p->end_ns, sizeof(p->end_ns));
+    get_bytes(&c, &p->sample_freq, sizeof(p->sample_freq));
+    get_bytes(&c, &reserved, sizeof(reserved));
+
+    /* Every element takes at least one byte: bound counts by what's left */
+    uint64_t n = get_varint(&c);
+    if (c.bad || n > (uint64_t)(c.end - c.p)) goto bad;
+    p->n_strings = (uint32_t)n;
+    p->strings = calloc(n ? n : 1, sizeof(*p->strings));
+    if (!p->strings) goto bad;
+    for (uint32_t i = 0; i < p->n_strings; i++) {
+        uint64_t len = get_varint(&c);
+        if (c.bad || len > (uint64_t)(c.end - c.p)) goto bad;
+        p->strings[i] = malloc(len + 1);
+        if (!p->strings[i]) goto bad;
+        get_bytes(&c, p->strings[i], len);
+        p->strings[i][len] = '\0';
+    }
+
+    n = get_varint(&c);
+    if (c.bad || n > (uint64_t)(c.end - c.p)) goto bad;
+    p->n_stacks = (uint32_t)n;
+    p->stack_off = calloc(n + 1, sizeof(*p->stack_off));
+    if (!p->stack_off) goto bad;
+    size_t cap_frames = 0, n_frames = 0;
+    for (uint32_t i = 0; i < p->n_stacks; i++) {
+        uint64_t depth = get_varint(&c);
+        if (c.bad || depth > (uint64_t)(c.end - c.p)) goto bad;
+        p->frames = grow(p->frames, &cap_frames, n_frames + depth + 1, sizeof(*p->frames));
+        for (uint64_t j = 0; j < depth; j++) {
+            uint64_t id = get_varint(&c);
+            if (c.bad || id >= p->n_strings) goto bad;
+            p->frames[n_frames++] = (uint32_t)id;
+        }
+        p->stack_off[i + 1] = (uint32_t)n_frames;
+    }
+
+    n = get_varint(&c);
+    if (c.bad || n > (uint64_t)(c.end - c.p)) goto bad;
+    p->n_samples = n;
+    p->samples = calloc(n ? n : 1, sizeof(*p->samples));
+    if (!p->samples) goto bad;
+    uint64_t ms = p->start_ns / 1000000;
+    for (size_t i = 0; i < p->n_samples; i++) {
+        uint64_t stack = get_varint(&c);
+        ms += get_varint(&c);
+        uint64_t count = get_varint(&c);
+        if (c.bad || stack >= p->n_stacks) goto bad;
+        p->samples[i] = (struct fgp_sample){ (uint32_t)stack, ms * 1000000, count };
+    }
+    return 0;
+
+bad:
+    fgp_profile_free(p);
+    return -1;
+}
+
+void fgp_profile_free(struct fgp_profile *p)
+{
+    for (uint32_t i = 0; p->strings && i < p->n_strings; i++)
+        free(p->strings[i]);
+    free(p->strings);
+    free(p->stack_off);
+    free(p->frames);
+    free(p->samples);
+    memset(p, 0, sizeof(*p));
+}
@@ -0,0 +1,81 @@
+/*
+ * fgprof.h — Compact binary profile format (.fgp)
+ *
+ * Interned frame names, stacks as lists of name IDs, and timestamped
+ * (stack, count) samples, all LEB128 varint-coded. Written by `profiler`,
+ * read by `flamegraph` and `scripts/flamediff.py`.
+ *
+ * Layout (little-endian):
+ *   char     magic[8]      "FGPROF01"
+ *   u64      start_ns      wall clock (ns since epoch) the profile covers
+ *   u64      end_ns
+ *   u32      sample_freq   Hz (0 if unknown)
+ *   u32      reserved
+ *   varint   n_strings,  then n_strings × { varint len; u8 bytes[len] }
+ *   varint   n_stacks,   then n_stacks  × { varint depth; varint name_id[depth] }
+ *                        (root first, leaf last)
+ *   varint   n_samples,  then n_samples × { varint stack_id;
+ *                                            varint time_delta_ms;
+ *                                            varint count }
+ *
+ * Samples are sorted by time; each time_delta_ms is relative to the
+ * previous sample (the first to start_ns).
+ */
+#ifndef FGPROF_H
+#define FGPROF_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define FGP_MAGIC     "FGPROF01"
+#define FGP_MAGIC_LEN 8
+
+/* ── Writing ─────────────────────────────────────────────────── */
+
+struct fgp_writer;
+
+/* Start a profile covering wall-clock time from `start_ns`.
+ * Everything is buffered in memory until fgp_write. NULL on failure. */
+struct fgp_writer *fgp_writer_new(uint64_t start_ns, uint32_t sample_freq);
+
+/* Intern a folded stack ("a;b;c", root first). Returns its stack ID. */
+uint32_t fgp_add_stack(struct fgp_writer *w, const char *folded);
+
+/* Record `count` samples of a stack at wall-clock time `time_ns`. */
+void fgp_add_sample(struct fgp_writer *w, uint32_t stack_id,
+                    uint64_t time_ns, uint64_t count);
+
+/* Write the profile to `path` and free the writer.
+ * Returns the number of bytes written, or -1 on failure. */
+long fgp_write(struct fgp_writer *w, const char *path, uint64_t end_ns);
+
+/* ── Reading ─────────────────────────────────────────────────── */
+
+struct fgp_sample {
+    uint32_t stack;
+    uint64_t time_ns;
+    uint64_t count;
+};
+
+struct fgp_profile {
+    uint64_t           start_ns;
+    uint64_t           end_ns;
+    uint32_t           sample_freq;
+    uint32_t           n_strings;
+    char             **strings;     /* NUL-terminated copies */
+    uint32_t           n_stacks;
+    uint32_t          *stack_off;   /* stack i = frames[stack_off[i] .. stack_off[i+1]) */
+    uint32_t          *frames;      /* name IDs */
+    size_t             n_samples;
+    struct fgp_sample *samples;
+};
+
+/* Non-zero if `data` starts with the .fgp magic. */
+int fgp_is_profile(const void *data, size_t size);
+
+/* Decode a whole .fgp image. Returns 0, or -1 if it is malformed. */
+int fgp_parse(const void *data, size_t size, struct fgp_profile *p);
+
+void fgp_profile_free(struct fgp_profile *p);
+
+#endif /* FGPROF_H */
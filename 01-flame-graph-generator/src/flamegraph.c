@@ -1,13 +1,29 @@
 /*
  * flamegraph.c — Milestone 3: Folded Stacks → SVG Flame Graph
  *
- * Reads folded stack format from stdin, builds a frame tree,
+ * Reads folded stack format from files (or stdin), builds a frame tree,
  * and outputs an interactive SVG flame graph.
  *
+ * Inputs are mmap'd and split into chunks on line boundaries; worker
+ * threads each build a partial tree from the chunks they take, and the
+ * partial trees are merged pairwise (in parallel) into one. Several
+ * input files are merged into a single graph.
+ *
+ * Binary .fgp profiles (see fgprof.h) are accepted anywhere a folded
+ * file is, and --from/--to select a wall-clock window out of them.
+ *
+ * With --base, the baseline and candidate trees are built the same way
+ * and merged into one tree carrying both counts; frames are coloured
+ * red/blue by the change in their share of samples, and the biggest
+ * self-time regressions are printed as a ranked report.
+ *
  * Usage:
  *   ./selfprofile | ./flamegraph > flame.svg
  *   ./flamegraph < stacks.folded > flame.svg
  *   ./flamegraph -t "My Profile" -w 1200 < stacks.folded > flame.svg
+ *   ./flamegraph -j 8 -o day.svg hour-*.folded
+ *   ./flamegraph --from 1760000000 --to 1760000600 host-*.fgp > ten-min.svg
+ *   ./flamegraph --base before.folded -n --report diff.txt after.folded > diff.svg
  */
 #define _GNU_SOURCE
 #include <stdio.h>
@@ -15,107 +31,576 @@
 #include <string.h>
 #include <stdint.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "fgprof.h"
 
 /* ── Configuration ──────────────────────────────────────────── */
 
-#define MAX_CHILDREN  512
-#define MAX_NAME_LEN  256
-#define MAX_LINE_LEN  8192
 #define FRAME_HEIGHT  16
 #define FONT_SIZE     11
 #define MIN_WIDTH_PX  0.1   /* minimum width to render a frame */
 #define CHAR_WIDTH    6.5   /* approximate width per character */
+#define ARENA_CHUNK   (1 << 20)
+#define MIN_CHUNK     (4 << 20)  /* don't split input finer than 4 MB */
+#define MAX_THREADS   256
+
+/* ── Arena ──────────────────────────────────────────────────── */
+
+/*
+ * Frames and interned names are bump-allocated from 1 MB chunks and
+ * freed all at once; nothing in the tree is ever freed individually.
+ */
+
+struct arena_chunk {
+    struct arena_chunk *next;
+    size_t used;
+    size_t size;
+    char   data[];
+};
+
+static void *arena_alloc(struct arena_chunk **arena, size_t n)
+{
+    n = (n + 7) & ~(size_t)7;
+    if (!*arena || (*arena)->used + n > (*arena)->size) {
+        size_t size = n > ARENA_CHUNK ? n : ARENA_CHUNK;
+        struct arena_chunk *c = malloc(sizeof(*c) + size);
+        if (!c) { perror("malloc"); exit(1); }
+        c->next = *arena;
+        c->used = 0;
+        c->size = size;
+        *arena = c;
+    }
+    void *p = (*arena)->data + (*arena)->used;
+    (*arena)->used += n;
+    return p;
+}
+
+static void arena_free(struct arena_chunk **arena)
+{
+    while (*arena) {
+        struct arena_chunk *next = (*arena)->next;
+        free(*arena);
+        *arena = next;
+    }
+}
 
 /* ── Frame tree ─────────────────────────────────────────────── */
 
+/*
+ * One tree per parsing thread, each with its own arena and name table,
+ * so workers never share mutable state until the merge.
+ *
+ * Children are a singly linked sibling list. Most frames have a handful
+ * of children, found by comparing interned name pointers along the list;
+ * once a frame has more than CHILD_SCAN_MAX, it gets an open-addressing
+ * index keyed by name pointer. There is no per-frame child limit.
+ */
+
+#define CHILD_SCAN_MAX 8
+
 struct frame {
-    char name[MAX_NAME_LEN];
-    int  count;           /* samples IN this frame (including children) */
-    int  self_count;      /* samples WHERE this frame is the leaf */
-    struct frame *children[MAX_CHILDREN];
-    int n_children;
+    const char    *name;        /* interned */
+    uint64_t       count;       /* samples IN this frame (including children) */
+    uint64_t       self_count;  /* samples WHERE this frame is the leaf */
+    uint64_t       count_b;     /* --base mode: candidate counts; the */
+    uint64_t       self_b;      /* baseline's are count/self_count */
+    struct frame  *first_child;
+    struct frame  *next_sibling;
+    struct frame **index;       /* NULL until n_children > CHILD_SCAN_MAX */
+    uint32_t       n_children;
+    uint32_t       index_mask;
+};
+
+struct intern_entry {
+    uint64_t    hash;
+    const char *name;
+};
+
+struct tree {
+    struct arena_chunk  *arena;
+    struct intern_entry *names;     /* every distinct name, stored once */
+    size_t               names_size;
+    size_t               n_names;
+    struct frame        *root;
+    uint64_t             total_samples;
+    size_t               n_frames;
 };
 
-static struct frame *frame_new(const char *name)
+/* ── Name interning ─────────────────────────────────────────── */
+
+static uint64_t hash_bytes(const char *s, size_t len)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;  /* FNV-1a */
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static struct intern_entry *intern_slot(struct tree *t, uint64_t hash,
+                                        const char *s, size_t len)
+{
+    size_t mask = t->names_size - 1;
+    for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+        struct intern_entry *e = &t->names[i];
+        if (!e->name)
+            return e;
+        if (e->hash == hash && strncmp(e->name, s, len) == 0 && e->name[len] == '\0')
+            return e;
+    }
+}
+
+static void names_grow(struct tree *t)
+{
+    struct intern_entry *old = t->names;
+    size_t old_size = t->names_size;
+
+    t->names_size = old_size ? old_size * 2 : 4096;
+    t->names = calloc(t->names_size, sizeof(*t->names));
+    if (!t->names) { perror("calloc"); exit(1); }
+
+    for (size_t i = 0; i < old_size; i++) {
+        if (old[i].name) {
+            size_t mask = t->names_size - 1, j = old[i].hash & mask;
+            while (t->names[j].name) j = (j + 1) & mask;
+            t->names[j] = old[i];
+        }
+    }
+    free(old);
+}
+
+static const char *intern(struct tree *t, const char *s, size_t len)
 {
-    struct frame *f = calloc(1, sizeof(*f));
-    if (!f) { perror("calloc"); exit(1); }
-    strncpy(f->name, name, MAX_NAME_LEN - 1);
+    if ((t->n_names + 1) * 2 > t->names_size)
+        names_grow(t);
+
+    uint64_t h = hash_bytes(s, len);
+    struct intern_entry *e = intern_slot(t, h, s, len);
+    if (!e->name) {
+        char *copy = arena_alloc(&t->arena, len + 1);
+        memcpy(copy, s, len);
+        copy[len] = '\0';
+        e->hash = h;
+        e->name = copy;
+        t->n_names++;
+    }
+    return e->name;
+}
+
+/* ── Frame operations ───────────────────────────────────────── */
+
+static size_t ptr_hash(const void *p)
+{
+    uint64_t h = (uintptr_t)p * 0x9E3779B97F4A7C15ULL;
+    return (size_t)(h >> 29);
+}
+
+static void index_insert(struct frame *f, struct frame *child)
+{
+    size_t i = ptr_hash(child->name) & f->index_mask;
+    while (f->index[i])
+        i = (i + 1) & f->index_mask;
+    f->index[i] = child;
+}
+
+/* (Re)build the child index at <= 1/2 load; old arrays stay in the arena */
+static void index_rebuild(struct tree *t, struct frame *f)
+{
+    size_t cap = 32;
+    while (cap < (size_t)f->n_children * 2) cap *= 2;
+
+    f->index = arena_alloc(&t->arena, cap * sizeof(*f->index));
+    memset(f->index, 0, cap * sizeof(*f->index));
+    f->index_mask = (uint32_t)(cap - 1);
+    for (struct frame *c = f->first_child; c; c = c->next_sibling)
+        index_insert(f, c);
+}
+
+static struct frame *frame_new(struct tree *t, const char *name)
+{
+    struct frame *f = arena_alloc(&t->arena, sizeof(*f));
+    memset(f, 0, sizeof(*f));
+    f->name = name;
+    t->n_frames++;
     return f;
 }
 
-static struct frame *frame_find_child(struct frame *parent, const char *name)
+/* `name` must be interned: children are matched by pointer */
+static struct frame *frame_find_child(const struct frame *parent, const char *name)
 {
-    for (int i = 0; i < parent->n_children; i++) {
-        if (strcmp(parent->children[i]->name, name) == 0)
-            return parent->children[i];
+    if (parent->index) {
+        for (size_t i = ptr_hash(name) & parent->index_mask; parent->index[i];
+             i = (i + 1) & parent->index_mask) {
+            if (parent->index[i]->name == name)
+                return parent->index[i];
+        }
+        return NULL;
     }
+    for (struct frame *c = parent->first_child; c; c = c->next_sibling)
+        if (c->name == name)
+            return c;
     return NULL;
 }
 
-static struct frame *frame_add_child(struct frame *parent, const char *name)
+static struct frame *frame_add_child(struct tree *t, struct frame *parent,
+                                     const char *name)
 {
     struct frame *child = frame_find_child(parent, name);
     if (child) return child;
 
-    if (parent->n_children >= MAX_CHILDREN) {
-        fprintf(stderr, "warning: too many children for '%s'\n", parent->name);
-        return parent;
-    }
+    child = frame_new(t, name);
+    child->next_sibling = parent->first_child;
+    parent->first_child = child;
+    parent->n_children++;
 
-    child = frame_new(name);
-    parent->children[parent->n_children++] = child;
+    if (parent->index && (size_t)parent->n_children * 2 <= (size_t)parent->index_mask + 1)
+        index_insert(parent, child);
+    else if (parent->n_children > CHILD_SCAN_MAX)
+        index_rebuild(t, parent);
     return child;
 }
 
-static void frame_free(struct frame *f)
+static void tree_init(struct tree *t)
+{
+    memset(t, 0, sizeof(*t));
+    t->root = frame_new(t, intern(t, "root", 4));
+}
+
+static void tree_free(struct tree *t)
+{
+    free(t->names);
+    arena_free(&t->arena);
+    memset(t, 0, sizeof(*t));
+}
+
+/* Add src's counts under dst (both frames of the same path) */
+static void frame_merge(struct tree *dst_t, struct frame *dst, const struct frame *src)
+{
+    dst->count += src->count;
+    dst->self_count += src->self_count;
+    for (const struct frame *c = src->first_child; c; c = c->next_sibling) {
+        const char *name = intern(dst_t, c->name, strlen(c->name));
+        frame_merge(dst_t, frame_add_child(dst_t, dst, name), c);
+    }
+}
+
+static void tree_merge(struct tree *dst, const struct tree *src)
 {
-    for (int i = 0; i < f->n_children; i++)
-        frame_free(f->children[i]);
-    free(f);
+    frame_merge(dst, dst->root, src->root);
+    dst->total_samples += src->total_samples;
+}
+
+/* Diff mode: add src's counts under dst as the candidate side */
+static void frame_merge_b(struct tree *dst_t, struct frame *dst, const struct frame *src)
+{
+    dst->count_b += src->count;
+    dst->self_b += src->self_count;
+    for (const struct frame *c = src->first_child; c; c = c->next_sibling) {
+        const char *name = intern(dst_t, c->name, strlen(c->name));
+        frame_merge_b(dst_t, frame_add_child(dst_t, dst, name), c);
+    }
 }
 
 /* ── Parse folded stacks ────────────────────────────────────── */
 
-static struct frame *root;
-static int total_samples = 0;
+/*
+ * Lines are parsed in place from the mapped input — no line buffer, so
+ * stacks of any depth are kept whole. Format: "func_a;func_b;func_c 42".
+ */
 
-static void parse_folded(FILE *in)
+static void parse_line(struct tree *t, const char *line, const char *end)
 {
-    root = frame_new("root");
+    /* Strip trailing CR/LF */
+    while (end > line && (end[-1] == '\r' || end[-1] == '\n'))
+        end--;
+    if (end == line || line[0] == '#')
+        return;
 
-    char line[MAX_LINE_LEN];
-    while (fgets(line, sizeof(line), in)) {
-        /* Format: func_a;func_b;func_c 42 */
-        line[strcspn(line, "\n\r")] = '\0';
-        if (line[0] == '\0' || line[0] == '#')
-            continue;
+    /* Find the last space — count is after it */
+    const char *last_space = end;
+    while (last_space > line && last_space[-1] != ' ')
+        last_space--;
+    if (last_space == line)
+        return;
+    last_space--;
+
+    long long count = 0;
+    const char *p = last_space + 1;
+    int neg = (p < end && *p == '-');
+    if (neg || (p < end && *p == '+')) p++;
+    while (p < end && *p >= '0' && *p <= '9')
+        count = count * 10 + (*p++ - '0');
+    if (neg || count <= 0) count = 1;
+
+    t->total_samples += count;
+
+    /* Walk the stack and add to tree */
+    struct frame *node = t->root;
+    node->count += count;
+
+    struct frame *leaf = node;
+    const char *tok = line;
+    while (tok < last_space) {
+        const char *semi = memchr(tok, ';', last_space - tok);
+        if (!semi) semi = last_space;
+        if (semi > tok) {  /* empty frames are skipped, as strtok did */
+            node = frame_add_child(t, node, intern(t, tok, semi - tok));
+            node->count += count;
+            leaf = node;
+        }
+        tok = semi + 1;
+    }
+    leaf->self_count += count;
+}
 
-        /* Find the last space — count is after it */
-        char *last_space = strrchr(line, ' ');
-        if (!last_space) continue;
+static void parse_chunk(struct tree *t, const char *p, const char *end)
+{
+    while (p < end) {
+        const char *nl = memchr(p, '\n', end - p);
+        const char *line_end = nl ? nl : end;
+        parse_line(t, p, line_end);
+        p = line_end + 1;
+    }
+}
 
-        int count = atoi(last_space + 1);
-        if (count <= 0) count = 1;
-        *last_space = '\0';
+/* ── Binary profile input ───────────────────────────────────── */
 
-        total_samples += count;
+/* Wall-clock window (ns since epoch) to keep from .fgp samples */
+static uint64_t from_ns = 0;
+static uint64_t to_ns = UINT64_MAX;
 
-        /* Walk the stack and add to tree */
-        struct frame *node = root;
-        node->count += count;
+/*
+ * A .fgp already holds interned names and whole stacks: sum the samples
+ * that fall in the window per stack, then walk each stack into the tree
+ * once. Names are interned into the tree once per string, up front.
+ */
+static void parse_fgp(struct tree *t, const char *data, size_t size, const char *name)
+{
+    struct fgp_profile p;
+    if (fgp_parse(data, size, &p) < 0) {
+        fprintf(stderr, "flamegraph: %s: malformed profile\n", name);
+        return;
+    }
+
+    const char **names = calloc(p.n_strings ? p.n_strings : 1, sizeof(*names));
+    uint64_t *counts = calloc(p.n_stacks ? p.n_stacks : 1, sizeof(*counts));
+    if (!names || !counts) { perror("calloc"); exit(1); }
 
-        char *saveptr;
-        char *tok = strtok_r(line, ";", &saveptr);
-        struct frame *leaf = node;
-        while (tok) {
-            node = frame_add_child(node, tok);
+    for (uint32_t i = 0; i < p.n_strings; i++)
+        names[i] = intern(t, p.strings[i], strlen(p.strings[i]));
+
+    for (size_t i = 0; i < p.n_samples; i++) {
+        const struct fgp_sample *s = &p.samples[i];
+        if (s->time_ns >= from_ns && s->time_ns < to_ns)
+            counts[s->stack] += s->count;
+    }
+
+    for (uint32_t i = 0; i < p.n_stacks; i++) {
+        uint64_t count = counts[i];
+        if (count == 0)
+            continue;
+
+        t->total_samples += count;
+        struct frame *node = t->root;
+        node->count += count;
+        for (uint32_t j = p.stack_off[i]; j < p.stack_off[i + 1]; j++) {
+            node = frame_add_child(t, node, names[p.frames[j]]);
             node->count += count;
-            leaf = node;
-            tok = strtok_r(NULL, ";", &saveptr);
         }
-        leaf->self_count += count;
+        node->self_count += count;
     }
+
+    free(names);
+    free(counts);
+    fgp_profile_free(&p);
+}
+
+/* ── Input loading and chunking ─────────────────────────────── */
+
+struct input {
+    const char *name;
+    char       *data;
+    size_t      size;
+    int         mapped;
+};
+
+struct chunk {
+    const char *begin;
+    const char *end;
+    const struct input *binary;   /* whole .fgp input, parsed as one unit */
+};
+
+/* mmap a regular file; read pipes/stdin into memory */
+static int input_load(struct input *in, const char *path)
+{
+    in->name = path ? path : "<stdin>";
+    int fd = path ? open(path, O_RDONLY) : STDIN_FILENO;
+    if (fd < 0) { perror(path); return -1; }
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        in->data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (in->data != MAP_FAILED) {
+            madvise(in->data, st.st_size, MADV_SEQUENTIAL);
+            in->size = st.st_size;
+            in->mapped = 1;
+            if (path) close(fd);
+            return 0;
+        }
+    }
+
+    size_t cap = 1 << 20;
+    in->data = malloc(cap);
+    in->size = 0;
+    for (;;) {
+        if (!in->data) { perror("malloc"); exit(1); }
+        ssize_t n = read(fd, in->data + in->size, cap - in->size);
+        if (n < 0) { perror(in->name); break; }
+        if (n == 0) break;
+        in->size += n;
+        if (in->size == cap)
+            in->data = realloc(in->data, cap *= 2);
+    }
+    if (path) close(fd);
+    return 0;
+}
+
+static void input_free(struct input *in)
+{
+    if (in->mapped)
+        munmap(in->data, in->size);
+    else
+        free(in->data);
+}
+
+/* Split an input into up to `pieces` chunks, each ending after a '\n' */
+static int split_input(const struct input *in, int pieces, struct chunk *out)
+{
+    const char *start = in->data, *end = in->data + in->size;
+    int n = 0;
+
+    if (fgp_is_profile(in->data, in->size)) {
+        out[0].begin = start;
+        out[0].end = end;
+        out[0].binary = in;
+        return 1;
+    }
+
+    for (int k = 1; k <= pieces && start < end; k++) {
+        const char *cut = (k == pieces) ? end : in->data + in->size * k / pieces;
+        if (cut < start) cut = start;
+        if (cut < end) {
+            const char *nl = memchr(cut, '\n', end - cut);
+            cut = nl ? nl + 1 : end;
+        }
+        out[n].begin = start;
+        out[n].end = cut;
+        n++;
+        start = cut;
+    }
+    return n;
+}
+
+/* ── Parallel build ─────────────────────────────────────────── */
+
+struct worker {
+    pthread_t     thread;
+    struct tree   tree;
+    struct tree  *merge_src;   /* merge phase: fold this tree into `tree` */
+};
+
+static struct chunk *chunks;
+static int n_chunks = 0;
+static int next_chunk = 0;
+
+static void *parse_worker(void *arg)
+{
+    struct worker *w = arg;
+    for (;;) {
+        int i = __atomic_fetch_add(&next_chunk, 1, __ATOMIC_RELAXED);
+        if (i >= n_chunks)
+            break;
+        if (chunks[i].binary)
+            parse_fgp(&w->tree, chunks[i].begin, chunks[i].end - chunks[i].begin,
+                      chunks[i].binary->name);
+        else
+            parse_chunk(&w->tree, chunks[i].begin, chunks[i].end);
+    }
+    return NULL;
+}
+
+static void *merge_worker(void *arg)
+{
+    struct worker *w = arg;
+    tree_merge(&w->tree, w->merge_src);
+    tree_free(w->merge_src);
+    return NULL;
+}
+
+/* Build one tree from all inputs using `n_threads` workers */
+static void build_tree(struct tree *out, struct input *inputs, int n_inputs,
+                       int n_threads)
+{
+    size_t total = 0;
+    for (int i = 0; i < n_inputs; i++)
+        total += inputs[i].size;
+
+    /* A few chunks per thread so uneven chunks even out */
+    int max_chunks = 0;
+    int *pieces = calloc(n_inputs, sizeof(*pieces));
+    if (!pieces) { perror("calloc"); exit(1); }
+    for (int i = 0; i < n_inputs; i++) {
+        size_t want = (size_t)n_threads * 4 * inputs[i].size / (total ? total : 1);
+        size_t cap = inputs[i].size / MIN_CHUNK;
+        pieces[i] = (int)(want < cap ? want : cap);
+        if (pieces[i] < 1) pieces[i] = 1;
+        max_chunks += pieces[i];
+    }
+
+    chunks = calloc(max_chunks, sizeof(*chunks));
+    if (!chunks) { perror("calloc"); exit(1); }
+    n_chunks = next_chunk = 0;
+    for (int i = 0; i < n_inputs; i++)
+        n_chunks += split_input(&inputs[i], pieces[i], &chunks[n_chunks]);
+    free(pieces);
+
+    if (n_threads > n_chunks) n_threads = n_chunks;
+    if (n_threads < 1) n_threads = 1;
+
+    struct worker *w = calloc(n_threads, sizeof(*w));
+    if (!w) { perror("calloc"); exit(1); }
+    for (int i = 0; i < n_threads; i++)
+        tree_init(&w[i].tree);
+
+    if (n_threads == 1) {
+        parse_worker(&w[0]);
+    } else {
+        for (int i = 0; i < n_threads; i++)
+            pthread_create(&w[i].thread, NULL, parse_worker, &w[i]);
+        for (int i = 0; i < n_threads; i++)
+            pthread_join(w[i].thread, NULL);
+
+        /* Pairwise reduction: log2(n_threads) rounds of parallel merges */
+        for (int stride = 1; stride < n_threads; stride *= 2) {
+            for (int i = 0; i + stride < n_threads; i += 2 * stride) {
+                w[i].merge_src = &w[i + stride].tree;
+                pthread_create(&w[i].thread, NULL, merge_worker, &w[i]);
+            }
+            for (int i = 0; i + stride < n_threads; i += 2 * stride)
+                pthread_join(w[i].thread, NULL);
+        }
+    }
+
+    *out = w[0].tree;
+    free(w);
+    free(chunks);
+    chunks = NULL;
 }
 
 /* ── Color generation ───────────────────────────────────────── */
@@ -149,18 +634,67 @@ static void name_to_color(const char *name, int *r, int *g, int *b)
     *b = (int)((bf + m) * 55 + 30);  /* slight blue tint for depth */
 }
 
+/*
+ * Differential colour from the change in a frame's share of samples:
+ * red = larger share in the candidate (regression), blue = smaller,
+ * gray = within 0.1%. Same scale as scripts/flamediff.py.
+ */
+static void delta_color(double rate_a, double rate_b, int *r, int *g, int *b)
+{
+    double diff = rate_b - rate_a;
+    if (diff > -0.001 && diff < 0.001) {
+        *r = *g = *b = 200;
+        return;
+    }
+
+    double intensity = (diff < 0 ? -diff : diff) / 0.3;
+    if (intensity > 1.0) intensity = 1.0;
+
+    if (diff > 0) {
+        *r = 200 + (int)(55 * intensity);
+        *g = 200 - (int)(140 * intensity);
+        *b = 200 - (int)(140 * intensity);
+    } else {
+        *r = 200 - (int)(140 * intensity);
+        *g = 200 - (int)(80 * intensity);
+        *b = 200 + (int)(55 * intensity);
+    }
+}
+
 /* ── SVG rendering ──────────────────────────────────────────── */
 
 static int svg_width = 1200;
 static int svg_height;
 static FILE *svg_out;
+static struct frame *root;
+static uint64_t total_samples;
+
+/* --base mode: total_samples is the baseline's, total_b the candidate's */
+static int diff_mode = 0;
+static uint64_t total_b = 0;
+static double norm_a = 1.0;     /* baseline scale factor (-n: total_b / total_a) */
+
+static double rate(uint64_t count, uint64_t total)
+{
+    return total ? (double)count / total : 0.0;
+}
+
+/* Width weight: in diff mode the larger side (after -n), so frames that
+ * only exist in one profile are still visible */
+static double frame_weight(const struct frame *f)
+{
+    if (!diff_mode)
+        return (double)f->count;
+    double a = f->count * norm_a;
+    return a > f->count_b ? a : (double)f->count_b;
+}
 
 /* Find maximum depth for sizing */
 static int max_depth(struct frame *f, int depth)
 {
     int m = depth;
-    for (int i = 0; i < f->n_children; i++) {
-        int d = max_depth(f->children[i], depth + 1);
+    for (struct frame *c = f->first_child; c; c = c->next_sibling) {
+        int d = max_depth(c, depth + 1);
         if (d > m) m = d;
     }
     return m;
@@ -174,12 +708,30 @@ static int cmp_frame_name(const void *a, const void *b)
     return strcmp(fa->name, fb->name);
 }
 
+static struct frame **sort_buf;
+static size_t sort_buf_cap = 0;
+
 static void sort_children(struct frame *f)
 {
-    if (f->n_children > 1)
-        qsort(f->children, f->n_children, sizeof(f->children[0]), cmp_frame_name);
-    for (int i = 0; i < f->n_children; i++)
-        sort_children(f->children[i]);
+    if (f->n_children > 1) {
+        if (f->n_children > sort_buf_cap) {
+            sort_buf_cap = f->n_children;
+            sort_buf = realloc(sort_buf, sort_buf_cap * sizeof(*sort_buf));
+            if (!sort_buf) { perror("realloc"); exit(1); }
+        }
+        size_t n = 0;
+        for (struct frame *c = f->first_child; c; c = c->next_sibling)
+            sort_buf[n++] = c;
+        qsort(sort_buf, n, sizeof(*sort_buf), cmp_frame_name);
+
+        /* Relink in sorted order */
+        for (size_t i = 0; i + 1 < n; i++)
+            sort_buf[i]->next_sibling = sort_buf[i + 1];
+        sort_buf[n - 1]->next_sibling = NULL;
+        f->first_child = sort_buf[0];
+    }
+    for (struct frame *c = f->first_child; c; c = c->next_sibling)
+        sort_children(c);
 }
 
 /* Escape XML special characters */
@@ -207,6 +759,8 @@ static void render_frame(struct frame *f, int depth, double x_left, double x_wid
     if (depth == 0) {
         /* Root frame — gray */
         r = 200; g = 200; b = 200;
+    } else if (diff_mode) {
+        delta_color(rate(f->count, total_samples), rate(f->count_b, total_b), &r, &g, &b);
     } else {
         name_to_color(f->name, &r, &g, &b);
     }
@@ -217,7 +771,13 @@ static void render_frame(struct frame *f, int depth, double x_left, double x_wid
     fprintf(svg_out, "<g>\n");
     fprintf(svg_out, "<title>");
     xml_escape(svg_out, f->name);
-    fprintf(svg_out, " (%d samples, %.1f%%)</title>\n", f->count, pct);
+    if (diff_mode) {
+        double pct_b = 100.0 * rate(f->count_b, total_b);
+        fprintf(svg_out, " (before: %lu [%.1f%%], after: %lu [%.1f%%], delta: %+.1f%%)</title>\n",
+                (unsigned long)f->count, pct, (unsigned long)f->count_b, pct_b, pct_b - pct);
+    } else {
+        fprintf(svg_out, " (%lu samples, %.1f%%)</title>\n", (unsigned long)f->count, pct);
+    }
     fprintf(svg_out, "<rect x=\"%.1f\" y=\"%.1f\" width=\"%.1f\" height=\"%d\" "
             "fill=\"rgb(%d,%d,%d)\" rx=\"1\" ry=\"1\" "
             "class=\"frame\" />\n",
@@ -234,11 +794,12 @@ static void render_frame(struct frame *f, int depth, double x_left, double x_wid
     } else if (x_width > 20) {
         /* Truncated name */
         int max_chars = (int)((x_width - 6) / CHAR_WIDTH);
+        if (max_chars > 255) max_chars = 255;
         if (max_chars > 0) {
             fprintf(svg_out, "<text x=\"%.1f\" y=\"%.1f\" font-size=\"%d\" "
                     "font-family=\"monospace\" fill=\"#000\">",
                     x_left + 3, y + FRAME_HEIGHT - 4, FONT_SIZE);
-            char trunc[MAX_NAME_LEN];
+            char trunc[256];
             strncpy(trunc, f->name, max_chars);
             trunc[max_chars] = '\0';
             xml_escape(svg_out, trunc);
@@ -250,9 +811,23 @@ static void render_frame(struct frame *f, int depth, double x_left, double x_wid
 
     /* Render children */
     double child_x = x_left;
-    for (int i = 0; i < f->n_children; i++) {
-        double child_w = x_width * ((double)f->children[i]->count / f->count);
-        render_frame(f->children[i], depth + 1, child_x, child_w);
+    if (!diff_mode) {
+        for (struct frame *c = f->first_child; c; c = c->next_sibling) {
+            double child_w = x_width * ((double)c->count / f->count);
+            render_frame(c, depth + 1, child_x, child_w);
+            child_x += child_w;
+        }
+        return;
+    }
+
+    /* Per-child maxima can add up to more than the parent's */
+    double total = frame_weight(f), sum = 0;
+    for (struct frame *c = f->first_child; c; c = c->next_sibling)
+        sum += frame_weight(c);
+    if (sum > total) total = sum;
+    for (struct frame *c = f->first_child; c; c = c->next_sibling) {
+        double child_w = x_width * (frame_weight(c) / total);
+        render_frame(c, depth + 1, child_x, child_w);
         child_x += child_w;
     }
 }
@@ -319,10 +894,29 @@ static void render_svg(FILE *out, const char *title)
             svg_width / 2, title);
 
     /* Subtitle */
-    fprintf(out, "<text x=\"%d\" y=\"36\" font-size=\"11\" font-family=\"sans-serif\" "
-            "text-anchor=\"middle\" fill=\"#888\">%d samples. "
-            "Ctrl+F to search, Esc to reset.</text>\n",
-            svg_width / 2, total_samples);
+    if (diff_mode) {
+        fprintf(out, "<text x=\"%d\" y=\"36\" font-size=\"11\" font-family=\"sans-serif\" "
+                "text-anchor=\"middle\" fill=\"#888\">Before: %lu samples, "
+                "After: %lu samples%s. Ctrl+F to search, Esc to reset.</text>\n",
+                svg_width / 2, (unsigned long)total_samples, (unsigned long)total_b,
+                norm_a != 1.0 ? " (widths normalized)" : "");
+
+        /* Legend */
+        int cx = svg_width / 2;
+        fprintf(out, "<rect x=\"%d\" y=\"42\" width=\"16\" height=\"12\" "
+                "fill=\"rgb(100,120,255)\" rx=\"2\" />\n", cx - 160);
+        fprintf(out, "<text x=\"%d\" y=\"52\" font-size=\"11\" font-family=\"sans-serif\" "
+                "fill=\"#333\">Improvement (less CPU)</text>\n", cx - 140);
+        fprintf(out, "<rect x=\"%d\" y=\"42\" width=\"16\" height=\"12\" "
+                "fill=\"rgb(255,80,80)\" rx=\"2\" />\n", cx + 40);
+        fprintf(out, "<text x=\"%d\" y=\"52\" font-size=\"11\" font-family=\"sans-serif\" "
+                "fill=\"#333\">Regression (more CPU)</text>\n", cx + 60);
+    } else {
+        fprintf(out, "<text x=\"%d\" y=\"36\" font-size=\"11\" font-family=\"sans-serif\" "
+                "text-anchor=\"middle\" fill=\"#888\">%lu samples. "
+                "Ctrl+F to search, Esc to reset.</text>\n",
+                svg_width / 2, (unsigned long)total_samples);
+    }
 
     /* Details bar */
     fprintf(out, "<text id=\"details\" x=\"4\" y=\"%d\" font-size=\"11\" "
@@ -339,13 +933,117 @@ static void render_svg(FILE *out, const char *title)
     fprintf(out, "</svg>\n");
 }
 
+/* ── Regression report ──────────────────────────────────────── */
+
+/*
+ * Self time per function, summed over every stack it is the leaf of,
+ * ranked by the change in its share of samples. Names are interned, so
+ * the table is keyed by pointer.
+ */
+
+struct func_delta {
+    const char *name;
+    uint64_t    self_a;
+    uint64_t    self_b;
+    double      delta;      /* share after - share before */
+};
+
+static struct func_delta *funcs;
+static size_t funcs_mask;
+static size_t n_funcs;
+
+static void collect_self(const struct frame *f)
+{
+    if (f->self_count || f->self_b) {
+        size_t i = ptr_hash(f->name) & funcs_mask;
+        while (funcs[i].name && funcs[i].name != f->name)
+            i = (i + 1) & funcs_mask;
+        if (!funcs[i].name) {
+            funcs[i].name = f->name;
+            n_funcs++;
+        }
+        funcs[i].self_a += f->self_count;
+        funcs[i].self_b += f->self_b;
+    }
+    for (const struct frame *c = f->first_child; c; c = c->next_sibling)
+        collect_self(c);
+}
+
+static int cmp_delta(const void *a, const void *b)
+{
+    const struct func_delta *x = a, *y = b;
+    if (x->delta != y->delta)
+        return x->delta < y->delta ? 1 : -1;
+    return strcmp(x->name, y->name);
+}
+
+/* Write the `top` largest regressions and improvements (0 = every
+ * function that changed) */
+static void report_diff(FILE *out, const struct tree *t, int top)
+{
+    size_t cap = 64;
+    while (cap < t->n_names * 2) cap *= 2;
+    funcs = calloc(cap, sizeof(*funcs));
+    if (!funcs) { perror("calloc"); exit(1); }
+    funcs_mask = cap - 1;
+    n_funcs = 0;
+    collect_self(t->root);
+
+    /* Compact and rank */
+    size_t n = 0;
+    for (size_t i = 0; i < cap; i++) {
+        if (!funcs[i].name)
+            continue;
+        funcs[n] = funcs[i];
+        funcs[n].delta = rate(funcs[n].self_b, total_b) - rate(funcs[n].self_a, total_samples);
+        n++;
+    }
+    qsort(funcs, n, sizeof(*funcs), cmp_delta);
+
+    fprintf(out, "# Self-time change: baseline %lu samples, candidate %lu samples\n",
+            (unsigned long)total_samples, (unsigned long)total_b);
+    fprintf(out, "# %4s %9s %8s %8s %10s %10s  %s\n",
+            "rank", "delta%", "base%", "cand%", "base", "cand", "function");
+
+    size_t limit = top > 0 && (size_t)top < n ? (size_t)top : n;
+    for (size_t i = 0; i < limit && funcs[i].delta > 0; i++) {
+        const struct func_delta *d = &funcs[i];
+        fprintf(out, "  %4zu %+9.2f %8.2f %8.2f %10lu %10lu  %s\n", i + 1,
+                100 * d->delta, 100 * rate(d->self_a, total_samples),
+                100 * rate(d->self_b, total_b),
+                (unsigned long)d->self_a, (unsigned long)d->self_b, d->name);
+    }
+
+    fprintf(out, "# Largest improvements\n");
+    for (size_t i = 0; i < limit && funcs[n - 1 - i].delta < 0; i++) {
+        const struct func_delta *d = &funcs[n - 1 - i];
+        fprintf(out, "  %4zu %+9.2f %8.2f %8.2f %10lu %10lu  %s\n", i + 1,
+                100 * d->delta, 100 * rate(d->self_a, total_samples),
+                100 * rate(d->self_b, total_b),
+                (unsigned long)d->self_a, (unsigned long)d->self_b, d->name);
+    }
+
+    free(funcs);
+    funcs = NULL;
+}
+
 /* ── Main ───────────────────────────────────────────────────── */
 
 static void usage(const char *prog)
 {
-    fprintf(stderr, "Usage: %s [-t title] [-w width] [-i infile] [-o outfile]\n", prog);
-    fprintf(stderr, "  Reads folded stacks from stdin (or -i file)\n");
+    fprintf(stderr, "Usage: %s [-t title] [-w width] [-j threads] [-i infile] [-o outfile]\n"
+                    "          [--from T] [--to T] [-b base [-n] [--top N] [--report file]]\n"
+                    "          [file ...]\n", prog);
+    fprintf(stderr, "  Reads folded stacks from the given files (merged into one graph),\n");
+    fprintf(stderr, "  or from stdin if none are given\n");
     fprintf(stderr, "  Writes SVG to stdout (or -o file)\n");
+    fprintf(stderr, "  -j N  Parser threads (default: online CPUs)\n");
+    fprintf(stderr, "  --from T, --to T  Keep .fgp samples with from <= time < to (epoch seconds)\n");
+    fprintf(stderr, "  -b, --base FILE   Differential graph: FILE (repeatable) is the baseline,\n"
+                    "                    the other inputs the candidate\n");
+    fprintf(stderr, "  -n, --normalize   Scale the baseline to the candidate's sample count\n");
+    fprintf(stderr, "  --top N           Regressions to print to stderr (default: 10)\n");
+    fprintf(stderr, "  --report FILE     Write the full ranked self-time report to FILE\n");
     exit(1);
 }
 
@@ -354,34 +1052,114 @@ int main(int argc, char *argv[])
     const char *title = "Flame Graph";
     const char *infile = NULL;
     const char *outfile = NULL;
+    int n_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+    static const struct option long_opts[] = {
+        { "from",      required_argument, NULL, 'F' },
+        { "to",        required_argument, NULL, 'T' },
+        { "base",      required_argument, NULL, 'b' },
+        { "normalize", no_argument,       NULL, 'n' },
+        { "top",       required_argument, NULL, 'N' },
+        { "report",    required_argument, NULL, 'R' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    const char **bases = calloc(argc, sizeof(*bases));
+    if (!bases) { perror("calloc"); return 1; }
+    int n_bases = 0, normalize = 0, top = 10;
+    const char *report = NULL;
 
     int opt;
-    while ((opt = getopt(argc, argv, "t:w:i:o:h")) != -1) {
+    while ((opt = getopt_long(argc, argv, "t:w:j:i:o:b:nh", long_opts, NULL)) != -1) {
         switch (opt) {
+        case 'b': bases[n_bases++] = optarg; break;
+        case 'n': normalize = 1; break;
+        case 'N': top = atoi(optarg); break;
+        case 'R': report = optarg; break;
+        case 'F': from_ns = (uint64_t)(atof(optarg) * 1e9); break;
+        case 'T': to_ns = (uint64_t)(atof(optarg) * 1e9); break;
         case 't': title = optarg; break;
         case 'w': svg_width = atoi(optarg); break;
+        case 'j': n_threads = atoi(optarg); break;
         case 'i': infile = optarg; break;
         case 'o': outfile = optarg; break;
         default:  usage(argv[0]);
         }
     }
+    if (n_threads < 1) n_threads = 1;
+    if (n_threads > MAX_THREADS) n_threads = MAX_THREADS;
+
+    int n_inputs = (argc - optind) + (infile != NULL);
+    /* Before the stdin fallback: a diff never reads its candidate implicitly */
+    if (n_bases > 0 && n_inputs == 0) {
+        fprintf(stderr, "flamegraph: --base needs a candidate profile too\n");
+        usage(argv[0]);
+    }
+    struct input *inputs = calloc(n_inputs ? n_inputs : 1, sizeof(*inputs));
+    if (!inputs) { perror("calloc"); return 1; }
+
+    int loaded = 0;
+    if (infile && input_load(&inputs[loaded++], infile) < 0) return 1;
+    for (int i = optind; i < argc; i++)
+        if (input_load(&inputs[loaded++], argv[i]) < 0) return 1;
+    if (n_inputs == 0) {
+        input_load(&inputs[0], NULL);
+        n_inputs = 1;
+    }
 
-    FILE *in = stdin;
-    if (infile) {
-        in = fopen(infile, "r");
-        if (!in) { perror(infile); return 1; }
+    struct tree tree;
+    build_tree(&tree, inputs, n_inputs, n_threads);
+
+    for (int i = 0; i < n_inputs; i++)
+        input_free(&inputs[i]);
+    free(inputs);
+
+    /* Diff: the baseline tree keeps count/self_count, the candidate is
+     * folded in as count_b/self_b */
+    if (n_bases > 0) {
+        struct input *base_inputs = calloc(n_bases, sizeof(*base_inputs));
+        if (!base_inputs) { perror("calloc"); return 1; }
+        for (int i = 0; i < n_bases; i++)
+            if (input_load(&base_inputs[i], bases[i]) < 0) return 1;
+
+        struct tree base;
+        build_tree(&base, base_inputs, n_bases, n_threads);
+        for (int i = 0; i < n_bases; i++)
+            input_free(&base_inputs[i]);
+        free(base_inputs);
+
+        frame_merge_b(&base, base.root, tree.root);
+        total_b = tree.total_samples;
+        tree_free(&tree);
+        tree = base;
+
+        diff_mode = 1;
+        if (normalize && tree.total_samples)
+            norm_a = (double)total_b / tree.total_samples;
     }
+    free(bases);
 
-    parse_folded(in);
-    if (in != stdin) fclose(in);
+    root = tree.root;
+    total_samples = tree.total_samples;
 
-    if (total_samples == 0) {
+    if (total_samples == 0 && total_b == 0) {
         fprintf(stderr, "flamegraph: no samples found in input\n");
         return 1;
     }
 
-    fprintf(stderr, "flamegraph: %d total samples, rendering SVG (%dx%d)...\n",
-            total_samples, svg_width, svg_height);
+    if (diff_mode) {
+        if (top > 0)
+            report_diff(stderr, &tree, top);
+        if (report) {
+            FILE *rf = fopen(report, "w");
+            if (!rf) { perror(report); return 1; }
+            report_diff(rf, &tree, 0);
+            fclose(rf);
+        }
+    }
+
+    fprintf(stderr, "flamegraph: %lu total samples, %zu frames, %zu unique names, "
+            "rendering SVG...\n", (unsigned long)total_samples, tree.n_frames, tree.n_names);
 
     FILE *out = stdout;
     if (outfile) {
@@ -393,7 +1171,8 @@ int main(int argc, char *argv[])
 
     if (out != stdout) fclose(out);
 
-    frame_free(root);
+    tree_free(&tree);
+    free(sort_buf);
 
     fprintf(stderr, "flamegraph: done\n");
     return 0;
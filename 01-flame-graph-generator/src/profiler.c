@@ -1,11 +1,22 @@
 /*
  * profiler.c — Milestone 2: External Process Profiler via perf_event_open
  *
- * Profiles an external process by sampling CPU stack traces using the
- * Linux perf subsystem. Outputs folded stacks to stdout.
+ * Profiles external processes by sampling CPU stack traces using the
+ * Linux perf subsystem. Outputs folded stacks to stdout, or a compact
+ * binary profile (.fgp, see fgprof.h) for continuous profiling.
+ *
+ * One event is opened per CPU (per thread, for -p targets), and every
+ * event on a CPU is redirected into that CPU's own mmap ring buffer with
+ * PERF_EVENT_IOC_SET_OUTPUT. All rings are drained from one epoll loop,
+ * woken only once a ring is a quarter full (wakeup_watermark), and
+ * records are parsed in place in the mmap.
  *
  * Usage:
- *   ./profiler -p <pid> [-d <seconds>] [-f <freq>] [-o <outfile>]
+ *   ./profiler -p <pid>[,<pid>...] [-d <seconds>] [-f <freq>] [-o <outfile>] [-C]
+ *   ./profiler -a [-d <seconds>] ...            # all processes, all CPUs
+ *   ./profiler --cgroup <path> [-d <seconds>] ... # one cgroup, all CPUs
+ *   ./profiler -a --rotate 60 -o /var/lib/prof/host  # continuous, one .fgp per minute
+ *   ./profiler -p <pid> -e cache-misses -c 10000 -k   # where the misses are, incl. kernel
  *
  * Requires: perf_event_paranoid <= 1, or CAP_PERFMON, or root
  *   sudo sysctl kernel.perf_event_paranoid=-1
@@ -17,22 +28,30 @@
 #include <stdint.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <dirent.h>
 #include <signal.h>
 #include <sys/types.h>
 #include <sys/mman.h>
 #include <sys/ioctl.h>
 #include <sys/syscall.h>
-#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
 #include <linux/perf_event.h>
 #include <time.h>
 
 #include "symbols.h"
+#include "fgprof.h"
 
 /* ── Configuration ──────────────────────────────────────────── */
 
 #define MAX_STACK_DEPTH   64
-#define MAX_SAMPLES       500000
-#define MMAP_PAGES        128   /* ring buffer size: (1 + MMAP_PAGES) * page_size */
+#define MMAP_PAGES        128   /* per-CPU ring size: (1 + MMAP_PAGES) * page_size */
+#define MAX_CPUS          1024
+#define MAX_TARGETS       64    /* -p PIDs */
+#define MAX_THREADS       4096  /* threads per -p PID */
+#define TICK_MS           100   /* drain every ring and check -p targets this often */
 
 /* ── Perf helpers ───────────────────────────────────────────── */
 
@@ -42,22 +61,151 @@ static long perf_event_open(struct perf_event_attr *attr, pid_t pid,
     return syscall(__NR_perf_event_open, attr, pid, cpu, group_fd, flags);
 }
 
-/* ── Raw sample storage ─────────────────────────────────────── */
+/* ── Stack aggregation ──────────────────────────────────────── */
+
+/*
+ * Samples are deduplicated as they come off the ring buffer: one entry
+ * per unique (pid, time slice, raw IP sequence), so memory scales with the
+ * number of distinct stacks rather than with duration × frequency. The
+ * time slice is always 0 for folded output, which has no time axis.
+ * IP arrays are bump-allocated from large chunks.
+ */
+
+#define STACKS_INIT_SIZE  4096          /* must be power of 2 */
+#define IP_CHUNK_IPS      (1 << 17)     /* 1 MB of IPs per chunk */
+
+struct stack_entry {
+    uint64_t  hash;
+    uint64_t  count;
+    uint64_t  slice;    /* sample time / slice_ns */
+    uint64_t *ips;      /* leaf-first, as delivered by the kernel */
+    int       depth;    /* 0 = empty slot */
+    int       pid;
+};
 
-struct raw_sample {
-    uint64_t ips[MAX_STACK_DEPTH];
-    int      depth;
+static struct stack_entry *stacks;
+static size_t stacks_size = 0;
+static size_t n_stacks = 0;
+static uint64_t n_samples = 0;        /* in the current interval (reset by rotation) */
+static uint64_t n_samples_total = 0;  /* over the whole run, for the loss figures */
+static uint64_t slice_ns = 0;   /* 0 = don't split by time */
+
+struct ip_chunk {
+    struct ip_chunk *next;
+    size_t used;
+    uint64_t ips[IP_CHUNK_IPS];
 };
 
-static struct raw_sample *raw_samples;
-static int n_samples = 0;
+static struct ip_chunk *ip_chunks;
+
+static uint64_t *ip_alloc(int n)
+{
+    if (!ip_chunks || ip_chunks->used + n > IP_CHUNK_IPS) {
+        struct ip_chunk *c = malloc(sizeof(*c));
+        if (!c) { perror("malloc"); exit(1); }
+        c->next = ip_chunks;
+        c->used = 0;
+        ip_chunks = c;
+    }
+    uint64_t *p = &ip_chunks->ips[ip_chunks->used];
+    ip_chunks->used += n;
+    return p;
+}
+
+static uint64_t stack_hash(int pid, uint64_t slice, const uint64_t *ips, int depth)
+{
+    uint64_t h = (0xcbf29ce484222325ULL ^ (uint64_t)pid) + slice * 0x9E3779B97F4A7C15ULL;
+    for (int i = 0; i < depth; i++) {
+        h ^= ips[i];
+        h *= 0x100000001b3ULL;
+        h ^= h >> 29;
+    }
+    return h;
+}
+
+static struct stack_entry *stack_slot(uint64_t hash, int pid, uint64_t slice,
+                                      const uint64_t *ips, int depth)
+{
+    size_t mask = stacks_size - 1;
+    for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+        struct stack_entry *e = &stacks[i];
+        if (e->depth == 0)
+            return e;
+        if (e->hash == hash && e->pid == pid && e->slice == slice && e->depth == depth &&
+            memcmp(e->ips, ips, depth * sizeof(*ips)) == 0)
+            return e;
+    }
+}
+
+static void stacks_grow(void)
+{
+    struct stack_entry *old = stacks;
+    size_t old_size = stacks_size;
+
+    stacks_size = old_size ? old_size * 2 : STACKS_INIT_SIZE;
+    stacks = calloc(stacks_size, sizeof(*stacks));
+    if (!stacks) { perror("calloc"); exit(1); }
+
+    for (size_t i = 0; i < old_size; i++)
+        if (old[i].depth)
+            *stack_slot(old[i].hash, old[i].pid, old[i].slice,
+                        old[i].ips, old[i].depth) = old[i];
+    free(old);
+}
+
+static void stack_add(int pid, uint64_t time_ns, const uint64_t *ips, int depth)
+{
+    if ((n_stacks + 1) * 2 > stacks_size)
+        stacks_grow();
+
+    uint64_t slice = slice_ns ? time_ns / slice_ns : 0;
+    uint64_t h = stack_hash(pid, slice, ips, depth);
+    struct stack_entry *e = stack_slot(h, pid, slice, ips, depth);
+
+    if (e->depth == 0) {
+        e->hash = h;
+        e->pid = pid;
+        e->slice = slice;
+        e->depth = depth;
+        e->ips = ip_alloc(depth);
+        memcpy(e->ips, ips, depth * sizeof(*ips));
+        n_stacks++;
+
+        /* Load maps while the process is still alive; no-op once seen */
+        sym_init(pid);
+    }
+    e->count++;
+    n_samples++;
+    n_samples_total++;
+}
+
+static void stacks_free(void)
+{
+    while (ip_chunks) {
+        struct ip_chunk *next = ip_chunks->next;
+        free(ip_chunks);
+        ip_chunks = next;
+    }
+    free(stacks);
+    stacks = NULL;
+    stacks_size = n_stacks = 0;
+    n_samples = 0;
+}
 
 /* ── Ring buffer reading ────────────────────────────────────── */
 
+/*
+ * Records are parsed in place: a record that doesn't straddle the end of
+ * the ring is handed out as a pointer into the mmap, and only the rare
+ * one that wraps is copied — in two memcpy()s — into a scratch buffer.
+ * Records are at most 64 KB (perf_event_header.size is a u16).
+ */
+
 struct ring_buffer {
     struct perf_event_mmap_page *meta;
     char *data;
     size_t data_size;
+    size_t peak_fill;   /* most bytes seen pending at one drain */
 };
 
 static void rb_init(struct ring_buffer *rb, void *mmap_base, size_t mmap_size)
@@ -65,89 +213,236 @@ static void rb_init(struct ring_buffer *rb, void *mmap_base, size_t mmap_size)
     rb->meta = (struct perf_event_mmap_page *)mmap_base;
     rb->data = (char *)mmap_base + sysconf(_SC_PAGESIZE);
     rb->data_size = mmap_size - sysconf(_SC_PAGESIZE);
+    rb->peak_fill = 0;
 }
 
-static void rb_read(struct ring_buffer *rb, void *dest, size_t offset, size_t len)
+static uint64_t wrap_buf[65536 / sizeof(uint64_t)];
+
+static const char *rb_record(const struct ring_buffer *rb, uint64_t pos, size_t len)
 {
-    size_t mask = rb->data_size - 1;
-    for (size_t i = 0; i < len; i++)
-        ((char *)dest)[i] = rb->data[(offset + i) & mask];
+    size_t off = pos & (rb->data_size - 1);
+    if (off + len <= rb->data_size)
+        return rb->data + off;
+
+    size_t first = rb->data_size - off;
+    memcpy(wrap_buf, rb->data + off, first);
+    memcpy((char *)wrap_buf + first, rb->data, len - first);
+    return (const char *)wrap_buf;
 }
 
-static void process_samples(struct ring_buffer *rb)
+/* Data-quality counters, reported when profiling ends */
+static uint64_t n_lost = 0;        /* samples the kernel dropped (ring full) */
+static uint64_t n_lost_records = 0;
+static uint64_t n_throttled = 0;   /* PERF_RECORD_THROTTLE: rate limited by the kernel */
+static uint64_t n_wrapped = 0;     /* records that had to be copied */
+
+/* Address-space bookkeeping records (attr.mmap2, attr.comm, attr.task) */
+static void process_task_record(const struct perf_event_header *hdr)
 {
-    uint64_t head = __atomic_load_n(&rb->meta->data_head, __ATOMIC_ACQUIRE);
-    uint64_t tail = rb->meta->data_tail;
+    const char *body = (const char *)(hdr + 1);
+    size_t body_size = hdr->size - sizeof(*hdr);
+
+    switch (hdr->type) {
+    case PERF_RECORD_MMAP2: {
+        struct mmap2_body {
+            uint32_t pid, tid;
+            uint64_t addr, len, pgoff;
+            uint32_t maj, min;
+            uint64_t ino, ino_generation;
+            uint32_t prot, flags;
+            char     filename[];
+        };
+        const struct mmap2_body *m = (const void *)body;
+        if (body_size <= sizeof(*m))
+            break;
+        /* filename is NUL-padded to 8 bytes; bound it by the record anyway */
+        size_t n = strnlen(m->filename, body_size - sizeof(*m));
+        if (n == body_size - sizeof(*m))
+            break;
+        if (m->prot & PROT_EXEC)
+            sym_add_mapping((int)m->pid, m->addr, m->len, m->pgoff, m->filename);
+        break;
+    }
+    case PERF_RECORD_COMM: {
+        const uint32_t *pid_tid = (const uint32_t *)body;
+        char comm[16];
+        if (body_size <= 2 * sizeof(uint32_t))
+            break;
+        size_t n = body_size - 2 * sizeof(uint32_t);
+        if (n > sizeof(comm) - 1) n = sizeof(comm) - 1;
+        memcpy(comm, body + 2 * sizeof(uint32_t), n);
+        comm[n] = '\0';
+        /* Thread renames don't change the process name */
+        if (pid_tid[0] == pid_tid[1])
+            sym_set_comm((int)pid_tid[0], comm,
+                         (hdr->misc & PERF_RECORD_MISC_COMM_EXEC) != 0);
+        break;
+    }
+    case PERF_RECORD_FORK:
+    case PERF_RECORD_EXIT: {
+        /* { u32 pid, ppid; u32 tid, ptid; u64 time; } */
+        const uint32_t *ids = (const uint32_t *)body;
+        if (body_size < 4 * sizeof(uint32_t))
+            break;
+        if (ids[0] != ids[2])
+            break;  /* thread, not process */
+        if (hdr->type == PERF_RECORD_FORK)
+            sym_fork((int)ids[0], (int)ids[1]);
+        else
+            sym_exit((int)ids[0]);
+        break;
+    }
+    case PERF_RECORD_LOST: {
+        /* { u64 id; u64 lost; } */
+        const uint64_t *l = (const uint64_t *)body;
+        if (body_size >= 2 * sizeof(uint64_t)) {
+            n_lost += l[1];
+            n_lost_records++;
+        }
+        break;
+    }
+    case PERF_RECORD_THROTTLE:
+        n_throttled++;
+        break;
+    }
+}
+
+/* Added to every sample time to put it on the wall clock: 0 when the
+ * event samples CLOCK_REALTIME itself, realtime - monotonic otherwise */
+static int64_t sample_clock_offset = 0;
 
-    while (tail < head && n_samples < MAX_SAMPLES) {
-        struct perf_event_header hdr;
-        rb_read(rb, &hdr, tail, sizeof(hdr));
+static void process_sample(const struct perf_event_header *hdr)
+{
+    /* Layout: { u32 pid, tid; u64 time; u64 nr; u64 ips[nr]; } for
+     * PERF_SAMPLE_TID | PERF_SAMPLE_TIME | PERF_SAMPLE_CALLCHAIN */
+    struct sample_body {
+        uint32_t pid, tid;
+        uint64_t time;
+        uint64_t nr;
+        uint64_t ips[];
+    };
+    const struct sample_body *s = (const void *)(hdr + 1);
+    size_t body_size = hdr->size - sizeof(*hdr);
+    if (body_size < sizeof(*s))
+        return;
+
+    uint64_t nr = s->nr;
+    if (nr > (body_size - sizeof(*s)) / sizeof(uint64_t))
+        return;
+    const uint64_t *ips = s->ips;
+
+    /* Callchains open with a context marker (PERF_CONTEXT_USER, ...);
+     * with no other marker inside, the IPs are used where they lie. */
+    while (nr > 0 && ips[0] >= PERF_CONTEXT_MAX) {
+        ips++;
+        nr--;
+    }
+    if (nr > MAX_STACK_DEPTH) nr = MAX_STACK_DEPTH;
 
-        if (hdr.type == PERF_RECORD_SAMPLE) {
-            /* Layout: { u64 nr; u64 ips[nr]; } for PERF_SAMPLE_CALLCHAIN */
-            size_t offset = tail + sizeof(hdr);
-            uint64_t nr;
-            rb_read(rb, &nr, offset, sizeof(nr));
-            offset += sizeof(nr);
+    int clean = 1;
+    for (uint64_t i = 0; i < nr; i++)
+        if (ips[i] >= PERF_CONTEXT_MAX) { clean = 0; break; }
 
-            struct raw_sample *s = &raw_samples[n_samples];
-            s->depth = 0;
+    uint64_t time_ns = s->time + sample_clock_offset;
+    if (clean) {
+        if (nr > 0)
+            stack_add((int)s->pid, time_ns, ips, (int)nr);
+        return;
+    }
 
-            if (nr > MAX_STACK_DEPTH) nr = MAX_STACK_DEPTH;
+    uint64_t filtered[MAX_STACK_DEPTH];
+    int depth = 0;
+    for (uint64_t i = 0; i < nr; i++)
+        if (ips[i] < PERF_CONTEXT_MAX)  /* skip sentinel markers */
+            filtered[depth++] = ips[i];
+    if (depth > 0)
+        stack_add((int)s->pid, time_ns, filtered, depth);
+}
 
-            for (uint64_t i = 0; i < nr; i++) {
-                uint64_t ip;
-                rb_read(rb, &ip, offset, sizeof(ip));
-                offset += sizeof(ip);
+static void process_samples(struct ring_buffer *rb)
+{
+    uint64_t head = __atomic_load_n(&rb->meta->data_head, __ATOMIC_ACQUIRE);
+    uint64_t tail = rb->meta->data_tail;
 
-                /* Skip sentinel markers */
-                if (ip >= (uint64_t)-4096)
-                    continue;
+    if (head - tail > rb->peak_fill)
+        rb->peak_fill = head - tail;
 
-                s->ips[s->depth++] = ip;
-            }
+    while (tail < head) {
+        const struct perf_event_header *hdr =
+            (const void *)rb_record(rb, tail, sizeof(struct perf_event_header));
+        size_t size = hdr->size;
+        if (size < sizeof(*hdr))
+            break;  /* corrupt; shouldn't happen */
 
-            if (s->depth > 0)
-                n_samples++;
-        }
+        size_t off = tail & (rb->data_size - 1);
+        if (off + size > rb->data_size)
+            n_wrapped++;
+        hdr = (const void *)rb_record(rb, tail, size);
 
-        tail += hdr.size;
+        if (hdr->type == PERF_RECORD_SAMPLE)
+            process_sample(hdr);
+        else
+            process_task_record(hdr);
+
+        tail += size;
     }
 
     __atomic_store_n(&rb->meta->data_tail, tail, __ATOMIC_RELEASE);
 }
 
-/* ── Folded stack output ────────────────────────────────────── */
+/* ── Folded stack / binary profile output ───────────────────── */
+
+/*
+ * Symbolize each unique raw stack once (sym_resolve caches per address),
+ * then merge raw stacks that fold to the same string — e.g. two IPs in
+ * the same function — by sorting the much smaller set of unique stacks.
+ */
 
 #define MAX_STACK_STR 4096
 
 struct folded_entry {
-    char stack[MAX_STACK_STR];
-    int  count;
+    char    *stack;
+    uint64_t count;
+    uint64_t slice;
 };
 
 static int cmp_folded(const void *a, const void *b)
 {
-    return strcmp(((const struct folded_entry *)a)->stack,
-                 ((const struct folded_entry *)b)->stack);
+    const struct folded_entry *x = a, *y = b;
+    int c = strcmp(x->stack, y->stack);
+    if (c) return c;
+    return (x->slice > y->slice) - (x->slice < y->slice);
 }
 
-static void output_folded(FILE *out)
+/* Prefix each stack with its process name when several processes are sampled */
+static int group_by_comm = 0;
+
+/* Symbolized stacks sorted by (stack, slice); caller frees */
+static size_t symbolize_stacks(struct folded_entry **out)
 {
-    struct folded_entry *entries = calloc(n_samples, sizeof(*entries));
-    if (!entries) { perror("calloc"); return; }
+    struct folded_entry *entries = calloc(n_stacks ? n_stacks : 1, sizeof(*entries));
+    if (!entries) { perror("calloc"); *out = NULL; return 0; }
 
-    int n_entries = 0;
+    size_t n_entries = 0;
+
+    for (size_t i = 0; i < stacks_size; i++) {
+        const struct stack_entry *s = &stacks[i];
+        if (s->depth == 0)
+            continue;
 
-    for (int i = 0; i < n_samples; i++) {
-        struct raw_sample *s = &raw_samples[i];
         char buf[MAX_STACK_STR];
         int pos = 0;
         int started = 0;
 
+        if (group_by_comm) {
+            int wrote = snprintf(buf, MAX_STACK_STR, "%s", sym_comm(s->pid));
+            if (wrote > 0) pos = (wrote < MAX_STACK_STR ? wrote : MAX_STACK_STR - 1);
+            started = 1;
+        }
+
         /* Stack is deepest-first; output root;...;leaf (reverse order) */
         for (int j = s->depth - 1; j >= 0; j--) {
-            const char *sym = sym_resolve(s->ips[j]);
+            const char *sym = sym_resolve(s->pid, s->ips[j]);
 
             if (strcmp(sym, "[unknown]") == 0 || strcmp(sym, "[null]") == 0)
                 continue;
@@ -162,31 +457,282 @@ static void output_folded(FILE *out)
         buf[pos] = '\0';
 
         if (pos > 0) {
-            memcpy(entries[n_entries].stack, buf, pos + 1);
-            entries[n_entries].count = 1;
+            entries[n_entries].stack = strdup(buf);
+            if (!entries[n_entries].stack) { perror("strdup"); break; }
+            entries[n_entries].count = s->count;
+            entries[n_entries].slice = s->slice;
             n_entries++;
         }
     }
 
-    /* Sort and merge duplicates */
     qsort(entries, n_entries, sizeof(*entries), cmp_folded);
+    *out = entries;
+    return n_entries;
+}
 
-    int w = 0;
-    for (int i = 1; i < n_entries; i++) {
-        if (strcmp(entries[w].stack, entries[i].stack) == 0) {
-            entries[w].count++;
-        } else {
-            w++;
-            if (w != i) entries[w] = entries[i];
+static void free_entries(struct folded_entry *entries, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        free(entries[i].stack);
+    free(entries);
+}
+
+static void output_folded(FILE *out)
+{
+    struct folded_entry *entries;
+    size_t n_entries = symbolize_stacks(&entries);
+
+    /* Merge stacks that symbolized identically */
+    size_t unique = 0;
+    for (size_t i = 0; i < n_entries; ) {
+        uint64_t count = 0;
+        size_t j = i;
+        for (; j < n_entries && strcmp(entries[j].stack, entries[i].stack) == 0; j++)
+            count += entries[j].count;
+        fprintf(out, "%s %lu\n", entries[i].stack, (unsigned long)count);
+        unique++;
+        i = j;
+    }
+
+    fprintf(stderr, "profiler: %zu unique stacks (%zu raw) from %lu samples\n",
+            unique, n_stacks, (unsigned long)n_samples);
+    free_entries(entries, n_entries);
+}
+
+static uint64_t realtime_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Write everything aggregated so far as one .fgp file; written to a
+ * temporary name and renamed so collectors never see a partial file. */
+static int output_fgp(const char *path, uint64_t start_ns, uint64_t end_ns, int freq)
+{
+    struct folded_entry *entries;
+    size_t n_entries = symbolize_stacks(&entries);
+
+    struct fgp_writer *w = fgp_writer_new(start_ns, (uint32_t)freq);
+    if (!w) { free_entries(entries, n_entries); return -1; }
+
+    for (size_t i = 0; i < n_entries; ) {
+        uint32_t id = fgp_add_stack(w, entries[i].stack);
+        size_t j = i;
+        for (; j < n_entries && strcmp(entries[j].stack, entries[i].stack) == 0; j++) {
+            uint64_t t = slice_ns ? entries[j].slice * slice_ns : start_ns;
+            uint64_t count = entries[j].count;
+            /* Coalesce raw stacks that share this slice */
+            while (j + 1 < n_entries && entries[j + 1].slice == entries[j].slice &&
+                   strcmp(entries[j + 1].stack, entries[i].stack) == 0)
+                count += entries[++j].count;
+            fgp_add_sample(w, id, t, count);
         }
+        i = j;
+    }
+    free_entries(entries, n_entries);
+
+    int to_stdout = (strcmp(path, "-") == 0);
+    char tmp[4096];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    long bytes = fgp_write(w, to_stdout ? "/dev/stdout" : tmp, end_ns);
+    if (bytes < 0)
+        return -1;
+    if (!to_stdout && rename(tmp, path) < 0) {
+        perror(path);
+        return -1;
     }
-    int unique = (n_entries > 0) ? w + 1 : 0;
 
-    for (int i = 0; i < unique; i++)
-        fprintf(out, "%s %d\n", entries[i].stack, entries[i].count);
+    fprintf(stderr, "profiler: wrote %s (%lu samples, %ld bytes)\n",
+            to_stdout ? "<stdout>" : path, (unsigned long)n_samples, bytes);
+    return 0;
+}
 
-    fprintf(stderr, "profiler: %d unique stacks from %d samples\n", unique, n_samples);
-    free(entries);
+/* <prefix>-YYYYmmddTHHMMSS.fgp, local time of the interval start */
+static void rotation_path(char *buf, size_t size, const char *prefix, uint64_t start_ns)
+{
+    time_t t = (time_t)(start_ns / 1000000000ULL);
+    struct tm tm;
+    localtime_r(&t, &tm);
+    char stamp[32];
+    strftime(stamp, sizeof(stamp), "%Y%m%dT%H%M%S", &tm);
+    snprintf(buf, size, "%s-%s.fgp", prefix, stamp);
+}
+
+/* ── Per-CPU event setup ────────────────────────────────────── */
+
+struct cpu_ring {
+    int    cpu;
+    int    fd;          /* event that owns the mmap; others SET_OUTPUT to it */
+    int    poll;        /* event_fds[] index of the one event in epoll, or -1 */
+    void  *base;
+    size_t size;
+    struct ring_buffer rb;
+};
+
+static struct cpu_ring rings[MAX_CPUS];
+static int n_cpus = 0;
+
+/* Every event opened, in open order; a CPU's ring owner comes first */
+struct event_fd {
+    int fd;
+    int cpu;
+};
+
+static struct event_fd *event_fds;
+static int n_event_fds = 0;
+static int cap_event_fds = 0;
+
+/* Open one event on `cpu` and attach it to that CPU's ring buffer.
+ * Returns 0 on success, -1 with errno set on failure. */
+static int open_on_cpu(struct perf_event_attr *pe, pid_t pid, int cpu,
+                       unsigned long flags)
+{
+    struct cpu_ring *r = &rings[cpu];
+
+    int fd = (int)perf_event_open(pe, pid, cpu, -1, flags);
+    if (fd < 0)
+        return -1;
+
+    if (r->fd < 0) {
+        size_t mmap_size = (1 + MMAP_PAGES) * sysconf(_SC_PAGESIZE);
+        void *base = mmap(NULL, mmap_size, PROT_READ | PROT_WRITE,
+                          MAP_SHARED, fd, 0);
+        if (base == MAP_FAILED) {
+            int err = errno;
+            close(fd);
+            errno = err;
+            return -1;
+        }
+        r->fd = fd;
+        r->base = base;
+        r->size = mmap_size;
+        rb_init(&r->rb, base, mmap_size);
+    } else if (ioctl(fd, PERF_EVENT_IOC_SET_OUTPUT, r->fd) < 0) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+
+    if (n_event_fds == cap_event_fds) {
+        cap_event_fds = cap_event_fds ? cap_event_fds * 2 : 256;
+        struct event_fd *p = realloc(event_fds, cap_event_fds * sizeof(*event_fds));
+        if (!p) { perror("realloc"); exit(1); }
+        event_fds = p;
+    }
+    event_fds[n_event_fds++] = (struct event_fd){ .fd = fd, .cpu = cpu };
+    return 0;
+}
+
+/* Threads of `pid` from /proc/<pid>/task. Returns count, or -1. */
+static int list_threads(int pid, int *tids, int max)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/task", pid);
+
+    DIR *d = opendir(path);
+    if (!d)
+        return -1;
+
+    int n = 0;
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL && n < max) {
+        int tid = atoi(de->d_name);
+        if (tid > 0)
+            tids[n++] = tid;
+    }
+    closedir(d);
+    return n;
+}
+
+/* Each (thread, CPU) pair needs its own fd; lift the soft limit so a
+ * many-threaded target on a large host does not hit EMFILE. */
+static void raise_fd_limit(void)
+{
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+}
+
+static void close_events(void)
+{
+    for (int i = 0; i < n_event_fds; i++)
+        close(event_fds[i].fd);
+    for (int c = 0; c < n_cpus; c++)
+        if (rings[c].base)
+            munmap(rings[c].base, rings[c].size);
+    free(event_fds);
+}
+
+/* Put event_fds[idx] into epoll as the one fd polled for ring `r` */
+static int poll_event(int epfd, struct cpu_ring *r, int idx)
+{
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = r };
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, event_fds[idx].fd, &ev) < 0)
+        return -1;
+    r->poll = idx;
+    return 0;
+}
+
+/* The polled event's thread has exited (EPOLLHUP, which is level-
+ * triggered). Poll the next event opened on the same CPU instead, so
+ * the ring keeps its wakeups while other threads still write to it;
+ * one that has exited too hangs up on the next epoll_wait. */
+static void next_poll_event(int epfd, struct cpu_ring *r)
+{
+    epoll_ctl(epfd, EPOLL_CTL_DEL, event_fds[r->poll].fd, NULL);
+    for (int i = r->poll + 1; i < n_event_fds; i++)
+        if (event_fds[i].cpu == r->cpu && poll_event(epfd, r, i) == 0)
+            return;
+    r->poll = -1;       /* drained on the tick only */
+}
+
+/* Whether any -p target is still running */
+static int targets_alive(const int *pids, int n_pids)
+{
+    for (int i = 0; i < n_pids; i++)
+        if (kill(pids[i], 0) == 0)
+            return 1;
+    return 0;
+}
+
+/* ── Data quality ───────────────────────────────────────────── */
+
+/* Loss, throttling and our own CPU cost over the profiling window */
+static void report_quality(const struct rusage *a, const struct rusage *b, double wall)
+{
+    size_t peak = 0, ring_size = 0;
+    for (int c = 0; c < n_cpus; c++) {
+        if (rings[c].fd < 0)
+            continue;
+        ring_size = rings[c].rb.data_size;
+        if (rings[c].rb.peak_fill > peak)
+            peak = rings[c].rb.peak_fill;
+    }
+
+    fprintf(stderr, "profiler: lost %lu samples in %lu overruns, %lu throttle events, "
+            "peak ring fill %.0f%%, %lu wrapped records\n",
+            (unsigned long)n_lost, (unsigned long)n_lost_records,
+            (unsigned long)n_throttled,
+            ring_size ? 100.0 * peak / ring_size : 0.0, (unsigned long)n_wrapped);
+    if (n_lost > 0)
+        fprintf(stderr, "profiler: warning: %.1f%% of samples lost; lower -f or raise MMAP_PAGES\n",
+                100.0 * n_lost / (n_lost + n_samples_total));
+    /* Drops in the last moments before DISABLE get no LOST record, so a
+     * ring seen with less than a page free may have lost more than that */
+    if (ring_size && peak + sysconf(_SC_PAGESIZE) > ring_size)
+        fprintf(stderr, "profiler: warning: a ring buffer filled up; samples may have been "
+                "lost uncounted; lower -f or raise MMAP_PAGES\n");
+
+    double cpu = (b->ru_utime.tv_sec - a->ru_utime.tv_sec) +
+                 (b->ru_utime.tv_usec - a->ru_utime.tv_usec) / 1e6 +
+                 (b->ru_stime.tv_sec - a->ru_stime.tv_sec) +
+                 (b->ru_stime.tv_usec - a->ru_stime.tv_usec) / 1e6;
+    fprintf(stderr, "profiler: overhead %.3f s CPU over %.1f s (%.2f%% of one CPU)\n",
+            cpu, wall, wall > 0 ? 100.0 * cpu / wall : 0.0);
 }
 
 /* ── Signal handling ────────────────────────────────────────── */
@@ -194,106 +740,357 @@ static void output_folded(FILE *out)
 static volatile int stop = 0;
 static void handle_signal(int sig) { (void)sig; stop = 1; }
 
+/* ── Sampling events ────────────────────────────────────────── */
+
+#define HW_CACHE(cache, op, result) \
+    ((PERF_COUNT_HW_CACHE_##cache) | (PERF_COUNT_HW_CACHE_OP_##op << 8) | \
+     (PERF_COUNT_HW_CACHE_RESULT_##result << 16))
+
+struct event_def {
+    const char *name;
+    uint32_t    type;
+    uint64_t    config;
+};
+
+/* Names follow perf-list(1) */
+static const struct event_def event_defs[] = {
+    { "cpu-clock",             PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_CLOCK },
+    { "task-clock",            PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+    { "page-faults",           PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+    { "cycles",                PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { "instructions",          PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { "cache-references",      PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES },
+    { "cache-misses",          PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+    { "branch-misses",         PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    { "L1-dcache-load-misses", PERF_TYPE_HW_CACHE, HW_CACHE(L1D, READ, MISS) },
+    { "LLC-load-misses",       PERF_TYPE_HW_CACHE, HW_CACHE(LL, READ, MISS) },
+    { "LLC-store-misses",      PERF_TYPE_HW_CACHE, HW_CACHE(LL, WRITE, MISS) },
+    { "dTLB-load-misses",      PERF_TYPE_HW_CACHE, HW_CACHE(DTLB, READ, MISS) },
+};
+
+/* Known name, or rNNNN for a raw PMU event (hex umask:event, as perf) */
+static int parse_event(const char *name, struct event_def *out)
+{
+    for (size_t i = 0; i < sizeof(event_defs) / sizeof(event_defs[0]); i++) {
+        if (strcmp(name, event_defs[i].name) == 0) {
+            *out = event_defs[i];
+            return 0;
+        }
+    }
+    if (name[0] == 'r' && name[1]) {
+        char *end;
+        uint64_t config = strtoull(name + 1, &end, 16);
+        if (*end == '\0') {
+            *out = (struct event_def){ name, PERF_TYPE_RAW, config };
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static void list_events(void)
+{
+    fprintf(stderr, "  Events:");
+    for (size_t i = 0; i < sizeof(event_defs) / sizeof(event_defs[0]); i++)
+        fprintf(stderr, "%s%s", i % 4 ? " " : "\n    ", event_defs[i].name);
+    fprintf(stderr, "\n    rNNNN (raw PMU event, hex)\n");
+}
+
 /* ── Main ───────────────────────────────────────────────────── */
 
 static void usage(const char *prog)
 {
-    fprintf(stderr, "Usage: %s -p <pid> [-d <seconds>] [-f <freq>] [-o <outfile>]\n", prog);
-    fprintf(stderr, "  -p PID      Process to profile (required)\n");
-    fprintf(stderr, "  -d SECONDS  Duration (default: 5)\n");
-    fprintf(stderr, "  -f FREQ     Sampling frequency in Hz (default: 99)\n");
-    fprintf(stderr, "  -o FILE     Output file (default: stdout)\n");
+    fprintf(stderr, "Usage: %s {-p <pid>[,<pid>...] | -a | --cgroup <path>}\n"
+                    "          [-d <seconds>] [-f <freq> | -c <period>] [-e <event>] [-k]\n"
+                    "          [-o <outfile>] [-C]\n"
+                    "          [--format folded|fgp] [--rotate <seconds>] [--slice <seconds>]\n", prog);
+    fprintf(stderr, "  -p PID        Process to profile (repeatable, or comma-separated)\n");
+    fprintf(stderr, "  -a            Profile all processes on all CPUs\n");
+    fprintf(stderr, "  --cgroup PATH Profile one cgroup (absolute, or relative to /sys/fs/cgroup)\n");
+    fprintf(stderr, "  -d SECONDS    Duration (default: 5)\n");
+    fprintf(stderr, "  -f FREQ       Sampling frequency in Hz (default: 99)\n");
+    fprintf(stderr, "  -c PERIOD     Sample every PERIOD events instead of at -f Hz\n");
+    fprintf(stderr, "  -e EVENT      Event to sample on (default: cpu-clock)\n");
+    fprintf(stderr, "  -k, --kernel  Include kernel callchains (needs paranoid <= 1 or root)\n");
+    fprintf(stderr, "  -o FILE       Output file (default: stdout); prefix with --rotate\n");
+    fprintf(stderr, "  -C, --demangle Demangle C++ symbol names\n");
+    fprintf(stderr, "  --format FMT  folded (default) or fgp (compact binary, see fgprof.h)\n");
+    fprintf(stderr, "  --rotate N    Continuous mode: run until signalled (or -d), writing\n"
+                    "                FILE-<timestamp>.fgp every N seconds (default -f 19)\n");
+    fprintf(stderr, "  --slice N     Time resolution of fgp samples (default: 1 second)\n");
+    list_events();
     exit(1);
 }
 
+static void add_pids(const char *arg, int *pids, int *n_pids)
+{
+    char buf[1024];
+    snprintf(buf, sizeof(buf), "%s", arg);
+
+    char *saveptr;
+    for (char *tok = strtok_r(buf, ",", &saveptr); tok;
+         tok = strtok_r(NULL, ",", &saveptr)) {
+        int pid = atoi(tok);
+        if (pid <= 0 || *n_pids >= MAX_TARGETS) {
+            fprintf(stderr, "profiler: bad or too many PIDs: %s\n", arg);
+            exit(1);
+        }
+        pids[(*n_pids)++] = pid;
+    }
+}
+
 int main(int argc, char *argv[])
 {
-    int target_pid = -1;
-    int duration = 5;
-    int freq = 99;
+    int pids[MAX_TARGETS];
+    int n_pids = 0;
+    int system_wide = 0;
+    const char *cgroup = NULL;
+    int duration = -1;
+    int freq = -1;
     const char *outfile = NULL;
+    int fgp = 0;
+    struct event_def event = event_defs[0];
+    uint64_t period = 0;
+    int kernel = 0;
+    int rotate = 0;
+    double slice_s = 1.0;
+
+    static const struct option long_opts[] = {
+        { "cgroup",   required_argument, NULL, 'G' },
+        { "demangle", no_argument,       NULL, 'C' },
+        { "kernel",   no_argument,       NULL, 'k' },
+        { "format",   required_argument, NULL, 'M' },
+        { "rotate",   required_argument, NULL, 'R' },
+        { "slice",    required_argument, NULL, 'S' },
+        { "help",     no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
 
     int opt;
-    while ((opt = getopt(argc, argv, "p:d:f:o:h")) != -1) {
+    while ((opt = getopt_long(argc, argv, "p:ad:f:c:e:ko:Ch", long_opts, NULL)) != -1) {
         switch (opt) {
-        case 'p': target_pid = atoi(optarg); break;
+        case 'p': add_pids(optarg, pids, &n_pids); break;
+        case 'a': system_wide = 1; break;
+        case 'G': cgroup = optarg; break;
         case 'd': duration = atoi(optarg); break;
         case 'f': freq = atoi(optarg); break;
+        case 'c': period = strtoull(optarg, NULL, 0); break;
+        case 'e':
+            if (parse_event(optarg, &event) < 0) {
+                fprintf(stderr, "profiler: unknown event '%s'\n", optarg);
+                usage(argv[0]);
+            }
+            break;
+        case 'k': kernel = 1; break;
         case 'o': outfile = optarg; break;
+        case 'C': sym_set_demangle(1); break;
+        case 'M':
+            if (strcmp(optarg, "fgp") == 0) fgp = 1;
+            else if (strcmp(optarg, "folded") != 0) usage(argv[0]);
+            break;
+        case 'R': rotate = atoi(optarg); break;
+        case 'S': slice_s = atof(optarg); break;
         default:  usage(argv[0]);
         }
     }
 
-    if (target_pid <= 0) usage(argv[0]);
+    if ((n_pids > 0) + system_wide + (cgroup != NULL) != 1) usage(argv[0]);
 
-    /* Check process exists */
-    if (kill(target_pid, 0) != 0) {
-        fprintf(stderr, "profiler: process %d does not exist: %s\n",
-                target_pid, strerror(errno));
-        return 1;
+    /* Continuous mode: low default frequency, no time limit, binary output */
+    if (rotate > 0) {
+        fgp = 1;
+        if (freq < 0) freq = 19;
+        if (duration < 0) duration = 0;
+    }
+    if (freq <= 0) freq = 99;
+    if (duration < 0) duration = 5;
+    if (fgp && slice_s > 0)
+        slice_ns = (uint64_t)(slice_s * 1e9);
+
+    /* Check processes exist */
+    for (int i = 0; i < n_pids; i++) {
+        if (kill(pids[i], 0) != 0) {
+            fprintf(stderr, "profiler: process %d does not exist: %s\n",
+                    pids[i], strerror(errno));
+            return 1;
+        }
     }
 
-    raw_samples = calloc(MAX_SAMPLES, sizeof(*raw_samples));
-    if (!raw_samples) { perror("calloc"); return 1; }
+    int cgroup_fd = -1;
+    if (cgroup) {
+        char path[4096];
+        if (cgroup[0] == '/')
+            snprintf(path, sizeof(path), "%s", cgroup);
+        else
+            snprintf(path, sizeof(path), "/sys/fs/cgroup/%s", cgroup);
+        cgroup_fd = open(path, O_RDONLY | O_DIRECTORY);
+        if (cgroup_fd < 0) {
+            fprintf(stderr, "profiler: cannot open cgroup %s: %s\n",
+                    path, strerror(errno));
+            return 1;
+        }
+    }
+
+    group_by_comm = system_wide || cgroup || n_pids > 1;
 
-    /* Set up perf event */
+    /* Set up perf events */
     struct perf_event_attr pe;
     memset(&pe, 0, sizeof(pe));
-    pe.type = PERF_TYPE_SOFTWARE;
-    pe.config = PERF_COUNT_SW_CPU_CLOCK;
+    pe.type = event.type;
+    pe.config = event.config;
     pe.size = sizeof(pe);
-    pe.sample_period = 0;
-    pe.sample_freq = freq;
-    pe.freq = 1;
-    pe.sample_type = PERF_SAMPLE_CALLCHAIN;
+    if (period > 0) {
+        pe.sample_period = period;
+    } else {
+        pe.sample_freq = freq;
+        pe.freq = 1;
+    }
+    pe.sample_type = PERF_SAMPLE_TID | PERF_SAMPLE_TIME | PERF_SAMPLE_CALLCHAIN;
+    /* Sample times on the wall clock, for .fgp. CLOCK_REALTIME is not
+     * NMI-safe, so the kernel takes it only for software events; PMU
+     * events sample CLOCK_MONOTONIC and get one offset taken here. */
+    pe.use_clockid = 1;
+    if (event.type == PERF_TYPE_SOFTWARE) {
+        pe.clockid = CLOCK_REALTIME;
+    } else {
+        struct timespec rt, mono;
+        pe.clockid = CLOCK_MONOTONIC;
+        clock_gettime(CLOCK_REALTIME, &rt);
+        clock_gettime(CLOCK_MONOTONIC, &mono);
+        sample_clock_offset = (int64_t)(rt.tv_sec - mono.tv_sec) * 1000000000LL +
+                              (rt.tv_nsec - mono.tv_nsec);
+    }
     pe.disabled = 1;
-    pe.exclude_kernel = 1;  /* user stacks only (avoids permission issues) */
+    pe.inherit = (n_pids > 0);  /* follow threads created while profiling */
+    pe.exclude_kernel = !kernel;  /* user stacks only unless -k */
     pe.exclude_hv = 1;
+    pe.mmap = 1;            /* track dlopen/exec so late mappings resolve */
+    pe.mmap2 = 1;
+    pe.comm = 1;
+    pe.comm_exec = 1;
+    pe.task = 1;
+    /* Batch wakeups: one per quarter ring rather than one per sample */
+    pe.watermark = 1;
+    pe.wakeup_watermark = MMAP_PAGES * sysconf(_SC_PAGESIZE) / 4;
+
+    n_cpus = (int)sysconf(_SC_NPROCESSORS_CONF);
+    if (n_cpus > MAX_CPUS) n_cpus = MAX_CPUS;
+    for (int c = 0; c < n_cpus; c++) {
+        rings[c].cpu = c;
+        rings[c].fd = -1;
+        rings[c].poll = -1;
+    }
 
-    int perf_fd = (int)perf_event_open(&pe, target_pid, -1, -1, 0);
-    if (perf_fd < 0) {
-        fprintf(stderr, "profiler: perf_event_open failed: %s\n", strerror(errno));
-        fprintf(stderr, "  Try: sudo sysctl kernel.perf_event_paranoid=-1\n");
-        fprintf(stderr, "  Or run as root\n");
-        free(raw_samples);
+    raise_fd_limit();
+
+    int *tids = malloc(MAX_THREADS * sizeof(*tids));
+    if (!tids) { perror("malloc"); return 1; }
+
+    int open_err = 0;
+    for (int c = 0; c < n_cpus; c++) {
+        if (system_wide) {
+            if (open_on_cpu(&pe, -1, c, 0) < 0) open_err = errno;
+        } else if (cgroup) {
+            if (open_on_cpu(&pe, cgroup_fd, c, PERF_FLAG_PID_CGROUP) < 0)
+                open_err = errno;
+        } else {
+            for (int i = 0; i < n_pids; i++) {
+                int nt = list_threads(pids[i], tids, MAX_THREADS);
+                for (int t = 0; t < nt; t++) {
+                    /* Threads may exit between listing and opening */
+                    if (open_on_cpu(&pe, tids[t], c, 0) < 0 && errno != ESRCH)
+                        open_err = errno;
+                }
+            }
+        }
+        /* Offline CPUs report ENODEV; skip them quietly */
+        if (open_err == ENODEV || open_err == ENXIO)
+            open_err = 0;
+        if (open_err)
+            break;
+    }
+    free(tids);
+    if (cgroup_fd >= 0) close(cgroup_fd);
+
+    if (open_err || n_event_fds == 0) {
+        fprintf(stderr, "profiler: perf_event_open(%s) failed: %s\n",
+                event.name, strerror(open_err ? open_err : ESRCH));
+        if (open_err == ENOENT || open_err == EOPNOTSUPP || open_err == EINVAL) {
+            fprintf(stderr, "  The CPU (or hypervisor) may not expose this event;"
+                            " try -e cpu-clock\n");
+        } else {
+            fprintf(stderr, "  Try: sudo sysctl kernel.perf_event_paranoid=-1\n");
+            fprintf(stderr, "  Or run as root\n");
+        }
+        close_events();
         return 1;
     }
 
-    /* mmap ring buffer */
-    size_t page_size = sysconf(_SC_PAGESIZE);
-    size_t mmap_size = (1 + MMAP_PAGES) * page_size;
-    void *mmap_base = mmap(NULL, mmap_size, PROT_READ | PROT_WRITE,
-                           MAP_SHARED, perf_fd, 0);
-    if (mmap_base == MAP_FAILED) {
-        perror("mmap");
-        close(perf_fd);
-        free(raw_samples);
+    int epfd = epoll_create1(0);
+    if (epfd < 0) {
+        perror("epoll_create1");
+        close_events();
         return 1;
     }
 
-    struct ring_buffer rb;
-    rb_init(&rb, mmap_base, mmap_size);
+    /* Only the ring owner goes into epoll. perf_poll() on any event
+     * redirected into a ring consumes that ring's wakeup, so a second
+     * polled fd per ring steals the owner's watermark wakeups. */
+    int n_rings = 0;
+    for (int i = 0; i < n_event_fds; i++) {
+        struct cpu_ring *r = &rings[event_fds[i].cpu];
+        if (event_fds[i].fd == r->fd && poll_event(epfd, r, i) == 0)
+            n_rings++;
+    }
 
-    /* Load symbol info */
-    if (sym_init(target_pid) < 0) {
-        fprintf(stderr, "profiler: warning: could not load symbols for pid %d\n",
-                target_pid);
+    /* Load symbol info for explicit targets up front */
+    for (int i = 0; i < n_pids; i++) {
+        if (sym_init(pids[i]) < 0) {
+            fprintf(stderr, "profiler: warning: could not load symbols for pid %d\n",
+                    pids[i]);
+        }
     }
 
     /* Start profiling */
     signal(SIGINT, handle_signal);
     signal(SIGTERM, handle_signal);
 
-    ioctl(perf_fd, PERF_EVENT_IOC_RESET, 0);
-    ioctl(perf_fd, PERF_EVENT_IOC_ENABLE, 0);
+    for (int i = 0; i < n_event_fds; i++) {
+        ioctl(event_fds[i].fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(event_fds[i].fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
 
-    fprintf(stderr, "profiler: sampling PID %d at %d Hz for %d seconds...\n",
-            target_pid, freq, duration);
+    if (system_wide)
+        fprintf(stderr, "profiler: sampling all CPUs");
+    else if (cgroup)
+        fprintf(stderr, "profiler: sampling cgroup %s", cgroup);
+    else if (n_pids == 1)
+        fprintf(stderr, "profiler: sampling PID %d", pids[0]);
+    else
+        fprintf(stderr, "profiler: sampling %d PIDs", n_pids);
+    fprintf(stderr, " on %s%s", event.name, kernel ? " (user+kernel)" : "");
+    if (period > 0)
+        fprintf(stderr, " every %lu events", (unsigned long)period);
+    else
+        fprintf(stderr, " at %d Hz", freq);
+    if (duration > 0)
+        fprintf(stderr, " for %d seconds", duration);
+    else
+        fprintf(stderr, " until interrupted");
+    if (rotate > 0)
+        fprintf(stderr, ", rotating every %d seconds", rotate);
+    fprintf(stderr, " (%d events, %d ring buffers)...\n", n_event_fds, n_rings);
 
     struct timespec start_ts;
     clock_gettime(CLOCK_MONOTONIC, &start_ts);
+    struct rusage ru_start;
+    getrusage(RUSAGE_SELF, &ru_start);
+    uint64_t interval_start_ns = realtime_ns();
+    double next_rotate = rotate;
+    double next_tick = 0;
+    const char *prefix = outfile ? outfile : "profile";
 
-    struct pollfd pfd = { .fd = perf_fd, .events = POLLIN };
+    struct epoll_event evs[64];
 
     while (!stop) {
         /* Check duration */
@@ -301,37 +1098,100 @@ int main(int argc, char *argv[])
         clock_gettime(CLOCK_MONOTONIC, &now);
         double elapsed = (now.tv_sec - start_ts.tv_sec) +
                          (now.tv_nsec - start_ts.tv_nsec) / 1e9;
-        if (elapsed >= duration)
+        if (duration > 0 && elapsed >= duration)
             break;
 
-        int ret = poll(&pfd, 1, 100);  /* 100ms timeout */
-        if (ret > 0)
-            process_samples(&rb);
+        /* Rings whose polled events have all exited get no wakeups, and
+         * epoll says nothing of the targets themselves: check both here */
+        if (elapsed >= next_tick) {
+            for (int c = 0; c < n_cpus; c++)
+                if (rings[c].fd >= 0)
+                    process_samples(&rings[c].rb);
+            if (n_pids > 0 && !targets_alive(pids, n_pids))
+                break;
+            next_tick = elapsed + TICK_MS / 1000.0;
+        }
+
+        if (rotate > 0 && elapsed >= next_rotate) {
+            for (int c = 0; c < n_cpus; c++)
+                if (rings[c].fd >= 0)
+                    process_samples(&rings[c].rb);
+
+            char path[4096];
+            uint64_t end_ns = realtime_ns();
+            rotation_path(path, sizeof(path), prefix, interval_start_ns);
+            output_fgp(path, interval_start_ns, end_ns, period ? 0 : freq);
+            stacks_free();
+            sym_flush_exited();
+            interval_start_ns = end_ns;
+            next_rotate += rotate;
+        }
+
+        /* Sleep until a ring passes its watermark or the next deadline */
+        double deadline = next_tick;
+        if (duration > 0 && duration < deadline) deadline = duration;
+        if (rotate > 0 && next_rotate < deadline) deadline = next_rotate;
+        int timeout = (int)((deadline - elapsed) * 1000) + 1;
+
+        int ret = epoll_wait(epfd, evs, 64, timeout);
+        for (int i = 0; i < ret; i++) {
+            struct cpu_ring *r = evs[i].data.ptr;
+            process_samples(&r->rb);
+            if (evs[i].events & EPOLLHUP)
+                next_poll_event(epfd, r);
+        }
     }
 
+    /* Make room before stopping: the kernel reports samples dropped on
+     * a full ring (PERF_RECORD_LOST) only with the next one that fits */
+    for (int c = 0; c < n_cpus; c++)
+        if (rings[c].fd >= 0)
+            process_samples(&rings[c].rb);
+
+    for (int i = 0; i < n_event_fds; i++)
+        ioctl(event_fds[i].fd, PERF_EVENT_IOC_DISABLE, 0);
+
     /* Final drain */
-    process_samples(&rb);
+    for (int c = 0; c < n_cpus; c++)
+        if (rings[c].fd >= 0)
+            process_samples(&rings[c].rb);
 
-    ioctl(perf_fd, PERF_EVENT_IOC_DISABLE, 0);
+    struct timespec end_ts;
+    clock_gettime(CLOCK_MONOTONIC, &end_ts);
+    struct rusage ru_end;
+    getrusage(RUSAGE_SELF, &ru_end);
 
-    fprintf(stderr, "profiler: collected %d samples\n", n_samples);
+    fprintf(stderr, "profiler: collected %lu samples\n", (unsigned long)n_samples_total);
+    report_quality(&ru_start, &ru_end,
+                   (end_ts.tv_sec - start_ts.tv_sec) +
+                   (end_ts.tv_nsec - start_ts.tv_nsec) / 1e9);
 
     /* Output */
-    FILE *out = stdout;
-    if (outfile) {
-        out = fopen(outfile, "w");
-        if (!out) { perror(outfile); out = stdout; }
-    }
+    if (rotate > 0) {
+        char path[4096];
+        rotation_path(path, sizeof(path), prefix, interval_start_ns);
+        if (n_samples > 0)
+            output_fgp(path, interval_start_ns, realtime_ns(), period ? 0 : freq);
+    } else if (fgp) {
+        output_fgp(outfile ? outfile : "-", interval_start_ns, realtime_ns(),
+                   period ? 0 : freq);
+    } else {
+        FILE *out = stdout;
+        if (outfile) {
+            out = fopen(outfile, "w");
+            if (!out) { perror(outfile); out = stdout; }
+        }
 
-    output_folded(out);
+        output_folded(out);
 
-    if (out != stdout) fclose(out);
+        if (out != stdout) fclose(out);
+    }
 
     /* Cleanup */
-    munmap(mmap_base, mmap_size);
-    close(perf_fd);
+    close(epfd);
+    close_events();
     sym_cleanup();
-    free(raw_samples);
+    stacks_free();
 
     return 0;
 }
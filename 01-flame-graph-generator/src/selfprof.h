@@ -0,0 +1,57 @@
+/*
+ * selfprof.h — In-process sampling profiler library (libselfprof)
+ *
+ * For services where perf_event_open is not allowed. Every thread gets
+ * its own CPU-time timer (timer_create + SIGEV_THREAD_ID), so samples
+ * are attributed to the thread that burned the CPU. The SIGPROF handler
+ * walks frame pointers into a preallocated per-thread ring buffer and
+ * does nothing that isn't async-signal-safe; a background thread drains
+ * the rings, and dumps are symbolized to folded stacks (root frame =
+ * thread name).
+ *
+ * Build the target with -fno-omit-frame-pointer.
+ *
+ *   selfprof_start(999);
+ *   selfprof_dump_on_signal(SIGUSR2, "/tmp/app.folded");
+ *   ...
+ *   selfprof_dump("/tmp/app.folded");   // any time; cumulative since start
+ *   selfprof_stop();
+ *
+ * Or without code changes (linked or LD_PRELOAD'ed):
+ *   SELFPROF_HZ=999 SELFPROF_OUT=/tmp/app.folded ./app
+ * starts at load, dumps on SIGUSR2 and at exit.
+ */
+#ifndef SELFPROF_H
+#define SELFPROF_H
+
+#include <stdint.h>
+
+/* Start sampling every thread of the process at `hz` samples per second
+ * of that thread's CPU time. Threads created later are picked up within
+ * a quarter of a second. Returns 0, or -1 with errno set. */
+int selfprof_start(int hz);
+
+/* Sample the calling thread right away (and with exact stack bounds),
+ * instead of waiting for the next thread scan. Optional. */
+void selfprof_register_thread(void);
+
+/* Write everything sampled since selfprof_start as folded stacks to
+ * `path` ("-" for stdout). Returns 0, or -1 on failure. */
+int selfprof_dump(const char *path);
+
+/* Dump to `path` whenever `sig` (e.g. SIGUSR2) is received. */
+int selfprof_dump_on_signal(int sig, const char *path);
+
+struct selfprof_stats {
+    uint64_t samples;   /* taken by the signal handler */
+    uint64_t dropped;   /* ring full, or unwinding impossible */
+    int      threads;   /* currently sampled */
+};
+
+void selfprof_get_stats(struct selfprof_stats *st);
+
+/* Stop all timers and the background thread; samples are kept, so a
+ * final selfprof_dump still works. */
+void selfprof_stop(void);
+
+#endif /* SELFPROF_H */
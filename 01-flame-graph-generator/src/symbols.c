@@ -1,10 +1,18 @@
 /*
- * symbols.c — Symbol resolution via /proc/<pid>/maps + addr2line
+ * symbols.c — Symbol resolution via /proc/<pid>/maps + in-process ELF parsing
  *
- * 1. Parse /proc/<pid>/maps to build a table of VMAs (virtual memory areas)
- * 2. For each address, find the containing VMA and compute the file offset
- * 3. Call addr2line to resolve the offset to a function name
- * 4. Cache results to avoid repeated addr2line invocations
+ * 1. Parse /proc/<pid>/maps to build a table of VMAs (virtual memory areas),
+ *    one sorted table per profiled process, kept current from perf
+ *    MMAP2/COMM/FORK/EXIT records; /tmp/perf-<pid>.map covers JIT code
+ * 2. For each address, find the containing VMA and compute the file offset,
+ *    then map it to an ELF virtual address through the PT_LOAD headers
+ * 3. Each DSO is mmap'd once; its .symtab/.dynsym (or those of its
+ *    build-id / .gnu_debuglink debug file) become a sorted address table
+ *    searched by binary search
+ * 4. Kernel addresses resolve through /proc/kallsyms, loaded on first use
+ * 5. Cache results so each (pid, address) is resolved exactly once
+ * 6. Data addresses (sym_resolve_data) resolve against OBJECT/TLS symbols,
+ *    loaded separately on first use, or name their anonymous mapping
  */
 #define _GNU_SOURCE
 #include "symbols.h"
@@ -12,84 +20,259 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <elf.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-/* ── VMA table ──────────────────────────────────────────────── */
+/* ── Per-process VMA tables ─────────────────────────────────── */
 
-#define MAX_VMAS 4096
+/*
+ * Each process has a sorted, non-overlapping array of executable file
+ * mappings. It is seeded from /proc/<pid>/maps and then kept current by
+ * the profiler feeding PERF_RECORD_MMAP2/COMM/FORK/EXIT records in, so
+ * libraries dlopen'd mid-profile resolve too. Lookups binary-search.
+ */
+
+#define MAX_PROCS 4096  /* must be power of 2 */
+
+struct dso;
 
 struct vma {
+    uint64_t    start;
+    uint64_t    end;
+    uint64_t    offset;
+    char        path[512];
+    struct dso *dso;    /* looked up on first use */
+};
+
+struct jit_sym {
     uint64_t start;
     uint64_t end;
-    uint64_t offset;
-    char     perms[5];
-    char     path[512];
+    char    *name;
+};
+
+struct proc_maps {
+    int             pid;
+    int             used;
+    int             n_vmas;
+    int             cap_vmas;
+    struct vma     *vmas;       /* sorted by start */
+    char            comm[16];
+    int             exited;     /* EXIT seen: a later FORK/COMM is a recycled PID */
+    uint32_t        gen;        /* bumped when the tables change; see sym_resolve */
+    int             jit_loaded;
+    size_t          n_jit, cap_jit;
+    struct jit_sym *jit;        /* /tmp/perf-<pid>.map, sorted by start */
+    off_t           jit_off;    /* bytes of the map read so far */
+    ino_t           jit_ino;
 };
 
-static struct vma vmas[MAX_VMAS];
-static int n_vmas = 0;
+static struct proc_maps procs[MAX_PROCS];
+
+static struct proc_maps *proc_lookup(int pid)
+{
+    uint32_t h = (uint32_t)pid * 2654435761U;
+    for (int i = 0; i < MAX_PROCS; i++) {  /* linear probe */
+        struct proc_maps *p = &procs[(h + i) & (MAX_PROCS - 1)];
+        if (!p->used || p->pid == pid)
+            return p;
+    }
+    return NULL;  /* table full */
+}
+
+static void proc_claim(struct proc_maps *pm, int pid)
+{
+    pm->pid = pid;
+    pm->used = 1;
+    strcpy(pm->comm, "[unknown]");
+}
+
+static void jit_free(struct proc_maps *pm)
+{
+    for (size_t i = 0; i < pm->n_jit; i++)
+        free(pm->jit[i].name);
+    free(pm->jit);
+    pm->jit = NULL;
+    pm->n_jit = pm->cap_jit = 0;
+    pm->jit_off = 0;
+}
 
-/* ── Symbol cache (simple open-addressing hash map) ─────────── */
+static void proc_reset(struct proc_maps *pm)
+{
+    pm->n_vmas = 0;
+    jit_free(pm);
+    pm->jit_loaded = 0;
+    pm->gen++;
+}
 
-#define CACHE_SIZE 65536  /* must be power of 2 */
-#define CACHE_MASK (CACHE_SIZE - 1)
+static int vmas_reserve(struct proc_maps *pm, int n)
+{
+    if (n <= pm->cap_vmas)
+        return 0;
+    int cap = pm->cap_vmas ? pm->cap_vmas : 64;
+    while (cap < n) cap *= 2;
+    struct vma *p = realloc(pm->vmas, cap * sizeof(*p));
+    if (!p)
+        return -1;
+    pm->vmas = p;
+    pm->cap_vmas = cap;
+    return 0;
+}
+
+/* First VMA with end > addr */
+static int vma_search(const struct proc_maps *pm, uint64_t addr)
+{
+    int lo = 0, hi = pm->n_vmas;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (pm->vmas[mid].end <= addr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/* Insert [start, end), trimming or splitting whatever it overlaps —
+ * the same thing the kernel did to the address space. */
+static void vma_insert(struct proc_maps *pm, uint64_t start, uint64_t end,
+                       uint64_t offset, const char *path)
+{
+    if (start >= end || vmas_reserve(pm, pm->n_vmas + 2) < 0)
+        return;
+
+    int i = vma_search(pm, start);
+
+    /* Split a mapping that strictly contains the new one */
+    if (i < pm->n_vmas && pm->vmas[i].start < start && pm->vmas[i].end > end) {
+        memmove(&pm->vmas[i + 2], &pm->vmas[i], (pm->n_vmas - i) * sizeof(struct vma));
+        pm->vmas[i + 2].offset += end - pm->vmas[i + 2].start;
+        pm->vmas[i + 2].start = end;
+        pm->vmas[i].end = start;
+        pm->n_vmas += 2;
+        i++;
+    } else {
+        /* Trim the tail of a mapping starting before us */
+        if (i < pm->n_vmas && pm->vmas[i].start < start) {
+            pm->vmas[i].end = start;
+            i++;
+        }
+        /* Drop mappings we cover entirely, trim the head of the last one */
+        int j = i;
+        while (j < pm->n_vmas && pm->vmas[j].end <= end)
+            j++;
+        if (j < pm->n_vmas && pm->vmas[j].start < end) {
+            pm->vmas[j].offset += end - pm->vmas[j].start;
+            pm->vmas[j].start = end;
+        }
+        memmove(&pm->vmas[i + 1], &pm->vmas[j], (pm->n_vmas - j) * sizeof(struct vma));
+        pm->n_vmas += 1 - (j - i);
+    }
+
+    struct vma *v = &pm->vmas[i];
+    v->start = start;
+    v->end = end;
+    v->offset = offset;
+    v->dso = NULL;
+    snprintf(v->path, sizeof(v->path), "%s", path);
+}
+
+/* ── Symbol cache (growable open-addressing hash map) ───────── */
+
+#define CACHE_INIT_SIZE 65536  /* must be power of 2 */
 
 struct cache_entry {
     uint64_t addr;
-    char     name[256];
+    int      pid;
+    uint32_t gen;       /* the process's gen when resolved */
     int      valid;
+    int      retry;     /* JIT miss in a live process: its map may grow */
+    int      owned;     /* name is malloc'd (demangled, JIT), free on cleanup */
+    char    *name;
 };
 
-static struct cache_entry sym_cache[CACHE_SIZE];
+static struct cache_entry *sym_cache;
+static size_t cache_size = 0;
+static size_t cache_used = 0;
+
+static uint32_t cache_hash(int pid, uint64_t addr)
+{
+    return (uint32_t)(((addr ^ ((uint64_t)pid << 40)) * 0x9E3779B97F4A7C15ULL) >> 32);
+}
 
-static struct cache_entry *cache_lookup(uint64_t addr)
+/* Entries are never evicted: the table grows instead, and an entry
+ * made stale by a change to its process (gen) is resolved again in place. */
+static struct cache_entry *cache_lookup(int pid, uint64_t addr)
 {
-    uint32_t h = (uint32_t)(addr * 2654435761ULL) & CACHE_MASK;
-    for (int i = 0; i < 16; i++) {  /* linear probe, max 16 steps */
-        struct cache_entry *e = &sym_cache[(h + i) & CACHE_MASK];
+    size_t mask = cache_size - 1;
+    for (size_t i = cache_hash(pid, addr) & mask; ; i = (i + 1) & mask) {
+        struct cache_entry *e = &sym_cache[i];
         if (!e->valid)
             return e;  /* empty slot — caller can fill */
-        if (e->addr == addr)
+        if (e->addr == addr && e->pid == pid)
             return e;  /* found */
     }
-    return NULL;  /* cache full in this region */
+}
+
+static int cache_grow(void)
+{
+    size_t old_size = cache_size;
+    struct cache_entry *old = sym_cache;
+
+    cache_size = old_size ? old_size * 2 : CACHE_INIT_SIZE;
+    sym_cache = calloc(cache_size, sizeof(*sym_cache));
+    if (!sym_cache) {
+        sym_cache = old;
+        cache_size = old_size;
+        return -1;
+    }
+
+    for (size_t i = 0; i < old_size; i++)
+        if (old[i].valid)
+            *cache_lookup(old[i].pid, old[i].addr) = old[i];
+    free(old);
+    return 0;
 }
 
 /* ── Parse /proc/<pid>/maps ─────────────────────────────────── */
 
-int sym_init(int pid)
+static int load_proc_maps(struct proc_maps *pm)
 {
     char path[64];
-    snprintf(path, sizeof(path), "/proc/%d/maps", pid);
-
+    snprintf(path, sizeof(path), "/proc/%d/comm", pm->pid);
     FILE *f = fopen(path, "r");
-    if (!f) {
-        perror(path);
-        return -1;
+    if (f) {
+        if (fgets(pm->comm, sizeof(pm->comm), f))
+            pm->comm[strcspn(pm->comm, "\n")] = '\0';
+        fclose(f);
     }
 
-    n_vmas = 0;
-    memset(sym_cache, 0, sizeof(sym_cache));
+    snprintf(path, sizeof(path), "/proc/%d/maps", pm->pid);
+    f = fopen(path, "r");
+    if (!f)
+        return -1;
 
     char line[1024];
-    while (fgets(line, sizeof(line), f) && n_vmas < MAX_VMAS) {
-        struct vma *v = &vmas[n_vmas];
-        v->path[0] = '\0';
+    while (fgets(line, sizeof(line), f)) {
+        uint64_t start, end, offset;
+        char perms[5];
+        char file[512] = "";
 
         /* Format: start-end perms offset dev inode pathname */
         int n = sscanf(line, "%lx-%lx %4s %lx %*s %*s %511[^\n]",
-                       &v->start, &v->end, v->perms, &v->offset, v->path);
+                       &start, &end, perms, &offset, file);
 
         if (n >= 4) {
             /* Strip leading whitespace from path */
-            char *p = v->path;
+            char *p = file;
             while (*p == ' ') p++;
-            if (p != v->path)
-                memmove(v->path, p, strlen(p) + 1);
 
             /* Only keep executable mappings with file paths */
-            if (v->perms[2] == 'x' && v->path[0] == '/') {
-                n_vmas++;
-            }
+            if (perms[2] == 'x' && p[0] == '/')
+                vma_insert(pm, start, end, offset, p);
         }
     }
 
@@ -97,93 +280,875 @@ int sym_init(int pid)
     return 0;
 }
 
+int sym_init(int pid)
+{
+    struct proc_maps *pm = proc_lookup(pid);
+    if (!pm)
+        return -1;
+    if (pm->used)
+        return 0;
+
+    /* Claim the slot even on failure so a vanished PID is not retried
+     * for every one of its samples. */
+    proc_claim(pm, pid);
+    return load_proc_maps(pm);
+}
+
+const char *sym_comm(int pid)
+{
+    struct proc_maps *pm = proc_lookup(pid);
+    return (pm && pm->used) ? pm->comm : "[unknown]";
+}
+
+/* ── Address-space events ───────────────────────────────────── */
+
+static void load_perf_map(struct proc_maps *pm);
+
+void sym_add_mapping(int pid, uint64_t start, uint64_t len, uint64_t pgoff,
+                     const char *path)
+{
+    struct proc_maps *pm = proc_lookup(pid);
+    if (!pm)
+        return;
+    if (!pm->used) {
+        sym_init(pid);  /* seed with what already existed */
+    } else if (pm->exited) {
+        /* A recycled PID whose FORK we did not see */
+        proc_reset(pm);
+        pm->exited = 0;
+        load_proc_maps(pm);
+    }
+
+    /* Anonymous (JIT) code, reported as "//anon", is covered by
+     * perf-<pid>.map instead */
+    if (path[0] == '/' && path[1] != '/')
+        vma_insert(pm, start, start + len, pgoff, path);
+}
+
+void sym_set_comm(int pid, const char *comm, int exec)
+{
+    struct proc_maps *pm = proc_lookup(pid);
+    if (!pm)
+        return;
+
+    if (!pm->used) {
+        /* A process we have not seen yet: after exec, MMAP2 records for
+         * the new image follow, so /proc/<pid>/maps is not needed. */
+        proc_claim(pm, pid);
+        if (!exec)
+            load_proc_maps(pm);
+    } else if (exec || pm->exited) {
+        proc_reset(pm);  /* new image, old mappings are gone */
+        if (pm->exited && !exec)
+            load_proc_maps(pm);
+        pm->exited = 0;
+    }
+    snprintf(pm->comm, sizeof(pm->comm), "%s", comm);
+}
+
+void sym_fork(int pid, int ppid)
+{
+    struct proc_maps *child = proc_lookup(pid);
+    struct proc_maps *parent = proc_lookup(ppid);
+    if (!child || !parent || !parent->used || child == parent)
+        return;
+
+    /* Fresh process, or a recycled PID: start from the parent's image */
+    if (!child->used)
+        proc_claim(child, pid);
+    proc_reset(child);
+    child->exited = 0;
+    if (vmas_reserve(child, parent->n_vmas) == 0) {
+        memcpy(child->vmas, parent->vmas, parent->n_vmas * sizeof(struct vma));
+        child->n_vmas = parent->n_vmas;
+    }
+    memcpy(child->comm, parent->comm, sizeof(child->comm));
+}
+
+void sym_exit(int pid)
+{
+    /* Keep the tables: stacks are symbolized after the process is gone.
+     * Take the rest of the JIT map now, before a recycled PID can
+     * overwrite it; it is not re-read after this. */
+    struct proc_maps *pm = proc_lookup(pid);
+    if (pm && pm->used && !pm->exited) {
+        load_perf_map(pm);
+        pm->exited = 1;
+    }
+}
+
+void sym_flush_exited(void)
+{
+    for (int i = 0; i < MAX_PROCS; i++) {
+        struct proc_maps *pm = &procs[i];
+        if (!pm->used || !pm->exited)
+            continue;
+        /* The slot stays claimed so linear probing still finds others */
+        proc_reset(pm);
+        free(pm->vmas);
+        pm->vmas = NULL;
+        pm->cap_vmas = 0;
+    }
+}
+
 /* ── Find VMA for address ───────────────────────────────────── */
 
-static const struct vma *find_vma(uint64_t addr)
+static struct vma *find_vma(int pid, uint64_t addr)
 {
-    for (int i = 0; i < n_vmas; i++) {
-        if (addr >= vmas[i].start && addr < vmas[i].end)
-            return &vmas[i];
+    struct proc_maps *pm = proc_lookup(pid);
+    if (!pm || !pm->used)
+        return NULL;
+
+    int i = vma_search(pm, addr);
+    if (i < pm->n_vmas && pm->vmas[i].start <= addr)
+        return &pm->vmas[i];
+    return NULL;
+}
+
+/* ── JIT perf maps (/tmp/perf-<pid>.map) ─────────────────────── */
+
+static int cmp_jit_sym(const void *a, const void *b)
+{
+    const struct jit_sym *x = a, *y = b;
+    return x->start < y->start ? -1 : x->start > y->start;
+}
+
+/* Format (one per line, hex): START SIZE symbol name. JITs append as
+ * they compile, so each call reads only the complete lines added since
+ * the last one; a file that shrank or was replaced is read afresh. */
+static void load_perf_map(struct proc_maps *pm)
+{
+    pm->jit_loaded = 1;
+
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/perf-%d.map", pm->pid);
+    struct stat st;
+    if (stat(path, &st) < 0)
+        return;
+    if (st.st_ino != pm->jit_ino || st.st_size < pm->jit_off) {
+        jit_free(pm);
+        pm->jit_ino = st.st_ino;
+        pm->gen++;
+    }
+    if (st.st_size == pm->jit_off)
+        return;
+
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return;
+    if (fseeko(f, pm->jit_off, SEEK_SET) < 0) {
+        fclose(f);
+        return;
     }
+
+    size_t n_before = pm->n_jit;
+    char *line = NULL;
+    size_t line_cap = 0;
+    ssize_t len;
+    while ((len = getline(&line, &line_cap, f)) > 0) {
+        if (line[len - 1] != '\n')
+            break;      /* still being written; read it next time */
+        pm->jit_off += len;
+
+        uint64_t start, size;
+        char name[768];
+        if (sscanf(line, "%lx %lx %767[^\n]", &start, &size, name) != 3)
+            continue;
+
+        if (pm->n_jit == pm->cap_jit) {
+            size_t cap = pm->cap_jit ? pm->cap_jit * 2 : 256;
+            struct jit_sym *p = realloc(pm->jit, cap * sizeof(*p));
+            if (!p)
+                break;
+            pm->jit = p;
+            pm->cap_jit = cap;
+        }
+        struct jit_sym *js = &pm->jit[pm->n_jit];
+        js->start = start;
+        js->end = start + size;
+        js->name = strdup(name);
+        if (js->name)
+            pm->n_jit++;
+    }
+    free(line);
+    fclose(f);
+
+    if (pm->n_jit == n_before)
+        return;
+    /* The newest entry for a range wins */
+    qsort(pm->jit, pm->n_jit, sizeof(*pm->jit), cmp_jit_sym);
+    pm->gen++;
+}
+
+static const char *jit_search(const struct proc_maps *pm, uint64_t addr)
+{
+    size_t lo = 0, hi = pm->n_jit;
+    while (lo < hi) {  /* last entry with start <= addr */
+        size_t mid = lo + (hi - lo) / 2;
+        if (pm->jit[mid].start <= addr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo > 0 && addr < pm->jit[lo - 1].end)
+        return pm->jit[lo - 1].name;
     return NULL;
 }
 
-/* ── Resolve via addr2line ──────────────────────────────────── */
+static const char *resolve_via_perf_map(int pid, uint64_t addr)
+{
+    struct proc_maps *pm = proc_lookup(pid);
+    if (!pm || !pm->used)
+        return NULL;
+    if (!pm->jit_loaded)
+        load_perf_map(pm);
+
+    const char *name = jit_search(pm, addr);
+    if (!name && !pm->exited) {
+        /* Compiled since the map was last read? */
+        uint32_t gen = pm->gen;
+        load_perf_map(pm);
+        if (pm->gen != gen)
+            name = jit_search(pm, addr);
+    }
+    return name;
+}
 
-static const char *resolve_via_addr2line(uint64_t addr, const struct vma *v)
+static uint32_t proc_gen(int pid)
 {
-    /* Compute offset within the file */
-    uint64_t file_offset = addr - v->start + v->offset;
+    struct proc_maps *pm = proc_lookup(pid);
+    return pm && pm->used ? pm->gen : 0;
+}
 
-    char cmd[1024];
-    snprintf(cmd, sizeof(cmd), "addr2line -f -e '%s' 0x%lx 2>/dev/null",
-             v->path, file_offset);
+static int proc_running(int pid)
+{
+    struct proc_maps *pm = proc_lookup(pid);
+    return pm && pm->used && !pm->exited;
+}
 
-    FILE *p = popen(cmd, "r");
-    if (!p)
+/* ── Kernel symbols (/proc/kallsyms) ────────────────────────── */
+
+#define KERNEL_START 0xffff800000000000ULL
+
+static struct jit_sym *ksyms;
+static size_t n_ksyms = 0;
+static int ksyms_loaded = 0;
+
+/* Text symbols only; each ends where the next begins. Names get the
+ * "_[k]" suffix flame graph tools use to colour kernel frames. With
+ * kptr_restrict every address reads as 0 and the table stays empty. */
+static void load_kallsyms(void)
+{
+    ksyms_loaded = 1;
+
+    FILE *f = fopen("/proc/kallsyms", "r");
+    if (!f)
+        return;
+
+    size_t cap = 0;
+    char line[512];
+    while (fgets(line, sizeof(line), f)) {
+        uint64_t start;
+        char type, name[256];
+        if (sscanf(line, "%lx %c %255s", &start, &type, name) != 3)
+            continue;
+        if (start == 0 || (type != 't' && type != 'T' && type != 'w' && type != 'W'))
+            continue;
+
+        if (n_ksyms == cap) {
+            cap = cap ? cap * 2 : 65536;
+            struct jit_sym *p = realloc(ksyms, cap * sizeof(*p));
+            if (!p)
+                break;
+            ksyms = p;
+        }
+        char buf[272];
+        snprintf(buf, sizeof(buf), "%s_[k]", name);
+        ksyms[n_ksyms].start = start;
+        ksyms[n_ksyms].name = strdup(buf);
+        if (ksyms[n_ksyms].name)
+            n_ksyms++;
+    }
+    fclose(f);
+
+    qsort(ksyms, n_ksyms, sizeof(*ksyms), cmp_jit_sym);
+    for (size_t i = 0; i < n_ksyms; i++)
+        ksyms[i].end = (i + 1 < n_ksyms) ? ksyms[i + 1].start : UINT64_MAX;
+}
+
+static const char *resolve_kernel(uint64_t addr)
+{
+    if (!ksyms_loaded)
+        load_kallsyms();
+
+    size_t lo = 0, hi = n_ksyms;
+    while (lo < hi) {  /* last entry with start <= addr */
+        size_t mid = lo + (hi - lo) / 2;
+        if (ksyms[mid].start <= addr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo > 0 && addr < ksyms[lo - 1].end)
+        return ksyms[lo - 1].name;
+    return "[kernel]";
+}
+
+/* ── ELF symbol tables ──────────────────────────────────────── */
+
+struct elf_sym {
+    uint64_t    addr;
+    uint64_t    size;
+    const char *name;   /* points into the mmap'd string table */
+};
+
+struct dso {
+    char            path[512];
+    void           *map;        /* the DSO itself (program headers) */
+    size_t          map_size;
+    void           *dbg_map;    /* separate debug file, if its symtab is used */
+    size_t          dbg_size;
+    struct elf_sym *syms;       /* sorted by addr */
+    size_t          n_syms;
+    struct elf_sym *dsyms;      /* data objects, for sym_resolve_data */
+    size_t          n_dsyms;
+    int             dsyms_loaded;
+};
+
+static struct dso **dsos;
+static int n_dsos = 0;
+static int cap_dsos = 0;
+
+static void *map_file(const char *path, size_t *size)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
         return NULL;
 
-    char func[256] = {0};
-    if (fgets(func, sizeof(func), p)) {
-        /* Remove trailing newline */
-        func[strcspn(func, "\n")] = '\0';
+    struct stat st;
+    void *p = NULL;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+        st.st_size >= (off_t)sizeof(Elf64_Ehdr)) {
+        p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED)
+            p = NULL;
+        else
+            *size = st.st_size;
+    }
+    close(fd);
+
+    if (p) {
+        const Elf64_Ehdr *eh = p;
+        if (memcmp(eh->e_ident, ELFMAG, SELFMAG) != 0 ||
+            eh->e_ident[EI_CLASS] != ELFCLASS64) {
+            munmap(p, *size);
+            p = NULL;
+        }
     }
+    return p;
+}
+
+/* Section headers, bounds-checked. Returns NULL if absent or truncated. */
+static const Elf64_Shdr *elf_shdrs(const void *map, size_t size)
+{
+    const Elf64_Ehdr *eh = map;
+    if (eh->e_shoff == 0 || eh->e_shentsize != sizeof(Elf64_Shdr) ||
+        eh->e_shoff + (uint64_t)eh->e_shnum * sizeof(Elf64_Shdr) > size)
+        return NULL;
+    return (const Elf64_Shdr *)((const char *)map + eh->e_shoff);
+}
 
-    pclose(p);
+static const Elf64_Shdr *elf_section(const void *map, size_t size, const char *name)
+{
+    const Elf64_Ehdr *eh = map;
+    const Elf64_Shdr *sh = elf_shdrs(map, size);
+    if (!sh || eh->e_shstrndx >= eh->e_shnum)
+        return NULL;
 
-    if (func[0] && strcmp(func, "??") != 0)
-        return strdup(func);
+    const Elf64_Shdr *strsec = &sh[eh->e_shstrndx];
+    if (strsec->sh_offset + strsec->sh_size > size)
+        return NULL;
+    const char *names = (const char *)map + strsec->sh_offset;
 
+    for (int i = 0; i < eh->e_shnum; i++) {
+        if (sh[i].sh_name < strsec->sh_size &&
+            strcmp(names + sh[i].sh_name, name) == 0)
+            return &sh[i];
+    }
     return NULL;
 }
 
-/* ── Public API ─────────────────────────────────────────────── */
+static int elf_has_symtab(const void *map, size_t size)
+{
+    const Elf64_Ehdr *eh = map;
+    const Elf64_Shdr *sh = elf_shdrs(map, size);
+    for (int i = 0; sh && i < eh->e_shnum; i++)
+        if (sh[i].sh_type == SHT_SYMTAB)
+            return 1;
+    return 0;
+}
 
-const char *sym_resolve(uint64_t addr)
+/* Append FUNC (or, with `data`, OBJECT) symbols from every
+ * .symtab/.dynsym section in `map`. */
+static void elf_collect(struct elf_sym **out, size_t *n_out, const void *map,
+                        size_t size, int data)
 {
-    if (addr == 0)
-        return "[null]";
+    const Elf64_Ehdr *eh = map;
+    const Elf64_Shdr *sh = elf_shdrs(map, size);
+    if (!sh)
+        return;
 
-    /* Check cache first */
-    struct cache_entry *ce = cache_lookup(addr);
-    if (ce && ce->valid && ce->addr == addr)
-        return ce->name;
+    for (int i = 0; i < eh->e_shnum; i++) {
+        if (sh[i].sh_type != SHT_SYMTAB && sh[i].sh_type != SHT_DYNSYM)
+            continue;
+        if (sh[i].sh_link >= eh->e_shnum ||
+            sh[i].sh_offset + sh[i].sh_size > size)
+            continue;
 
-    /* Find VMA */
-    const struct vma *v = find_vma(addr);
-    const char *name = NULL;
+        const Elf64_Shdr *strsec = &sh[sh[i].sh_link];
+        if (strsec->sh_offset + strsec->sh_size > size)
+            continue;
+
+        const Elf64_Sym *syms = (const Elf64_Sym *)((const char *)map + sh[i].sh_offset);
+        size_t n = sh[i].sh_size / sizeof(Elf64_Sym);
+        const char *strs = (const char *)map + strsec->sh_offset;
+
+        struct elf_sym *grown = realloc(*out, (*n_out + n) * sizeof(*grown));
+        if (!grown)
+            return;
+        *out = grown;
+
+        for (size_t j = 0; j < n; j++) {
+            int type = ELF64_ST_TYPE(syms[j].st_info);
+            int want = data ? type == STT_OBJECT
+                            : type == STT_FUNC || type == STT_GNU_IFUNC;
+            if (!want || syms[j].st_shndx == SHN_UNDEF || syms[j].st_value == 0 ||
+                syms[j].st_name >= strsec->sh_size)
+                continue;
 
-    if (v) {
-        name = resolve_via_addr2line(addr, v);
+            struct elf_sym *es = &(*out)[(*n_out)++];
+            es->addr = syms[j].st_value;
+            es->size = syms[j].st_size;
+            es->name = strs + syms[j].st_name;
+        }
     }
+}
+
+static void elf_collect_syms(struct dso *d, const void *map, size_t size)
+{
+    elf_collect(&d->syms, &d->n_syms, map, size, 0);
+}
 
-    if (!name) {
-        /* Try kernel addresses (above 0xffff...) */
-        if (addr >= 0xffff000000000000ULL)
-            name = "[kernel]";
+static int cmp_elf_sym(const void *a, const void *b)
+{
+    const struct elf_sym *x = a, *y = b;
+    if (x->addr != y->addr)
+        return x->addr < y->addr ? -1 : 1;
+    /* Among aliases, prefer the sized one */
+    return (y->size > 0) - (x->size > 0);
+}
+
+/* Sort, drop aliases (.symtab and .dynsym overlap), and give zero-sized
+ * symbols the gap up to the next symbol. */
+static void finish_syms(struct elf_sym *syms, size_t *n_syms)
+{
+    if (*n_syms == 0)
+        return;
+
+    qsort(syms, *n_syms, sizeof(*syms), cmp_elf_sym);
+
+    size_t w = 0;
+    for (size_t i = 1; i < *n_syms; i++) {
+        if (syms[i].addr != syms[w].addr)
+            syms[++w] = syms[i];
+    }
+    *n_syms = w + 1;
+
+    for (size_t i = 0; i + 1 < *n_syms; i++) {
+        if (syms[i].size == 0)
+            syms[i].size = syms[i + 1].addr - syms[i].addr;
+    }
+}
+
+static void dso_finish_syms(struct dso *d)
+{
+    finish_syms(d->syms, &d->n_syms);
+}
+
+/* Look for a separate debug file: build-id first, then .gnu_debuglink. */
+static void *dso_open_debug(const struct dso *d, size_t *size)
+{
+    char path[1024];
+
+    const Elf64_Shdr *note = elf_section(d->map, d->map_size, ".note.gnu.build-id");
+    if (note && note->sh_offset + note->sh_size <= d->map_size &&
+        note->sh_size > sizeof(Elf64_Nhdr) + 4) {
+        const Elf64_Nhdr *nh = (const Elf64_Nhdr *)((const char *)d->map + note->sh_offset);
+        const unsigned char *id = (const unsigned char *)(nh + 1) + ((nh->n_namesz + 3) & ~3u);
+        if (nh->n_type == NT_GNU_BUILD_ID && nh->n_descsz > 1 &&
+            (const char *)id + nh->n_descsz <= (const char *)d->map + note->sh_offset + note->sh_size) {
+            int pos = snprintf(path, sizeof(path), "/usr/lib/debug/.build-id/%02x/", id[0]);
+            for (unsigned i = 1; i < nh->n_descsz && pos < (int)sizeof(path) - 8; i++)
+                pos += snprintf(path + pos, sizeof(path) - pos, "%02x", id[i]);
+            snprintf(path + pos, sizeof(path) - pos, ".debug");
+
+            void *p = map_file(path, size);
+            if (p)
+                return p;
+        }
+    }
+
+    const Elf64_Shdr *link = elf_section(d->map, d->map_size, ".gnu_debuglink");
+    if (link && link->sh_offset + link->sh_size <= d->map_size && link->sh_size > 0) {
+        const char *name = (const char *)d->map + link->sh_offset;
+        if (strnlen(name, link->sh_size) == link->sh_size)
+            return NULL;
+
+        char dir[512];
+        snprintf(dir, sizeof(dir), "%s", d->path);
+        char *slash = strrchr(dir, '/');
+        if (slash) *slash = '\0';
+
+        const char *fmts[] = { "%s/%s", "%s/.debug/%s", "/usr/lib/debug%s/%s" };
+        for (size_t i = 0; i < sizeof(fmts) / sizeof(fmts[0]); i++) {
+            snprintf(path, sizeof(path), fmts[i], dir, name);
+            if (strcmp(path, d->path) == 0)
+                continue;
+            void *p = map_file(path, size);
+            if (p)
+                return p;
+        }
+    }
+    return NULL;
+}
+
+static struct dso *dso_load(const char *path, int pid)
+{
+    struct dso *d = calloc(1, sizeof(*d));
+    if (!d)
+        return NULL;
+    snprintf(d->path, sizeof(d->path), "%s", path);
+
+    d->map = map_file(path, &d->map_size);
+    if (!d->map) {
+        /* Target may live in another mount namespace (containers) */
+        char alt[600];
+        snprintf(alt, sizeof(alt), "/proc/%d/root%s", pid, path);
+        d->map = map_file(alt, &d->map_size);
+    }
+    if (!d->map)
+        return d;  /* keep the negative entry so we don't retry */
+
+    /* Stripped binaries keep only .dynsym; a debug file has the full table */
+    if (!elf_has_symtab(d->map, d->map_size)) {
+        d->dbg_map = dso_open_debug(d, &d->dbg_size);
+        if (d->dbg_map)
+            elf_collect_syms(d, d->dbg_map, d->dbg_size);
+    }
+    elf_collect_syms(d, d->map, d->map_size);
+    dso_finish_syms(d);
+    return d;
+}
+
+static struct dso *dso_find(const char *path, int pid)
+{
+    for (int i = 0; i < n_dsos; i++)
+        if (strcmp(dsos[i]->path, path) == 0)
+            return dsos[i];
+
+    if (n_dsos == cap_dsos) {
+        int cap = cap_dsos ? cap_dsos * 2 : 64;
+        struct dso **p = realloc(dsos, cap * sizeof(*p));
+        if (!p)
+            return NULL;
+        dsos = p;
+        cap_dsos = cap;
+    }
+
+    struct dso *d = dso_load(path, pid);
+    if (d)
+        dsos[n_dsos++] = d;
+    return d;
+}
+
+/* File offset → ELF virtual address via the PT_LOAD program headers */
+static int dso_offset_to_vaddr(const struct dso *d, uint64_t off, uint64_t *vaddr)
+{
+    const Elf64_Ehdr *eh = d->map;
+    if (eh->e_phoff + (uint64_t)eh->e_phnum * sizeof(Elf64_Phdr) > d->map_size)
+        return -1;
+
+    const Elf64_Phdr *ph = (const Elf64_Phdr *)((const char *)d->map + eh->e_phoff);
+    for (int i = 0; i < eh->e_phnum; i++) {
+        if (ph[i].p_type == PT_LOAD &&
+            off >= ph[i].p_offset && off < ph[i].p_offset + ph[i].p_filesz) {
+            *vaddr = off - ph[i].p_offset + ph[i].p_vaddr;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static const struct elf_sym *syms_lookup(const struct elf_sym *syms, size_t n,
+                                         uint64_t vaddr)
+{
+    size_t lo = 0, hi = n;
+    while (lo < hi) {  /* last symbol with addr <= vaddr */
+        size_t mid = lo + (hi - lo) / 2;
+        if (syms[mid].addr <= vaddr)
+            lo = mid + 1;
         else
-            name = "[unknown]";
+            hi = mid;
+    }
+    if (lo == 0)
+        return NULL;
+
+    const struct elf_sym *es = &syms[lo - 1];
+    /* A zero size only survives on the last symbol: accept it */
+    if (es->size && vaddr >= es->addr + es->size)
+        return NULL;
+    return es;
+}
+
+static const char *dso_resolve(const struct dso *d, uint64_t vaddr)
+{
+    const struct elf_sym *es = syms_lookup(d->syms, d->n_syms, vaddr);
+    return es ? es->name : NULL;
+}
+
+static void dso_free(struct dso *d)
+{
+    if (d->map) munmap(d->map, d->map_size);
+    if (d->dbg_map) munmap(d->dbg_map, d->dbg_size);
+    free(d->syms);
+    free(d->dsyms);
+    free(d);
+}
+
+static const char *resolve_via_elf(int pid, uint64_t addr, struct vma *v)
+{
+    if (!v->dso)
+        v->dso = dso_find(v->path, pid);
+    if (!v->dso || !v->dso->map)
+        return NULL;
+
+    uint64_t vaddr;
+    if (dso_offset_to_vaddr(v->dso, addr - v->start + v->offset, &vaddr) < 0)
+        return NULL;
+    return dso_resolve(v->dso, vaddr);
+}
+
+/* ── Data addresses ─────────────────────────────────────────── */
+
+/*
+ * The VMA tables only hold executable mappings, so data addresses are
+ * looked up in a fresh read of /proc/<pid>/maps. That is slow, but it is
+ * only done for the handful of addresses a report prints. An anonymous
+ * mapping right after a file's mappings is that file's .bss.
+ */
+
+static void dso_load_dsyms(struct dso *d)
+{
+    d->dsyms_loaded = 1;
+    if (d->dbg_map)
+        elf_collect(&d->dsyms, &d->n_dsyms, d->dbg_map, d->dbg_size, 1);
+    elf_collect(&d->dsyms, &d->n_dsyms, d->map, d->map_size, 1);
+    finish_syms(d->dsyms, &d->n_dsyms);
+}
+
+/* Link-time address of the first PT_LOAD, subtracted to get the bias */
+static uint64_t dso_first_vaddr(const struct dso *d)
+{
+    const Elf64_Ehdr *eh = d->map;
+    if (eh->e_phoff + (uint64_t)eh->e_phnum * sizeof(Elf64_Phdr) > d->map_size)
+        return 0;
+
+    const Elf64_Phdr *ph = (const Elf64_Phdr *)((const char *)d->map + eh->e_phoff);
+    for (int i = 0; i < eh->e_phnum; i++)
+        if (ph[i].p_type == PT_LOAD)
+            return ph[i].p_vaddr & ~(uint64_t)0xfff;
+    return 0;
+}
+
+const char *sym_resolve_data(int pid, uint64_t addr, char *buf, size_t len)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/maps", pid);
+    FILE *f = fopen(path, "r");
+    snprintf(buf, len, "[unknown]");
+    if (!f)
+        return buf;
+
+    char line[1024], owner[512] = "";
+    uint64_t base = 0;
+    while (fgets(line, sizeof(line), f)) {
+        uint64_t start, end, offset;
+        char file[512] = "";
+        if (sscanf(line, "%lx-%lx %*4s %lx %*s %*s %511[^\n]",
+                   &start, &end, &offset, file) < 3)
+            continue;
+        char *p = file;
+        while (*p == ' ') p++;
+
+        /* Remember the file whose mappings we are in, and its load base */
+        if (p[0] == '/') {
+            if (strcmp(p, owner) != 0) {
+                snprintf(owner, sizeof(owner), "%s", p);
+                base = start - offset;
+            }
+        } else if (p[0]) {
+            owner[0] = '\0';
+        }
+
+        if (addr < start || addr >= end)
+            continue;
+
+        if (p[0] && p[0] != '/') {
+            snprintf(buf, len, "%s", p);            /* [heap], [stack], ... */
+        } else if (owner[0]) {
+            struct dso *d = dso_find(owner, pid);
+            const struct elf_sym *es = NULL;
+            uint64_t vaddr = 0;
+            if (d && d->map) {
+                if (!d->dsyms_loaded)
+                    dso_load_dsyms(d);
+                vaddr = addr - base + dso_first_vaddr(d);
+                es = syms_lookup(d->dsyms, d->n_dsyms, vaddr);
+            }
+            const char *slash = strrchr(owner, '/');
+            if (es)
+                snprintf(buf, len, "%s+0x%lx", es->name, (unsigned long)(vaddr - es->addr));
+            else
+                snprintf(buf, len, "%s+0x%lx", slash ? slash + 1 : owner,
+                         (unsigned long)(addr - base));
+        } else {
+            snprintf(buf, len, "[anon]");
+        }
+        break;
     }
+    fclose(f);
+    return buf;
+}
+
+/* ── C++ demangling (optional, via libstdc++ loaded on demand) ─ */
+
+typedef char *(*cxa_demangle_fn)(const char *, char *, size_t *, int *);
+
+static cxa_demangle_fn cxa_demangle;
+static void *libstdcxx;
+
+void sym_set_demangle(int enable)
+{
+    if (!enable || cxa_demangle)
+        return;
+    libstdcxx = dlopen("libstdc++.so.6", RTLD_LAZY | RTLD_LOCAL);
+    if (libstdcxx)
+        cxa_demangle = (cxa_demangle_fn)dlsym(libstdcxx, "__cxa_demangle");
+    if (!cxa_demangle)
+        fprintf(stderr, "symbols: libstdc++ not found, C++ names stay mangled\n");
+}
+
+static char *demangle(const char *name)
+{
+    if (!cxa_demangle || name[0] != '_' || name[1] != 'Z')
+        return NULL;
+    int status;
+    char *out = cxa_demangle(name, NULL, NULL, &status);
+    return status == 0 ? out : NULL;
+}
 
-    /* Store in cache */
-    if (ce) {
-        ce->addr = addr;
-        strncpy(ce->name, name, sizeof(ce->name) - 1);
-        ce->name[sizeof(ce->name) - 1] = '\0';
-        ce->valid = 1;
+/* ── Public API ─────────────────────────────────────────────── */
+
+const char *sym_resolve(int pid, uint64_t addr)
+{
+    if (addr == 0)
+        return "[null]";
 
-        /* Free if we strdup'd */
-        if (name != ce->name && name[0] != '[')
-            free((void *)name);
+    /* Check cache first (keep load factor <= 1/2) */
+    if (cache_used * 2 >= cache_size && cache_grow() < 0 && cache_used >= cache_size)
+        return "[unknown]";
 
+    struct cache_entry *ce = cache_lookup(pid, addr);
+    if (ce->valid && ce->gen == proc_gen(pid) && !ce->retry)
         return ce->name;
+    if (ce->valid && ce->owned)
+        free(ce->name);
+
+    const char *name = NULL;
+    int owned = 0, retry = 0;
+
+    if (addr >= KERNEL_START) {
+        name = resolve_kernel(addr);
+    } else {
+        /* Find VMA */
+        struct vma *v = find_vma(pid, addr);
+        int jit = 0;
+        if (v) {
+            name = resolve_via_elf(pid, addr, v);
+        } else {
+            name = resolve_via_perf_map(pid, addr);
+            jit = name != NULL;
+            retry = !jit && proc_running(pid);
+        }
+
+        char *dm = name ? demangle(name) : NULL;
+        if (dm) {
+            name = dm;
+            owned = 1;
+        } else if (jit) {
+            /* The JIT table is freed when the process is reset */
+            name = strdup(name);
+            owned = name != NULL;
+        }
+        if (!name)
+            name = "[unknown]";
     }
 
-    return name;
+    /* Store in cache; names point into mmap'd string tables or static
+     * placeholders, except demangled and JIT ones which we own */
+    if (!ce->valid)
+        cache_used++;
+    ce->addr = addr;
+    ce->pid = pid;
+    ce->gen = proc_gen(pid);
+    ce->name = (char *)name;
+    ce->owned = owned;
+    ce->valid = 1;
+    ce->retry = retry;
+
+    return ce->name;
 }
 
 void sym_cleanup(void)
 {
-    n_vmas = 0;
-    memset(sym_cache, 0, sizeof(sym_cache));
+    for (int i = 0; i < MAX_PROCS; i++) {
+        proc_reset(&procs[i]);
+        free(procs[i].vmas);
+    }
+    memset(procs, 0, sizeof(procs));
+
+    for (size_t i = 0; i < cache_size; i++)
+        if (sym_cache[i].valid && sym_cache[i].owned)
+            free(sym_cache[i].name);
+    free(sym_cache);
+    sym_cache = NULL;
+    cache_size = cache_used = 0;
+
+    for (int i = 0; i < n_dsos; i++)
+        dso_free(dsos[i]);
+    free(dsos);
+    dsos = NULL;
+    n_dsos = cap_dsos = 0;
+
+    for (size_t i = 0; i < n_ksyms; i++)
+        free(ksyms[i].name);
+    free(ksyms);
+    ksyms = NULL;
+    n_ksyms = 0;
+    ksyms_loaded = 0;
+
+    if (libstdcxx)
+        dlclose(libstdcxx);
+    libstdcxx = NULL;
+    cxa_demangle = NULL;
 }
@@ -1,22 +1,55 @@
 /*
  * symbols.h — Symbol resolution for external process profiling
  *
- * Parses /proc/<pid>/maps and uses addr2line for address-to-symbol mapping.
+ * Parses /proc/<pid>/maps and the ELF symbol tables of each mapped DSO
+ * (in-process, no addr2line) for address-to-symbol mapping. JIT code is
+ * resolved through /tmp/perf-<pid>.map.
  */
 #ifndef SYMBOLS_H
 #define SYMBOLS_H
 
+#include <stddef.h>
 #include <stdint.h>
 
-/* Initialize the symbol resolver for a given PID.
- * Parses /proc/<pid>/maps to build the VMA table.
+/* Load the VMA table for a given PID.
+ * Parses /proc/<pid>/maps once; later calls for the same PID are no-ops,
+ * so it is safe to call for every PID seen in a system-wide profile.
  * Returns 0 on success, -1 on failure. */
 int sym_init(int pid);
 
-/* Resolve a virtual address to a function name.
+/* Resolve a virtual address in process `pid` to a function name.
  * Returns a pointer to a static/cached string (do not free).
  * Returns "[unknown]" if resolution fails. */
-const char *sym_resolve(uint64_t addr);
+const char *sym_resolve(int pid, uint64_t addr);
+
+/* Resolve a data address in process `pid`: "symbol+0xoff" for globals
+ * and statics of a mapped ELF file, "file+0xoff" without symbols, or the
+ * mapping name ("[heap]", "[stack]", "[anon]"). Re-reads
+ * /proc/<pid>/maps on every call, so the process must still be running.
+ * Writes into buf and returns it. */
+const char *sym_resolve_data(int pid, uint64_t addr, char *buf, size_t len);
+
+/* Keep a process's address space current while profiling. Feed these
+ * from PERF_RECORD_MMAP2 / COMM / FORK / EXIT so libraries loaded after
+ * sym_init still resolve. `exec` is set for COMM records caused by exec,
+ * which replace the whole image. Tables survive exit for symbolization. */
+void sym_add_mapping(int pid, uint64_t start, uint64_t len, uint64_t pgoff,
+                     const char *path);
+void sym_set_comm(int pid, const char *comm, int exec);
+void sym_fork(int pid, int ppid);
+void sym_exit(int pid);
+
+/* Drop the tables of processes that have exited, once no stack still
+ * to be symbolized refers to them (after each --rotate interval). A
+ * /tmp/perf-<pid>.map is re-read when a lookup misses and it has grown. */
+void sym_flush_exited(void);
+
+/* Enable C++ demangling of resolved names (needs libstdc++ at runtime).
+ * Call before the first sym_resolve. */
+void sym_set_demangle(int enable);
+
+/* Command name of a process loaded by sym_init ("[unknown]" if not). */
+const char *sym_comm(int pid);
 
 /* Free all resources used by the symbol resolver. */
 void sym_cleanup(void);
@@ -9,6 +9,7 @@
  * actually touches the cache line (not optimized to a register).
  */
 #include "common.h"
+#include "topology.h"
 
 /* ── Packed: both counters on the SAME cache line ────────────── */
 struct packed_counters {
@@ -79,10 +80,11 @@ int main(void)
     long iterations = get_iterations();
     int ncores = get_num_cores();
 
-    /* Pick two cores that are far apart (0 and ncores/2) to maximize
-       the chance they're on different physical cores / CCXs. */
-    int core_a = 0;
-    int core_b = ncores / 2;
+    /* First two CPUs of the placement (PLACEMENT=core by default: two
+       physical cores of one socket, never SMT siblings) */
+    topo_place_env();
+    int core_a = topo_cpu_for(0);
+    int core_b = topo_cpu_for(1);
 
     printf("Cache-Line False Sharing Demonstrator\n");
     print_separator();
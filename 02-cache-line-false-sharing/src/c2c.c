@@ -0,0 +1,711 @@
+/*
+ * c2c.c — Cache-line contention detector (a small `perf c2c`)
+ *
+ * Attaches to a running process (or the whole system) and samples
+ * memory loads and stores with precise mem-load/mem-store events
+ * (PERF_SAMPLE_ADDR + PERF_SAMPLE_DATA_SRC). Samples are grouped by
+ * 64-byte cache line; the lines with the most HITM (load hit a line
+ * Modified in another core's cache) and remote-cache hits are reported
+ * with the offsets inside the line, the code that touched them, and the
+ * global/static the line belongs to.
+ *
+ * Usage:
+ *   bin/patterns array_counters & sudo bin/c2c -p $! -d 5
+ *   sudo bin/c2c -a -d 10 -n 20        # system-wide, top 20 lines
+ *
+ * Two offsets of one line written from several CPUs, with HITM on the
+ * loads, is false sharing; the data column names the struct to pad.
+ *
+ * Needs a PMU with load-latency sampling: Intel (mem-loads/mem-stores,
+ * including hybrid cpu_core) or AMD IBS (ibs_op). Most VMs do not
+ * expose one.
+ */
+#include "common.h"
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <dirent.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "symbols.h"    /* from 01-flame-graph-generator */
+
+#define RING_PAGES      64      /* data pages per ring, power of 2 */
+#define MAX_RINGS       1024
+#define MAX_ACCESSES    32      /* distinct (offset, ip) kept per line */
+#define DEFAULT_LDLAT   30      /* cycles; shorter loads are L1 hits */
+#define DEFAULT_FREQ    4000
+
+/* ── Configuration ──────────────────────────────────────────── */
+
+static pid_t target_pid = -1;
+static int system_wide = 0;
+static int duration = 10;
+static int top_lines = 10;
+static int ldlat = DEFAULT_LDLAT;
+static uint64_t period = 0;     /* 0: DEFAULT_FREQ samples/s */
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    stop = 1;
+}
+
+static long perf_event_open(struct perf_event_attr *attr, pid_t pid,
+                            int cpu, int group_fd, unsigned long flags)
+{
+    return syscall(__NR_perf_event_open, attr, pid, cpu, group_fd, flags);
+}
+
+/* ── Event discovery (sysfs) ────────────────────────────────── */
+
+/*
+ * The encodings differ per CPU model, so read them from the PMU's sysfs
+ * directory: events/mem-loads holds terms like "event=0xcd,umask=0x1,
+ * ldlat=3" and format/<term> says which config bits each term fills.
+ *
+ * Where the PMU also lists events/mem-loads-aux (Sapphire Rapids, the
+ * hybrid cpu_core PMU), a precise mem-loads is only accepted as a member
+ * of a group led by mem-loads-aux; on its own it fails with ENODATA.
+ */
+
+enum access_kind { KIND_LOAD, KIND_STORE, KIND_ANY };
+
+struct mem_event {
+    const char      *label;
+    enum access_kind kind;      /* when data_src doesn't say */
+    uint32_t         type;
+    uint64_t         config;
+    uint64_t         config1;
+    int              has_aux;   /* open under a mem-loads-aux leader */
+    uint64_t         aux_config, aux_config1;
+};
+
+static struct mem_event events[2];
+static int n_events = 0;
+
+static int read_sysfs(const char *path, char *buf, size_t len)
+{
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return -1;
+    if (!fgets(buf, (int)len, f)) {
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+    buf[strcspn(buf, "\n")] = '\0';
+    return 0;
+}
+
+/* Place `val` into the bits named by format/<term>, e.g. "config:8-15" */
+static int apply_term(const char *pmu, const char *term, uint64_t val,
+                      struct mem_event *ev)
+{
+    char path[256], fmt[64];
+    snprintf(path, sizeof(path), "/sys/bus/event_source/devices/%s/format/%s", pmu, term);
+    if (read_sysfs(path, fmt, sizeof(fmt)) < 0)
+        return -1;
+
+    uint64_t *field = strncmp(fmt, "config1:", 8) == 0 ? &ev->config1 :
+                      strncmp(fmt, "config:", 7) == 0  ? &ev->config : NULL;
+    if (!field)
+        return -1;
+
+    int lo, hi;
+    int n = sscanf(strchr(fmt, ':') + 1, "%d-%d", &lo, &hi);
+    if (n < 1 || lo < 0 || lo > 63)
+        return -1;
+    if (n == 1)
+        hi = lo;
+    uint64_t mask = (hi - lo >= 63) ? ~0ULL : ((1ULL << (hi - lo + 1)) - 1);
+    *field |= (val & mask) << lo;
+    return 0;
+}
+
+/* type, config and config1 of events/<name> (NULL: the PMU's bare type) */
+static int parse_event(const char *pmu, const char *name, struct mem_event *ev)
+{
+    char path[256], buf[256];
+
+    snprintf(path, sizeof(path), "/sys/bus/event_source/devices/%s/type", pmu);
+    if (read_sysfs(path, buf, sizeof(buf)) < 0)
+        return -1;
+    ev->type = (uint32_t)atoi(buf);
+
+    if (name) {
+        snprintf(path, sizeof(path), "/sys/bus/event_source/devices/%s/events/%s", pmu, name);
+        if (read_sysfs(path, buf, sizeof(buf)) < 0)
+            return -1;
+
+        char *save, *tok;
+        for (tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+            char *eq = strchr(tok, '=');
+            uint64_t val = 1;
+            if (eq) {
+                *eq = '\0';
+                val = strtoull(eq + 1, NULL, 0);
+            }
+            if (strcmp(tok, "ldlat") == 0)
+                val = (uint64_t)ldlat;  /* the sysfs default (3) is every load */
+            if (apply_term(pmu, tok, val, ev) < 0)
+                return -1;
+        }
+    }
+    return 0;
+}
+
+static int load_event(const char *pmu, const char *name, const char *label,
+                      enum access_kind kind)
+{
+    struct mem_event ev = { .label = label, .kind = kind };
+    if (parse_event(pmu, name, &ev) < 0)
+        return -1;
+    events[n_events++] = ev;
+    return 0;
+}
+
+static int discover_events(void)
+{
+    /* Intel; hybrid parts expose the P-core PMU as cpu_core */
+    const char *pmus[] = { "cpu", "cpu_core" };
+    for (size_t i = 0; i < sizeof(pmus) / sizeof(pmus[0]); i++) {
+        if (load_event(pmus[i], "mem-loads", "mem-loads", KIND_LOAD) == 0) {
+            struct mem_event aux = { 0 };
+            if (parse_event(pmus[i], "mem-loads-aux", &aux) == 0) {
+                events[0].has_aux = 1;
+                events[0].aux_config = aux.config;
+                events[0].aux_config1 = aux.config1;
+            }
+            load_event(pmus[i], "mem-stores", "mem-stores", KIND_STORE);
+            return 0;
+        }
+    }
+
+    /* AMD: one IBS op event samples loads and stores alike */
+    if (load_event("ibs_op", NULL, "ibs_op", KIND_ANY) == 0)
+        return 0;
+    return -1;
+}
+
+/* ── Ring buffers ───────────────────────────────────────────── */
+
+struct ring {
+    int                          fd;
+    int                          aux_fd;    /* mem-loads-aux leader, or -1 */
+    struct perf_event_mmap_page *meta;
+    char                        *data;
+    size_t                       size;      /* data area, power of 2 */
+    enum access_kind             kind;
+};
+
+static struct ring rings[MAX_RINGS];
+static int n_rings = 0;
+static uint64_t n_lost = 0;
+static size_t page_size;
+
+static int open_ring(const struct mem_event *ev, pid_t pid, int cpu)
+{
+    if (n_rings == MAX_RINGS) {
+        fprintf(stderr, "c2c: more than %d rings, ignoring the rest\n", MAX_RINGS);
+        return -1;
+    }
+
+    struct perf_event_attr pe;
+    memset(&pe, 0, sizeof(pe));
+    pe.type = ev->type;
+    pe.size = sizeof(pe);
+    pe.config = ev->config;
+    pe.config1 = ev->config1;
+    pe.sample_type = PERF_SAMPLE_IP | PERF_SAMPLE_TID | PERF_SAMPLE_ADDR |
+                     PERF_SAMPLE_CPU | PERF_SAMPLE_WEIGHT | PERF_SAMPLE_DATA_SRC;
+    if (period) {
+        pe.sample_period = period;
+    } else {
+        pe.freq = 1;
+        pe.sample_freq = DEFAULT_FREQ;
+    }
+    pe.disabled = 1;
+    pe.exclude_kernel = 1;
+    pe.exclude_hv = 1;
+    pe.wakeup_watermark = (RING_PAGES * page_size) / 4;
+    pe.watermark = 1;
+
+    /*
+     * The leader only counts: left enabled, so enabling the sampling
+     * member later starts the group. Same target and exclusions.
+     */
+    int aux_fd = -1;
+    if (ev->has_aux) {
+        struct perf_event_attr lead;
+        memset(&lead, 0, sizeof(lead));
+        lead.type = ev->type;
+        lead.size = sizeof(lead);
+        lead.config = ev->aux_config;
+        lead.config1 = ev->aux_config1;
+        lead.exclude_kernel = 1;
+        lead.exclude_hv = 1;
+        aux_fd = (int)perf_event_open(&lead, pid, cpu, -1, PERF_FLAG_FD_CLOEXEC);
+        if (aux_fd < 0)
+            return -1;
+    }
+
+    /* Load-latency events need PEBS; take the best skid the PMU offers */
+    int fd = -1;
+    for (int precise = 3; precise >= 0 && fd < 0; precise--) {
+        pe.precise_ip = precise;
+        fd = (int)perf_event_open(&pe, pid, cpu, aux_fd, PERF_FLAG_FD_CLOEXEC);
+    }
+    if (fd < 0) {
+        int err = errno;
+        if (aux_fd >= 0)
+            close(aux_fd);
+        errno = err;
+        return -1;
+    }
+
+    size_t len = (RING_PAGES + 1) * page_size;
+    void *m = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (m == MAP_FAILED) {
+        close(fd);
+        if (aux_fd >= 0)
+            close(aux_fd);
+        return -1;
+    }
+
+    struct ring *r = &rings[n_rings++];
+    r->fd = fd;
+    r->aux_fd = aux_fd;
+    r->meta = m;
+    r->data = (char *)m + page_size;
+    r->size = RING_PAGES * page_size;
+    r->kind = ev->kind;
+    return 0;
+}
+
+/* Online CPU ids from /sys/devices/system/cpu/online ("0-3,5,8-11"):
+ * numbering can be sparse, and offline CPUs can't be opened. Falls back
+ * to 0 .. online count - 1. Returns the number of ids. */
+static int online_cpus(int *cpus, int max)
+{
+    int n = 0;
+    FILE *f = fopen("/sys/devices/system/cpu/online", "r");
+    if (f) {
+        int lo, hi;
+        while (n < max && fscanf(f, "%d", &lo) == 1) {
+            hi = lo;
+            if (fscanf(f, "-%d", &hi) != 1)
+                hi = lo;
+            for (int c = lo; c <= hi && n < max; c++)
+                cpus[n++] = c;
+            if (fgetc(f) != ',')
+                break;
+        }
+        fclose(f);
+    }
+    if (n == 0)
+        for (int c = 0; c < get_num_cores() && n < max; c++)
+            cpus[n++] = c;
+    return n;
+}
+
+/* One ring per event per thread of the target (no inherit: it can't be
+ * combined with a per-thread mmap), or per event per online CPU with -a */
+static int open_rings(void)
+{
+    int opened = 0, err = 0;
+    static int cpus[MAX_RINGS];
+    int n_cpus = system_wide ? online_cpus(cpus, MAX_RINGS) : 0;
+
+    page_size = (size_t)sysconf(_SC_PAGESIZE);
+
+    for (int e = 0; e < n_events; e++) {
+        if (system_wide) {
+            for (int i = 0; i < n_cpus; i++) {
+                if (open_ring(&events[e], -1, cpus[i]) == 0) opened++;
+                else err = errno;
+            }
+            continue;
+        }
+
+        char path[64];
+        snprintf(path, sizeof(path), "/proc/%d/task", target_pid);
+        DIR *d = opendir(path);
+        if (!d) {
+            perror(path);
+            return -1;
+        }
+        struct dirent *de;
+        while ((de = readdir(d)) != NULL) {
+            if (de->d_name[0] == '.')
+                continue;
+            if (open_ring(&events[e], atoi(de->d_name), -1) == 0) opened++;
+            else err = errno;
+        }
+        closedir(d);
+    }
+
+    if (opened == 0) {
+        fprintf(stderr, "c2c: perf_event_open(%s): %s\n", events[0].label, strerror(err));
+        if (err == EACCES || err == EPERM)
+            fprintf(stderr, "  Try: sudo sysctl kernel.perf_event_paranoid=%d\n",
+                    system_wide ? -1 : 1);
+        else if (err == ENODATA)
+            fprintf(stderr, "  ENODATA: this PMU samples mem-loads only under a mem-loads-aux "
+                            "group leader, which its sysfs does not list\n");
+        else if (err == ENOENT || err == EOPNOTSUPP || err == EINVAL)
+            fprintf(stderr, "  The PMU does not support precise memory sampling "
+                            "(common in VMs)\n");
+        return -1;
+    }
+    return 0;
+}
+
+/* ── Cache line table ───────────────────────────────────────── */
+
+struct access {
+    uint64_t ip;
+    uint32_t offset;            /* within the line */
+    uint32_t loads, stores, hitm;
+    uint64_t cpus;              /* bitmask of cpu % 64 */
+};
+
+struct line {
+    uint64_t addr;              /* line address; 0 = empty slot */
+    uint32_t pid;
+    uint32_t loads, stores;
+    uint32_t lcl_hitm, rmt_hitm;
+    uint32_t rmt_hit;           /* remote cache/memory, clean */
+    uint64_t load_lat;          /* sum of load weights (cycles) */
+    uint64_t cpus;
+    int      n_acc;
+    struct access acc[MAX_ACCESSES];
+};
+
+static struct line *lines;
+static size_t lines_cap = 0, n_lines = 0;
+
+static size_t line_hash(uint32_t pid, uint64_t addr)
+{
+    uint64_t h = (addr >> 6) * 0x9e3779b97f4a7c15ULL ^ pid;
+    return (size_t)(h ^ (h >> 29));
+}
+
+static struct line *line_get(uint32_t pid, uint64_t addr)
+{
+    if (n_lines * 2 >= lines_cap) {
+        size_t cap = lines_cap ? lines_cap * 2 : 4096;
+        struct line *grown = calloc(cap, sizeof(*grown));
+        if (!grown) { perror("calloc"); exit(1); }
+        for (size_t i = 0; i < lines_cap; i++) {
+            if (!lines[i].addr)
+                continue;
+            size_t j = line_hash(lines[i].pid, lines[i].addr) & (cap - 1);
+            while (grown[j].addr)
+                j = (j + 1) & (cap - 1);
+            grown[j] = lines[i];
+        }
+        free(lines);
+        lines = grown;
+        lines_cap = cap;
+    }
+
+    size_t i = line_hash(pid, addr) & (lines_cap - 1);
+    while (lines[i].addr && (lines[i].addr != addr || lines[i].pid != pid))
+        i = (i + 1) & (lines_cap - 1);
+    if (!lines[i].addr) {
+        lines[i].addr = addr;
+        lines[i].pid = pid;
+        n_lines++;
+    }
+    return &lines[i];
+}
+
+/* ── Sample decoding ────────────────────────────────────────── */
+
+static uint64_t total_samples, total_loads, total_stores;
+static uint64_t total_lcl_hitm, total_rmt_hitm, no_addr;
+
+static void account(enum access_kind kind, uint32_t pid, uint32_t cpu,
+                    uint64_t ip, uint64_t addr, uint64_t weight, uint64_t dsrc)
+{
+    union perf_mem_data_src ds = { .val = dsrc };
+
+    total_samples++;
+    if (addr < CACHE_LINE_SIZE) {      /* no address recorded */
+        no_addr++;
+        return;
+    }
+
+    int is_store = (ds.mem_op & PERF_MEM_OP_STORE) ? 1 :
+                   (ds.mem_op & PERF_MEM_OP_LOAD)  ? 0 : kind == KIND_STORE;
+    int hitm = (ds.mem_snoop & PERF_MEM_SNOOP_HITM) != 0;
+    int remote = ds.mem_remote ||
+                 (ds.mem_lvl & (PERF_MEM_LVL_REM_CCE1 | PERF_MEM_LVL_REM_CCE2 |
+                                PERF_MEM_LVL_REM_RAM1 | PERF_MEM_LVL_REM_RAM2));
+
+    struct line *l = line_get(pid, addr & ~(uint64_t)(CACHE_LINE_SIZE - 1));
+    l->cpus |= 1ULL << (cpu % 64);
+    if (is_store) {
+        l->stores++;
+        total_stores++;
+    } else {
+        l->loads++;
+        l->load_lat += weight;
+        total_loads++;
+        if (hitm && remote)  { l->rmt_hitm++; total_rmt_hitm++; }
+        else if (hitm)       { l->lcl_hitm++; total_lcl_hitm++; }
+        else if (remote)     l->rmt_hit++;
+    }
+
+    uint32_t off = (uint32_t)(addr & (CACHE_LINE_SIZE - 1));
+    struct access *a = NULL;
+    for (int i = 0; i < l->n_acc; i++) {
+        if (l->acc[i].ip == ip && l->acc[i].offset == off) {
+            a = &l->acc[i];
+            break;
+        }
+    }
+    if (!a) {
+        if (l->n_acc == MAX_ACCESSES)
+            return;     /* the line totals above still count */
+        a = &l->acc[l->n_acc++];
+        a->ip = ip;
+        a->offset = off;
+    }
+    a->cpus |= 1ULL << (cpu % 64);
+    if (is_store) a->stores++;
+    else          a->loads++;
+    a->hitm += !is_store && hitm;
+}
+
+/* Fields in PERF_SAMPLE_* bit order */
+struct mem_sample {
+    uint64_t ip;
+    uint32_t pid, tid;
+    uint64_t addr;
+    uint32_t cpu, res;
+    uint64_t weight;
+    uint64_t data_src;
+};
+
+static void drain_ring(struct ring *r)
+{
+    uint64_t head = __atomic_load_n(&r->meta->data_head, __ATOMIC_ACQUIRE);
+    uint64_t tail = r->meta->data_tail;
+    char buf[256];
+
+    while (tail < head) {
+        struct perf_event_header hdr;
+        size_t pos = tail & (r->size - 1);
+
+        /* Records may wrap around the end of the ring: copy out */
+        for (size_t i = 0; i < sizeof(hdr); i++)
+            ((char *)&hdr)[i] = r->data[(pos + i) & (r->size - 1)];
+        if (hdr.size == 0)
+            break;
+        size_t n = hdr.size < sizeof(buf) ? hdr.size : sizeof(buf);
+        for (size_t i = 0; i < n; i++)
+            buf[i] = r->data[(pos + i) & (r->size - 1)];
+
+        if (hdr.type == PERF_RECORD_SAMPLE &&
+            hdr.size >= sizeof(hdr) + sizeof(struct mem_sample)) {
+            struct mem_sample s;
+            memcpy(&s, buf + sizeof(hdr), sizeof(s));
+            account(r->kind, s.pid, s.cpu, s.ip, s.addr, s.weight, s.data_src);
+        } else if (hdr.type == PERF_RECORD_LOST) {
+            uint64_t lost;
+            memcpy(&lost, buf + sizeof(hdr) + sizeof(uint64_t), sizeof(lost));
+            n_lost += lost;
+        }
+        tail += hdr.size;
+    }
+
+    __atomic_store_n(&r->meta->data_tail, tail, __ATOMIC_RELEASE);
+}
+
+/* ── Report ─────────────────────────────────────────────────── */
+
+static int cmp_line(const void *a, const void *b)
+{
+    const struct line *x = a, *y = b;
+    uint32_t hx = x->lcl_hitm + x->rmt_hitm, hy = y->lcl_hitm + y->rmt_hitm;
+    if (hx != hy)
+        return hx < hy ? 1 : -1;
+    if (x->rmt_hit != y->rmt_hit)
+        return x->rmt_hit < y->rmt_hit ? 1 : -1;
+    /* Without HITM data (e.g. IBS on some kernels), rank by writes */
+    if (x->stores != y->stores)
+        return x->stores < y->stores ? 1 : -1;
+    return (x->loads < y->loads) - (x->loads > y->loads);
+}
+
+static int cmp_access(const void *a, const void *b)
+{
+    const struct access *x = a, *y = b;
+    if (x->offset != y->offset)
+        return x->offset < y->offset ? -1 : 1;
+    return (x->hitm + x->stores < y->hitm + y->stores) -
+           (x->hitm + x->stores > y->hitm + y->stores);
+}
+
+static void report(void)
+{
+    printf("Cache-line contention report\n");
+    print_separator();
+    printf("  Samples         : %lu (%lu loads, %lu stores, %lu without address)\n",
+           (unsigned long)total_samples, (unsigned long)total_loads,
+           (unsigned long)total_stores, (unsigned long)no_addr);
+    printf("  HITM            : %lu local, %lu remote\n",
+           (unsigned long)total_lcl_hitm, (unsigned long)total_rmt_hitm);
+    printf("  Cache lines     : %zu\n", n_lines);
+    if (n_lost)
+        printf("  Lost samples    : %lu (ring full; use -c to sample less)\n",
+               (unsigned long)n_lost);
+    print_separator();
+
+    /* Compact and rank */
+    size_t n = 0;
+    for (size_t i = 0; i < lines_cap; i++)
+        if (lines[i].addr)
+            lines[n++] = lines[i];
+    qsort(lines, n, sizeof(*lines), cmp_line);
+
+    size_t shown = n < (size_t)top_lines ? n : (size_t)top_lines;
+    for (size_t i = 0; i < shown; i++) {
+        struct line *l = &lines[i];
+        char data[256];
+
+        sym_init((int)l->pid);
+        sym_resolve_data((int)l->pid, l->addr, data, sizeof(data));
+
+        printf("\n#%-3zu 0x%016lx  pid %u (%s)  %s\n", i + 1, (unsigned long)l->addr,
+               l->pid, sym_comm((int)l->pid), data);
+        printf("     HITM %u (local %u, remote %u)  remote hits %u  loads %u  stores %u"
+               "  cpus %d",
+               l->lcl_hitm + l->rmt_hitm, l->lcl_hitm, l->rmt_hitm, l->rmt_hit,
+               l->loads, l->stores, __builtin_popcountll(l->cpus));
+        if (l->loads)
+            printf("  avg load %lu cyc", (unsigned long)(l->load_lat / l->loads));
+        printf("\n");
+
+        qsort(l->acc, l->n_acc, sizeof(*l->acc), cmp_access);
+        printf("     %-6s %-18s %8s %8s %8s %5s  %s\n",
+               "offset", "ip", "loads", "stores", "hitm", "cpus", "code");
+        for (int j = 0; j < l->n_acc; j++) {
+            const struct access *a = &l->acc[j];
+            printf("     0x%-4x 0x%016lx %8u %8u %8u %5d  %s\n",
+                   a->offset, (unsigned long)a->ip, a->loads, a->stores, a->hitm,
+                   __builtin_popcountll(a->cpus), sym_resolve((int)l->pid, a->ip));
+        }
+    }
+
+    if (n == 0)
+        printf("\n  No samples with a data address.\n");
+    else if (total_lcl_hitm + total_rmt_hitm == 0)
+        printf("\n  NOTE: no HITM samples; lines are ranked by stores. Raise the\n"
+               "  sampling rate (-c) or lower the load-latency threshold (-l).\n");
+}
+
+/* ── Main ───────────────────────────────────────────────────── */
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s (-p PID | -a) [options]\n", prog);
+    fprintf(stderr, "  -p PID     sample one process (its threads at startup)\n");
+    fprintf(stderr, "  -a         sample all processes\n");
+    fprintf(stderr, "  -d SECS    duration (default: %d, 0 = until Ctrl-C)\n", duration);
+    fprintf(stderr, "  -n N       cache lines to report (default: %d)\n", top_lines);
+    fprintf(stderr, "  -l CYCLES  load-latency threshold (default: %d)\n", DEFAULT_LDLAT);
+    fprintf(stderr, "  -c PERIOD  sample every PERIOD events (default: %d Hz)\n", DEFAULT_FREQ);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "p:ad:n:l:c:h")) != -1) {
+        switch (opt) {
+        case 'p': target_pid = atoi(optarg); break;
+        case 'a': system_wide = 1; break;
+        case 'd': duration = atoi(optarg); break;
+        case 'n': top_lines = atoi(optarg); break;
+        case 'l': ldlat = atoi(optarg); break;
+        case 'c': period = strtoull(optarg, NULL, 10); break;
+        default:  usage(argv[0]);
+        }
+    }
+    if ((target_pid > 0) == system_wide)
+        usage(argv[0]);
+
+    if (discover_events() < 0) {
+        fprintf(stderr, "c2c: no mem-loads or ibs_op event in "
+                        "/sys/bus/event_source/devices (no PMU with memory sampling)\n");
+        return 1;
+    }
+    if (open_rings() < 0)
+        return 1;
+
+    /* Resolve the target's code while it is alive */
+    if (target_pid > 0)
+        sym_init(target_pid);
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    fprintf(stderr, "c2c: sampling ");
+    for (int e = 0; e < n_events; e++)
+        fprintf(stderr, "%s%s", e ? " + " : "", events[e].label);
+    if (system_wide)
+        fprintf(stderr, " on all CPUs");
+    else
+        fprintf(stderr, " in pid %d (%d threads)", target_pid, n_rings / n_events);
+    if (duration)
+        fprintf(stderr, " for %d s\n", duration);
+    else
+        fprintf(stderr, ", Ctrl-C to stop\n");
+
+    for (int i = 0; i < n_rings; i++)
+        ioctl(rings[i].fd, PERF_EVENT_IOC_ENABLE, 0);
+
+    static struct pollfd pfds[MAX_RINGS];
+    for (int i = 0; i < n_rings; i++) {
+        pfds[i].fd = rings[i].fd;
+        pfds[i].events = POLLIN;
+    }
+
+    uint64_t deadline = now_ns() + (uint64_t)duration * 1000000000ULL;
+    while (!stop) {
+        int timeout = 100;
+        if (duration) {
+            uint64_t now = now_ns();
+            if (now >= deadline)
+                break;
+            if ((deadline - now) / 1000000 < (uint64_t)timeout)
+                timeout = (int)((deadline - now) / 1000000) + 1;
+        }
+        poll(pfds, n_rings, timeout);
+        for (int i = 0; i < n_rings; i++)
+            drain_ring(&rings[i]);
+    }
+
+    for (int i = 0; i < n_rings; i++) {
+        ioctl(rings[i].fd, PERF_EVENT_IOC_DISABLE, 0);
+        drain_ring(&rings[i]);
+    }
+
+    report();
+
+    for (int i = 0; i < n_rings; i++) {
+        munmap(rings[i].meta, (RING_PAGES + 1) * page_size);
+        close(rings[i].fd);
+        if (rings[i].aux_fd >= 0)
+            close(rings[i].aux_fd);
+    }
+    free(lines);
+    sym_cleanup();
+    return 0;
+}
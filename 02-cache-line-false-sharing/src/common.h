@@ -14,6 +14,8 @@
 #include <unistd.h>
 #include <errno.h>
 
+#include "tsc.h"
+
 #define CACHE_LINE_SIZE 64
 
 #define CACHE_ALIGNED __attribute__((aligned(CACHE_LINE_SIZE)))
@@ -1,7 +1,8 @@
 /*
  * patterns.c — Milestone 4: Real-World False Sharing Patterns
  *
- * Demonstrates four common false-sharing anti-patterns with fixes.
+ * Demonstrates four common false-sharing anti-patterns with fixes, then
+ * compares the scalable counter designs that replace a single hot atomic.
  * Uses _Atomic with relaxed ordering to guarantee memory writes each iteration.
  *
  * Usage:
@@ -10,8 +11,17 @@
  *   ./patterns producer_consumer
  *   ./patterns hash_buckets
  *   ./patterns thread_stats
+ *   ./patterns scalable_counters
+ *   ./patterns --perf [pattern] # + IPC, cache/dTLB misses per op (perf_group.h)
  */
 #include "common.h"
+#include "topology.h"
+#include "perf_group.h"
+#include <sys/sysinfo.h>
+#if __has_include(<sys/rseq.h>)
+#include <sys/rseq.h>           /* glibc >= 2.35 registers rseq per thread */
+#define HAVE_RSEQ 1
+#endif
 
 #define NUM_THREADS 8
 #define DEFAULT_ITERS 100000000L
@@ -39,6 +49,17 @@ static inline void atomic_add_relaxed(_Atomic long *p, long v)
     atomic_fetch_add_explicit(p, v, memory_order_relaxed);
 }
 
+/* Hardware counters (--perf): each worker merges its group into
+ * pat_perf, which every run resets */
+static struct pg_counts pat_perf;
+
+static void print_perf(const struct pg_counts *c, double ops)
+{
+    char buf[128];
+    if (pg_enabled)
+        printf("  %-20s %s\n", "", pg_format(c, ops, buf, sizeof(buf)));
+}
+
 /* ═══════════════════════════════════════════════════════════════
  *  Pattern 1: Array of Counters
  *
@@ -64,7 +85,9 @@ struct array_args {
 static void *array_worker(void *arg)
 {
     struct array_args *a = (struct array_args *)arg;
-    pin_to_core(a->id);
+    pin_to_core(topo_cpu_for(a->id));
+    struct pg_set ps;
+    pg_thread_begin(&ps);
     long iters = a->iters;
 
     if (a->padded) {
@@ -76,6 +99,7 @@ static void *array_worker(void *arg)
         for (long i = 0; i < iters; i++)
             atomic_inc_relaxed(ctr);
     }
+    pg_thread_end(&ps, &pat_perf);
     return NULL;
 }
 
@@ -92,6 +116,7 @@ static double run_array_counters(int padded, long iters)
     for (int i = 0; i < NUM_THREADS; i++)
         args[i] = (struct array_args){ .id = i, .iters = iters, .padded = padded };
 
+    memset(&pat_perf, 0, sizeof(pat_perf));
     uint64_t start = now_ns();
     for (int i = 0; i < NUM_THREADS; i++)
         pthread_create(&threads[i], NULL, array_worker, &args[i]);
@@ -110,11 +135,15 @@ static void benchmark_array_counters(void)
     printf("  %-20s %12s %15s\n", "Layout", "Time (ms)", "Ops/sec");
 
     double packed_ms = run_array_counters(0, iters);
+    struct pg_counts packed_perf = pat_perf;
     double padded_ms = run_array_counters(1, iters);
+    struct pg_counts padded_perf = pat_perf;
     double total = (double)NUM_THREADS * (double)iters;
 
     printf("  %-20s %12.1f %15.0f\n", "Packed (adjacent)", packed_ms, total / (packed_ms / 1000));
+    print_perf(&packed_perf, total);
     printf("  %-20s %12.1f %15.0f\n", "Padded (separated)", padded_ms, total / (padded_ms / 1000));
+    print_perf(&padded_perf, total);
     printf("  Slowdown: %.1fx\n", packed_ms / padded_ms);
     printf("  Fix: __attribute__((aligned(64))) or pad each entry to 64 bytes\n");
 }
@@ -147,7 +176,9 @@ struct pc_args {
 static void *pc_worker(void *arg)
 {
     struct pc_args *a = (struct pc_args *)arg;
-    pin_to_core(a->is_producer ? 0 : get_num_cores() / 2);
+    pin_to_core(topo_cpu_for(a->is_producer ? 0 : 1));
+    struct pg_set ps;
+    pg_thread_begin(&ps);
     long iters = a->iters;
 
     if (a->padded) {
@@ -161,6 +192,7 @@ static void *pc_worker(void *arg)
         for (long i = 0; i < iters; i++)
             atomic_inc_relaxed(ctr);
     }
+    pg_thread_end(&ps, &pat_perf);
     return NULL;
 }
 
@@ -170,6 +202,7 @@ static double run_producer_consumer(int padded, long iters, void *flags)
     struct pc_args p = { .flags = flags, .iters = iters, .padded = padded, .is_producer = 1 };
     struct pc_args c = { .flags = flags, .iters = iters, .padded = padded, .is_producer = 0 };
 
+    memset(&pat_perf, 0, sizeof(pat_perf));
     uint64_t start = now_ns();
     pthread_create(&t1, NULL, pc_worker, &p);
     pthread_create(&t2, NULL, pc_worker, &c);
@@ -194,13 +227,18 @@ static void benchmark_producer_consumer(void)
     memset(padded, 0, sizeof(*padded));
 
     double packed_ms = run_producer_consumer(0, iters, packed);
+    struct pg_counts packed_perf = pat_perf;
     double padded_ms = run_producer_consumer(1, iters, padded);
+    struct pg_counts padded_perf = pat_perf;
     double total = 2.0 * (double)iters;
 
     printf("  %-20s %12.1f %15.0f\n", "Packed (adjacent)", packed_ms, total / (packed_ms / 1000));
+    print_perf(&packed_perf, total);
     printf("  %-20s %12.1f %15.0f\n", "Padded (separated)", padded_ms, total / (padded_ms / 1000));
+    print_perf(&padded_perf, total);
     printf("  Slowdown: %.1fx\n", packed_ms / padded_ms);
     printf("  Fix: separate producer and consumer fields onto different cache lines\n");
+    printf("  (bin/queues shows the same effect on a real queue's head/tail indices)\n");
 
     free(packed);
     free(padded);
@@ -237,7 +275,9 @@ struct bucket_args {
 static void *bucket_worker(void *arg)
 {
     struct bucket_args *a = (struct bucket_args *)arg;
-    pin_to_core(a->id);
+    pin_to_core(topo_cpu_for(a->id));
+    struct pg_set ps;
+    pg_thread_begin(&ps);
     long iters = a->iters;
     int my_bucket = a->id;
 
@@ -258,6 +298,7 @@ static void *bucket_worker(void *arg)
             atomic_add_relaxed(lock, -1);
         }
     }
+    pg_thread_end(&ps, &pat_perf);
     return NULL;
 }
 
@@ -275,6 +316,7 @@ static double run_hash_buckets(int padded, long iters)
     for (int i = 0; i < NUM_THREADS; i++)
         args[i] = (struct bucket_args){ .id = i, .iters = iters, .padded = padded };
 
+    memset(&pat_perf, 0, sizeof(pat_perf));
     uint64_t start = now_ns();
     for (int i = 0; i < NUM_THREADS; i++)
         pthread_create(&threads[i], NULL, bucket_worker, &args[i]);
@@ -295,11 +337,15 @@ static void benchmark_hash_buckets(void)
     printf("  %-20s %12s %15s\n", "Layout", "Time (ms)", "Ops/sec");
 
     double packed_ms = run_hash_buckets(0, iters);
+    struct pg_counts packed_perf = pat_perf;
     double padded_ms = run_hash_buckets(1, iters);
+    struct pg_counts padded_perf = pat_perf;
     double total = (double)NUM_THREADS * (double)iters;
 
     printf("  %-20s %12.1f %15.0f\n", "Packed (adjacent)", packed_ms, total / (packed_ms / 1000));
+    print_perf(&packed_perf, total);
     printf("  %-20s %12.1f %15.0f\n", "Padded (separated)", padded_ms, total / (padded_ms / 1000));
+    print_perf(&padded_perf, total);
     printf("  Slowdown: %.1fx\n", packed_ms / padded_ms);
     printf("  Fix: pad each bucket struct to CACHE_LINE_SIZE\n");
 }
@@ -334,7 +380,9 @@ struct stats_args {
 static void *stats_worker(void *arg)
 {
     struct stats_args *a = (struct stats_args *)arg;
-    pin_to_core(a->id);
+    pin_to_core(topo_cpu_for(a->id));
+    struct pg_set ps;
+    pg_thread_begin(&ps);
     long iters = a->iters;
 
     if (a->padded) {
@@ -358,6 +406,7 @@ static void *stats_worker(void *arg)
                 atomic_inc_relaxed(err);
         }
     }
+    pg_thread_end(&ps, &pat_perf);
     return NULL;
 }
 
@@ -377,6 +426,7 @@ static double run_thread_stats(int padded, long iters)
     for (int i = 0; i < NUM_THREADS; i++)
         args[i] = (struct stats_args){ .id = i, .iters = iters, .padded = padded };
 
+    memset(&pat_perf, 0, sizeof(pat_perf));
     uint64_t start = now_ns();
     for (int i = 0; i < NUM_THREADS; i++)
         pthread_create(&threads[i], NULL, stats_worker, &args[i]);
@@ -399,20 +449,398 @@ static void benchmark_thread_stats(void)
     printf("  %-20s %12s %15s\n", "Layout", "Time (ms)", "Ops/sec");
 
     double packed_ms = run_thread_stats(0, iters);
+    struct pg_counts packed_perf = pat_perf;
     double padded_ms = run_thread_stats(1, iters);
+    struct pg_counts padded_perf = pat_perf;
     double total = (double)NUM_THREADS * (double)iters;
 
     printf("  %-20s %12.1f %15.0f\n", "Packed (adjacent)", packed_ms, total / (packed_ms / 1000));
+    print_perf(&packed_perf, total);
     printf("  %-20s %12.1f %15.0f\n", "Padded (separated)", padded_ms, total / (padded_ms / 1000));
+    print_perf(&padded_perf, total);
     printf("  Slowdown: %.1fx\n", packed_ms / padded_ms);
     printf("  Fix: align each per-thread struct to cache line size\n");
 }
 
+/* ═══════════════════════════════════════════════════════════════
+ *  Pattern 5: Scalable Counters
+ *
+ *  What to use for a hot request counter instead of one padded
+ *  atomic. Each design is measured for increment throughput and, from
+ *  a concurrent reader, for read cost and staleness (increments that
+ *  had completed before a read started but are missing from it).
+ *
+ *    atomic      one padded atomic (the baseline)
+ *    per_cpu     one cell per CPU, picked by the rseq cpu_id (or
+ *                sched_getcpu); still a lock add, since the thread
+ *                may migrate, but almost never contended
+ *    tls_batch   plain thread-local count, flushed every SC_BATCH
+ *    striped     LongAdder: CAS on a base value; threads that lose a
+ *                CAS move to striped cells, which double (up to the
+ *                CPU count) while CASes keep failing
+ *    combining   flat combining: publish a request, and whoever takes
+ *                the lock applies everyone's pending requests at once
+ * ═══════════════════════════════════════════════════════════════ */
+
+#define SC_MAX_CPUS  1024
+#define SC_MAX_CELLS 64
+#define SC_BATCH     1024
+#define SC_READ_BURST 64
+
+enum sc_kind { SC_ATOMIC, SC_PERCPU, SC_TLS_BATCH, SC_STRIPED, SC_COMBINING, SC_NKINDS };
+
+static const char *sc_names[SC_NKINDS] = {
+    "atomic", "per_cpu", "tls_batch", "striped", "combining",
+};
+
+struct sc_cell {
+    _Atomic long v;
+    char _pad[CACHE_LINE_SIZE - sizeof(_Atomic long)];
+} CACHE_ALIGNED;
+
+static struct sc_cell sc_single;                    /* atomic, tls_batch target */
+static struct sc_cell sc_cpu_cells[SC_MAX_CPUS];    /* per_cpu */
+static int sc_ncpus;
+
+static struct sc_cell sc_base;                      /* striped */
+static struct sc_cell sc_cells[SC_MAX_CELLS];
+static _Atomic int sc_ncells;                       /* 0, then a power of 2 */
+static _Atomic int sc_grow_lock;
+static int sc_max_cells;
+
+static struct sc_cell sc_fc_pending[NUM_THREADS];   /* combining */
+static struct sc_cell sc_fc_lock;
+static struct sc_cell sc_fc_value;
+
+static struct sc_cell sc_progress[NUM_THREADS];     /* increments done, per writer */
+static _Atomic int sc_done;
+
+static inline int sc_current_cpu(void)
+{
+#ifdef HAVE_RSEQ
+    if (__rseq_size > 0) {
+        const struct rseq *rs = (const struct rseq *)
+            ((char *)__builtin_thread_pointer() + __rseq_offset);
+        int cpu = (int)__atomic_load_n(&rs->cpu_id, __ATOMIC_RELAXED);
+        if (cpu >= 0)
+            return cpu;
+    }
+#endif
+    int cpu = sched_getcpu();
+    return cpu < 0 ? 0 : cpu;
+}
+
+/* ── striped (LongAdder) ── */
+
+static void striped_grow(int seen)
+{
+    if (seen >= sc_max_cells)
+        return;
+    int unlocked = 0;
+    if (!atomic_compare_exchange_strong(&sc_grow_lock, &unlocked, 1))
+        return;     /* someone else is growing */
+    if (atomic_load(&sc_ncells) == seen)
+        atomic_store_explicit(&sc_ncells, seen ? seen * 2 : 2, memory_order_release);
+    atomic_store_explicit(&sc_grow_lock, 0, memory_order_release);
+}
+
+static inline void striped_inc(unsigned *probe)
+{
+    int n = atomic_load_explicit(&sc_ncells, memory_order_acquire);
+    if (n == 0) {
+        long b = atomic_load_explicit(&sc_base.v, memory_order_relaxed);
+        if (atomic_compare_exchange_weak_explicit(&sc_base.v, &b, b + 1,
+                memory_order_relaxed, memory_order_relaxed))
+            return;
+        striped_grow(0);
+        n = atomic_load_explicit(&sc_ncells, memory_order_acquire);
+        if (n == 0) {   /* grow lock busy: fall back to the base */
+            atomic_inc_relaxed(&sc_base.v);
+            return;
+        }
+    }
+
+    _Atomic long *c = &sc_cells[*probe & (n - 1)].v;
+    long v = atomic_load_explicit(c, memory_order_relaxed);
+    if (atomic_compare_exchange_weak_explicit(c, &v, v + 1,
+            memory_order_relaxed, memory_order_relaxed))
+        return;
+
+    /* Contended cell: move to another one, and grow if there's room */
+    *probe ^= *probe << 13;
+    *probe ^= *probe >> 17;
+    *probe ^= *probe << 5;
+    striped_grow(n);
+    n = atomic_load_explicit(&sc_ncells, memory_order_acquire);
+    atomic_inc_relaxed(&sc_cells[*probe & (n - 1)].v);
+}
+
+/* ── combining ── */
+
+static inline void combining_inc(int id)
+{
+    atomic_store_explicit(&sc_fc_pending[id].v, 1, memory_order_release);
+
+    for (int spins = 1; atomic_load_explicit(&sc_fc_pending[id].v, memory_order_acquire); spins++) {
+        long unlocked = 0;
+        if (atomic_load_explicit(&sc_fc_lock.v, memory_order_relaxed) == 0 &&
+            atomic_compare_exchange_strong(&sc_fc_lock.v, &unlocked, 1)) {
+            /* Combiner: apply every pending request, publish, then release
+             * the waiters so a read after their return sees the result */
+            int served[NUM_THREADS], n = 0;
+            for (int i = 0; i < NUM_THREADS; i++)
+                if (atomic_load_explicit(&sc_fc_pending[i].v, memory_order_acquire))
+                    served[n++] = i;
+            long v = atomic_load_explicit(&sc_fc_value.v, memory_order_relaxed);
+            atomic_store_explicit(&sc_fc_value.v, v + n, memory_order_release);
+            for (int i = 0; i < n; i++)
+                atomic_store_explicit(&sc_fc_pending[served[i]].v, 0, memory_order_release);
+            atomic_store_explicit(&sc_fc_lock.v, 0, memory_order_release);
+        } else if (spins % 128 == 0) {
+            sched_yield();  /* the combiner may be preempted when oversubscribed */
+        }
+    }
+}
+
+static long sc_read(enum sc_kind k)
+{
+    long sum = 0;
+    switch (k) {
+    case SC_ATOMIC:
+    case SC_TLS_BATCH:
+        return atomic_load_explicit(&sc_single.v, memory_order_acquire);
+    case SC_PERCPU:
+        for (int i = 0; i < sc_ncpus; i++)
+            sum += atomic_load_explicit(&sc_cpu_cells[i].v, memory_order_acquire);
+        return sum;
+    case SC_STRIPED: {
+        int n = atomic_load_explicit(&sc_ncells, memory_order_acquire);
+        sum = atomic_load_explicit(&sc_base.v, memory_order_acquire);
+        for (int i = 0; i < n; i++)
+            sum += atomic_load_explicit(&sc_cells[i].v, memory_order_acquire);
+        return sum;
+    }
+    case SC_COMBINING:
+        return atomic_load_explicit(&sc_fc_value.v, memory_order_acquire);
+    case SC_NKINDS:
+        break;
+    }
+    return 0;
+}
+
+struct sc_args {
+    enum sc_kind kind;
+    int id;
+    long iters;
+};
+
+static void *sc_worker(void *arg)
+{
+    struct sc_args *a = (struct sc_args *)arg;
+    pin_to_core(topo_cpu_for(a->id));
+    struct pg_set ps;
+    pg_thread_begin(&ps);
+    long iters = a->iters;
+    /* Published after each increment, so a reader that sees it knows the
+     * increment is complete */
+    _Atomic long *done = &sc_progress[a->id].v;
+
+    switch (a->kind) {
+    case SC_ATOMIC:
+        for (long i = 0; i < iters; i++) {
+            atomic_inc_relaxed(&sc_single.v);
+            atomic_store_explicit(done, i + 1, memory_order_release);
+        }
+        break;
+    case SC_PERCPU:
+        for (long i = 0; i < iters; i++) {
+            atomic_inc_relaxed(&sc_cpu_cells[sc_current_cpu() % sc_ncpus].v);
+            atomic_store_explicit(done, i + 1, memory_order_release);
+        }
+        break;
+    case SC_TLS_BATCH: {
+        long local = 0;
+        for (long i = 0; i < iters; i++) {
+            if (++local == SC_BATCH) {
+                atomic_add_relaxed(&sc_single.v, local);
+                local = 0;
+            }
+            atomic_store_explicit(done, i + 1, memory_order_release);
+        }
+        atomic_add_relaxed(&sc_single.v, local);     /* flush at thread exit */
+        break;
+    }
+    case SC_STRIPED: {
+        unsigned probe = (unsigned)(a->id + 1) * 0x9e3779b9u;
+        for (long i = 0; i < iters; i++) {
+            striped_inc(&probe);
+            atomic_store_explicit(done, i + 1, memory_order_release);
+        }
+        break;
+    }
+    case SC_COMBINING:
+        for (long i = 0; i < iters; i++) {
+            combining_inc(a->id);
+            atomic_store_explicit(done, i + 1, memory_order_release);
+        }
+        break;
+    case SC_NKINDS:
+        break;
+    }
+    pg_thread_end(&ps, &pat_perf);
+    return NULL;
+}
+
+struct sc_reader_args {
+    enum sc_kind kind;
+    int nthreads;
+    long reads;
+    double read_ns;
+    double stale_avg;
+    long stale_max;
+};
+
+static void *sc_reader(void *arg)
+{
+    struct sc_reader_args *r = (struct sc_reader_args *)arg;
+    pin_to_core(topo_cpu_for(r->nthreads));
+    long samples = 0, sink = 0;
+    double stale_sum = 0, ns = 0;
+
+    while (!atomic_load_explicit(&sc_done, memory_order_acquire)) {
+        /* Staleness: increments known complete before the read began */
+        long truth = 0;
+        for (int t = 0; t < r->nthreads; t++)
+            truth += atomic_load_explicit(&sc_progress[t].v, memory_order_acquire);
+        long stale = truth - sc_read(r->kind);
+        if (stale < 0)
+            stale = 0;
+        stale_sum += (double)stale;
+        if (stale > r->stale_max)
+            r->stale_max = stale;
+        samples++;
+
+        /* Read cost: a burst of back-to-back reads (cycle counter, its
+         * overhead subtracted: a clock_gettime pair is ~64 cheap reads) */
+        uint64_t t0 = tsc_start();
+        for (int i = 0; i < SC_READ_BURST; i++)
+            sink += sc_read(r->kind);
+        ns += (double)tsc_elapsed_ns(t0, tsc_stop());
+        r->reads += SC_READ_BURST;
+        sched_yield();  /* don't starve writers when CPUs are short */
+    }
+
+    r->read_ns = r->reads ? ns / (double)r->reads : 0;
+    r->stale_avg = samples ? stale_sum / (double)samples : 0;
+    (void)sink;
+    return NULL;
+}
+
+static void sc_reset(void)
+{
+    atomic_store(&sc_single.v, 0);
+    for (int i = 0; i < SC_MAX_CPUS; i++)
+        atomic_store(&sc_cpu_cells[i].v, 0);
+    atomic_store(&sc_base.v, 0);
+    for (int i = 0; i < SC_MAX_CELLS; i++)
+        atomic_store(&sc_cells[i].v, 0);
+    atomic_store(&sc_ncells, 0);
+    for (int i = 0; i < NUM_THREADS; i++) {
+        atomic_store(&sc_fc_pending[i].v, 0);
+        atomic_store(&sc_progress[i].v, 0);
+    }
+    atomic_store(&sc_fc_value.v, 0);
+    atomic_store(&sc_done, 0);
+}
+
+static double run_scalable_counter(enum sc_kind k, int nthreads, long iters,
+                                   struct sc_reader_args *rd, long *final)
+{
+    sc_reset();
+
+    pthread_t threads[NUM_THREADS], reader;
+    struct sc_args args[NUM_THREADS];
+    for (int i = 0; i < nthreads; i++)
+        args[i] = (struct sc_args){ .kind = k, .id = i, .iters = iters };
+    *rd = (struct sc_reader_args){ .kind = k, .nthreads = nthreads };
+
+    memset(&pat_perf, 0, sizeof(pat_perf));
+    uint64_t start = now_ns();
+    for (int i = 0; i < nthreads; i++)
+        pthread_create(&threads[i], NULL, sc_worker, &args[i]);
+    pthread_create(&reader, NULL, sc_reader, rd);
+    for (int i = 0; i < nthreads; i++)
+        pthread_join(threads[i], NULL);
+    double ms = elapsed_ms(start, now_ns());
+
+    atomic_store_explicit(&sc_done, 1, memory_order_release);
+    pthread_join(reader, NULL);
+    *final = sc_read(k);
+    return ms;
+}
+
+static void benchmark_scalable_counters(void)
+{
+    /* A tenth of the other patterns' iterations: combining is slow */
+    long iters = get_pattern_iterations() / 10;
+    if (iters < 1)
+        iters = 1;
+    int counts[] = { 1, 2, 4, NUM_THREADS };
+
+    sc_ncpus = get_nprocs_conf();
+    if (sc_ncpus < 1) sc_ncpus = 1;
+    if (sc_ncpus > SC_MAX_CPUS) sc_ncpus = SC_MAX_CPUS;
+    sc_max_cells = 2;
+    while (sc_max_cells < sc_ncpus && sc_max_cells < SC_MAX_CELLS)
+        sc_max_cells *= 2;
+
+    printf("\n  Pattern: SCALABLE COUNTERS\n");
+    printf("  Hot counter designs; a concurrent reader measures read cost and staleness\n");
+    printf("  Iterations: %ldM per thread, CPUs: %d, tls_batch flushes every %d, rseq: %s\n",
+           iters / 1000000, sc_ncpus, SC_BATCH,
+#ifdef HAVE_RSEQ
+           __rseq_size > 0 ? "yes" : "no (sched_getcpu)"
+#else
+           "no (sched_getcpu)"
+#endif
+           );
+    printf("  %-8s %-10s %12s %12s %10s %12s %10s %6s\n", "Threads", "Design",
+           "Time (ms)", "Ops/sec", "Read (ns)", "Stale avg", "Stale max", "Final");
+
+    for (size_t ci = 0; ci < sizeof(counts) / sizeof(counts[0]); ci++) {
+        int nthreads = counts[ci];
+        for (int k = 0; k < SC_NKINDS; k++) {
+            struct sc_reader_args rd;
+            long final;
+            double ms = run_scalable_counter((enum sc_kind)k, nthreads, iters, &rd, &final);
+            double total = (double)nthreads * (double)iters;
+
+            printf("  %-8d %-10s %12.1f %12.0f %10.1f %12.1f %10ld %6s\n",
+                   nthreads, sc_names[k], ms, total / (ms / 1000), rd.read_ns,
+                   rd.stale_avg, rd.stale_max, final == (long)total ? "exact" : "WRONG");
+            print_perf(&pat_perf, total);
+        }
+        if (ci + 1 < sizeof(counts) / sizeof(counts[0]))
+            printf("  %s\n", "--------");
+    }
+    printf("  Pick: tls_batch when a read may lag by threads x batch; per_cpu or striped\n");
+    printf("  when reads must be exact and rare; combining when the update is not an add\n");
+}
+
 /* ═══════════════════════════════════════════════════════════════ */
 
 int main(int argc, char *argv[])
 {
-    const char *pattern = (argc > 1) ? argv[1] : "all";
+    const char *pattern = "all";
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--perf") == 0)
+            pg_enabled = 1;
+        else
+            pattern = argv[i];
+    }
+
+    topo_place_env();
+    tsc_init();
 
     printf("Real-World False Sharing Patterns\n");
     print_separator();
@@ -439,10 +867,16 @@ int main(int argc, char *argv[])
         print_separator();
         ran = 1;
     }
+    if (strcmp(pattern, "all") == 0 || strcmp(pattern, "scalable_counters") == 0) {
+        benchmark_scalable_counters();
+        print_separator();
+        ran = 1;
+    }
 
     if (!ran) {
         fprintf(stderr, "Unknown pattern: %s\n", pattern);
-        fprintf(stderr, "Available: array_counters, producer_consumer, hash_buckets, thread_stats, all\n");
+        fprintf(stderr, "Available: array_counters, producer_consumer, hash_buckets, thread_stats,\n"
+                        "           scalable_counters, all\n");
         return 1;
     }
 
@@ -5,56 +5,24 @@
  * programmatically, comparing cache behavior for packed vs padded layouts.
  */
 #include "common.h"
-#include <sys/ioctl.h>
-#include <sys/syscall.h>
-#include <linux/perf_event.h>
-#include <linux/hw_breakpoint.h>
-
-/* ── Perf event helpers ─────────────────────────────────────── */
-
-static long perf_event_open(struct perf_event_attr *attr, pid_t pid,
-                            int cpu, int group_fd, unsigned long flags)
-{
-    return syscall(__NR_perf_event_open, attr, pid, cpu, group_fd, flags);
-}
-
-struct counter_set {
-    int fd_cache_refs;
-    int fd_cache_misses;
-    int fd_l1d_misses;
-    int fd_llc_misses;
+#include "topology.h"
+#include "perf_group.h"
+
+/* ── Counter set ────────────────────────────────────────────── */
+
+enum { EV_CACHE_REFS, EV_CACHE_MISSES, EV_L1D_MISSES, EV_LLC_MISSES, EV_COUNT };
+
+static const struct pg_event events[EV_COUNT] = {
+    [EV_CACHE_REFS]   = { "cache-references", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES },
+    [EV_CACHE_MISSES] = { "cache-misses",     PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+    [EV_L1D_MISSES]   = { "L1-dcache-load-misses", PERF_TYPE_HW_CACHE,
+                          PG_HW_CACHE(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_OP_READ,
+                                      PERF_COUNT_HW_CACHE_RESULT_MISS) },
+    [EV_LLC_MISSES]   = { "LLC-load-misses",  PERF_TYPE_HW_CACHE,
+                          PG_HW_CACHE(PERF_COUNT_HW_CACHE_LL, PERF_COUNT_HW_CACHE_OP_READ,
+                                      PERF_COUNT_HW_CACHE_RESULT_MISS) },
 };
 
-static void start_counters(struct counter_set *cs)
-{
-    int fds[] = { cs->fd_cache_refs, cs->fd_cache_misses, cs->fd_l1d_misses, cs->fd_llc_misses };
-    for (int i = 0; i < 4; i++) {
-        if (fds[i] >= 0) {
-            ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
-            ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
-        }
-    }
-}
-
-static void stop_counters(struct counter_set *cs)
-{
-    int fds[] = { cs->fd_cache_refs, cs->fd_cache_misses, cs->fd_l1d_misses, cs->fd_llc_misses };
-    for (int i = 0; i < 4; i++) {
-        if (fds[i] >= 0)
-            ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
-    }
-}
-
-static long long read_counter(int fd)
-{
-    long long val = -1;
-    if (fd >= 0) {
-        if (read(fd, &val, sizeof(val)) < 0)
-            val = -1;
-    }
-    return val;
-}
-
 struct counter_vals {
     long long cache_refs;
     long long cache_misses;
@@ -62,30 +30,17 @@ struct counter_vals {
     long long llc_misses;
 };
 
-static void read_all_counters(struct counter_set *cs, struct counter_vals *vals)
-{
-    vals->cache_refs   = read_counter(cs->fd_cache_refs);
-    vals->cache_misses = read_counter(cs->fd_cache_misses);
-    vals->l1d_misses   = read_counter(cs->fd_l1d_misses);
-    vals->llc_misses   = read_counter(cs->fd_llc_misses);
-}
-
-static void close_counters(struct counter_set *cs)
+static long long count_of(const struct pg_counts *c, int ev)
 {
-    int fds[] = { cs->fd_cache_refs, cs->fd_cache_misses, cs->fd_l1d_misses, cs->fd_llc_misses };
-    for (int i = 0; i < 4; i++) {
-        if (fds[i] >= 0)
-            close(fds[i]);
-    }
+    return c->have[ev] ? (long long)c->val[ev] : -1;
 }
 
 /* ── Benchmark (same as basic_demo but single-threaded per measurement) ── */
 
 /*
- * We run the benchmark in the MAIN thread to capture perf counters
- * (perf_event_open with pid=0 counts the calling thread).
- * Two volatile pointers simulate the two-thread write pattern by
- * alternating writes to both counters.
+ * Each worker opens its own counter group (perf_group.h) around its
+ * loop, so all four events are scheduled together and scaled if the
+ * PMU is multiplexed; the two threads' counts are summed.
  */
 
 struct packed_counters {
@@ -103,6 +58,7 @@ struct thread_args {
     _Atomic long *counter;
     long iterations;
     int core;
+    struct pg_counts counts;
 };
 
 static void *worker(void *arg)
@@ -110,45 +66,20 @@ static void *worker(void *arg)
     struct thread_args *ta = (struct thread_args *)arg;
     pin_to_core(ta->core);
 
+    struct pg_set ps;
+    struct pg_counts c = {0};
+    pg_open(&ps, events, EV_COUNT);
+    pg_start(&ps);
+
     _Atomic long *ctr = ta->counter;
     long iters = ta->iterations;
     for (long i = 0; i < iters; i++)
         atomic_fetch_add_explicit(ctr, 1, memory_order_relaxed);
-    return NULL;
-}
 
-static int open_process_counter(uint32_t type, uint64_t config)
-{
-    struct perf_event_attr pe;
-    memset(&pe, 0, sizeof(pe));
-    pe.type = type;
-    pe.size = sizeof(pe);
-    pe.config = config;
-    pe.disabled = 1;
-    pe.exclude_kernel = 1;
-    pe.exclude_hv = 1;
-    pe.inherit = 1;  /* count child threads too */
-
-    int fd = (int)perf_event_open(&pe, 0, -1, -1, 0);
-    if (fd < 0)
-        fprintf(stderr, "warning: perf_event_open failed: %s\n", strerror(errno));
-    return fd;
-}
-
-static void open_process_counters(struct counter_set *cs)
-{
-    cs->fd_cache_refs   = open_process_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES);
-    cs->fd_cache_misses = open_process_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
-
-    uint64_t l1d_config = PERF_COUNT_HW_CACHE_L1D
-                        | (PERF_COUNT_HW_CACHE_OP_READ << 8)
-                        | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
-    cs->fd_l1d_misses = open_process_counter(PERF_TYPE_HW_CACHE, l1d_config);
-
-    uint64_t llc_config = PERF_COUNT_HW_CACHE_LL
-                        | (PERF_COUNT_HW_CACHE_OP_READ << 8)
-                        | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
-    cs->fd_llc_misses = open_process_counter(PERF_TYPE_HW_CACHE, llc_config);
+    pg_stop(&ps, &c);
+    pg_close(&ps);
+    ta->counts = c;
+    return NULL;
 }
 
 static void run_with_counters(_Atomic long *counter_a, _Atomic long *counter_b,
@@ -162,10 +93,6 @@ static void run_with_counters(_Atomic long *counter_a, _Atomic long *counter_b,
     struct thread_args args_a = { .counter = counter_a, .iterations = iterations, .core = core_a };
     struct thread_args args_b = { .counter = counter_b, .iterations = iterations, .core = core_b };
 
-    struct counter_set cs;
-    open_process_counters(&cs);
-
-    start_counters(&cs);
     uint64_t t0 = now_ns();
 
     pthread_t t1, t2;
@@ -175,9 +102,14 @@ static void run_with_counters(_Atomic long *counter_a, _Atomic long *counter_b,
     pthread_join(t2, NULL);
 
     uint64_t t1_end = now_ns();
-    stop_counters(&cs);
-    read_all_counters(&cs, out_vals);
-    close_counters(&cs);
+
+    struct pg_counts total = {0};
+    pg_counts_add(&total, &args_a.counts);
+    pg_counts_add(&total, &args_b.counts);
+    out_vals->cache_refs   = count_of(&total, EV_CACHE_REFS);
+    out_vals->cache_misses = count_of(&total, EV_CACHE_MISSES);
+    out_vals->l1d_misses   = count_of(&total, EV_L1D_MISSES);
+    out_vals->llc_misses   = count_of(&total, EV_LLC_MISSES);
 
     *out_ms = elapsed_ms(t0, t1_end);
     (void)label;
@@ -192,9 +124,10 @@ static void print_val(const char *name, long long packed, long long padded)
 int main(void)
 {
     long iterations = get_iterations();
-    int ncores = get_num_cores();
-    int core_a = 0;
-    int core_b = ncores / 2;
+    pg_enabled = 1;
+    topo_place_env();
+    int core_a = topo_cpu_for(0);
+    int core_b = topo_cpu_for(1);
 
     printf("Hardware Counter Comparison: False Sharing\n");
     print_separator();
@@ -0,0 +1,275 @@
+#ifndef PERF_GROUP_H
+#define PERF_GROUP_H
+
+/*
+ * perf_group.h — Grouped per-thread hardware counters for benchmarks
+ *
+ * Each thread opens one event group on itself (PERF_FORMAT_GROUP), so
+ * its counters are scheduled onto the PMU together and read with one
+ * read(). When more events compete than there are counters (other perf
+ * users, the NMI watchdog) the kernel multiplexes whole groups; values
+ * are scaled by time_enabled / time_running, and the ratio is reported
+ * so heavily multiplexed numbers can be spotted.
+ *
+ *   struct pg_set s;                                  (one per thread)
+ *   pg_open(&s, pg_default_events, PG_DEFAULT_N);
+ *   pg_start(&s); ...phase...; pg_stop(&s, &counts);  (repeatable; adds up)
+ *   pg_close(&s);
+ *
+ * Workers usually just bracket their loop with pg_thread_begin() and
+ * pg_thread_end(), which merges into a shared pg_counts. Everything is a
+ * no-op unless pg_enabled is set (the benchmarks' --perf flag).
+ *
+ * Self-contained (no common.h): also used by 04-memory-allocator-benchmark.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#define PG_MAX_EVENTS 8
+
+struct pg_event {
+    const char *name;
+    uint32_t    type;
+    uint64_t    config;
+};
+
+#define PG_HW_CACHE(cache, op, result) \
+    ((uint64_t)(cache) | ((uint64_t)(op) << 8) | ((uint64_t)(result) << 16))
+
+/* Default set: enough for IPC, cache misses and dTLB misses per op */
+enum { PG_CYCLES, PG_INSTRUCTIONS, PG_CACHE_MISSES, PG_DTLB_MISSES, PG_DEFAULT_N };
+
+static const struct pg_event pg_default_events[PG_DEFAULT_N] = {
+    [PG_CYCLES]       = { "cycles",           PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    [PG_INSTRUCTIONS] = { "instructions",     PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    [PG_CACHE_MISSES] = { "cache-misses",     PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+    [PG_DTLB_MISSES]  = { "dTLB-load-misses", PERF_TYPE_HW_CACHE,
+                          PG_HW_CACHE(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_READ,
+                                      PERF_COUNT_HW_CACHE_RESULT_MISS) },
+};
+
+struct pg_set {
+    int      n;                     /* events in the list */
+    int      leader;                /* -1: nothing could be opened */
+    int      fd[PG_MAX_EVENTS];     /* -1: event unavailable */
+    uint64_t id[PG_MAX_EVENTS];
+    uint64_t enabled0, running0;    /* group times at pg_start */
+};
+
+struct pg_counts {
+    double   val[PG_MAX_EVENTS];    /* scaled for multiplexing */
+    int      have[PG_MAX_EVENTS];
+    uint64_t enabled, running;      /* ns, summed over phases and threads */
+};
+
+static int pg_enabled = 0;
+static int pg_warned = 0;
+static pthread_mutex_t pg_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Group read layout for GROUP | TOTAL_TIME_ENABLED | TOTAL_TIME_RUNNING | ID */
+struct pg_read_buf {
+    uint64_t nr;
+    uint64_t enabled;
+    uint64_t running;
+    struct {
+        uint64_t value;
+        uint64_t id;
+    } ev[PG_MAX_EVENTS];
+};
+
+static inline int pg_read(const struct pg_set *s, struct pg_read_buf *rb)
+{
+    ssize_t n = read(s->leader, rb, sizeof(*rb));
+    return n >= (ssize_t)(3 * sizeof(uint64_t)) ? 0 : -1;
+}
+
+/* Open the events for the calling thread. Unavailable events are left
+ * out of the group; returns 0 if at least one opened. */
+static inline int pg_open(struct pg_set *s, const struct pg_event *ev, int n)
+{
+    memset(s, 0, sizeof(*s));
+    s->n = n < PG_MAX_EVENTS ? n : PG_MAX_EVENTS;
+    s->leader = -1;
+    for (int i = 0; i < PG_MAX_EVENTS; i++)
+        s->fd[i] = -1;
+    if (!pg_enabled)
+        return -1;
+
+    int err = 0;
+    for (int i = 0; i < s->n; i++) {
+        struct perf_event_attr pe;
+        memset(&pe, 0, sizeof(pe));
+        pe.type = ev[i].type;
+        pe.size = sizeof(pe);
+        pe.config = ev[i].config;
+        pe.disabled = s->leader < 0;    /* members follow the leader */
+        pe.exclude_kernel = 1;
+        pe.exclude_hv = 1;
+        pe.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_ID |
+                         PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        int fd = (int)syscall(__NR_perf_event_open, &pe, 0, -1, s->leader,
+                              PERF_FLAG_FD_CLOEXEC);
+        if (fd < 0) {
+            err = errno;
+            continue;
+        }
+        if (ioctl(fd, PERF_EVENT_IOC_ID, &s->id[i]) < 0) {
+            close(fd);
+            continue;
+        }
+        if (s->leader < 0)
+            s->leader = fd;
+        s->fd[i] = fd;
+    }
+
+    if (err) {
+        pthread_mutex_lock(&pg_lock);
+        if (!pg_warned) {
+            pg_warned = 1;
+            fprintf(stderr, "warning: perf counters: %s%s\n", strerror(err),
+                    err == EACCES || err == EPERM
+                        ? " (try: sudo sysctl kernel.perf_event_paranoid=1)"
+                        : err == ENOENT ? " (no hardware PMU, e.g. in a VM)" : "");
+        }
+        pthread_mutex_unlock(&pg_lock);
+    }
+    return s->leader < 0 ? -1 : 0;
+}
+
+static inline void pg_start(struct pg_set *s)
+{
+    if (s->leader < 0)
+        return;
+    ioctl(s->leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+
+    /* The reset clears the counts but not the times: remember them */
+    struct pg_read_buf rb;
+    if (pg_read(s, &rb) == 0) {
+        s->enabled0 = rb.enabled;
+        s->running0 = rb.running;
+    }
+    ioctl(s->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+/* Stop the phase and add its (scaled) counts to c */
+static inline void pg_stop(struct pg_set *s, struct pg_counts *c)
+{
+    if (s->leader < 0)
+        return;
+    ioctl(s->leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+    struct pg_read_buf rb;
+    if (pg_read(s, &rb) < 0)
+        return;
+    uint64_t enabled = rb.enabled - s->enabled0;
+    uint64_t running = rb.running - s->running0;
+    c->enabled += enabled;
+    c->running += running;
+    if (running == 0)
+        return;     /* group never got onto the PMU */
+
+    double scale = (double)enabled / (double)running;
+    for (uint64_t k = 0; k < rb.nr && k < PG_MAX_EVENTS; k++) {
+        for (int i = 0; i < s->n; i++) {
+            if (s->fd[i] >= 0 && s->id[i] == rb.ev[k].id) {
+                c->val[i] += (double)rb.ev[k].value * scale;
+                c->have[i] = 1;
+                break;
+            }
+        }
+    }
+}
+
+static inline void pg_close(struct pg_set *s)
+{
+    for (int i = 0; i < s->n; i++)
+        if (s->fd[i] >= 0)
+            close(s->fd[i]);
+    s->leader = -1;
+}
+
+static inline void pg_counts_add(struct pg_counts *dst, const struct pg_counts *src)
+{
+    for (int i = 0; i < PG_MAX_EVENTS; i++) {
+        dst->val[i] += src->val[i];
+        dst->have[i] |= src->have[i];
+    }
+    dst->enabled += src->enabled;
+    dst->running += src->running;
+}
+
+/* ── Per-thread convenience (default events) ── */
+
+static inline void pg_thread_begin(struct pg_set *s)
+{
+    if (pg_open(s, pg_default_events, PG_DEFAULT_N) == 0)
+        pg_start(s);
+}
+
+/* Stop, close, and merge this thread's counts into a shared total */
+static inline void pg_thread_end(struct pg_set *s, struct pg_counts *total)
+{
+    if (s->leader < 0)
+        return;
+    struct pg_counts c;
+    memset(&c, 0, sizeof(c));
+    pg_stop(s, &c);
+    pg_close(s);
+
+    pthread_mutex_lock(&pg_lock);
+    pg_counts_add(total, &c);
+    pthread_mutex_unlock(&pg_lock);
+}
+
+/* ── Reporting (default events) ── */
+
+static inline double pg_per_op(const struct pg_counts *c, int ev, double ops)
+{
+    return (c->have[ev] && ops > 0) ? c->val[ev] / ops : -1;
+}
+
+/* "IPC 1.23  cache-miss/op 0.0120  dTLB-miss/op 0.0010" ("n/a" when not
+ * counted), plus the fraction of time counted when multiplexed */
+static inline const char *pg_format(const struct pg_counts *c, double ops,
+                                    char *buf, size_t len)
+{
+    char ipc[16] = "n/a", cm[16] = "n/a", tlb[16] = "n/a";
+    if (c->have[PG_CYCLES] && c->have[PG_INSTRUCTIONS] && c->val[PG_CYCLES] > 0)
+        snprintf(ipc, sizeof(ipc), "%.2f", c->val[PG_INSTRUCTIONS] / c->val[PG_CYCLES]);
+    if (pg_per_op(c, PG_CACHE_MISSES, ops) >= 0)
+        snprintf(cm, sizeof(cm), "%.4f", pg_per_op(c, PG_CACHE_MISSES, ops));
+    if (pg_per_op(c, PG_DTLB_MISSES, ops) >= 0)
+        snprintf(tlb, sizeof(tlb), "%.4f", pg_per_op(c, PG_DTLB_MISSES, ops));
+
+    int pos = snprintf(buf, len, "IPC %s  cache-miss/op %s  dTLB-miss/op %s", ipc, cm, tlb);
+    if (c->enabled && c->running < c->enabled && pos > 0 && (size_t)pos < len)
+        snprintf(buf + pos, len - pos, "  (counted %.0f%% of the time)",
+                 100.0 * (double)c->running / (double)c->enabled);
+    return buf;
+}
+
+#define PG_CSV_HEADER ",ipc,cache_misses_per_op,dtlb_misses_per_op"
+
+/* ",1.23,0.0120,0.0010" with empty fields when not counted */
+static inline const char *pg_csv(const struct pg_counts *c, double ops, char *buf, size_t len)
+{
+    char ipc[24] = "", cm[24] = "", tlb[24] = "";
+    if (c->have[PG_CYCLES] && c->have[PG_INSTRUCTIONS] && c->val[PG_CYCLES] > 0)
+        snprintf(ipc, sizeof(ipc), "%.3f", c->val[PG_INSTRUCTIONS] / c->val[PG_CYCLES]);
+    if (pg_per_op(c, PG_CACHE_MISSES, ops) >= 0)
+        snprintf(cm, sizeof(cm), "%.5f", pg_per_op(c, PG_CACHE_MISSES, ops));
+    if (pg_per_op(c, PG_DTLB_MISSES, ops) >= 0)
+        snprintf(tlb, sizeof(tlb), "%.5f", pg_per_op(c, PG_DTLB_MISSES, ops));
+    snprintf(buf, len, ",%s,%s,%s", ipc, cm, tlb);
+    return buf;
+}
+
+#endif /* PERF_GROUP_H */
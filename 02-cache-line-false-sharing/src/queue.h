@@ -0,0 +1,517 @@
+#ifndef QUEUE_H
+#define QUEUE_H
+
+/*
+ * queue.h — Bounded lock-free queues for handing pointers between threads
+ *
+ *   spsc   one producer, one consumer. head and tail sit on separate
+ *          cache lines and each side caches the other's index, so the
+ *          shared lines only move when the cached view runs out — about
+ *          once per lap when the queue is streaming, not once per item.
+ *   fanin  N producers, one consumer: one spsc lane per producer, drained
+ *          round-robin. No two producers ever write the same line.
+ *   mpmc   N producers, M consumers (Vyukov's bounded queue): a sequence
+ *          number per slot, one CAS per operation on the enqueue or
+ *          dequeue counter, no ABA and no NULL-spinning for publication.
+ *
+ * The *_push_batch / *_pop_batch variants move up to n items for one
+ * index publication (spsc) or one CAS (mpmc). Items are non-NULL
+ * pointers; pops return NULL (or 0 items) when empty, pushes return -1
+ * (or fewer than n) when full.
+ *
+ * struct queue wraps the three behind one interface, so a benchmark can
+ * take the transport as an option (queue_kind_from_name).
+ *
+ * Self-contained (no common.h): also used by 04-memory-allocator-benchmark.
+ */
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <sched.h>
+
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
+
+static inline void queue_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __asm__ volatile("pause" ::: "memory");
+#elif defined(__aarch64__)
+    __asm__ volatile("yield" ::: "memory");
+#endif
+}
+
+/* Spin briefly, then yield: the peer we wait for may share our CPU */
+static inline void queue_backoff(unsigned *spins)
+{
+    if (++*spins < 64)
+        queue_relax();
+    else
+        sched_yield();
+}
+
+static inline size_t queue_pow2(size_t n)
+{
+    size_t c = 2;
+    while (c < n)
+        c <<= 1;
+    return c;
+}
+
+/* Zeroed, cache-line aligned allocation for the queue structs */
+static inline void *queue_alloc(size_t size)
+{
+    size = (size + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+    void *p = aligned_alloc(CACHE_LINE_SIZE, size);
+    if (p)
+        memset(p, 0, size);
+    return p;
+}
+
+/* ── SPSC ── */
+
+struct spsc_queue {
+    /* Producer's line */
+    _Alignas(CACHE_LINE_SIZE) _Atomic size_t head;  /* next slot to write */
+    size_t cached_tail;
+    /* Consumer's line */
+    _Alignas(CACHE_LINE_SIZE) _Atomic size_t tail;  /* next slot to read */
+    size_t cached_head;
+    /* Read-only after init */
+    _Alignas(CACHE_LINE_SIZE) void **slots;
+    size_t mask;
+};
+
+static inline int spsc_init(struct spsc_queue *q, size_t capacity)
+{
+    size_t cap = queue_pow2(capacity);
+    memset(q, 0, sizeof(*q));
+    q->slots = calloc(cap, sizeof(void *));
+    if (!q->slots)
+        return -1;
+    q->mask = cap - 1;
+    return 0;
+}
+
+static inline void spsc_destroy(struct spsc_queue *q)
+{
+    free(q->slots);
+    q->slots = NULL;
+}
+
+static inline int spsc_push(struct spsc_queue *q, void *item)
+{
+    size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    if (head - q->cached_tail > q->mask) {
+        q->cached_tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+        if (head - q->cached_tail > q->mask)
+            return -1;
+    }
+    q->slots[head & q->mask] = item;
+    atomic_store_explicit(&q->head, head + 1, memory_order_release);
+    return 0;
+}
+
+static inline void *spsc_pop(struct spsc_queue *q)
+{
+    size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    if (tail == q->cached_head) {
+        q->cached_head = atomic_load_explicit(&q->head, memory_order_acquire);
+        if (tail == q->cached_head)
+            return NULL;
+    }
+    void *item = q->slots[tail & q->mask];
+    atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+    return item;
+}
+
+/* Push up to n items with one publication; returns how many went in */
+static inline size_t spsc_push_batch(struct spsc_queue *q, void *const *items, size_t n)
+{
+    size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    size_t room = q->mask + 1 - (head - q->cached_tail);
+    if (room < n) {
+        q->cached_tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+        room = q->mask + 1 - (head - q->cached_tail);
+    }
+    if (n > room)
+        n = room;
+    for (size_t i = 0; i < n; i++)
+        q->slots[(head + i) & q->mask] = items[i];
+    if (n)
+        atomic_store_explicit(&q->head, head + n, memory_order_release);
+    return n;
+}
+
+static inline size_t spsc_pop_batch(struct spsc_queue *q, void **out, size_t max)
+{
+    size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    size_t avail = q->cached_head - tail;
+    if (avail < max) {
+        q->cached_head = atomic_load_explicit(&q->head, memory_order_acquire);
+        avail = q->cached_head - tail;
+    }
+    if (max > avail)
+        max = avail;
+    for (size_t i = 0; i < max; i++)
+        out[i] = q->slots[(tail + i) & q->mask];
+    if (max)
+        atomic_store_explicit(&q->tail, tail + max, memory_order_release);
+    return max;
+}
+
+/* ── Fan-in: one SPSC lane per producer ── */
+
+struct fanin_queue {
+    struct spsc_queue *lanes;
+    int nlanes;
+    /* Consumer's round-robin cursor, kept off the line producers read */
+    _Alignas(CACHE_LINE_SIZE) int next;
+};
+
+static inline int fanin_init(struct fanin_queue *q, int nlanes, size_t lane_capacity)
+{
+    memset(q, 0, sizeof(*q));
+    q->lanes = queue_alloc((size_t)nlanes * sizeof(*q->lanes));
+    if (!q->lanes)
+        return -1;
+    q->nlanes = nlanes;
+    for (int i = 0; i < nlanes; i++) {
+        if (spsc_init(&q->lanes[i], lane_capacity) < 0) {
+            while (i--)
+                spsc_destroy(&q->lanes[i]);
+            free(q->lanes);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static inline void fanin_destroy(struct fanin_queue *q)
+{
+    for (int i = 0; i < q->nlanes; i++)
+        spsc_destroy(&q->lanes[i]);
+    free(q->lanes);
+    q->lanes = NULL;
+}
+
+static inline int fanin_push(struct fanin_queue *q, int lane, void *item)
+{
+    return spsc_push(&q->lanes[lane], item);
+}
+
+static inline size_t fanin_push_batch(struct fanin_queue *q, int lane,
+                                      void *const *items, size_t n)
+{
+    return spsc_push_batch(&q->lanes[lane], items, n);
+}
+
+static inline void *fanin_pop(struct fanin_queue *q)
+{
+    for (int k = 0; k < q->nlanes; k++) {
+        int lane = (q->next + k) % q->nlanes;
+        void *item = spsc_pop(&q->lanes[lane]);
+        if (item) {
+            q->next = (lane + 1) % q->nlanes;
+            return item;
+        }
+    }
+    return NULL;
+}
+
+/* One pass over the lanes, starting after the last lane served */
+static inline size_t fanin_pop_batch(struct fanin_queue *q, void **out, size_t max)
+{
+    size_t got = 0;
+    for (int k = 0; k < q->nlanes && got < max; k++) {
+        int lane = (q->next + k) % q->nlanes;
+        got += spsc_pop_batch(&q->lanes[lane], out + got, max - got);
+    }
+    q->next = (q->next + 1) % q->nlanes;
+    return got;
+}
+
+/* ── MPMC (Vyukov) ── */
+
+struct mpmc_cell {
+    _Atomic size_t seq;     /* pos: free for pos; pos + 1: holds pos's item */
+    void *data;
+};
+
+struct mpmc_queue {
+    _Alignas(CACHE_LINE_SIZE) _Atomic size_t enqueue_pos;
+    _Alignas(CACHE_LINE_SIZE) _Atomic size_t dequeue_pos;
+    _Alignas(CACHE_LINE_SIZE) struct mpmc_cell *cells;
+    size_t mask;
+};
+
+static inline int mpmc_init(struct mpmc_queue *q, size_t capacity)
+{
+    size_t cap = queue_pow2(capacity);
+    memset(q, 0, sizeof(*q));
+    q->cells = queue_alloc(cap * sizeof(*q->cells));
+    if (!q->cells)
+        return -1;
+    for (size_t i = 0; i < cap; i++)
+        atomic_store_explicit(&q->cells[i].seq, i, memory_order_relaxed);
+    q->mask = cap - 1;
+    return 0;
+}
+
+static inline void mpmc_destroy(struct mpmc_queue *q)
+{
+    free(q->cells);
+    q->cells = NULL;
+}
+
+static inline int mpmc_push(struct mpmc_queue *q, void *item)
+{
+    size_t pos = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
+    struct mpmc_cell *c;
+    for (;;) {
+        c = &q->cells[pos & q->mask];
+        size_t seq = atomic_load_explicit(&c->seq, memory_order_acquire);
+        intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+        if (dif == 0) {
+            if (atomic_compare_exchange_weak_explicit(&q->enqueue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed))
+                break;
+        } else if (dif < 0) {
+            return -1;      /* slot still holds last lap's item: full */
+        } else {
+            pos = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
+        }
+    }
+    c->data = item;
+    atomic_store_explicit(&c->seq, pos + 1, memory_order_release);
+    return 0;
+}
+
+static inline void *mpmc_pop(struct mpmc_queue *q)
+{
+    size_t pos = atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed);
+    struct mpmc_cell *c;
+    for (;;) {
+        c = &q->cells[pos & q->mask];
+        size_t seq = atomic_load_explicit(&c->seq, memory_order_acquire);
+        intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+        if (dif == 0) {
+            if (atomic_compare_exchange_weak_explicit(&q->dequeue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed))
+                break;
+        } else if (dif < 0) {
+            return NULL;    /* not yet published: empty */
+        } else {
+            pos = atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed);
+        }
+    }
+    void *item = c->data;
+    atomic_store_explicit(&c->seq, pos + q->mask + 1, memory_order_release);
+    return item;
+}
+
+/*
+ * Batches claim k consecutive positions with one CAS, choosing k (halving
+ * from n) so that the LAST claimed cell is ready. Positions are claimed
+ * in order, so every earlier cell's previous owner has already claimed it
+ * too and is at most mid-copy: we wait for its seq store instead of
+ * failing.
+ */
+static inline size_t mpmc_push_batch(struct mpmc_queue *q, void *const *items, size_t n)
+{
+    size_t pos = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
+    size_t k;
+    for (;;) {
+        for (k = n; k > 0; k /= 2) {
+            size_t seq = atomic_load_explicit(&q->cells[(pos + k - 1) & q->mask].seq,
+                                              memory_order_acquire);
+            if (seq == pos + k - 1)
+                break;
+        }
+        if (k == 0) {
+            size_t seq = atomic_load_explicit(&q->cells[pos & q->mask].seq,
+                                              memory_order_acquire);
+            if ((intptr_t)seq - (intptr_t)pos < 0)
+                return 0;   /* full */
+            pos = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
+            continue;
+        }
+        if (atomic_compare_exchange_weak_explicit(&q->enqueue_pos, &pos, pos + k,
+                                                  memory_order_relaxed,
+                                                  memory_order_relaxed))
+            break;
+    }
+
+    for (size_t i = 0; i < k; i++) {
+        struct mpmc_cell *c = &q->cells[(pos + i) & q->mask];
+        unsigned spins = 0;
+        while (atomic_load_explicit(&c->seq, memory_order_acquire) != pos + i)
+            queue_backoff(&spins);
+        c->data = items[i];
+        atomic_store_explicit(&c->seq, pos + i + 1, memory_order_release);
+    }
+    return k;
+}
+
+static inline size_t mpmc_pop_batch(struct mpmc_queue *q, void **out, size_t max)
+{
+    size_t pos = atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed);
+    size_t k;
+    for (;;) {
+        for (k = max; k > 0; k /= 2) {
+            size_t seq = atomic_load_explicit(&q->cells[(pos + k - 1) & q->mask].seq,
+                                              memory_order_acquire);
+            if (seq == pos + k)
+                break;
+        }
+        if (k == 0) {
+            size_t seq = atomic_load_explicit(&q->cells[pos & q->mask].seq,
+                                              memory_order_acquire);
+            if ((intptr_t)seq - (intptr_t)(pos + 1) < 0)
+                return 0;   /* empty */
+            pos = atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed);
+            continue;
+        }
+        if (atomic_compare_exchange_weak_explicit(&q->dequeue_pos, &pos, pos + k,
+                                                  memory_order_relaxed,
+                                                  memory_order_relaxed))
+            break;
+    }
+
+    for (size_t i = 0; i < k; i++) {
+        struct mpmc_cell *c = &q->cells[(pos + i) & q->mask];
+        unsigned spins = 0;
+        while (atomic_load_explicit(&c->seq, memory_order_acquire) != pos + i + 1)
+            queue_backoff(&spins);
+        out[i] = c->data;
+        atomic_store_explicit(&c->seq, pos + i + q->mask + 1, memory_order_release);
+    }
+    return k;
+}
+
+/* ── One interface over all three ── */
+
+enum queue_kind { QUEUE_SPSC, QUEUE_FANIN, QUEUE_MPMC };
+
+static const char *const queue_kind_names[] = { "spsc", "fanin", "mpmc" };
+
+struct queue {
+    enum queue_kind kind;
+    union {
+        struct spsc_queue  *spsc;
+        struct fanin_queue *fanin;
+        struct mpmc_queue  *mpmc;
+    };
+};
+
+/* Returns the kind for a name, or -1 */
+static inline int queue_kind_from_name(const char *name)
+{
+    for (int k = 0; k < 3; k++)
+        if (strcmp(name, queue_kind_names[k]) == 0)
+            return k;
+    return -1;
+}
+
+/* capacity is per lane for fanin. spsc takes one producer, fanin
+ * nproducers (each passing its index as `producer`), mpmc any number. */
+static inline int queue_init(struct queue *q, enum queue_kind kind, int nproducers,
+                             size_t capacity)
+{
+    int rc = -1;
+    q->kind = kind;
+    switch (kind) {
+    case QUEUE_SPSC:
+        if ((q->spsc = queue_alloc(sizeof(*q->spsc))))
+            rc = spsc_init(q->spsc, capacity);
+        break;
+    case QUEUE_FANIN:
+        if ((q->fanin = queue_alloc(sizeof(*q->fanin))))
+            rc = fanin_init(q->fanin, nproducers, capacity);
+        break;
+    case QUEUE_MPMC:
+        if ((q->mpmc = queue_alloc(sizeof(*q->mpmc))))
+            rc = mpmc_init(q->mpmc, capacity);
+        break;
+    }
+    if (rc < 0) {
+        free(q->spsc);      /* any union member: same pointer */
+        q->spsc = NULL;
+    }
+    return rc;
+}
+
+static inline void queue_destroy(struct queue *q)
+{
+    switch (q->kind) {
+    case QUEUE_SPSC:  if (q->spsc)  spsc_destroy(q->spsc);   break;
+    case QUEUE_FANIN: if (q->fanin) fanin_destroy(q->fanin); break;
+    case QUEUE_MPMC:  if (q->mpmc)  mpmc_destroy(q->mpmc);   break;
+    }
+    free(q->spsc);
+    q->spsc = NULL;
+}
+
+static inline size_t queue_push_batch(struct queue *q, int producer,
+                                      void *const *items, size_t n)
+{
+    switch (q->kind) {
+    case QUEUE_SPSC:  return spsc_push_batch(q->spsc, items, n);
+    case QUEUE_FANIN: return fanin_push_batch(q->fanin, producer, items, n);
+    case QUEUE_MPMC:  return mpmc_push_batch(q->mpmc, items, n);
+    }
+    return 0;
+}
+
+static inline size_t queue_pop_batch(struct queue *q, void **out, size_t max)
+{
+    switch (q->kind) {
+    case QUEUE_SPSC:  return spsc_pop_batch(q->spsc, out, max);
+    case QUEUE_FANIN: return fanin_pop_batch(q->fanin, out, max);
+    case QUEUE_MPMC:  return mpmc_pop_batch(q->mpmc, out, max);
+    }
+    return 0;
+}
+
+static inline int queue_push(struct queue *q, int producer, void *item)
+{
+    switch (q->kind) {
+    case QUEUE_SPSC:  return spsc_push(q->spsc, item);
+    case QUEUE_FANIN: return fanin_push(q->fanin, producer, item);
+    case QUEUE_MPMC:  return mpmc_push(q->mpmc, item);
+    }
+    return -1;
+}
+
+static inline void *queue_pop(struct queue *q)
+{
+    switch (q->kind) {
+    case QUEUE_SPSC:  return spsc_pop(q->spsc);
+    case QUEUE_FANIN: return fanin_pop(q->fanin);
+    case QUEUE_MPMC:  return mpmc_pop(q->mpmc);
+    }
+    return NULL;
+}
+
+/* Push all n items, backing off while full */
+static inline void queue_push_all(struct queue *q, int producer, void *const *items, size_t n)
+{
+    unsigned spins = 0;
+    while (n) {
+        size_t k = n == 1 ? (queue_push(q, producer, items[0]) == 0)
+                          : queue_push_batch(q, producer, items, n);
+        if (k) {
+            items += k;
+            n -= k;
+            spins = 0;
+        } else {
+            queue_backoff(&spins);
+        }
+    }
+}
+
+#endif /* QUEUE_H */
@@ -0,0 +1,414 @@
+/*
+ * queues.c — Lock-free queue designs under producer/consumer load
+ *
+ * Passes tagged integers (as pointers) from producers to consumers
+ * through each design in queue.h and two baselines, and reports
+ * throughput per design, shape (producers x consumers) and batch size:
+ *
+ *   naive_spsc  head and tail on one line, no index caching: the line
+ *               ping-pongs on every item (false sharing inside the queue)
+ *   cas_ring    CAS on both head and tail, NULL-spin for publication —
+ *               the ring bench_mt used for cross-thread free
+ *   spsc        padded, cached indices          (1 x 1)
+ *   fanin       one spsc lane per producer     (N x 1)
+ *   mpmc        Vyukov, per-slot sequence      (N x M)
+ *
+ * Consumers sum what they receive, so a lost or duplicated item shows
+ * up as WRONG.
+ *
+ * Usage:
+ *   ./queues                     # all shapes and designs
+ *   ./queues --csv               # CSV for plotting
+ *   ./queues --batch 64          # batch size for the batched rows (default 32)
+ *   ./queues --producers 4       # producers for the N x 1 and N x N shapes
+ *   ./queues --perf              # + IPC, cache/dTLB misses per item
+ *   ./queues --json FILE         # + results in the common schema (bench_json.h)
+ *   ITERATIONS=1000000 ./queues  # items per row (default 10M)
+ */
+#include "common.h"
+#include "topology.h"
+#include "perf_group.h"
+#include "queue.h"
+#include "bench_json.h"
+
+#define DEFAULT_ITEMS  10000000L
+#define QUEUE_CAPACITY 1024
+#define MAX_BATCH      1024
+#define MAX_SIDE       64      /* producers or consumers per row */
+
+static long get_items(void)
+{
+    const char *env = getenv("ITERATIONS");
+    if (env) {
+        long val = atol(env);
+        if (val > 0)
+            return val;
+    }
+    return DEFAULT_ITEMS;
+}
+
+/* ── Baselines ──────────────────────────────────────────────── */
+
+/* Textbook SPSC ring: both indices on one line, each side reads the
+ * other's index on every operation */
+struct naive_spsc {
+    _Atomic size_t head;
+    _Atomic size_t tail;
+    void **slots;
+    size_t mask;
+};
+
+static int naive_push(struct naive_spsc *q, void *item)
+{
+    size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    if (head - atomic_load_explicit(&q->tail, memory_order_acquire) > q->mask)
+        return -1;
+    q->slots[head & q->mask] = item;
+    atomic_store_explicit(&q->head, head + 1, memory_order_release);
+    return 0;
+}
+
+static void *naive_pop(struct naive_spsc *q)
+{
+    size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    if (tail == atomic_load_explicit(&q->head, memory_order_acquire))
+        return NULL;
+    void *item = q->slots[tail & q->mask];
+    atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+    return item;
+}
+
+/* The former bench_mt ring: producers CAS head, then store the pointer;
+ * consumers CAS tail, then spin until the pointer appears. tail moves
+ * before the slot is read, so a producer a lap ahead can reach a slot
+ * that is still occupied; the original overwrote it (losing an item and
+ * hanging a consumer), here the producer also spins until it is empty. */
+struct cas_ring {
+    void **buf;
+    size_t mask;
+    _Atomic long head;
+    _Atomic long tail;
+};
+
+static int cas_push(struct cas_ring *r, void *item)
+{
+    long head = atomic_load(&r->head);
+    for (;;) {
+        if (head - atomic_load(&r->tail) > (long)r->mask)
+            return -1;
+        if (atomic_compare_exchange_weak(&r->head, &head, head + 1))
+            break;
+    }
+    _Atomic(void *) *slot = (_Atomic(void *) *)&r->buf[head & r->mask];
+    unsigned spins = 0;
+    while (atomic_load_explicit(slot, memory_order_relaxed))
+        queue_backoff(&spins);
+    atomic_store_explicit(slot, item, memory_order_release);
+    return 0;
+}
+
+static void *cas_pop(struct cas_ring *r)
+{
+    long tail = atomic_load(&r->tail);
+    for (;;) {
+        if (tail >= atomic_load(&r->head))
+            return NULL;
+        if (atomic_compare_exchange_weak(&r->tail, &tail, tail + 1))
+            break;
+    }
+    _Atomic(void *) *slot = (_Atomic(void *) *)&r->buf[tail & r->mask];
+    void *item;
+    unsigned spins = 0;
+    while (!(item = atomic_exchange_explicit(slot, NULL, memory_order_acquire)))
+        queue_backoff(&spins);
+    return item;
+}
+
+/* ── One benchmark row ──────────────────────────────────────── */
+
+enum design { D_NAIVE, D_CAS, D_SPSC, D_FANIN, D_MPMC };
+
+static const char *design_names[] = { "naive_spsc", "cas_ring", "spsc", "fanin", "mpmc" };
+
+struct run {
+    enum design design;
+    int producers, consumers;
+    size_t batch;
+    long per_producer;
+    struct queue q;             /* spsc, fanin, mpmc */
+    struct naive_spsc *naive;
+    struct cas_ring ring;
+    _Atomic int producers_done;
+    _Atomic uint64_t sum;       /* what the consumers received */
+};
+
+struct thread_arg {
+    struct run *run;
+    int id;
+};
+
+static struct pg_counts q_perf;
+
+static void send(struct run *r, int id, void **items, size_t n)
+{
+    if (r->design >= D_SPSC) {
+        queue_push_all(&r->q, id, items, n);
+        return;
+    }
+    for (size_t i = 0; i < n; i++) {
+        unsigned spins = 0;
+        while ((r->design == D_NAIVE ? naive_push(r->naive, items[i])
+                                     : cas_push(&r->ring, items[i])) < 0)
+            queue_backoff(&spins);
+    }
+}
+
+static size_t receive(struct run *r, void **out, size_t max)
+{
+    if (r->design >= D_SPSC)
+        return max == 1 ? (size_t)((out[0] = queue_pop(&r->q)) != NULL)
+                        : queue_pop_batch(&r->q, out, max);
+    size_t n = 0;
+    while (n < max && (out[n] = r->design == D_NAIVE ? naive_pop(r->naive)
+                                                     : cas_pop(&r->ring)))
+        n++;
+    return n;
+}
+
+static void *producer(void *arg)
+{
+    struct thread_arg *a = (struct thread_arg *)arg;
+    struct run *r = a->run;
+    pin_to_core(topo_cpu_for(a->id));
+    struct pg_set ps;
+    pg_thread_begin(&ps);
+
+    void *buf[MAX_BATCH];
+    size_t nb = 0;
+    for (long v = 1; v <= r->per_producer; v++) {
+        buf[nb++] = (void *)(uintptr_t)v;
+        if (nb == r->batch || v == r->per_producer) {
+            send(r, a->id, buf, nb);
+            nb = 0;
+        }
+    }
+    atomic_fetch_add_explicit(&r->producers_done, 1, memory_order_release);
+
+    pg_thread_end(&ps, &q_perf);
+    return NULL;
+}
+
+static void *consumer(void *arg)
+{
+    struct thread_arg *a = (struct thread_arg *)arg;
+    struct run *r = a->run;
+    pin_to_core(topo_cpu_for(r->producers + a->id));
+    struct pg_set ps;
+    pg_thread_begin(&ps);
+
+    void *buf[MAX_BATCH];
+    uint64_t sum = 0;
+    unsigned spins = 0;
+    for (;;) {
+        /* Read the flag first: if every producer was done before this
+         * receive came back empty, nothing more is coming */
+        int done = atomic_load_explicit(&r->producers_done, memory_order_acquire)
+                   == r->producers;
+        size_t n = receive(r, buf, r->batch);
+        for (size_t i = 0; i < n; i++)
+            sum += (uintptr_t)buf[i];
+        if (n) {
+            spins = 0;
+        } else if (done) {
+            break;
+        } else {
+            queue_backoff(&spins);
+        }
+    }
+    atomic_fetch_add(&r->sum, sum);
+
+    pg_thread_end(&ps, &q_perf);
+    return NULL;
+}
+
+static int run_init(struct run *r)
+{
+    switch (r->design) {
+    case D_NAIVE:
+        r->naive = queue_alloc(sizeof(*r->naive));
+        if (!r->naive || !(r->naive->slots = calloc(QUEUE_CAPACITY, sizeof(void *))))
+            return -1;
+        r->naive->mask = QUEUE_CAPACITY - 1;
+        return 0;
+    case D_CAS:
+        r->ring.buf = calloc(QUEUE_CAPACITY, sizeof(void *));
+        r->ring.mask = QUEUE_CAPACITY - 1;
+        return r->ring.buf ? 0 : -1;
+    case D_SPSC:
+        return queue_init(&r->q, QUEUE_SPSC, 1, QUEUE_CAPACITY);
+    case D_FANIN:
+        return queue_init(&r->q, QUEUE_FANIN, r->producers, QUEUE_CAPACITY);
+    case D_MPMC:
+        return queue_init(&r->q, QUEUE_MPMC, r->producers, QUEUE_CAPACITY);
+    }
+    return -1;
+}
+
+static void run_destroy(struct run *r)
+{
+    if (r->design >= D_SPSC)
+        queue_destroy(&r->q);
+    if (r->naive)
+        free(r->naive->slots);
+    free(r->naive);
+    free(r->ring.buf);
+}
+
+/* Returns elapsed ms; *ok says whether every item arrived exactly once */
+static double run_row(enum design d, int producers, int consumers, size_t batch,
+                      long items, int *ok)
+{
+    struct run r = {
+        .design = d, .producers = producers, .consumers = consumers,
+        .batch = batch, .per_producer = items / producers,
+    };
+    if (run_init(&r) < 0) {
+        perror("queue init");
+        exit(1);
+    }
+    memset(&q_perf, 0, sizeof(q_perf));
+
+    pthread_t threads[2 * MAX_SIDE];
+    struct thread_arg args[2 * MAX_SIDE];
+    int n = producers + consumers;
+
+    uint64_t start = now_ns();
+    for (int i = 0; i < n; i++) {
+        args[i] = (struct thread_arg){ .run = &r, .id = i < producers ? i : i - producers };
+        pthread_create(&threads[i], NULL, i < producers ? producer : consumer, &args[i]);
+    }
+    for (int i = 0; i < n; i++)
+        pthread_join(threads[i], NULL);
+    double ms = elapsed_ms(start, now_ns());
+
+    uint64_t p = (uint64_t)r.per_producer;
+    *ok = atomic_load(&r.sum) == (uint64_t)producers * (p * (p + 1) / 2);
+    run_destroy(&r);
+    return ms;
+}
+
+/* ── Main ───────────────────────────────────────────────────── */
+
+struct row {
+    enum design design;
+    int shape;              /* 0: 1x1, 1: Nx1, 2: NxN */
+    int batched;
+};
+
+static const struct row rows[] = {
+    { D_NAIVE, 0, 0 }, { D_CAS, 0, 0 }, { D_SPSC, 0, 0 }, { D_SPSC, 0, 1 },
+    { D_MPMC, 0, 0 },
+    { D_CAS, 1, 0 }, { D_MPMC, 1, 0 }, { D_MPMC, 1, 1 }, { D_FANIN, 1, 0 },
+    { D_FANIN, 1, 1 },
+    { D_CAS, 2, 0 }, { D_MPMC, 2, 0 }, { D_MPMC, 2, 1 },
+};
+
+int main(int argc, char *argv[])
+{
+    int csv_mode = 0;
+    int nprod = 0;
+    size_t batch = 32;
+    const char *json_path = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--csv") == 0) {
+            csv_mode = 1;
+        } else if (strcmp(argv[i], "--perf") == 0) {
+            pg_enabled = 1;
+        } else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            batch = (size_t)atol(argv[++i]);
+            if (batch < 2) batch = 2;
+            if (batch > MAX_BATCH) batch = MAX_BATCH;
+        } else if (strcmp(argv[i], "--producers") == 0 && i + 1 < argc) {
+            nprod = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+            json_path = argv[++i];
+        } else {
+            fprintf(stderr, "Usage: %s [--csv] [--perf] [--batch N] [--producers N] [--json FILE]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+
+    topo_place_env();
+    if (bj_open(json_path, "queues", argc, argv) < 0)
+        return 1;
+    long items = get_items();
+    /* N x 1 and N x N default to half the CPUs producing */
+    if (nprod <= 0)
+        nprod = topo_ncpus / 2 > 1 ? topo_ncpus / 2 : 2;
+    if (nprod > MAX_SIDE)
+        nprod = MAX_SIDE;
+
+    if (csv_mode) {
+        printf("design,producers,consumers,batch,items,time_ms,items_per_sec,ns_per_item,correct%s\n",
+               pg_enabled ? PG_CSV_HEADER : "");
+    } else {
+        printf("Lock-Free Queue Designs\n");
+        print_separator();
+        printf("Items per row : %ld (%.0fM), capacity %d\n", items, items / 1e6, QUEUE_CAPACITY);
+        printf("CPUs          : %d\n", topo_ncpus);
+        print_separator();
+        printf("  %-11s %5s %5s %6s %10s %12s %8s %6s\n", "Design", "Prod", "Cons", "Batch",
+               "Time (ms)", "Items/sec", "ns/item", "Check");
+    }
+
+    int last_shape = 0;
+    for (size_t i = 0; i < sizeof(rows) / sizeof(rows[0]); i++) {
+        const struct row *rw = &rows[i];
+        int producers = rw->shape == 0 ? 1 : nprod;
+        int consumers = rw->shape == 2 ? nprod : 1;
+        size_t b = rw->batched ? batch : 1;
+        long total = items / producers * producers;
+
+        if (!csv_mode && rw->shape != last_shape)
+            printf("  %s\n", "--------");
+        last_shape = rw->shape;
+
+        int ok;
+        double ms = run_row(rw->design, producers, consumers, b, items, &ok);
+        double per_sec = (double)total / (ms / 1000.0);
+        double ns = ms * 1e6 / (double)total;
+        char perf[128] = "";
+
+        bj_result(design_names[rw->design]);
+        bj_param_int("producers", producers);
+        bj_param_int("consumers", consumers);
+        bj_param_int("batch", (long)b);
+        bj_metric("items_per_sec", per_sec, "items/s", BJ_HIGHER);
+        bj_metric("ns_per_item", ns, "ns", BJ_LOWER);
+        bj_metric("correct", ok, "bool", BJ_HIGHER);
+
+        if (csv_mode) {
+            if (pg_enabled)
+                pg_csv(&q_perf, (double)total, perf, sizeof(perf));
+            printf("%s,%d,%d,%zu,%ld,%.1f,%.0f,%.2f,%d%s\n", design_names[rw->design],
+                   producers, consumers, b, total, ms, per_sec, ns, ok, perf);
+        } else {
+            printf("  %-11s %5d %5d %6zu %10.1f %12.0f %8.2f %6s\n", design_names[rw->design],
+                   producers, consumers, b, ms, per_sec, ns, ok ? "ok" : "WRONG");
+            if (pg_enabled)
+                printf("  %-11s %s\n", "", pg_format(&q_perf, (double)total, perf, sizeof(perf)));
+        }
+        fflush(stdout);
+    }
+
+    if (!csv_mode) {
+        print_separator();
+        printf("\nExpected behavior:\n");
+        printf("  - spsc beats naive_spsc: cached indices keep head/tail lines still\n");
+        printf("  - cas_ring and mpmc pay a CAS per item; batching amortizes it\n");
+        printf("  - fanin scales producers without any shared producer line\n");
+    }
+    return 0;
+}
@@ -6,12 +6,30 @@
  *   padded     — each counter on its own cache line
  *   true_share — all threads atomically increment ONE shared counter
  *
+ * Threads are pinned by a topology-aware placement policy (see
+ * topology.h), so runs are comparable across machines.
+ *
+ * --perf adds per-op hardware counters (IPC, cache and dTLB misses),
+ * counted in one event group per worker thread (see perf_group.h).
+ *
+ * --matrix instead measures cache-line ping-pong latency between every
+ * pair of CPUs: two threads take turns writing a shared line, and half
+ * the round-trip time is the one-way core-to-core transfer latency.
+ *
  * Usage:
  *   ./scaling                    # pretty-print table
  *   ./scaling --csv              # output CSV for plotting
  *   ./scaling --threads 1,2,4,8  # custom thread counts
+ *   ./scaling --placement spread # smt|core|socket|numa|spread|linear
+ *   ./scaling --perf             # + IPC, cache/dTLB misses per op
+ *   ./scaling --matrix           # core-to-core latency matrix
+ *   ./scaling --matrix --csv     # cpu_a,cpu_b,relation,latency_ns
+ *   ./scaling --json FILE        # + results in the common schema (bench_json.h)
  */
 #include "common.h"
+#include "topology.h"
+#include "perf_group.h"
+#include "bench_json.h"
 
 #define MAX_THREADS 256
 
@@ -39,6 +57,7 @@ struct thread_args {
     int thread_id;
     long iterations;
     int core;
+    struct pg_counts counts;
 };
 
 static void *worker(void *arg)
@@ -47,6 +66,9 @@ static void *worker(void *arg)
     pin_to_core(ta->core);
     long iters = ta->iterations;
 
+    struct pg_set ps;
+    pg_thread_begin(&ps);
+
     switch (ta->mode) {
     case MODE_PACKED: {
         _Atomic long *ctr = &packed_counters[ta->thread_id];
@@ -65,12 +87,15 @@ static void *worker(void *arg)
             atomic_fetch_add_explicit(&shared_counter, 1, memory_order_relaxed);
         break;
     }
+
+    pg_thread_end(&ps, &ta->counts);
     return NULL;
 }
 
 /* ── Run a benchmark for given mode and thread count ─────── */
 
-static double run_benchmark(enum mode m, int nthreads, long iterations)
+static double run_benchmark(enum mode m, int nthreads, long iterations,
+                            struct pg_counts *counts)
 {
     /* Reset counters */
     for (int i = 0; i < nthreads; i++) {
@@ -79,7 +104,6 @@ static double run_benchmark(enum mode m, int nthreads, long iterations)
     }
     atomic_store(&shared_counter, 0);
 
-    int ncores = get_num_cores();
     pthread_t threads[MAX_THREADS];
     struct thread_args args[MAX_THREADS];
 
@@ -88,7 +112,7 @@ static double run_benchmark(enum mode m, int nthreads, long iterations)
             .mode = m,
             .thread_id = i,
             .iterations = iterations,
-            .core = i % ncores,
+            .core = topo_cpu_for(i),
         };
     }
 
@@ -99,6 +123,9 @@ static double run_benchmark(enum mode m, int nthreads, long iterations)
         pthread_join(threads[i], NULL);
     uint64_t end = now_ns();
 
+    memset(counts, 0, sizeof(*counts));
+    for (int i = 0; i < nthreads; i++)
+        pg_counts_add(counts, &args[i].counts);
     return elapsed_ms(start, end);
 }
 
@@ -112,6 +139,157 @@ static const char *mode_name(enum mode m)
     return "unknown";
 }
 
+/* ── Core-to-core latency ───────────────────────────────────── */
+
+/*
+ * The pinger writes round+1 into one cache line and spins until the
+ * ponger echoes it back with the next even value; every write has to
+ * steal the line from the other core. Each pair runs PING_BATCHES
+ * batches and keeps the fastest, which filters out interrupts and
+ * frequency ramps.
+ */
+
+#define DEFAULT_ROUNDS 20000
+#define PING_BATCHES   5
+
+static struct {
+    _Atomic long seq;
+    char _pad[CACHE_LINE_SIZE - sizeof(_Atomic long)];
+} ping_line CACHE_ALIGNED;
+
+struct ping_args {
+    int  cpu;
+    long rounds;
+};
+
+static void *ponger(void *arg)
+{
+    struct ping_args *pa = (struct ping_args *)arg;
+    pin_to_core(pa->cpu);
+
+    for (long r = 0; r < pa->rounds; r++) {
+        long want = 2 * r + 1;
+        while (atomic_load_explicit(&ping_line.seq, memory_order_acquire) != want)
+            ;
+        atomic_store_explicit(&ping_line.seq, want + 1, memory_order_release);
+    }
+    return NULL;
+}
+
+/* One-way latency in ns between two CPUs */
+static double ping_pong(int cpu_a, int cpu_b, long rounds)
+{
+    double best = 0;
+
+    for (int b = 0; b < PING_BATCHES; b++) {
+        atomic_store(&ping_line.seq, 0);
+        struct ping_args pa = { .cpu = cpu_b, .rounds = rounds };
+        pthread_t t;
+        pthread_create(&t, NULL, ponger, &pa);
+
+        pin_to_core(cpu_a);
+        /* Wait until the ponger is on its CPU: one untimed round trip */
+        long seq = 0;
+        atomic_store_explicit(&ping_line.seq, ++seq, memory_order_release);
+        while (atomic_load_explicit(&ping_line.seq, memory_order_acquire) != seq + 1)
+            ;
+        seq++;
+
+        uint64_t t0 = now_ns();
+        for (long r = 1; r < rounds; r++) {
+            atomic_store_explicit(&ping_line.seq, ++seq, memory_order_release);
+            while (atomic_load_explicit(&ping_line.seq, memory_order_acquire) != seq + 1)
+                ;
+            seq++;
+        }
+        uint64_t t1 = now_ns();
+        pthread_join(t, NULL);
+
+        double ns = (double)(t1 - t0) / (2.0 * (double)(rounds - 1));
+        if (b == 0 || ns < best)
+            best = ns;
+    }
+    return best;
+}
+
+static int run_matrix(long rounds, int csv_mode)
+{
+    int n = topo_ncpus;
+    if (n < 2) {
+        fprintf(stderr, "scaling: --matrix needs at least 2 CPUs (have %d)\n", n);
+        return 1;
+    }
+
+    double *lat = calloc((size_t)n * n, sizeof(*lat));
+    if (!lat) {
+        perror("calloc");
+        return 1;
+    }
+
+    /* Rows/columns follow the placement order, so the smt/core/socket
+     * blocks line up along the diagonal */
+    if (csv_mode)
+        printf("cpu_a,cpu_b,relation,latency_ns\n");
+    for (int i = 0; i < n; i++) {
+        for (int j = i + 1; j < n; j++) {
+            int a = topo_order[i], b = topo_order[j];
+            lat[i * n + j] = lat[j * n + i] = ping_pong(a, b, rounds);
+            if (csv_mode)
+                printf("%d,%d,%s,%.1f\n", a, b, topo_relation(a, b), lat[i * n + j]);
+            bj_result("ping_pong");
+            bj_param_int("cpu_a", a);
+            bj_param_int("cpu_b", b);
+            bj_param_str("relation", topo_relation(a, b));
+            bj_metric("latency_ns", lat[i * n + j], "ns", BJ_LOWER);
+        }
+    }
+
+    if (!csv_mode) {
+        printf("Core-to-Core Latency (ns, one way, best of %d x %ld round trips)\n",
+               PING_BATCHES, rounds);
+        print_separator();
+        printf("%5s", "cpu");
+        for (int j = 0; j < n; j++)
+            printf(" %5d", topo_order[j]);
+        printf("\n");
+        for (int i = 0; i < n; i++) {
+            printf("%5d", topo_order[i]);
+            for (int j = 0; j < n; j++) {
+                if (i == j)
+                    printf(" %5s", "-");
+                else
+                    printf(" %5.0f", lat[i * n + j]);
+            }
+            printf("\n");
+        }
+        print_separator();
+
+        /* Summary per relation: what sharding across each level costs */
+        const char *rels[] = { "smt", "core", "socket" };
+        for (int r = 0; r < 3; r++) {
+            double sum = 0, lo = 0, hi = 0;
+            int cnt = 0;
+            for (int i = 0; i < n; i++) {
+                for (int j = i + 1; j < n; j++) {
+                    if (strcmp(topo_relation(topo_order[i], topo_order[j]), rels[r]) != 0)
+                        continue;
+                    double v = lat[i * n + j];
+                    if (cnt == 0 || v < lo) lo = v;
+                    if (cnt == 0 || v > hi) hi = v;
+                    sum += v;
+                    cnt++;
+                }
+            }
+            if (cnt)
+                printf("  %-8s %5d pairs   min %6.1f   mean %6.1f   max %6.1f ns\n",
+                       rels[r], cnt, lo, sum / cnt, hi);
+        }
+    }
+
+    free(lat);
+    return 0;
+}
+
 /* ── Parse --threads argument ───────────────────────────────── */
 
 static int parse_thread_list(const char *str, int *out, int max)
@@ -133,6 +311,10 @@ int main(int argc, char *argv[])
 {
     long iterations = get_iterations();
     int csv_mode = 0;
+    int matrix_mode = 0;
+    long rounds = DEFAULT_ROUNDS;
+    const char *placement = "core";
+    const char *json_path = NULL;
 
     /* Default thread counts */
     int thread_counts[32];
@@ -145,9 +327,33 @@ int main(int argc, char *argv[])
             csv_mode = 1;
         } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
             num_counts = parse_thread_list(argv[++i], thread_counts, 32);
+        } else if (strcmp(argv[i], "--placement") == 0 && i + 1 < argc) {
+            placement = argv[++i];
+        } else if (strcmp(argv[i], "--perf") == 0) {
+            pg_enabled = 1;
+        } else if (strcmp(argv[i], "--matrix") == 0) {
+            matrix_mode = 1;
+        } else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+            json_path = argv[++i];
+        } else if (strcmp(argv[i], "--rounds") == 0 && i + 1 < argc) {
+            rounds = atol(argv[++i]);
+            if (rounds < 2)
+                rounds = 2;
         }
     }
 
+    if (topo_place(placement) < 0) {
+        fprintf(stderr, "scaling: unknown placement '%s' "
+                "(smt, core, socket, numa, spread, linear)\n", placement);
+        return 1;
+    }
+    ncores = topo_ncpus;
+    if (bj_open(json_path, "scaling", argc, argv) < 0)
+        return 1;
+
+    if (matrix_mode)
+        return run_matrix(rounds, csv_mode);
+
     /* Default: powers of 2 up to nproc */
     if (num_counts == 0) {
         for (int t = 1; t <= ncores && num_counts < 32; t *= 2)
@@ -161,12 +367,17 @@ int main(int argc, char *argv[])
     long base_iters = iterations;
 
     if (csv_mode) {
-        printf("threads,mode,ops_per_sec,time_ms,total_ops\n");
+        printf("threads,mode,ops_per_sec,time_ms,total_ops,placement%s\n",
+               pg_enabled ? PG_CSV_HEADER : "");
     } else {
         printf("Thread Scaling Experiment: False Sharing\n");
         print_separator();
         printf("Base iterations/thread: %ld (%.0fM)\n", base_iters, base_iters / 1e6);
         printf("Available cores       : %d\n", ncores);
+        printf("Placement             : %s (", placement);
+        for (int i = 0; i < ncores && i < 16; i++)
+            printf("%s%d", i ? "," : "", topo_order[i]);
+        printf("%s)\n", ncores > 16 ? ",..." : "");
         print_separator();
         printf("  %-8s %-12s %15s %12s\n", "Threads", "Mode", "Ops/sec", "Time (ms)");
         print_separator();
@@ -185,16 +396,29 @@ int main(int argc, char *argv[])
             iters = 1000000;
 
         for (int mi = 0; mi < nmodes; mi++) {
-            double ms = run_benchmark(modes[mi], nthreads, iters);
+            struct pg_counts pc;
+            double ms = run_benchmark(modes[mi], nthreads, iters, &pc);
             double total_ops = (double)nthreads * (double)iters;
             double ops_per_sec = total_ops / (ms / 1000.0);
+            char perf[128] = "";
+
+            bj_result(mode_name(modes[mi]));
+            bj_param_int("threads", nthreads);
+            bj_param_str("placement", placement);
+            bj_metric("ops_per_sec", ops_per_sec, "ops/s", BJ_HIGHER);
+            bj_metric("time_ms", ms, "ms", BJ_LOWER);
 
             if (csv_mode) {
-                printf("%d,%s,%.0f,%.1f,%.0f\n",
-                       nthreads, mode_name(modes[mi]), ops_per_sec, ms, total_ops);
+                if (pg_enabled)
+                    pg_csv(&pc, total_ops, perf, sizeof(perf));
+                printf("%d,%s,%.0f,%.1f,%.0f,%s%s\n",
+                       nthreads, mode_name(modes[mi]), ops_per_sec, ms, total_ops,
+                       placement, perf);
             } else {
                 printf("  %-8d %-12s %15.0f %12.1f\n",
                        nthreads, mode_name(modes[mi]), ops_per_sec, ms);
+                if (pg_enabled)
+                    printf("  %-8s %s\n", "", pg_format(&pc, total_ops, perf, sizeof(perf)));
             }
         }
 
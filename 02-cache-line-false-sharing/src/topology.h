@@ -0,0 +1,208 @@
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+/*
+ * topology.h — CPU topology and thread placement policies
+ *
+ * Reads /sys/devices/system/cpu/cpuN/topology (package, core, SMT
+ * siblings) and /sys/devices/system/node (NUMA) for the CPUs this
+ * process may run on, and turns a placement policy into a fixed CPU
+ * order: thread i is pinned to topo_order[i % topo_ncpus].
+ *
+ *   smt     fill both SMT siblings of a core before the next core
+ *   core    one thread per physical core, socket by socket; siblings last
+ *   socket  fill a socket (cores, then siblings) before the next socket
+ *   numa    like socket, by NUMA node (differs with sub-NUMA clustering)
+ *   spread  round-robin across sockets, one thread per core; siblings last
+ *   linear  CPU ids in order (the old i % ncores)
+ */
+#include "common.h"
+
+#define TOPO_MAX_CPUS 1024
+
+struct topo_cpu {
+    int cpu;
+    int package;
+    int node;
+    int core;           /* core_id, unique within the package */
+    int smt;            /* 0 for the first sibling of a core, 1, ... */
+    int rank;           /* position among its package's cores */
+};
+
+static struct topo_cpu topo_cpus[TOPO_MAX_CPUS];
+static int topo_order[TOPO_MAX_CPUS];
+static int topo_ncpus;
+
+static inline int topo_read_int(const char *fmt, int cpu, int fallback)
+{
+    char path[128];
+    snprintf(path, sizeof(path), fmt, cpu);
+    FILE *f = fopen(path, "r");
+    int val = fallback;
+    if (f) {
+        if (fscanf(f, "%d", &val) != 1)
+            val = fallback;
+        fclose(f);
+    }
+    return val;
+}
+
+/* NUMA node of a CPU: the nodeN entry in its sysfs directory */
+static inline int topo_cpu_node(int cpu)
+{
+    for (int n = 0; n < 64; n++) {
+        char path[128];
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/node%d", cpu, n);
+        if (access(path, F_OK) == 0)
+            return n;
+    }
+    return 0;
+}
+
+static inline int topo_cmp_smt(const void *a, const void *b)
+{
+    const struct topo_cpu *x = a, *y = b;
+    if (x->package != y->package) return x->package - y->package;
+    if (x->core != y->core)       return x->core - y->core;
+    return x->cpu - y->cpu;
+}
+
+/* Number SMT siblings and each package's cores in (package, core) order */
+static inline void topo_finish(void)
+{
+    qsort(topo_cpus, topo_ncpus, sizeof(*topo_cpus), topo_cmp_smt);
+    for (int i = 0, rank = -1; i < topo_ncpus; i++) {
+        struct topo_cpu *t = &topo_cpus[i], *p = i ? &topo_cpus[i - 1] : NULL;
+        int same_core = p && p->package == t->package && p->core == t->core;
+        if (!p || p->package != t->package)
+            rank = -1;
+        t->smt = same_core ? p->smt + 1 : 0;
+        if (!same_core)
+            rank++;
+        t->rank = rank;
+    }
+}
+
+/* Load the topology of the CPUs in our affinity mask. Returns the
+ * number of CPUs, or -1. */
+static inline int topo_load(void)
+{
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) != 0) {
+        perror("sched_getaffinity");
+        return -1;
+    }
+
+    topo_ncpus = 0;
+    for (int c = 0; c < CPU_SETSIZE && topo_ncpus < TOPO_MAX_CPUS; c++) {
+        if (!CPU_ISSET(c, &set))
+            continue;
+        struct topo_cpu *t = &topo_cpus[topo_ncpus++];
+        t->cpu = c;
+        t->package = topo_read_int("/sys/devices/system/cpu/cpu%d/topology/physical_package_id", c, 0);
+        t->core = topo_read_int("/sys/devices/system/cpu/cpu%d/topology/core_id", c, c);
+        t->node = topo_cpu_node(c);
+    }
+
+    topo_finish();
+    return topo_ncpus;
+}
+
+/* Sort keys for each policy, most significant first */
+static const char *topo_policy = "core";
+
+static inline void topo_keys(const struct topo_cpu *t, int k[4])
+{
+    if (strcmp(topo_policy, "smt") == 0) {
+        k[0] = t->package; k[1] = t->rank;  k[2] = t->smt;     k[3] = t->cpu;
+    } else if (strcmp(topo_policy, "socket") == 0) {
+        k[0] = t->package; k[1] = t->smt;   k[2] = t->rank;    k[3] = t->cpu;
+    } else if (strcmp(topo_policy, "numa") == 0) {
+        k[0] = t->node;    k[1] = t->smt;   k[2] = t->package; k[3] = t->rank;
+    } else if (strcmp(topo_policy, "spread") == 0) {
+        k[0] = t->smt;     k[1] = t->rank;  k[2] = t->package; k[3] = t->cpu;
+    } else if (strcmp(topo_policy, "linear") == 0) {
+        k[0] = t->cpu;     k[1] = k[2] = k[3] = 0;
+    } else {    /* core */
+        k[0] = t->smt;     k[1] = t->package; k[2] = t->rank;  k[3] = t->cpu;
+    }
+}
+
+static inline int topo_cmp_policy(const void *a, const void *b)
+{
+    int ka[4], kb[4];
+    topo_keys(&topo_cpus[*(const int *)a], ka);
+    topo_keys(&topo_cpus[*(const int *)b], kb);
+    for (int i = 0; i < 4; i++)
+        if (ka[i] != kb[i])
+            return ka[i] - kb[i];
+    return 0;
+}
+
+static inline int topo_valid_policy(const char *p)
+{
+    const char *names[] = { "smt", "core", "socket", "numa", "spread", "linear" };
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+        if (strcmp(p, names[i]) == 0)
+            return 1;
+    return 0;
+}
+
+/* Build topo_order for `policy` (loads the topology on first use).
+ * Returns 0, or -1 for an unknown policy. */
+static inline int topo_place(const char *policy)
+{
+    if (!topo_valid_policy(policy))
+        return -1;
+    if (topo_ncpus == 0 && topo_load() < 0)
+        return -1;
+
+    topo_policy = policy;
+    int idx[TOPO_MAX_CPUS];
+    for (int i = 0; i < topo_ncpus; i++)
+        idx[i] = i;
+    qsort(idx, topo_ncpus, sizeof(int), topo_cmp_policy);
+    for (int i = 0; i < topo_ncpus; i++)
+        topo_order[i] = topo_cpus[idx[i]].cpu;
+    return 0;
+}
+
+/* Placement from env PLACEMENT (default "core"), for the demos that
+ * take no options. Exits on an unknown policy. */
+static inline void topo_place_env(void)
+{
+    const char *env = getenv("PLACEMENT");
+    const char *policy = env && *env ? env : "core";
+    if (topo_place(policy) < 0) {
+        fprintf(stderr, "unknown PLACEMENT '%s' "
+                "(smt, core, socket, numa, spread, linear)\n", policy);
+        exit(1);
+    }
+}
+
+/* CPU for thread i under the current placement */
+static inline int topo_cpu_for(int i)
+{
+    return topo_ncpus ? topo_order[i % topo_ncpus] : i % get_num_cores();
+}
+
+static inline const struct topo_cpu *topo_find(int cpu)
+{
+    for (int i = 0; i < topo_ncpus; i++)
+        if (topo_cpus[i].cpu == cpu)
+            return &topo_cpus[i];
+    return NULL;
+}
+
+/* How two CPUs relate: "smt", "core" (same package), "socket" (across) */
+static inline const char *topo_relation(int a, int b)
+{
+    const struct topo_cpu *x = topo_find(a), *y = topo_find(b);
+    if (!x || !y)
+        return "?";
+    if (x->package != y->package)
+        return "socket";
+    return x->core == y->core ? "smt" : "core";
+}
+
+#endif /* TOPOLOGY_H */
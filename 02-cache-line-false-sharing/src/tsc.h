@@ -0,0 +1,222 @@
+#ifndef TSC_H
+#define TSC_H
+
+/*
+ * tsc.h — Cycle-counter timing for short (10–1000 ns) regions
+ *
+ * clock_gettime() through the vDSO costs 20–50 ns a call (far more where
+ * a hypervisor traps it), as much as the malloc or the shared-counter
+ * read being timed. This reads the cycle counter directly:
+ *
+ *   x86-64   lfence; rdtsc  ...region...  rdtscp; lfence
+ *            The first lfence waits for earlier instructions, the second
+ *            keeps the region from starting before the read; rdtscp waits
+ *            for the region and the trailing lfence keeps later work out.
+ *            Needs an invariant TSC (constant rate, ticking in C-states).
+ *   aarch64  isb; mrs cntvct_el0 — the generic timer, fixed frequency
+ *            (cntfrq_el0), typically 25–100 MHz: coarser, still cheap.
+ *   other    CLOCK_MONOTONIC, as before.
+ *
+ *   tsc_init();                                    (once; ~20 ms)
+ *   uint64_t t0 = tsc_start();
+ *   ...region...
+ *   uint64_t ns = tsc_elapsed_ns(t0, tsc_stop());
+ *
+ * tsc_init() calibrates ticks against CLOCK_MONOTONIC and measures an
+ * empty start/stop pair (the minimum of many), which tsc_elapsed_ns()
+ * subtracts: an empty region reads 0, not the timer's own cost. Without
+ * tsc_init() everything is CLOCK_MONOTONIC nanoseconds.
+ *
+ * tsc_sample() says whether to time this op: every op by default, about
+ * 1 in tsc_sample_every with --sample N. The gaps are random (uniform,
+ * mean N) so sampling can't lock onto a periodic pattern in the workload.
+ *
+ * Self-contained (no common.h): also used by 04-memory-allocator-benchmark.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#include <cpuid.h>
+#endif
+
+enum tsc_source { TSC_CLOCK, TSC_X86, TSC_ARM };
+
+static const char *tsc_source_names[] = {
+    [TSC_CLOCK] = "clock_gettime",
+    [TSC_X86]   = "rdtsc",
+    [TSC_ARM]   = "cntvct_el0",
+};
+
+static struct {
+    enum tsc_source source;
+    double          ns_per_tick;    /* 1.0 for TSC_CLOCK */
+    uint64_t        overhead;       /* ticks of an empty start/stop pair */
+} tsc = { TSC_CLOCK, 1.0, 0 };
+
+static inline uint64_t tsc_clock_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static inline uint64_t tsc_start(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if (tsc.source == TSC_X86) {
+        _mm_lfence();
+        uint64_t t = __rdtsc();
+        _mm_lfence();
+        return t;
+    }
+#elif defined(__aarch64__)
+    if (tsc.source == TSC_ARM) {
+        uint64_t t;
+        __asm__ __volatile__("isb; mrs %0, cntvct_el0" : "=r"(t) :: "memory");
+        return t;
+    }
+#endif
+    return tsc_clock_ns();
+}
+
+static inline uint64_t tsc_stop(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if (tsc.source == TSC_X86) {
+        unsigned int aux;
+        uint64_t t = __rdtscp(&aux);
+        _mm_lfence();
+        return t;
+    }
+#elif defined(__aarch64__)
+    if (tsc.source == TSC_ARM) {
+        uint64_t t;
+        __asm__ __volatile__("isb; mrs %0, cntvct_el0" : "=r"(t) :: "memory");
+        return t;
+    }
+#endif
+    return tsc_clock_ns();
+}
+
+/* Region length in ns, timer overhead subtracted (never negative) */
+static inline uint64_t tsc_elapsed_ns(uint64_t t0, uint64_t t1)
+{
+    uint64_t ticks = t1 - t0;
+    ticks = ticks > tsc.overhead ? ticks - tsc.overhead : 0;
+    if (tsc.source == TSC_CLOCK)
+        return ticks;
+    return (uint64_t)((double)ticks * tsc.ns_per_tick + 0.5);
+}
+
+/* Invariant TSC: CPUID 0x80000007 EDX bit 8, or the kernel clocksource
+ * is the TSC (VMs often hide the bit but the kernel still trusts it) */
+static inline int tsc_x86_invariant(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int a, b, c, d;
+    if (__get_cpuid(0x80000007, &a, &b, &c, &d) && (d & (1u << 8)))
+        return 1;
+    char cs[32] = "";
+    FILE *f = fopen("/sys/devices/system/clocksource/clocksource0/current_clocksource", "r");
+    if (f) {
+        if (!fgets(cs, sizeof(cs), f))
+            cs[0] = '\0';
+        fclose(f);
+    }
+    return strncmp(cs, "tsc", 3) == 0;
+#else
+    return 0;
+#endif
+}
+
+static inline void tsc_measure_overhead(void)
+{
+    uint64_t best = UINT64_MAX;
+    for (int i = 0; i < 10000; i++) {
+        uint64_t t0 = tsc_start();
+        uint64_t t1 = tsc_stop();
+        if (t1 - t0 < best)
+            best = t1 - t0;
+    }
+    tsc.overhead = best;
+}
+
+/* Pick the counter, calibrate it and measure its overhead. TSC_TIMER=clock
+ * forces CLOCK_MONOTONIC (to compare, or if the TSC is known bad). */
+static inline void tsc_init(void)
+{
+    const char *force = getenv("TSC_TIMER");
+    tsc.source = TSC_CLOCK;
+    tsc.ns_per_tick = 1.0;
+    tsc.overhead = 0;
+
+    if (!(force && strcmp(force, "clock") == 0)) {
+#if defined(__x86_64__) || defined(__i386__)
+        if (tsc_x86_invariant()) {
+            tsc.source = TSC_X86;
+            /* ~20 ms against CLOCK_MONOTONIC: < 0.01% rate error */
+            uint64_t c0 = tsc_clock_ns(), t0 = tsc_start();
+            while (tsc_clock_ns() - c0 < 20000000ULL)
+                ;
+            uint64_t c1 = tsc_clock_ns(), t1 = tsc_stop();
+            tsc.ns_per_tick = (double)(c1 - c0) / (double)(t1 - t0);
+        }
+#elif defined(__aarch64__)
+        uint64_t freq;
+        __asm__ __volatile__("mrs %0, cntfrq_el0" : "=r"(freq));
+        if (freq) {
+            tsc.source = TSC_ARM;
+            tsc.ns_per_tick = 1e9 / (double)freq;
+        }
+#endif
+    }
+    tsc_measure_overhead();
+}
+
+/* "rdtsc 2.995 GHz, overhead 24 ticks (8 ns) subtracted" */
+static inline const char *tsc_describe(char *buf, size_t len)
+{
+    if (tsc.source == TSC_CLOCK)
+        snprintf(buf, len, "%s, overhead %lu ns subtracted",
+                 tsc_source_names[tsc.source], (unsigned long)tsc.overhead);
+    else
+        snprintf(buf, len, "%s %.3f %s, overhead %lu ticks (%.0f ns) subtracted",
+                 tsc_source_names[tsc.source],
+                 tsc.source == TSC_X86 ? 1.0 / tsc.ns_per_tick : 1e3 / tsc.ns_per_tick,
+                 tsc.source == TSC_X86 ? "GHz" : "MHz",
+                 (unsigned long)tsc.overhead, (double)tsc.overhead * tsc.ns_per_tick);
+    return buf;
+}
+
+/* ── Sampled timing ── */
+
+static uint32_t tsc_sample_every = 1;
+static __thread uint32_t tsc_sample_left;
+static __thread uint64_t tsc_sample_rng;
+
+/* 1 if this op should be timed */
+static inline int tsc_sample(void)
+{
+    if (tsc_sample_every <= 1)
+        return 1;
+    if (tsc_sample_left) {
+        tsc_sample_left--;
+        return 0;
+    }
+    /* Skip 0 .. 2N-2 ops until the next timed one: 1 in N on average */
+    uint64_t x = tsc_sample_rng ? tsc_sample_rng
+                                : (uint64_t)(uintptr_t)&tsc_sample_left | 1;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    tsc_sample_rng = x;
+    tsc_sample_left = (uint32_t)(x % (2ULL * tsc_sample_every - 1));
+    return 1;
+}
+
+#endif /* TSC_H */
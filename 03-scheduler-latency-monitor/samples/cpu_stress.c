@@ -3,7 +3,13 @@
  * Spawns N threads (default: 2 * nproc) doing tight FP loops.
  * More threads than CPUs → run-queue contention → measurable latency.
  *
- * Usage: ./cpu_stress [seconds] [threads]
+ * "pingpong" mode instead pairs the threads up, bouncing one byte over
+ * two pipes: every round trip is two wakeups and two context switches,
+ * the worst case for a scheduler tracer. Context switches per second
+ * (from /proc/stat) are printed in both modes, so running it with and
+ * without a tracer attached measures the tracer's overhead.
+ *
+ * Usage: ./cpu_stress [seconds] [threads] [spin|pingpong]
  */
 
 #define _GNU_SOURCE
@@ -12,10 +18,18 @@
 #include <unistd.h>
 #include <pthread.h>
 #include <signal.h>
+#include <string.h>
+#include <time.h>
 #include <math.h>
 
 static volatile sig_atomic_t running = 1;
 
+struct pair {
+	int			ab[2];	/* ping → pong */
+	int			ba[2];	/* pong → ping */
+	unsigned long long	trips;
+};
+
 static void sig_handler(int sig)
 {
 	(void)sig;
@@ -40,39 +54,122 @@ static void *worker(void *arg)
 	return NULL;
 }
 
+static void *ping(void *arg)
+{
+	struct pair *p = arg;
+	char c = 0;
+
+	while (running) {
+		if (write(p->ab[1], &c, 1) != 1 || read(p->ba[0], &c, 1) != 1)
+			break;
+		p->trips++;
+	}
+
+	close(p->ab[1]);	/* EOF tells pong to stop */
+	return NULL;
+}
+
+static void *pong(void *arg)
+{
+	struct pair *p = arg;
+	char c;
+
+	while (read(p->ab[0], &c, 1) == 1)
+		if (write(p->ba[1], &c, 1) != 1)
+			break;
+	return NULL;
+}
+
+/* System-wide context switches since boot ("ctxt" in /proc/stat) */
+static unsigned long long read_ctxt(void)
+{
+	unsigned long long ctxt = 0;
+	char line[256];
+	FILE *f = fopen("/proc/stat", "r");
+
+	if (!f)
+		return 0;
+	while (fgets(line, sizeof(line), f))
+		if (sscanf(line, "ctxt %llu", &ctxt) == 1)
+			break;
+	fclose(f);
+	return ctxt;
+}
+
+static double now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
 int main(int argc, char **argv)
 {
 	int duration = 10;
 	int nthreads = 0;
+	int pingpong = 0;
+	struct pair *pairs = NULL;
 
 	if (argc > 1)
 		duration = atoi(argv[1]);
 	if (argc > 2)
 		nthreads = atoi(argv[2]);
+	if (argc > 3) {
+		if (strcmp(argv[3], "pingpong") == 0) {
+			pingpong = 1;
+		} else if (strcmp(argv[3], "spin") != 0) {
+			fprintf(stderr, "Usage: %s [seconds] [threads] "
+				"[spin|pingpong]\n", argv[0]);
+			return 1;
+		}
+	}
 
 	if (nthreads <= 0) {
 		long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
 		nthreads = (int)(ncpus * 2);
 	}
+	if (pingpong)
+		nthreads = (nthreads + 1) & ~1;	/* whole pairs */
 
 	signal(SIGINT, sig_handler);
 	signal(SIGTERM, sig_handler);
 
-	printf("cpu_stress: %d threads for %d seconds (PID %d)\n",
-	       nthreads, duration, getpid());
+	printf("cpu_stress: %d %s threads for %d seconds (PID %d)\n",
+	       nthreads, pingpong ? "pingpong" : "spinning", duration, getpid());
 
 	pthread_t *tids = calloc(nthreads, sizeof(pthread_t));
-	if (!tids) {
+	if (pingpong)
+		pairs = calloc(nthreads / 2, sizeof(*pairs));
+	if (!tids || (pingpong && !pairs)) {
 		perror("calloc");
 		return 1;
 	}
 
+	unsigned long long ctxt0 = read_ctxt();
+	double t0 = now_sec();
+	int started = 0;
+
 	for (int i = 0; i < nthreads; i++) {
-		if (pthread_create(&tids[i], NULL, worker, NULL) != 0) {
+		struct pair *p = pingpong ? &pairs[i / 2] : NULL;
+		int rc;
+
+		if (p && i % 2 == 0 && (pipe(p->ab) < 0 || pipe(p->ba) < 0)) {
+			perror("pipe");
+			running = 0;
+			break;
+		}
+		if (!p)
+			rc = pthread_create(&tids[i], NULL, worker, NULL);
+		else
+			rc = pthread_create(&tids[i], NULL,
+					    i % 2 ? pong : ping, p);
+		if (rc != 0) {
 			perror("pthread_create");
 			running = 0;
 			break;
 		}
+		started++;
 	}
 
 	/* Run for the requested duration, or until signal */
@@ -81,9 +178,26 @@ int main(int argc, char **argv)
 
 	running = 0;
 
-	for (int i = 0; i < nthreads; i++)
+	/* A ping without its pong would block forever: unblock it */
+	if (pingpong && started % 2)
+		close(pairs[started / 2].ba[1]);
+
+	for (int i = 0; i < started; i++)
 		pthread_join(tids[i], NULL);
 
+	double elapsed = now_sec() - t0;
+	unsigned long long switches = read_ctxt() - ctxt0;
+	unsigned long long trips = 0;
+
+	for (int i = 0; pingpong && i < nthreads / 2; i++)
+		trips += pairs[i].trips;
+
+	printf("cpu_stress: %.0f context switches/s", switches / elapsed);
+	if (pingpong)
+		printf(", %.0f round trips/s", trips / elapsed);
+	printf("\n");
+
+	free(pairs);
 	free(tids);
 	printf("cpu_stress: done\n");
 	return 0;
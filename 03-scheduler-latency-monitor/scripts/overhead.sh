@@ -0,0 +1,47 @@
+#!/usr/bin/env bash
+# overhead.sh — Measure what runqlat costs the workload it watches.
+#
+# Runs cpu_stress in pingpong mode (two wakeups + two context switches per
+# round trip) with no tracer, with runqlat's default maps, and with
+# runqlat --fast, and compares context switches per second.
+#
+# Usage: sudo bash scripts/overhead.sh [seconds] [threads]
+
+set -euo pipefail
+cd "$(dirname "$0")/.."
+
+SECS=${1:-5}
+THREADS=${2:-$(( $(nproc) * 2 ))}
+
+make all >/dev/null
+
+# run MODE → prints context switches/s of one cpu_stress run
+run() {
+    local mode=$1 tracer=""
+
+    case "$mode" in
+        default) bin/runqlat 3600 1 >/dev/null 2>&1 & tracer=$! ;;
+        fast)    bin/runqlat --fast 3600 1 >/dev/null 2>&1 & tracer=$! ;;
+    esac
+    [ -n "$tracer" ] && sleep 2     # let it load and attach
+
+    bin/cpu_stress "$SECS" "$THREADS" pingpong |
+        awk '/switches\/s/ { print $2 }'
+
+    if [ -n "$tracer" ]; then
+        kill -INT "$tracer" 2>/dev/null || true
+        wait "$tracer" 2>/dev/null || true
+    fi
+}
+
+echo "=== runqlat overhead: $THREADS pingpong threads, ${SECS}s per run ==="
+
+base=$(run none)
+printf "%-10s %14s %10s\n" "tracer" "switches/s" "overhead"
+printf "%-10s %14s %10s\n" "none" "$base" "-"
+
+for mode in default fast; do
+    rate=$(run "$mode")
+    awk -v m="$mode" -v r="$rate" -v b="$base" \
+        'BEGIN { printf "%-10s %14s %9.1f%%\n", m, r, (b - r) * 100 / b }'
+done
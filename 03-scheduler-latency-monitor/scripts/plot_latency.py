@@ -2,10 +2,15 @@
 """plot_latency.py — Visualize runqlat CSV output.
 
 Reads CSV from:  sudo bin/runqlat --csv 1 30 > results/latency.csv
-Columns:         timestamp, p50_us, p95_us, p99_us, max_us
+Columns:         timestamp, key, p50_us, p95_us, p99_us, p999_us, max_us
+
+The key is "all" for the global histogram; with runqlat --by there are
+also rows per TGID / cgroup / comm, selected here with --key. Older CSVs
+(integer log2 percentiles, no p999_us column) still load.
 
 Usage:
     python3 scripts/plot_latency.py results/latency.csv [-o results/latency.png]
+    python3 scripts/plot_latency.py results/latency.csv --key /system.slice/nginx.service
 
 Falls back to a text-mode table if matplotlib is unavailable.
 """
@@ -15,30 +20,36 @@ import csv
 import sys
 
 
-def load_csv(path):
+def load_csv(path, key="all"):
     rows = []
     with open(path) as f:
         reader = csv.DictReader(f)
         for r in reader:
+            if r.get("key", "all") != key:   # older CSVs have no key column
+                continue
             rows.append({
                 "ts": float(r["timestamp"]),
-                "p50": int(r["p50_us"]),
-                "p95": int(r["p95_us"]),
-                "p99": int(r["p99_us"]),
-                "max": int(r["max_us"]),
+                "p50": float(r["p50_us"]),
+                "p95": float(r["p95_us"]),
+                "p99": float(r["p99_us"]),
+                "p999": float(r["p999_us"]) if r.get("p999_us") else None,
+                "max": float(r["max_us"]),
             })
     return rows
 
 
 def text_table(rows):
     """Fallback: print a simple ASCII table."""
-    print(f"{'#':>4}  {'p50 (us)':>10}  {'p95 (us)':>10}  {'p99 (us)':>10}  {'max (us)':>10}")
-    print("-" * 52)
+    print(f"{'#':>4}  {'p50 (us)':>10}  {'p95 (us)':>10}  {'p99 (us)':>10}  "
+          f"{'p99.9 (us)':>10}  {'max (us)':>10}")
+    print("-" * 64)
     for i, r in enumerate(rows):
-        print(f"{i:4d}  {r['p50']:10d}  {r['p95']:10d}  {r['p99']:10d}  {r['max']:10d}")
+        p999 = f"{r['p999']:10.1f}" if r["p999"] is not None else f"{'-':>10}"
+        print(f"{i:4d}  {r['p50']:10.1f}  {r['p95']:10.1f}  {r['p99']:10.1f}  "
+              f"{p999}  {r['max']:10.1f}")
 
 
-def plot_matplotlib(rows, output):
+def plot_matplotlib(rows, output, key):
     import matplotlib
     matplotlib.use("Agg")
     import matplotlib.pyplot as plt
@@ -50,12 +61,18 @@ def plot_matplotlib(rows, output):
     ax.plot(xs, [r["p50"] for r in rows], label="p50", linewidth=1.5)
     ax.plot(xs, [r["p95"] for r in rows], label="p95", linewidth=1.5)
     ax.plot(xs, [r["p99"] for r in rows], label="p99", linewidth=1.5, linestyle="--")
+    if all(r["p999"] is not None for r in rows):
+        ax.plot(xs, [r["p999"] for r in rows], label="p99.9", linewidth=1.5,
+                linestyle="-.")
     ax.plot(xs, [r["max"] for r in rows], label="max", linewidth=1.0,
             linestyle=":", alpha=0.7)
 
     ax.set_xlabel("Time (seconds)")
     ax.set_ylabel("Run-queue latency (us)")
-    ax.set_title("CPU Scheduler Latency Over Time")
+    title = "CPU Scheduler Latency Over Time"
+    if key != "all":
+        title += f" ({key})"
+    ax.set_title(title)
     ax.legend()
     ax.grid(True, alpha=0.3)
     ax.set_yscale("log")
@@ -72,15 +89,17 @@ def main():
     parser = argparse.ArgumentParser(description="Plot runqlat CSV data")
     parser.add_argument("csv_file", help="CSV file from runqlat --csv")
     parser.add_argument("-o", "--output", help="Output PNG path (default: show window)")
+    parser.add_argument("-k", "--key", default="all",
+                        help="Key to plot from runqlat --by output (default: all)")
     args = parser.parse_args()
 
-    rows = load_csv(args.csv_file)
+    rows = load_csv(args.csv_file, args.key)
     if not rows:
         print("No data in CSV file.", file=sys.stderr)
         return 1
 
     try:
-        plot_matplotlib(rows, args.output)
+        plot_matplotlib(rows, args.output, args.key)
     except ImportError:
         print("matplotlib not available, printing text table:\n", file=sys.stderr)
         text_table(rows)
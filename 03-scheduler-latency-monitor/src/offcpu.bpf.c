@@ -0,0 +1,124 @@
+/* offcpu.bpf.c — BPF program: off-CPU time by stack trace
+ *
+ * Hooks sched_switch via tp_btf. When a task is switched out, its user
+ * and kernel stacks are captured with bpf_get_stackid() (it is still
+ * `current` at that point) and stored with a timestamp. When it is next
+ * switched in, the blocked time is added to a hash map keyed by
+ * (tgid, tid, user stack, kernel stack, reason).
+ *
+ * Userspace symbolizes the stacks and writes folded stacks weighted by
+ * microseconds blocked — the same format as 01-flame-graph-generator.
+ */
+
+#include "vmlinux.h"
+#include <bpf/bpf_helpers.h>
+#include <bpf/bpf_core_read.h>
+#include <bpf/bpf_tracing.h>
+#include "offcpu.h"
+
+#define PF_KTHREAD	0x00200000
+
+/* Userspace sets these before loading (via .rodata) */
+const volatile __u32 targ_tgid    = 0;		/* filter by process (0 = all) */
+const volatile __u64 min_block_ns = 1000;	/* ignore shorter blocks */
+const volatile __u64 max_block_ns = -1;
+const volatile int   user_only    = 0;		/* skip kernel stacks */
+const volatile int   kthreads     = 0;		/* include kernel threads */
+
+struct start_val {
+	__u64	ts;
+	int	user_stack_id;
+	int	kern_stack_id;
+	__u32	reason;
+};
+
+/* Hash map: tid → switch-out timestamp + stacks */
+struct {
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__uint(max_entries, OFFCPU_MAX_ENTRIES);
+	__type(key, __u32);
+	__type(value, struct start_val);
+} start SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_STACK_TRACE);
+	__uint(max_entries, OFFCPU_MAX_STACKS);
+	__uint(key_size, sizeof(__u32));
+	__uint(value_size, OFFCPU_MAX_DEPTH * sizeof(__u64));
+} stacks SEC(".maps");
+
+/* Hash map: offcpu_key → total usecs blocked */
+struct {
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__uint(max_entries, OFFCPU_MAX_ENTRIES);
+	__type(key, struct offcpu_key);
+	__type(value, __u64);
+} info SEC(".maps");
+
+static __always_inline int wanted(struct task_struct *t)
+{
+	if (BPF_CORE_READ(t, pid) == 0)
+		return 0;	/* idle task */
+	if (!kthreads && (BPF_CORE_READ(t, flags) & PF_KTHREAD))
+		return 0;
+	if (targ_tgid && BPF_CORE_READ(t, tgid) != targ_tgid)
+		return 0;
+	return 1;
+}
+
+SEC("tp_btf/sched_switch")
+int BPF_PROG(sched_switch, bool preempt,
+	     struct task_struct *prev, struct task_struct *next)
+{
+	struct start_val *sv, val = {};
+	struct offcpu_key key = {};
+	__u64 now = bpf_ktime_get_ns();
+	__u32 tid;
+
+	/* prev is leaving the CPU: remember when, why and where */
+	if (wanted(prev)) {
+		long state = BPF_CORE_READ(prev, __state);
+
+		tid = BPF_CORE_READ(prev, pid);
+		val.ts = now;
+		val.reason = state == 0 ? OFFCPU_PREEMPTED :
+			     state & 1  ? OFFCPU_SLEEP :
+			     state & 2  ? OFFCPU_DISK : OFFCPU_OTHER;
+		val.user_stack_id = bpf_get_stackid(ctx, &stacks, BPF_F_USER_STACK);
+		val.kern_stack_id = user_only ? -1 : bpf_get_stackid(ctx, &stacks, 0);
+		bpf_map_update_elem(&start, &tid, &val, BPF_ANY);
+	}
+
+	/* next is coming back: charge the time it was away */
+	tid = BPF_CORE_READ(next, pid);
+	sv = bpf_map_lookup_elem(&start, &tid);
+	if (!sv)
+		return 0;
+
+	__u64 delta = now - sv->ts;
+	if (delta >= min_block_ns && delta <= max_block_ns) {
+		__u64 us = delta / 1000, *total;
+
+		key.pid = BPF_CORE_READ(next, tgid);
+		key.tid = tid;
+		key.user_stack_id = sv->user_stack_id;
+		key.kern_stack_id = sv->kern_stack_id;
+		key.reason = sv->reason;
+		BPF_CORE_READ_STR_INTO(&key.comm, next, comm);
+
+		total = bpf_map_lookup_elem(&info, &key);
+		if (total) {
+			__sync_fetch_and_add(total, us);
+		} else if (bpf_map_update_elem(&info, &key, &us, BPF_NOEXIST)) {
+			/* Another CPU created the entry first: add to it */
+			total = bpf_map_lookup_elem(&info, &key);
+			if (total)
+				__sync_fetch_and_add(total, us);
+		}
+	}
+	bpf_map_delete_elem(&start, &tid);
+
+	return 0;
+}
+
+char LICENSE[] SEC("license") = "GPL";
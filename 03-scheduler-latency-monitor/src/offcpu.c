@@ -0,0 +1,346 @@
+/* offcpu.c — userspace loader for the offcpu BPF program
+ *
+ * Loads the BPF object, attaches to sched_switch (tp_btf), and after the
+ * tracing window walks the aggregated (stacks, reason) → usecs map,
+ * symbolizes the stacks, and prints folded stacks weighted by time
+ * blocked. Feed the output to 01-flame-graph-generator's renderer:
+ *
+ *   sudo bin/offcpu -p $(pgrep server) -d 10 > offcpu.folded
+ *   ../01-flame-graph-generator/bin/flamegraph -t "Off-CPU" < offcpu.folded > offcpu.svg
+ *
+ * Usage: sudo ./offcpu [options]
+ *        -p PID     trace one process only
+ *        -d SECS    trace for SECS seconds (default: until Ctrl-C)
+ *        -m USECS   ignore blocks shorter than USECS (default: 1)
+ *        -M USECS   ignore blocks longer than USECS
+ *        -u         user stacks only
+ *        -k         include kernel threads
+ *        -o FILE    write folded stacks to FILE (default: stdout)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <errno.h>
+#include <getopt.h>
+#include <linux/types.h>
+#include <bpf/libbpf.h>
+#include <bpf/bpf.h>
+
+#include "offcpu.h"
+#include "symbols.h"	/* from 01-flame-graph-generator */
+
+/* ── Configuration ─────────────────────────────────────────────── */
+
+static struct {
+	__u32		pid;		/* target PID / TGID (0 = all) */
+	int		duration;	/* seconds (0 = until Ctrl-C)  */
+	__u64		min_us;
+	__u64		max_us;
+	int		user_only;
+	int		kthreads;
+	const char	*outfile;
+} env = {
+	.min_us = 1,
+	.max_us = (__u64)-1 / 1000,
+};
+
+static volatile sig_atomic_t exiting;
+
+static void sig_handler(int sig)
+{
+	(void)sig;
+	exiting = 1;
+}
+
+/* ── Usage ─────────────────────────────────────────────────────── */
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"\n"
+		"Summarize off-CPU time by stack trace, as folded stacks\n"
+		"weighted by microseconds blocked.\n"
+		"\n"
+		"Options:\n"
+		"  -p PID    trace this PID only\n"
+		"  -d SECS   trace for SECS seconds (default: until Ctrl-C)\n"
+		"  -m USECS  minimum block time to record (default: 1)\n"
+		"  -M USECS  maximum block time to record\n"
+		"  -u        user stacks only (no kernel frames)\n"
+		"  -k        include kernel threads\n"
+		"  -o FILE   output file (default: stdout)\n"
+		"  -h        show this help\n",
+		prog);
+}
+
+/* ── .rodata configuration ─────────────────────────────────────── */
+
+/*
+ * Layout must match BPF globals declaration order in offcpu.bpf.c:
+ *   const volatile __u32 targ_tgid;
+ *   const volatile __u64 min_block_ns, max_block_ns;
+ *   const volatile int   user_only, kthreads;
+ */
+struct rodata {
+	__u32	targ_tgid;
+	__u64	min_block_ns;
+	__u64	max_block_ns;
+	int	user_only;
+	int	kthreads;
+};
+
+static struct bpf_map *find_rodata(struct bpf_object *obj)
+{
+	struct bpf_map *map;
+
+	bpf_object__for_each_map(map, obj) {
+		const char *name = bpf_map__name(map);
+		if (strstr(name, ".rodata"))
+			return map;
+	}
+	return NULL;
+}
+
+/* ── Folded stack output ───────────────────────────────────────── */
+
+static const char *reason_names[] = {
+	[OFFCPU_PREEMPTED] = "[preempted]",
+	[OFFCPU_SLEEP]     = "[sleep]",
+	[OFFCPU_DISK]      = "[uninterruptible]",
+	[OFFCPU_OTHER]     = "[other]",
+};
+
+#define MAX_LINE 8192
+
+/* Append frames root-first; the stack map stores them leaf-first */
+static int append_stack(char *buf, int pos, int stacks_fd, int stack_id, __u32 pid)
+{
+	__u64 ips[OFFCPU_MAX_DEPTH];
+	int depth = 0;
+
+	if (stack_id < 0 || bpf_map_lookup_elem(stacks_fd, &stack_id, ips) < 0)
+		return pos;
+	while (depth < OFFCPU_MAX_DEPTH && ips[depth])
+		depth++;
+
+	for (int i = depth - 1; i >= 0; i--) {
+		const char *sym = sym_resolve((int)pid, ips[i]);
+		if (strcmp(sym, "[unknown]") == 0)
+			continue;
+		int n = snprintf(buf + pos, MAX_LINE - pos, ";%s", sym);
+		if (n < 0 || n >= MAX_LINE - pos)
+			break;
+		pos += n;
+	}
+	return pos;
+}
+
+static int print_folded(FILE *out, int info_fd, int stacks_fd)
+{
+	struct offcpu_key key, next;
+	struct offcpu_key *prev = NULL;
+	__u64 total_us = 0, n_keys = 0, missing = 0;
+	char buf[MAX_LINE];
+
+	while (bpf_map_get_next_key(info_fd, prev, &next) == 0) {
+		__u64 us = 0;
+
+		key = next;
+		prev = &key;
+		if (bpf_map_lookup_elem(info_fd, &key, &us) < 0 || us == 0)
+			continue;
+
+		if (key.user_stack_id < 0 && key.kern_stack_id < 0)
+			missing++;
+
+		/* Sibling threads share symbols; sym_init is per process */
+		sym_init((int)key.pid);
+
+		char comm[TASK_COMM_LEN + 1];
+		memcpy(comm, key.comm, TASK_COMM_LEN);
+		comm[TASK_COMM_LEN] = '\0';
+
+		__u32 r = key.reason <= OFFCPU_OTHER ? key.reason : OFFCPU_OTHER;
+		int pos = snprintf(buf, MAX_LINE, "%s;%s", comm, reason_names[r]);
+		pos = append_stack(buf, pos, stacks_fd, key.user_stack_id, key.pid);
+		pos = append_stack(buf, pos, stacks_fd, key.kern_stack_id, key.pid);
+
+		fprintf(out, "%s %llu\n", buf, (unsigned long long)us);
+		total_us += us;
+		n_keys++;
+	}
+
+	fprintf(stderr, "offcpu: %llu stacks, %.3f s blocked in total",
+		(unsigned long long)n_keys, total_us / 1e6);
+	if (missing)
+		fprintf(stderr, " (%llu without stacks: stack map full or no frame pointers)",
+			(unsigned long long)missing);
+	fprintf(stderr, "\n");
+	return 0;
+}
+
+/* ── Main ──────────────────────────────────────────────────────── */
+
+int main(int argc, char **argv)
+{
+	struct bpf_object *obj = NULL;
+	struct bpf_program *prog;
+	struct bpf_link *link = NULL;
+	struct bpf_map *map;
+	int info_fd, stacks_fd;
+	int err = 0;
+
+	/* ── Parse CLI ──────────────────────────────────────────── */
+
+	int opt;
+	while ((opt = getopt(argc, argv, "p:d:m:M:ukho:")) != -1) {
+		switch (opt) {
+		case 'p':
+			env.pid = (__u32)atoi(optarg);
+			break;
+		case 'd':
+			env.duration = atoi(optarg);
+			break;
+		case 'm':
+			env.min_us = strtoull(optarg, NULL, 10);
+			break;
+		case 'M':
+			env.max_us = strtoull(optarg, NULL, 10);
+			break;
+		case 'u':
+			env.user_only = 1;
+			break;
+		case 'k':
+			env.kthreads = 1;
+			break;
+		case 'o':
+			env.outfile = optarg;
+			break;
+		case 'h':
+			usage(argv[0]);
+			return 0;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	/* ── Signal handling ────────────────────────────────────── */
+
+	signal(SIGINT, sig_handler);
+	signal(SIGTERM, sig_handler);
+
+	/* ── Open BPF object ────────────────────────────────────── */
+
+	obj = bpf_object__open("bin/offcpu.bpf.o");
+	if (libbpf_get_error(obj)) {
+		fprintf(stderr, "ERROR: failed to open BPF object: %s\n",
+			strerror(errno));
+		return 1;
+	}
+
+	/* ── Set .rodata configuration before load ──────────────── */
+
+	struct bpf_map *rodata_map = find_rodata(obj);
+	if (rodata_map) {
+		size_t sz;
+		struct rodata *rd = bpf_map__initial_value(rodata_map, &sz);
+		if (rd && sz >= sizeof(*rd)) {
+			rd->targ_tgid    = env.pid;
+			rd->min_block_ns = env.min_us * 1000;
+			rd->max_block_ns = env.max_us * 1000;
+			rd->user_only    = env.user_only;
+			rd->kthreads     = env.kthreads;
+		} else {
+			fprintf(stderr, "WARN: rodata pointer invalid, "
+				"filters may not work\n");
+		}
+	} else {
+		fprintf(stderr, "WARN: .rodata map not found, "
+			"filters not available\n");
+	}
+
+	/* ── Load + attach ──────────────────────────────────────── */
+
+	err = bpf_object__load(obj);
+	if (err) {
+		fprintf(stderr, "ERROR: failed to load BPF object: %s\n",
+			strerror(errno));
+		goto cleanup;
+	}
+
+	prog = bpf_object__find_program_by_name(obj, "sched_switch");
+	if (!prog) {
+		fprintf(stderr, "ERROR: program sched_switch not found\n");
+		err = 1;
+		goto cleanup;
+	}
+	link = bpf_program__attach(prog);
+	if (libbpf_get_error(link)) {
+		fprintf(stderr, "ERROR: failed to attach sched_switch: %s\n",
+			strerror(errno));
+		link = NULL;
+		err = 1;
+		goto cleanup;
+	}
+
+	map = bpf_object__find_map_by_name(obj, "info");
+	if (!map) {
+		fprintf(stderr, "ERROR: info map not found\n");
+		err = 1;
+		goto cleanup;
+	}
+	info_fd = bpf_map__fd(map);
+
+	map = bpf_object__find_map_by_name(obj, "stacks");
+	if (!map) {
+		fprintf(stderr, "ERROR: stacks map not found\n");
+		err = 1;
+		goto cleanup;
+	}
+	stacks_fd = bpf_map__fd(map);
+
+	/* ── Trace ──────────────────────────────────────────────── */
+
+	fprintf(stderr, "Tracing off-CPU time...");
+	if (env.pid)
+		fprintf(stderr, " PID %u.", env.pid);
+	if (env.duration)
+		fprintf(stderr, " %d seconds.\n", env.duration);
+	else
+		fprintf(stderr, " Hit Ctrl-C to end.\n");
+
+	for (int t = 0; !exiting && (!env.duration || t < env.duration); t++)
+		sleep(1);
+
+	/* Stop collecting before walking the map */
+	bpf_link__destroy(link);
+	link = NULL;
+
+	/* ── Output ─────────────────────────────────────────────── */
+
+	FILE *out = stdout;
+	if (env.outfile) {
+		out = fopen(env.outfile, "w");
+		if (!out) {
+			perror(env.outfile);
+			out = stdout;
+		}
+	}
+
+	print_folded(out, info_fd, stacks_fd);
+
+	if (out != stdout)
+		fclose(out);
+	sym_cleanup();
+
+cleanup:
+	bpf_link__destroy(link);
+	bpf_object__close(obj);
+
+	return err != 0;
+}
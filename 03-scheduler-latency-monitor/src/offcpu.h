@@ -0,0 +1,29 @@
+/* offcpu.h — shared definitions between offcpu.bpf.c and offcpu.c */
+
+#ifndef OFFCPU_H
+#define OFFCPU_H
+
+#define TASK_COMM_LEN		16
+#define OFFCPU_MAX_DEPTH	127	/* PERF_MAX_STACK_DEPTH */
+#define OFFCPU_MAX_STACKS	16384
+#define OFFCPU_MAX_ENTRIES	10240
+
+/* Why the task left the CPU (prev->__state at sched_switch) */
+enum offcpu_reason {
+	OFFCPU_PREEMPTED = 0,	/* TASK_RUNNING: still runnable, waited for a CPU */
+	OFFCPU_SLEEP     = 1,	/* TASK_INTERRUPTIBLE: locks, futexes, sockets, sleep() */
+	OFFCPU_DISK      = 2,	/* TASK_UNINTERRUPTIBLE: mostly block I/O */
+	OFFCPU_OTHER     = 3,
+};
+
+/* One aggregation key per (thread, stacks, reason); value is __u64 usecs */
+struct offcpu_key {
+	__u32	pid;		/* TGID */
+	__u32	tid;
+	int	user_stack_id;	/* < 0: not captured */
+	int	kern_stack_id;
+	__u32	reason;
+	char	comm[TASK_COMM_LEN];
+};
+
+#endif /* OFFCPU_H */
@@ -7,7 +7,21 @@
  * Uses tp_btf so we get typed access to task_struct, allowing proper
  * TGID-based PID filtering (all threads in a process, not just one).
  *
- * Results are stored in a log2 histogram (power-of-2 buckets, microseconds).
+ * Results are stored in a log-linear histogram of nanoseconds (hdr_hist.h:
+ * 2 significant digits, so p99.9 is within 1%, not a power-of-2 slot).
+ * Optionally, a hash of histograms keyed by TGID, cgroup or comm breaks the
+ * same waits down per tenant.
+ *
+ * With `fast` set, the enqueue timestamp lives in task-local storage
+ * (no hash lookup/delete per switch) and the histogram is a PERCPU_ARRAY
+ * (no atomics, no cache line bouncing between CPUs); userspace sums it.
+ *
+ * With `min_us` set, every wait at least that long is also pushed into a
+ * ring buffer with who waited, on which CPU, and who held the CPU.
+ *
+ * The imbalance view adds a perf_event program sampling each CPU's
+ * nr_running, and a sched_migrate_task hook counting migrations by
+ * source and destination CPU.
  */
 
 #include "vmlinux.h"
@@ -19,6 +33,10 @@
 /* Userspace sets these before loading (via .rodata) */
 const volatile __u32 targ_tgid = 0;	/* filter by process PID (TGID) */
 const volatile int   per_cpu   = 0;	/* enable per-CPU histograms    */
+const volatile int   targ_key  = 0;	/* per-key histograms (hist_key_mode) */
+const volatile int   fast      = 0;	/* task storage + per-CPU histogram */
+const volatile __u64 min_us    = 0;	/* outlier events (0 = off)     */
+const volatile int   stacks_on = 0;	/* stack IDs in outlier events  */
 
 /* Hash map: tid → enqueue timestamp (ns) */
 struct {
@@ -28,73 +46,239 @@ struct {
 	__type(value, __u64);
 } start SEC(".maps");
 
-/* Global histogram: slot → count */
+/* Task-local storage: enqueue timestamp (fast path, 0 = not queued) */
+struct {
+	__uint(type, BPF_MAP_TYPE_TASK_STORAGE);
+	__uint(map_flags, BPF_F_NO_PREALLOC);
+	__type(key, int);
+	__type(value, __u64);
+} start_ts SEC(".maps");
+
+/* Global histogram: slot → count (mmapable: userspace reads it in place) */
 struct {
 	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
 	__uint(max_entries, MAX_SLOTS);
 	__type(key, __u32);
 	__type(value, __u64);
 } hist SEC(".maps");
 
-/* Per-CPU histogram: (cpu * MAX_SLOTS + slot) → count */
+/* Fast-path histogram: slot → count, one copy per CPU (also serves -C) */
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__uint(max_entries, MAX_SLOTS);
+	__type(key, __u32);
+	__type(value, __u64);
+} hist_pcpu SEC(".maps");
+
+/* Per-CPU histogram: (cpu * MAX_SLOTS + slot) → count (mmapable) */
 struct {
 	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
 	__uint(max_entries, MAX_CPUS * MAX_SLOTS);
 	__type(key, __u32);
 	__type(value, __u64);
 } hist_cpu SEC(".maps");
 
-/* Compute floor(log2(v)), verifier-safe via unrolled loop */
-static __always_inline __u32 log2l(__u64 v)
-{
-	__u32 r = 0;
+/* Hash map: hist_key → histogram + total wait (targ_key != KEY_NONE) */
+struct {
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__uint(max_entries, MAX_KEYS);
+	__type(key, struct hist_key);
+	__type(value, struct hist_val);
+} hist_by_key SEC(".maps");
 
-	#pragma unroll
-	for (int i = 0; i < 25; i++) {
-		if (v > 1) {
-			v >>= 1;
-			r++;
-		}
-	}
-	return r;
-}
+/* Outlier events → userspace */
+struct {
+	__uint(type, BPF_MAP_TYPE_RINGBUF);
+	__uint(max_entries, RQ_RINGBUF_SIZE);
+} events SEC(".maps");
+
+/* Events lost to a full ring buffer: [0] → count */
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(max_entries, 1);
+	__type(key, __u32);
+	__type(value, __u64);
+} event_drops SEC(".maps");
+
+/* Stacks of the task that held the CPU during an outlier wait */
+struct {
+	__uint(type, BPF_MAP_TYPE_STACK_TRACE);
+	__uint(max_entries, RQ_MAX_STACKS);
+	__uint(key_size, sizeof(__u32));
+	__uint(value_size, RQ_MAX_DEPTH * sizeof(__u64));
+} stacks SEC(".maps");
+
+/* Run-queue depth samples: (cpu * MAX_QDEPTH + nr_running) → count */
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
+	__uint(max_entries, MAX_CPUS * MAX_QDEPTH);
+	__type(key, __u32);
+	__type(value, __u64);
+} depth_hist SEC(".maps");
+
+/* Migrations: (src_cpu * MAX_CPUS + dst_cpu) → count */
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(map_flags, BPF_F_MMAPABLE);
+	__uint(max_entries, MAX_CPUS * MAX_CPUS);
+	__type(key, __u32);
+	__type(value, __u64);
+} migrations SEC(".maps");
+
+extern const struct rq runqueues __ksym;
 
-static __always_inline void record_enqueue(__u32 tgid, __u32 tid)
+/* Initial value for new hist_by_key entries (too big for the stack twice) */
+static struct hist_val zero_val;
+
+static __always_inline void record_enqueue(struct task_struct *p,
+					   __u32 tgid, __u32 tid)
 {
-	__u64 ts;
+	__u64 ts, *tsp;
 
 	if (targ_tgid && tgid != targ_tgid)
 		return;
 
 	ts = bpf_ktime_get_ns();
+	if (fast) {
+		tsp = bpf_task_storage_get(&start_ts, p, 0,
+					   BPF_LOCAL_STORAGE_GET_F_CREATE);
+		if (tsp)
+			*tsp = ts;
+		return;
+	}
 	bpf_map_update_elem(&start, &tid, &ts, BPF_ANY);
 }
 
-static __always_inline void record_dequeue(__u32 tgid, __u32 tid)
+/* Add one wait to the histogram of p's TGID / cgroup / comm */
+static __always_inline void record_key(struct task_struct *p, __u64 delta_ns)
+{
+	struct hist_key key = {};
+	struct hist_val *val;
+	__u32 slot;
+
+	switch (targ_key) {
+	case KEY_TGID:
+		key.id = BPF_CORE_READ(p, tgid);
+		break;
+	case KEY_CGROUP:
+		key.id = BPF_CORE_READ(p, cgroups, dfl_cgrp, kn, id);
+		break;
+	case KEY_COMM:
+		BPF_CORE_READ_STR_INTO(&key.comm, p, comm);
+		break;
+	default:
+		return;
+	}
+
+	val = bpf_map_lookup_elem(&hist_by_key, &key);
+	if (!val) {
+		/* NOEXIST: another CPU may have created it meanwhile */
+		bpf_map_update_elem(&hist_by_key, &key, &zero_val, BPF_NOEXIST);
+		val = bpf_map_lookup_elem(&hist_by_key, &key);
+		if (!val)
+			return;		/* map full: still counted in hist */
+		BPF_CORE_READ_STR_INTO(&val->comm, p, group_leader, comm);
+	}
+
+	slot = hdr_index(delta_ns, KEY_SUB_BITS);
+	if (slot >= KEY_SLOTS)
+		slot = KEY_SLOTS - 1;
+	__sync_fetch_and_add(&val->slots[slot], 1);
+	__sync_fetch_and_add(&val->total_us, delta_ns / 1000);
+}
+
+/*
+ * Report one long wait. Runs in sched_switch, so `current` is still prev:
+ * the stacks are of the task that kept p off the CPU, at the moment it
+ * gave the CPU up.
+ */
+static __always_inline void emit_outlier(void *ctx, struct task_struct *p,
+					 struct task_struct *prev,
+					 __u64 delta_us)
+{
+	struct rq_event *e;
+	__u32 zero = 0;
+	__u64 *drops;
+
+	e = bpf_ringbuf_reserve(&events, sizeof(*e), 0);
+	if (!e) {
+		/* Userspace fell behind: count it, never block the switch */
+		drops = bpf_map_lookup_elem(&event_drops, &zero);
+		if (drops)
+			__sync_fetch_and_add(drops, 1);
+		return;
+	}
+
+	e->ts_ns = bpf_ktime_get_ns();
+	e->wait_us = delta_us;
+	e->pid = BPF_CORE_READ(p, tgid);
+	e->tid = BPF_CORE_READ(p, pid);
+	e->cpu = bpf_get_smp_processor_id();
+	e->prev_pid = BPF_CORE_READ(prev, tgid);
+	e->prev_tid = BPF_CORE_READ(prev, pid);
+	BPF_CORE_READ_STR_INTO(&e->comm, p, comm);
+	BPF_CORE_READ_STR_INTO(&e->prev_comm, prev, comm);
+	e->user_stack_id = -1;
+	e->kern_stack_id = -1;
+	if (stacks_on) {
+		e->user_stack_id = bpf_get_stackid(ctx, &stacks, BPF_F_USER_STACK);
+		e->kern_stack_id = bpf_get_stackid(ctx, &stacks, 0);
+	}
+
+	bpf_ringbuf_submit(e, 0);
+}
+
+static __always_inline void record_dequeue(void *ctx, struct task_struct *p,
+					   struct task_struct *prev,
+					   __u32 tgid, __u32 tid)
 {
-	__u64 *tsp, delta, now;
+	__u64 *tsp, delta, delta_us, now;
 	__u32 slot, key;
 	__u64 *countp;
 
 	if (targ_tgid && tgid != targ_tgid)
 		return;
 
-	tsp = bpf_map_lookup_elem(&start, &tid);
-	if (!tsp)
-		return;
+	if (fast) {
+		/* Storage stays with the task; zero marks "not queued" */
+		tsp = bpf_task_storage_get(&start_ts, p, 0, 0);
+		if (!tsp || !*tsp)
+			return;
+		now = bpf_ktime_get_ns();
+		delta = now - *tsp;
+		*tsp = 0;
+	} else {
+		tsp = bpf_map_lookup_elem(&start, &tid);
+		if (!tsp)
+			return;
 
-	now = bpf_ktime_get_ns();
-	delta = now - *tsp;
-	bpf_map_delete_elem(&start, &tid);
+		now = bpf_ktime_get_ns();
+		delta = now - *tsp;
+		bpf_map_delete_elem(&start, &tid);
+	}
 
-	/* Convert ns → us for histogram buckets */
-	delta /= 1000;
+	delta_us = delta / 1000;
+	if (min_us && delta_us >= min_us)
+		emit_outlier(ctx, p, prev, delta_us);
 
-	/* Compute log2 bucket */
-	slot = log2l(delta);
+	/* Log-linear slot: index math only, no loop */
+	slot = hdr_index(delta, HIST_SUB_BITS);
 	if (slot >= MAX_SLOTS)
 		slot = MAX_SLOTS - 1;
 
+	if (fast) {
+		/* This CPU's copy: nobody else writes it, no atomic needed */
+		countp = bpf_map_lookup_elem(&hist_pcpu, &slot);
+		if (countp)
+			(*countp)++;
+		if (targ_key)
+			record_key(p, delta);
+		return;
+	}
+
 	/* Update global histogram */
 	countp = bpf_map_lookup_elem(&hist, &slot);
 	if (countp)
@@ -110,19 +294,22 @@ static __always_inline void record_dequeue(__u32 tgid, __u32 tid)
 				__sync_fetch_and_add(countp, 1);
 		}
 	}
+
+	if (targ_key)
+		record_key(p, delta);
 }
 
 SEC("tp_btf/sched_wakeup")
 int BPF_PROG(sched_wakeup, struct task_struct *p)
 {
-	record_enqueue(BPF_CORE_READ(p, tgid), BPF_CORE_READ(p, pid));
+	record_enqueue(p, BPF_CORE_READ(p, tgid), BPF_CORE_READ(p, pid));
 	return 0;
 }
 
 SEC("tp_btf/sched_wakeup_new")
 int BPF_PROG(sched_wakeup_new, struct task_struct *p)
 {
-	record_enqueue(BPF_CORE_READ(p, tgid), BPF_CORE_READ(p, pid));
+	record_enqueue(p, BPF_CORE_READ(p, tgid), BPF_CORE_READ(p, pid));
 	return 0;
 }
 
@@ -141,11 +328,67 @@ int BPF_PROG(sched_switch, bool preempt,
 	 * it was involuntarily preempted — record its enqueue time.
 	 */
 	if (prev_state == 0 /* TASK_RUNNING */)
-		record_enqueue(prev_tgid, prev_pid);
+		record_enqueue(prev, prev_tgid, prev_pid);
 
 	/* The next task is leaving the run queue — record its wait time */
-	record_dequeue(next_tgid, next_pid);
+	record_dequeue(ctx, next, prev, next_tgid, next_pid);
+
+	return 0;
+}
+
+/*
+ * Fired on every CPU at a fixed rate (cpu-clock, so also when idle):
+ * nr_running counts the running task too, 0 means the CPU was idle.
+ */
+SEC("perf_event")
+int sample_depth(struct bpf_perf_event_data *ctx)
+{
+	struct rq *rq = bpf_this_cpu_ptr(&runqueues);
+	__u32 cpu = bpf_get_smp_processor_id();
+	__u32 depth, key;
+	__u64 *countp;
+
+	if (cpu >= MAX_CPUS)
+		return 0;
+
+	depth = rq->nr_running;
+	if (depth >= MAX_QDEPTH)
+		depth = MAX_QDEPTH - 1;
+
+	key = cpu * MAX_QDEPTH + depth;
+	countp = bpf_map_lookup_elem(&depth_hist, &key);
+	if (countp)
+		__sync_fetch_and_add(countp, 1);
+	return 0;
+}
+
+/* task_struct::cpu moved into thread_info in 5.16 */
+struct task_struct___old {
+	unsigned int cpu;
+} __attribute__((preserve_access_index));
+
+static __always_inline __u32 task_cpu(struct task_struct *p)
+{
+	if (bpf_core_field_exists(p->thread_info.cpu))
+		return BPF_CORE_READ(p, thread_info.cpu);
+	return BPF_CORE_READ((struct task_struct___old *)p, cpu);
+}
 
+SEC("tp_btf/sched_migrate_task")
+int BPF_PROG(sched_migrate_task, struct task_struct *p, int dest_cpu)
+{
+	__u32 src = task_cpu(p), dst = dest_cpu, key;
+	__u64 *countp;
+
+	if (targ_tgid && BPF_CORE_READ(p, tgid) != targ_tgid)
+		return 0;
+	if (src >= MAX_CPUS || dst >= MAX_CPUS)
+		return 0;
+
+	key = src * MAX_CPUS + dst;
+	countp = bpf_map_lookup_elem(&migrations, &key);
+	if (countp)
+		__sync_fetch_and_add(countp, 1);
 	return 0;
 }
 
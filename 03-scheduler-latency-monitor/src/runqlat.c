@@ -1,15 +1,31 @@
 /* runqlat.c — userspace loader for the runqlat BPF program
  *
  * Loads the BPF object, attaches to scheduler tracepoints (tp_btf),
- * and periodically reads + prints the latency histogram.
+ * and periodically snapshots + prints the latency histogram. The
+ * interval may be fractional (e.g. 0.1 for 100 ms).
  *
  * Usage: sudo ./runqlat [options] [interval [count]]
  *        -p PID     trace one process only
  *        -C         show per-CPU histograms
  *        -m         display milliseconds (default: microseconds)
- *        --csv      CSV output (timestamp,p50,p95,p99,max)
+ *        --by KEY   per-key histograms: tgid, cgroup or comm
+ *        --top N    rows to print with --by (default 10)
+ *        --sort S   order --by rows by p99 (default) or total wait
+ *        --fast     low-overhead maps: task storage + per-CPU arrays
+ *        --min-us N stream every wait >= N us (ring buffer)
+ *        --stacks   add the CPU holder's stacks to --min-us events
+ *        -I         imbalance view: run-queue depth heatmap and
+ *                   CPU / NUMA node migration matrices
+ *        --csv      CSV output (timestamp,key,p50,p95,p99,p99.9,max)
+ *        --json F   whole-run percentiles in the common result schema
+ *                   (bench_json.h; $BENCH_JSON when run by benchrun)
+ *
+ * The BPF histograms are log-linear (hdr_hist.h): percentiles come from
+ * them with 2 significant digits; the ASCII view folds them back into
+ * the familiar power-of-2 rows.
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -18,28 +34,61 @@
 #include <errno.h>
 #include <time.h>
 #include <getopt.h>
+#include <ftw.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
 #include <linux/types.h>
 #include <bpf/libbpf.h>
 #include <bpf/bpf.h>
 
 #include "runqlat.h"
+#include "symbols.h"
+#include "bench_json.h"
 
 /* ── Configuration ─────────────────────────────────────────────── */
 
 static struct {
-	int	interval;	/* seconds between prints      */
+	double	interval;	/* seconds between prints      */
 	int	count;		/* number of intervals (0=inf) */
 	__u32	pid;		/* target PID / TGID (0 = all) */
 	int	per_cpu;	/* show per-CPU histograms     */
 	int	milliseconds;	/* display in ms not us        */
 	int	csv;		/* CSV output mode             */
+	int	key_mode;	/* enum hist_key_mode          */
+	int	top;		/* rows shown with --by        */
+	int	sort_total;	/* sort by total wait, not p99 */
+	int	fast;		/* --fast BPF data path        */
+	__u64	min_us;		/* outlier threshold (0 = off) */
+	int	stacks;		/* stacks in outlier events    */
+	int	imbalance;	/* depth + migration view      */
+	const char	*json;	/* --json result file          */
 } env = {
 	.interval = 99999999,	/* default: run until Ctrl-C   */
 	.count    = 1,
+	.top      = 10,
+};
+
+static const char *key_mode_names[] = {
+	[KEY_NONE]   = "none",
+	[KEY_TGID]   = "tgid",
+	[KEY_CGROUP] = "cgroup",
+	[KEY_COMM]   = "comm",
 };
 
 static volatile sig_atomic_t exiting;
 
+/* Sub-second capable sleep; returns early on a signal */
+static void sleep_interval(double secs)
+{
+	struct timespec ts;
+
+	ts.tv_sec = (time_t)secs;
+	ts.tv_nsec = (long)((secs - ts.tv_sec) * 1e9);
+	nanosleep(&ts, NULL);
+}
+
 static void sig_handler(int sig)
 {
 	(void)sig;
@@ -54,16 +103,70 @@ static void usage(const char *prog)
 		"Usage: %s [options] [interval [count]]\n"
 		"\n"
 		"Measure CPU run-queue (scheduler) latency.\n"
+		"interval is in seconds and may be fractional (0.1 = 100 ms).\n"
 		"\n"
 		"Options:\n"
 		"  -p PID   trace this PID only\n"
 		"  -C       show per-CPU histograms\n"
+		"  -I       imbalance view: per-CPU run-queue depth heatmap\n"
+		"           and migration matrices by CPU and NUMA node\n"
 		"  -m       display in milliseconds (default: microseconds)\n"
-		"  --csv    CSV output: timestamp,p50,p95,p99,max\n"
+		"  --by KEY per-key histograms: tgid, cgroup or comm; prints\n"
+		"           the top-N keys by wait time each interval\n"
+		"  --top N  number of keys to print (default: 10)\n"
+		"  --sort S sort keys by p99 (default) or total wait time\n"
+		"  --fast   low-overhead data path: task-local timestamps and\n"
+		"           per-CPU histograms (kernel 5.11+)\n"
+		"  --min-us N\n"
+		"           also print every wait of N us or more as it\n"
+		"           happens: who waited, where, and who had the CPU\n"
+		"  --stacks with --min-us: kernel and user stack of the task\n"
+		"           that had the CPU\n"
+		"  --csv    CSV output: timestamp,key,p50,p95,p99,p99.9,max\n"
+		"  --json F write the whole run's percentiles to F in the\n"
+		"           common result schema (bench_json.h)\n"
 		"  -h       show this help\n",
 		prog);
 }
 
+/* ── Percentile computation from histogram ─────────────────────── */
+
+struct percentiles {
+	double p50;		/* microseconds */
+	double p95;
+	double p99;
+	double p999;
+	double max;		/* upper bound of the highest slot */
+};
+
+/* Counts of a BPF histogram (sub_bits layout) as a struct hdr_hist */
+static int load_hdr(struct hdr_hist *h, const __u64 slots[], int nslots,
+		    int sub_bits)
+{
+	if (hdr_init(h, sub_bits, HIST_MAX_BITS) < 0)
+		return -1;
+	for (int i = 0; i < nslots; i++)
+		hdr_add(h, i, slots[i]);
+	return 0;
+}
+
+static struct percentiles compute_percentiles(const __u64 slots[], int nslots,
+					      int sub_bits)
+{
+	struct percentiles p = {0};
+	struct hdr_hist h;
+
+	if (load_hdr(&h, slots, nslots, sub_bits) < 0)
+		return p;
+	p.p50  = hdr_percentile(&h, 50) / 1000.0;
+	p.p95  = hdr_percentile(&h, 95) / 1000.0;
+	p.p99  = hdr_percentile(&h, 99) / 1000.0;
+	p.p999 = hdr_percentile(&h, 99.9) / 1000.0;
+	p.max  = h.max / 1000.0;
+	hdr_free(&h);
+	return p;
+}
+
 /* ── Histogram display ─────────────────────────────────────────── */
 
 #define HIST_WIDTH 40
@@ -94,21 +197,35 @@ static void print_hist_row(__u64 low, __u64 high, __u64 count, __u64 max_count)
 	printf("|\n");
 }
 
-/* Print one full power-of-2 histogram from an array of slot counts. */
-static void print_histogram(__u64 slots[], int nslots, int use_ms)
+#define LOG2_ROWS	40
+
+/*
+ * Print one histogram of MAX_SLOTS log-linear slots: folded into
+ * power-of-2 rows of usecs (or msecs), then its percentiles.
+ */
+static void print_histogram(const __u64 slots[], int nslots, int use_ms)
 {
-	__u64 max_count = 0;
+	__u64 rows[LOG2_ROWS] = {0}, max_count = 0;
 	int first = -1, last = -1;
 	const char *unit = use_ms ? "msecs" : "usecs";
 
-	/* Find range of non-zero slots and max count */
 	for (int i = 0; i < nslots; i++) {
-		if (slots[i] > 0) {
+		if (!slots[i])
+			continue;
+		__u64 us = hdr_lowest(i, HIST_SUB_BITS) / 1000;
+		int row = us ? hdr_log2(us) : 0;
+
+		rows[row < LOG2_ROWS ? row : LOG2_ROWS - 1] += slots[i];
+	}
+
+	/* Find range of non-zero rows and max count */
+	for (int i = 0; i < LOG2_ROWS; i++) {
+		if (rows[i] > 0) {
 			if (first < 0)
 				first = i;
 			last = i;
-			if (slots[i] > max_count)
-				max_count = slots[i];
+			if (rows[i] > max_count)
+				max_count = rows[i];
 		}
 	}
 
@@ -128,114 +245,853 @@ static void print_histogram(__u64 slots[], int nslots, int use_ms)
 			high /= 1000;
 		}
 
-		print_hist_row(low, high, slots[i], max_count);
+		print_hist_row(low, high, rows[i], max_count);
 	}
+
+	struct percentiles p = compute_percentiles(slots, nslots, HIST_SUB_BITS);
+	double div = use_ms ? 1000.0 : 1.0;
+	int prec = use_ms ? 3 : 1;
+
+	printf("     p50 %.*f  p95 %.*f  p99 %.*f  p99.9 %.*f  max %.*f %s\n",
+	       prec, p.p50 / div, prec, p.p95 / div, prec, p.p99 / div,
+	       prec, p.p999 / div, prec, p.max / div, unit);
 }
 
-/* ── Percentile computation from histogram ─────────────────────── */
+/* ── CSV output ────────────────────────────────────────────────── */
 
-struct percentiles {
-	__u64 p50;
-	__u64 p95;
-	__u64 p99;
-	__u64 max;
-};
+/*
+ * One row per interval for the global histogram (key "all"), plus one per
+ * top-N key with --by. plot_latency.py selects a key with --key.
+ */
+static void print_csv_header(void)
+{
+	printf("timestamp,key,p50_us,p95_us,p99_us,p999_us,max_us\n");
+}
 
-static struct percentiles compute_percentiles(__u64 slots[], int nslots)
+static void print_csv_row(const char *key, const __u64 slots[], int nslots,
+			  int sub_bits)
 {
-	struct percentiles p = {0};
-	__u64 total = 0;
+	struct percentiles p = compute_percentiles(slots, nslots, sub_bits);
+	struct timespec ts;
 
-	for (int i = 0; i < nslots; i++)
-		total += slots[i];
+	clock_gettime(CLOCK_REALTIME, &ts);
+	printf("%ld.%03ld,%s,%.1f,%.1f,%.1f,%.1f,%.1f\n",
+	       ts.tv_sec, ts.tv_nsec / 1000000, key,
+	       p.p50, p.p95, p.p99, p.p999, p.max);
+}
 
-	if (total == 0)
-		return p;
+/* ── JSON result (--json) ──────────────────────────────────────── */
 
-	__u64 cum = 0;
-	int got50 = 0, got95 = 0, got99 = 0;
+/*
+ * Interval deltas summed over the run: one result for the whole trace,
+ * so repeated runs of the same workload compare as one measurement.
+ */
+static __u64 run_slots[MAX_SLOTS];
 
+static void json_add_interval(const __u64 slots[])
+{
+	for (int i = 0; i < MAX_SLOTS; i++)
+		run_slots[i] += slots[i];
+}
+
+static void json_write_run(void)
+{
+	struct percentiles p = compute_percentiles(run_slots, MAX_SLOTS,
+						   HIST_SUB_BITS);
+	__u64 waits = 0;
+	char pid[16];
+
+	for (int i = 0; i < MAX_SLOTS; i++)
+		waits += run_slots[i];
+	/* Metadata, not a param: a pgrep'd pid changes every run */
+	if (env.pid) {
+		snprintf(pid, sizeof(pid), "%u", env.pid);
+		bj_meta("pid", pid);
+	}
+	bj_result("all");
+	bj_param_str("maps", env.fast ? "fast" : "default");
+	bj_metric("p50_us", p.p50, "us", BJ_LOWER);
+	bj_metric("p95_us", p.p95, "us", BJ_LOWER);
+	bj_metric("p99_us", p.p99, "us", BJ_LOWER);
+	bj_metric("p999_us", p.p999, "us", BJ_LOWER);
+	bj_metric("max_us", p.max, "us", BJ_LOWER);
+	bj_metric("waits", (double)waits, "count", BJ_NONE);
+}
+
+/* ── Histogram snapshots ───────────────────────────────────────── */
+
+/*
+ * The BPF side only ever increments; nothing is cleared. Each interval
+ * takes a snapshot of the cumulative counts and prints the difference
+ * from the previous one, so no increment racing with a clear is lost.
+ *
+ * Default maps: hist and hist_cpu, shared ARRAYs created BPF_F_MMAPABLE
+ * and read straight from mapped memory (no syscall at all). --fast:
+ * hist_pcpu, a PERCPU_ARRAY where each CPU bumps its own copy of a slot;
+ * one bpf_map_lookup_batch() returns every CPU's copy of every slot,
+ * summed here for the global view and kept apart for -C. Kernels without
+ * mmap or batch support fall back to one lookup per element.
+ */
+static struct {
+	int		hist_fd;	/* hist, or hist_pcpu with --fast  */
+	int		hist_cpu_fd;	/* hist_cpu (-C without --fast)    */
+	int		ncpus;		/* CPUs shown by -C                */
+	int		npossible;	/* values per PERCPU_ARRAY element */
+	const __u64	*hist_mem;	/* mmap of hist, or NULL           */
+	const __u64	*hist_cpu_mem;	/* mmap of hist_cpu, or NULL       */
+	size_t		hist_len, hist_cpu_len;
+	__u64		*pcpu_vals;	/* MAX_SLOTS * npossible values    */
+	__u64		cur[MAX_SLOTS], prev[MAX_SLOTS];
+	__u64		*cur_cpu, *prev_cpu;	/* ncpus * MAX_SLOTS       */
+} hm = { .hist_cpu_fd = -1 };
+
+static int read_hist(int fd, __u64 slots[], int nslots)
+{
 	for (int i = 0; i < nslots; i++) {
-		if (slots[i] > 0)
-			p.max = (1ULL << (i + 1)) - 1;  /* upper bound of slot */
+		__u32 key = i;
+		__u64 val = 0;
+
+		if (bpf_map_lookup_elem(fd, &key, &val) < 0)
+			return -1;
+		slots[i] = val;
+	}
+	return 0;
+}
+
+/* Map an mmapable ARRAY read-only; NULL if the kernel can't */
+static const __u64 *mmap_hist(struct bpf_map *map, size_t *len)
+{
+	long page = sysconf(_SC_PAGESIZE);
+	void *mem;
+
+	*len = (size_t)bpf_map__value_size(map) * bpf_map__max_entries(map);
+	*len = (*len + page - 1) / page * page;
+	mem = mmap(NULL, *len, PROT_READ, MAP_SHARED, bpf_map__fd(map), 0);
+	return mem == MAP_FAILED ? NULL : mem;
+}
 
-		cum += slots[i];
+/* Copy n counters out of a mapped array; the BPF side updates them atomically */
+static void copy_hist(__u64 dst[], const __u64 *mem, int n)
+{
+	for (int i = 0; i < n; i++)
+		dst[i] = __atomic_load_n(&mem[i], __ATOMIC_RELAXED);
+}
 
-		if (!got50 && cum >= total * 50 / 100) {
-			p.p50 = (i == 0) ? 0 : (1ULL << i);
-			got50 = 1;
+/* Every CPU's copy of every slot: pcpu_vals[slot * npossible + cpu] */
+static int read_hist_pcpu(void)
+{
+	LIBBPF_OPTS(bpf_map_batch_opts, opts);
+	__u32 keys[MAX_SLOTS], count = MAX_SLOTS, out_batch;
+	static int no_batch;
+	int err;
+
+	if (!no_batch) {
+		err = bpf_map_lookup_batch(hm.hist_fd, NULL, &out_batch, keys,
+					   hm.pcpu_vals, &count, &opts);
+		/* ENOENT: reached the end, which a full read always does */
+		if ((!err || errno == ENOENT) && count == MAX_SLOTS)
+			return 0;
+		no_batch = 1;
+	}
+
+	for (int i = 0; i < MAX_SLOTS; i++) {
+		__u32 key = i;
+
+		if (bpf_map_lookup_elem(hm.hist_fd, &key,
+					&hm.pcpu_vals[i * hm.npossible]) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+/* Cumulative counts → counts since the previous call */
+static void take_delta(__u64 out[], const __u64 cur[], __u64 prev[], int n)
+{
+	for (int i = 0; i < n; i++) {
+		out[i] = cur[i] - prev[i];
+		prev[i] = cur[i];
+	}
+}
+
+/*
+ * Global histogram since the last snapshot into slots; per-CPU ones into
+ * cpu_slots[cpu * MAX_SLOTS + slot] if non-NULL.
+ */
+static int snapshot(__u64 slots[], __u64 cpu_slots[])
+{
+	int ncpu_slots = hm.ncpus * MAX_SLOTS;
+
+	if (env.fast) {
+		if (read_hist_pcpu() < 0)
+			return -1;
+		for (int i = 0; i < MAX_SLOTS; i++) {
+			const __u64 *v = &hm.pcpu_vals[i * hm.npossible];
+
+			hm.cur[i] = 0;
+			for (int cpu = 0; cpu < hm.npossible; cpu++) {
+				hm.cur[i] += v[cpu];
+				if (cpu < hm.ncpus)
+					hm.cur_cpu[cpu * MAX_SLOTS + i] = v[cpu];
+			}
+		}
+	} else {
+		if (hm.hist_mem)
+			copy_hist(hm.cur, hm.hist_mem, MAX_SLOTS);
+		else if (read_hist(hm.hist_fd, hm.cur, MAX_SLOTS) < 0)
+			return -1;
+
+		if (hm.hist_cpu_mem)
+			copy_hist(hm.cur_cpu, hm.hist_cpu_mem, ncpu_slots);
+		else if (hm.hist_cpu_fd >= 0 &&
+			 read_hist(hm.hist_cpu_fd, hm.cur_cpu, ncpu_slots) < 0)
+			return -1;
+	}
+
+	take_delta(slots, hm.cur, hm.prev, MAX_SLOTS);
+	if (hm.cur_cpu) {
+		if (cpu_slots)
+			take_delta(cpu_slots, hm.cur_cpu, hm.prev_cpu, ncpu_slots);
+		else
+			memcpy(hm.prev_cpu, hm.cur_cpu,
+			       ncpu_slots * sizeof(__u64));
+	}
+	return 0;
+}
+
+/* ── Per-key histograms (--by) ─────────────────────────────────── */
+
+#define CGROUP_ROOT	"/sys/fs/cgroup"
+#define KEY_NAME_LEN	128
+
+struct key_row {
+	struct hist_key		key;
+	struct hist_val		val;
+	struct percentiles	p;
+	__u64			count;
+	char			name[KEY_NAME_LEN];	/* CSV / table label */
+};
+
+static struct key_row *key_rows;	/* MAX_KEYS entries */
+
+static int cmp_key_row(const void *a, const void *b)
+{
+	const struct key_row *x = a, *y = b;
+	double kx = env.sort_total ? (double)x->val.total_us : x->p.p99;
+	double ky = env.sort_total ? (double)y->val.total_us : y->p.p99;
+
+	if (kx != ky)
+		return kx < ky ? 1 : -1;
+	if (x->val.total_us != y->val.total_us)
+		return x->val.total_us < y->val.total_us ? 1 : -1;
+	return 0;
+}
+
+/*
+ * cgroup v2 IDs are the inode numbers of the cgroup directories, so the
+ * names of the printed rows are found with one walk of the hierarchy.
+ */
+static int cg_nrows, cg_left;
+
+static int cg_visit(const char *path, const struct stat *st, int type,
+		    struct FTW *ftw)
+{
+	(void)ftw;
+	if (type != FTW_D)
+		return 0;
+
+	for (int i = 0; i < cg_nrows; i++) {
+		struct key_row *r = &key_rows[i];
+
+		if (r->name[0] || r->key.id != (__u64)st->st_ino)
+			continue;
+		const char *rel = path + strlen(CGROUP_ROOT);
+		snprintf(r->name, sizeof(r->name), "%s", *rel ? rel : "/");
+		if (--cg_left == 0)
+			return 1;	/* all found: stop walking */
+	}
+	return 0;
+}
+
+static void name_key_rows(int n)
+{
+	for (int i = 0; i < n; i++) {
+		struct key_row *r = &key_rows[i];
+
+		r->name[0] = '\0';
+		if (env.key_mode == KEY_TGID)
+			snprintf(r->name, sizeof(r->name), "%llu",
+				 (unsigned long long)r->key.id);
+		else if (env.key_mode == KEY_COMM)
+			snprintf(r->name, sizeof(r->name), "%.*s",
+				 TASK_COMM_LEN, r->key.comm);
+	}
+
+	if (env.key_mode == KEY_CGROUP) {
+		cg_nrows = cg_left = n;
+		nftw(CGROUP_ROOT, cg_visit, 16, FTW_PHYS | FTW_MOUNT);
+		for (int i = 0; i < n; i++)
+			if (!key_rows[i].name[0])	/* gone, or cgroup v1 */
+				snprintf(key_rows[i].name, KEY_NAME_LEN,
+					 "cgid:%llu",
+					 (unsigned long long)key_rows[i].key.id);
+	}
+}
+
+/*
+ * Cumulative per-key values as of the last snapshot, sorted by key for
+ * bsearch; rows are the differences. A key with no waits for a whole
+ * interval is deleted from the map, or exited processes would fill it:
+ * only those deletes can race with an increment, and an idle key has
+ * nothing to lose but that one.
+ */
+struct key_snap {
+	struct hist_key	key;
+	struct hist_val	val;
+};
+
+static struct {
+	struct hist_key	*keys;		/* batch lookup buffers */
+	struct hist_val	*vals;
+	struct key_snap	*cur, *prev;
+	int		nprev;
+} ks;
+
+static int cmp_key_snap(const void *a, const void *b)
+{
+	return memcmp(&((const struct key_snap *)a)->key,
+		      &((const struct key_snap *)b)->key,
+		      sizeof(struct hist_key));
+}
+
+/* Every entry of the hash into ks.keys / ks.vals, batched if possible */
+static int read_key_map(int fd)
+{
+	LIBBPF_OPTS(bpf_map_batch_opts, opts);
+	struct hist_key key, next, *prev = NULL;
+	__u32 in_batch, out_batch, count;
+	static int no_batch;
+	int n = 0, first = 1;
+
+	while (!no_batch && n < MAX_KEYS) {
+		count = MAX_KEYS - n;
+		int err = bpf_map_lookup_batch(fd, first ? NULL : &in_batch,
+					       &out_batch, &ks.keys[n],
+					       &ks.vals[n], &count, &opts);
+		if (err && errno != ENOENT) {
+			no_batch = 1;	/* old kernel, or a bucket too big */
+			break;
 		}
-		if (!got95 && cum >= total * 95 / 100) {
-			p.p95 = (i == 0) ? 0 : (1ULL << i);
-			got95 = 1;
+		n += count;
+		if (err)
+			return n;	/* ENOENT: walked the whole map */
+		in_batch = out_batch;
+		first = 0;
+	}
+	if (!no_batch)
+		return n;
+
+	n = 0;
+	while (n < MAX_KEYS && bpf_map_get_next_key(fd, prev, &next) == 0) {
+		key = next;
+		prev = &key;
+		if (bpf_map_lookup_elem(fd, &key, &ks.vals[n]) < 0)
+			continue;
+		ks.keys[n++] = key;
+	}
+	return n;
+}
+
+/* Each key's waits since the last call, sorted (top-N first); returns count */
+static int read_key_rows(int fd)
+{
+	int n = read_key_map(fd), ncur = 0, nrows = 0;
+
+	for (int i = 0; i < n; i++) {
+		ks.cur[i].key = ks.keys[i];
+		ks.cur[i].val = ks.vals[i];
+	}
+	qsort(ks.cur, n, sizeof(ks.cur[0]), cmp_key_snap);
+
+	for (int i = 0; i < n; i++) {
+		struct key_snap *c = &ks.cur[i];
+		const struct key_snap *old = bsearch(c, ks.prev, ks.nprev,
+						     sizeof(*old), cmp_key_snap);
+		struct key_row *r = &key_rows[nrows];
+
+		r->key = c->key;
+		r->val = c->val;
+		r->count = 0;
+		for (int s = 0; s < KEY_SLOTS; s++) {
+			if (old)
+				r->val.slots[s] -= old->val.slots[s];
+			r->count += r->val.slots[s];
 		}
-		if (!got99 && cum >= total * 99 / 100) {
-			p.p99 = (i == 0) ? 0 : (1ULL << i);
-			got99 = 1;
+		if (old)
+			r->val.total_us -= old->val.total_us;
+
+		if (old && r->count == 0) {
+			bpf_map_delete_elem(fd, &c->key);	/* idle */
+			continue;
 		}
+		ks.cur[ncur++] = *c;	/* keep as next baseline */
+		if (r->count == 0)
+			continue;
+		r->p = compute_percentiles(r->val.slots, KEY_SLOTS,
+					   KEY_SUB_BITS);
+		nrows++;
 	}
 
-	return p;
+	struct key_snap *tmp = ks.prev;
+	ks.prev = ks.cur;
+	ks.cur = tmp;
+	ks.nprev = ncur;
+
+	qsort(key_rows, nrows, sizeof(key_rows[0]), cmp_key_row);
+	return nrows;
 }
 
-/* ── CSV output ────────────────────────────────────────────────── */
+static void print_key_table(int n)
+{
+	const char *label = env.key_mode == KEY_CGROUP ? "CGROUP" :
+			    env.key_mode == KEY_TGID   ? "TGID"   : "COMM";
+	int shown = n < env.top ? n : env.top;
 
-static void print_csv_header(void)
+	name_key_rows(shown);
+
+	printf("%-32s %-16s %10s %12s %9s %9s %9s %9s %9s\n",
+	       label, "PROCESS", "WAITS", "TOTAL_ms",
+	       "P50_us", "P95_us", "P99_us", "P99.9_us", "MAX_us");
+
+	for (int i = 0; i < shown; i++) {
+		struct key_row *r = &key_rows[i];
+
+		printf("%-32s %-16.*s %10llu %12.1f %9.1f %9.1f %9.1f %9.1f %9.1f\n",
+		       r->name, TASK_COMM_LEN, r->val.comm,
+		       (unsigned long long)r->count, r->val.total_us / 1000.0,
+		       r->p.p50, r->p.p95, r->p.p99, r->p.p999, r->p.max);
+	}
+
+	if (n > shown)
+		printf("... %d more (--top)\n", n - shown);
+	if (n >= MAX_KEYS)
+		printf("WARN: %d keys: hash full, new keys not recorded\n",
+		       MAX_KEYS);
+}
+
+static void print_key_csv(int n)
 {
-	printf("timestamp,p50_us,p95_us,p99_us,max_us\n");
+	int shown = n < env.top ? n : env.top;
+
+	name_key_rows(shown);
+	for (int i = 0; i < shown; i++)
+		print_csv_row(key_rows[i].name, key_rows[i].val.slots,
+			      KEY_SLOTS, KEY_SUB_BITS);
 }
 
-static void print_csv_row(__u64 slots[], int nslots)
+/* ── Outlier events (--min-us) ─────────────────────────────────── */
+
+static int stacks_fd = -1;
+static __u64 events_seen;
+
+/* Leaf-first frames of one stack, one per line */
+static void print_stack(FILE *out, int stack_id, __u32 pid)
 {
-	struct percentiles p = compute_percentiles(slots, nslots);
+	__u64 ips[RQ_MAX_DEPTH];
+
+	if (stack_id < 0 || bpf_map_lookup_elem(stacks_fd, &stack_id, ips) < 0) {
+		fprintf(out, "        [stack not captured]\n");
+		return;
+	}
+	for (int i = 0; i < RQ_MAX_DEPTH && ips[i]; i++)
+		fprintf(out, "        %s\n", sym_resolve((int)pid, ips[i]));
+}
+
+static int handle_event(void *ctx, void *data, size_t size)
+{
+	const struct rq_event *e = data;
+	FILE *out = env.csv ? stderr : stdout;	/* keep the CSV clean */
 	struct timespec ts;
+	struct tm tm;
+	(void)ctx;
+
+	if (size < sizeof(*e))
+		return 0;
+
+	if (events_seen++ == 0)
+		fprintf(out, "%-12s %4s %10s %7s %7s %-16s %7s %-16s\n",
+			"TIME", "CPU", "WAIT_us", "PID", "TID", "COMM",
+			"PREV", "PREV_COMM");
 
 	clock_gettime(CLOCK_REALTIME, &ts);
-	printf("%ld.%03ld,%llu,%llu,%llu,%llu\n",
-	       ts.tv_sec, ts.tv_nsec / 1000000,
-	       (unsigned long long)p.p50,
-	       (unsigned long long)p.p95,
-	       (unsigned long long)p.p99,
-	       (unsigned long long)p.max);
+	localtime_r(&ts.tv_sec, &tm);
+	fprintf(out, "%02d:%02d:%02d.%03ld %4u %10llu %7u %7u %-16.*s %7u %-16.*s\n",
+		tm.tm_hour, tm.tm_min, tm.tm_sec, ts.tv_nsec / 1000000,
+		e->cpu, (unsigned long long)e->wait_us, e->pid, e->tid,
+		TASK_COMM_LEN, e->comm, e->prev_tid,
+		TASK_COMM_LEN, e->prev_comm);
+
+	if (env.stacks) {
+		sym_init((int)e->prev_pid);
+		print_stack(out, e->kern_stack_id, e->prev_pid);
+		fprintf(out, "        --\n");
+		print_stack(out, e->user_stack_id, e->prev_pid);
+		fprintf(out, "\n");
+	}
+	return 0;
 }
 
-/* ── Read histogram from BPF map ───────────────────────────────── */
+/*
+ * Sleep one interval; with a ring buffer, spend it delivering events
+ * instead. The histograms are only read when it is over.
+ */
+static void wait_interval(struct ring_buffer *rb)
+{
+	struct timespec now, end;
 
-static int read_hist(int fd, __u64 slots[], int nslots)
+	if (!rb) {
+		sleep_interval(env.interval);
+		return;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	end.tv_sec += (time_t)env.interval;
+	end.tv_nsec += (long)((env.interval - (time_t)env.interval) * 1e9);
+	if (end.tv_nsec >= 1000000000L) {
+		end.tv_sec++;
+		end.tv_nsec -= 1000000000L;
+	}
+
+	while (!exiting) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		double left_ms = (end.tv_sec - now.tv_sec) * 1e3 +
+				 (end.tv_nsec - now.tv_nsec) / 1e6;
+		if (left_ms <= 0)
+			break;
+		if (ring_buffer__poll(rb, left_ms > 1000 ? 1000 : (int)left_ms + 1) < 0 &&
+		    errno != EINTR)
+			break;
+	}
+}
+
+/* ── Imbalance view (-I) ───────────────────────────────────────── */
+
+#define DEPTH_SAMPLE_HZ	99
+#define MATRIX_MAX_CPUS	16	/* larger hosts: top pairs instead */
+#define TOP_PAIRS	10
+
+/*
+ * depth_hist and migrations are cumulative, mmapable arrays like hist:
+ * each interval prints the difference from the previous snapshot.
+ */
+static struct {
+	int		ncpus;		/* min(possible CPUs, MAX_CPUS) */
+	int		nnodes;
+	int		node_of[MAX_CPUS];
+	int		depth_fd, migr_fd;
+	const __u64	*depth_mem, *migr_mem;
+	size_t		depth_len, migr_len;
+	__u64		*depth_cur, *depth_prev, *depth;
+	__u64		*migr_cur, *migr_prev, *migr;
+	struct bpf_link	**links;	/* one sampler per CPU */
+} imb;
+
+/* CPU → NUMA node from /sys/devices/system/node/node<N>/cpulist */
+static void read_numa_nodes(void)
 {
-	for (int i = 0; i < nslots; i++) {
-		__u32 key = i;
-		__u64 val = 0;
+	char path[128], list[4096];
+
+	imb.nnodes = 1;
+	for (int node = 0; node < MAX_CPUS; node++) {
+		snprintf(path, sizeof(path),
+			 "/sys/devices/system/node/node%d/cpulist", node);
+		FILE *f = fopen(path, "r");
+		if (!f)
+			continue;
+		if (fgets(list, sizeof(list), f)) {
+			/* "0-3,8-11" */
+			for (char *tok = strtok(list, ",\n"); tok;
+			     tok = strtok(NULL, ",\n")) {
+				int lo, hi;
+				int n = sscanf(tok, "%d-%d", &lo, &hi);
+
+				if (n < 1)
+					continue;
+				if (n == 1)
+					hi = lo;
+				for (int c = lo; c <= hi && c < MAX_CPUS; c++)
+					imb.node_of[c] = node;
+			}
+			if (node + 1 > imb.nnodes)
+				imb.nnodes = node + 1;
+		}
+		fclose(f);
+	}
+}
 
-		if (bpf_map_lookup_elem(fd, &key, &val) < 0)
-			return -1;
-		slots[i] = val;
+static int read_counts(const __u64 *mem, int fd, __u64 cur[], int n)
+{
+	if (mem) {
+		copy_hist(cur, mem, n);
+		return 0;
 	}
-	return 0;
+	return read_hist(fd, cur, n);
 }
 
-static int clear_hist(int fd, int nslots)
+/* A cpu-clock event per CPU drives sample_depth, idle CPUs included */
+static int attach_depth_sampler(struct bpf_object *obj)
 {
-	for (int i = 0; i < nslots; i++) {
-		__u32 key = i;
-		__u64 val = 0;
+	struct bpf_program *prog;
+	struct perf_event_attr attr;
+	int attached = 0;
+
+	prog = bpf_object__find_program_by_name(obj, "sample_depth");
+	imb.links = calloc(imb.ncpus, sizeof(imb.links[0]));
+	if (!prog || !imb.links)
+		return -1;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.type = PERF_TYPE_SOFTWARE;
+	attr.config = PERF_COUNT_SW_CPU_CLOCK;
+	attr.size = sizeof(attr);
+	attr.freq = 1;
+	attr.sample_freq = DEPTH_SAMPLE_HZ;
+
+	for (int cpu = 0; cpu < imb.ncpus; cpu++) {
+		int fd = (int)syscall(__NR_perf_event_open, &attr, -1, cpu, -1,
+				      PERF_FLAG_FD_CLOEXEC);
+		if (fd < 0)
+			continue;	/* offline CPU */
+
+		struct bpf_link *link = bpf_program__attach_perf_event(prog, fd);
+		if (libbpf_get_error(link)) {
+			close(fd);
+			continue;
+		}
+		imb.links[cpu] = link;	/* closes fd when destroyed */
+		attached++;
+	}
+	return attached ? 0 : -1;
+}
 
-		if (bpf_map_update_elem(fd, &key, &val, BPF_ANY) < 0)
-			return -1;
+static void print_depth_heatmap(void)
+{
+	static const char shades[] = " .:-=+*#%@";
+	int nshades = (int)sizeof(shades) - 2;
+	double min_avg = -1, max_avg = 0;
+	int min_cpu = 0, max_cpu = 0;
+
+	printf("Run-queue depth per CPU (nr_running sampled at %d Hz, "
+	       "shade = share of samples)\n", DEPTH_SAMPLE_HZ);
+	printf(" CPU node   avg |");
+	for (int d = 0; d < MAX_QDEPTH; d++)
+		printf(d == MAX_QDEPTH - 1 ? " %2d+" : "%4d", d);
+	printf(" |\n");
+
+	for (int cpu = 0; cpu < imb.ncpus; cpu++) {
+		const __u64 *row = &imb.depth[cpu * MAX_QDEPTH];
+		__u64 total = 0, weighted = 0;
+
+		for (int d = 0; d < MAX_QDEPTH; d++) {
+			total += row[d];
+			weighted += row[d] * d;
+		}
+		if (total == 0)
+			continue;	/* offline */
+
+		double avg = (double)weighted / total;
+		if (min_avg < 0 || avg < min_avg) {
+			min_avg = avg;
+			min_cpu = cpu;
+		}
+		if (avg > max_avg) {
+			max_avg = avg;
+			max_cpu = cpu;
+		}
+
+		printf("%4d %4d %5.2f |", cpu, imb.node_of[cpu], avg);
+		for (int d = 0; d < MAX_QDEPTH; d++) {
+			int level = row[d] ? 1 + (int)((double)row[d] / total *
+						       (nshades - 1) + 0.5) : 0;
+			printf("   %c", shades[level]);
+		}
+		printf(" |\n");
+	}
+
+	if (min_avg >= 0)
+		printf("Deepest: CPU %d (avg %.2f), shallowest: CPU %d (avg %.2f)\n",
+		       max_cpu, max_avg, min_cpu, min_avg);
+}
+
+static void print_migrations(void)
+{
+	static __u64 node_m[MAX_CPUS][MAX_CPUS];
+	__u64 total = 0, cross = 0;
+	int n = imb.ncpus;
+
+	memset(node_m, 0, sizeof(node_m));
+	for (int src = 0; src < n; src++)
+		for (int dst = 0; dst < n; dst++) {
+			__u64 c = imb.migr[src * MAX_CPUS + dst];
+
+			node_m[imb.node_of[src]][imb.node_of[dst]] += c;
+			total += c;
+			if (imb.node_of[src] != imb.node_of[dst])
+				cross += c;
+		}
+
+	printf("\nMigrations: %llu", (unsigned long long)total);
+	if (total)
+		printf(", %llu (%.1f%%) across NUMA nodes",
+		       (unsigned long long)cross, 100.0 * cross / total);
+	printf("\n");
+	if (!total)
+		return;
+
+	if (imb.nnodes > 1) {
+		printf("  node src\\dst");
+		for (int d = 0; d < imb.nnodes; d++)
+			printf(" %9d", d);
+		printf("\n");
+		for (int s = 0; s < imb.nnodes; s++) {
+			printf("  %12d", s);
+			for (int d = 0; d < imb.nnodes; d++)
+				printf(" %9llu", (unsigned long long)node_m[s][d]);
+			printf("\n");
+		}
+	}
+
+	if (n <= MATRIX_MAX_CPUS) {
+		printf("  cpu src\\dst ");
+		for (int d = 0; d < n; d++)
+			printf(" %6d", d);
+		printf("\n");
+		for (int src = 0; src < n; src++) {
+			printf("  %12d", src);
+			for (int dst = 0; dst < n; dst++)
+				printf(" %6llu", (unsigned long long)
+				       imb.migr[src * MAX_CPUS + dst]);
+			printf("\n");
+		}
+		return;
+	}
+
+	/* Too many CPUs for a matrix: the busiest source → destination pairs */
+	printf("  top CPU pairs:\n");
+	for (int k = 0; k < TOP_PAIRS; k++) {
+		__u64 best = 0;
+		int bi = -1;
+
+		for (int i = 0; i < MAX_CPUS * MAX_CPUS; i++)
+			if (imb.migr[i] > best) {
+				best = imb.migr[i];
+				bi = i;
+			}
+		if (bi < 0)
+			break;
+		printf("  %4d -> %-4d %9llu%s\n", bi / MAX_CPUS, bi % MAX_CPUS,
+		       (unsigned long long)best,
+		       imb.node_of[bi / MAX_CPUS] != imb.node_of[bi % MAX_CPUS] ?
+		       "  (cross-node)" : "");
+		imb.migr[bi] = 0;	/* delta buffer: consumed by printing */
+	}
+}
+
+static void print_imbalance(void)
+{
+	int nd = imb.ncpus * MAX_QDEPTH, nm = MAX_CPUS * MAX_CPUS;
+
+	if (read_counts(imb.depth_mem, imb.depth_fd, imb.depth_cur, nd) < 0 ||
+	    read_counts(imb.migr_mem, imb.migr_fd, imb.migr_cur, nm) < 0)
+		return;
+	take_delta(imb.depth, imb.depth_cur, imb.depth_prev, nd);
+	take_delta(imb.migr, imb.migr_cur, imb.migr_prev, nm);
+
+	printf("\n");
+	print_depth_heatmap();
+	print_migrations();
+}
+
+static int setup_imbalance(struct bpf_object *obj)
+{
+	struct bpf_map *dm = bpf_object__find_map_by_name(obj, "depth_hist");
+	struct bpf_map *mm = bpf_object__find_map_by_name(obj, "migrations");
+	size_t nd, nm = (size_t)MAX_CPUS * MAX_CPUS;
+
+	if (!dm || !mm) {
+		fprintf(stderr, "ERROR: imbalance maps not found\n");
+		return -1;
+	}
+
+	imb.ncpus = libbpf_num_possible_cpus();
+	if (imb.ncpus < 0) {
+		fprintf(stderr, "ERROR: failed to get CPU count\n");
+		return -1;
+	}
+	if (imb.ncpus > MAX_CPUS)
+		imb.ncpus = MAX_CPUS;
+	nd = (size_t)imb.ncpus * MAX_QDEPTH;
+	read_numa_nodes();
+
+	imb.depth_fd = bpf_map__fd(dm);
+	imb.migr_fd = bpf_map__fd(mm);
+	imb.depth_mem = mmap_hist(dm, &imb.depth_len);
+	imb.migr_mem = mmap_hist(mm, &imb.migr_len);
+
+	imb.depth_cur = calloc(nd, sizeof(__u64));
+	imb.depth_prev = calloc(nd, sizeof(__u64));
+	imb.depth = calloc(nd, sizeof(__u64));
+	imb.migr_cur = calloc(nm, sizeof(__u64));
+	imb.migr_prev = calloc(nm, sizeof(__u64));
+	imb.migr = calloc(nm, sizeof(__u64));
+	if (!imb.depth_cur || !imb.depth_prev || !imb.depth ||
+	    !imb.migr_cur || !imb.migr_prev || !imb.migr) {
+		perror("calloc");
+		return -1;
+	}
+
+	if (attach_depth_sampler(obj) < 0) {
+		fprintf(stderr, "ERROR: failed to attach depth sampler: %s\n",
+			strerror(errno));
+		return -1;
 	}
 	return 0;
 }
 
+static void cleanup_imbalance(void)
+{
+	for (int cpu = 0; imb.links && cpu < imb.ncpus; cpu++)
+		bpf_link__destroy(imb.links[cpu]);
+	free(imb.links);
+	if (imb.depth_mem)
+		munmap((void *)imb.depth_mem, imb.depth_len);
+	if (imb.migr_mem)
+		munmap((void *)imb.migr_mem, imb.migr_len);
+	free(imb.depth_cur);
+	free(imb.depth_prev);
+	free(imb.depth);
+	free(imb.migr_cur);
+	free(imb.migr_prev);
+	free(imb.migr);
+}
+
 /* ── .rodata configuration ─────────────────────────────────────── */
 
 /*
  * Layout must match BPF globals declaration order in runqlat.bpf.c:
  *   const volatile __u32 targ_tgid;
  *   const volatile int   per_cpu;
+ *   const volatile int   targ_key;
+ *   const volatile int   fast;
+ *   const volatile __u64 min_us;
+ *   const volatile int   stacks_on;
  */
 struct rodata {
 	__u32	targ_tgid;
 	int	per_cpu;
+	int	targ_key;
+	int	fast;
+	__u64	min_us;
+	int	stacks_on;
 };
 
 /*
@@ -284,21 +1140,30 @@ int main(int argc, char **argv)
 {
 	struct bpf_object *obj = NULL;
 	struct bpf_link *link_wakeup = NULL, *link_wakeup_new = NULL,
-			*link_switch = NULL;
-	struct bpf_map *hist_map, *hist_cpu_map;
-	int hist_fd, hist_cpu_fd = -1;
-	int err = 0, ncpus = 0;
+			*link_switch = NULL, *link_migrate = NULL;
+	struct bpf_map *hist_map, *hist_cpu_map, *key_map, *map;
+	struct ring_buffer *rb = NULL;
+	__u64 *cpu_slots = NULL;
+	int key_fd = -1;
+	int err = 0;
 
 	/* ── Parse CLI ──────────────────────────────────────────── */
 
 	static struct option long_opts[] = {
-		{"csv",  no_argument, NULL, 'V'},
-		{"help", no_argument, NULL, 'h'},
-		{NULL,   0,           NULL,  0 },
+		{"csv",  no_argument,       NULL, 'V'},
+		{"json", required_argument, NULL, 'J'},
+		{"by",   required_argument, NULL, 'B'},
+		{"top",  required_argument, NULL, 'N'},
+		{"sort", required_argument, NULL, 'S'},
+		{"fast", no_argument,       NULL, 'F'},
+		{"min-us", required_argument, NULL, 'U'},
+		{"stacks", no_argument,       NULL, 'K'},
+		{"help", no_argument,       NULL, 'h'},
+		{NULL,   0,                 NULL,  0 },
 	};
 
 	int opt;
-	while ((opt = getopt_long(argc, argv, "p:Cmh", long_opts, NULL)) != -1) {
+	while ((opt = getopt_long(argc, argv, "p:CImh", long_opts, NULL)) != -1) {
 		switch (opt) {
 		case 'p':
 			env.pid = (__u32)atoi(optarg);
@@ -306,12 +1171,52 @@ int main(int argc, char **argv)
 		case 'C':
 			env.per_cpu = 1;
 			break;
+		case 'I':
+			env.imbalance = 1;
+			break;
 		case 'm':
 			env.milliseconds = 1;
 			break;
 		case 'V':
 			env.csv = 1;
 			break;
+		case 'J':
+			env.json = optarg;
+			break;
+		case 'B':
+			env.key_mode = -1;
+			for (int k = KEY_TGID; k <= KEY_COMM; k++)
+				if (strcmp(optarg, key_mode_names[k]) == 0)
+					env.key_mode = k;
+			if (env.key_mode < 0) {
+				fprintf(stderr, "ERROR: --by must be tgid, "
+					"cgroup or comm\n");
+				return 1;
+			}
+			break;
+		case 'N':
+			env.top = atoi(optarg);
+			if (env.top < 1)
+				env.top = 1;
+			break;
+		case 'S':
+			if (strcmp(optarg, "total") == 0) {
+				env.sort_total = 1;
+			} else if (strcmp(optarg, "p99") != 0) {
+				fprintf(stderr, "ERROR: --sort must be p99 "
+					"or total\n");
+				return 1;
+			}
+			break;
+		case 'F':
+			env.fast = 1;
+			break;
+		case 'U':
+			env.min_us = strtoull(optarg, NULL, 10);
+			break;
+		case 'K':
+			env.stacks = 1;
+			break;
 		case 'h':
 			usage(argv[0]);
 			return 0;
@@ -321,12 +1226,28 @@ int main(int argc, char **argv)
 		}
 	}
 
-	if (optind < argc)
-		env.interval = atoi(argv[optind]);
+	if (env.imbalance && env.csv) {
+		fprintf(stderr, "ERROR: -I is a text view, not for --csv\n");
+		return 1;
+	}
+	if (env.stacks && !env.min_us) {
+		fprintf(stderr, "ERROR: --stacks needs --min-us\n");
+		return 1;
+	}
+
+	if (optind < argc) {
+		env.interval = strtod(argv[optind], NULL);
+		if (env.interval <= 0) {
+			fprintf(stderr, "ERROR: interval must be > 0\n");
+			return 1;
+		}
+	}
 	if (optind + 1 < argc)
 		env.count = atoi(argv[optind + 1]);
 	else if (optind < argc)
 		env.count = 0;  /* interval given, no count → infinite */
+	if (bj_open(env.json, "runqlat", argc, argv) < 0)
+		return 1;
 
 	/* ── Signal handling ────────────────────────────────────── */
 
@@ -351,13 +1272,37 @@ int main(int argc, char **argv)
 		if (rd && sz >= sizeof(*rd)) {
 			rd->targ_tgid = env.pid;
 			rd->per_cpu   = env.per_cpu;
+			rd->targ_key  = env.key_mode;
+			rd->fast      = env.fast;
+			rd->min_us    = env.min_us;
+			rd->stacks_on = env.stacks;
 		} else {
 			fprintf(stderr, "WARN: rodata pointer invalid, "
-				"PID filter/per-CPU may not work\n");
+				"PID filter/per-CPU/--by/--min-us may not work\n");
 		}
-	} else if (env.pid || env.per_cpu) {
+	} else if (env.pid || env.per_cpu || env.key_mode || env.fast ||
+		   env.min_us) {
 		fprintf(stderr, "WARN: .rodata map not found, "
-			"PID filter/per-CPU not available\n");
+			"PID filter/per-CPU/--by/--fast/--min-us not available\n");
+	}
+
+	/* Shrink the maps the chosen data path never touches */
+	if (env.fast) {
+		bpf_map__set_max_entries(bpf_object__find_map_by_name(obj, "start"), 1);
+		bpf_map__set_max_entries(bpf_object__find_map_by_name(obj, "hist_cpu"), 1);
+	} else if (!env.per_cpu) {
+		bpf_map__set_max_entries(bpf_object__find_map_by_name(obj, "hist_cpu"), 1);
+	}
+	if (!env.min_us)	/* ring buffers must be a power-of-2 pages */
+		bpf_map__set_max_entries(bpf_object__find_map_by_name(obj, "events"),
+					 sysconf(_SC_PAGESIZE));
+	if (!env.stacks)
+		bpf_map__set_max_entries(bpf_object__find_map_by_name(obj, "stacks"), 1);
+	if (!env.imbalance) {
+		bpf_map__set_max_entries(bpf_object__find_map_by_name(obj, "depth_hist"), 1);
+		bpf_map__set_max_entries(bpf_object__find_map_by_name(obj, "migrations"), 1);
+		bpf_program__set_autoload(bpf_object__find_program_by_name(obj, "sample_depth"), 0);
+		bpf_program__set_autoload(bpf_object__find_program_by_name(obj, "sched_migrate_task"), 0);
 	}
 
 	/* ── Load BPF programs + maps into kernel ───────────────── */
@@ -380,32 +1325,93 @@ int main(int argc, char **argv)
 	link_switch = attach_prog(obj, "sched_switch");
 	if (!link_switch) { err = 1; goto cleanup; }
 
+	if (env.imbalance) {
+		link_migrate = attach_prog(obj, "sched_migrate_task");
+		if (!link_migrate || setup_imbalance(obj) < 0) {
+			err = 1;
+			goto cleanup;
+		}
+	}
+
 	/* ── Get histogram map FDs ──────────────────────────────── */
 
-	hist_map = bpf_object__find_map_by_name(obj, "hist");
+	hist_map = bpf_object__find_map_by_name(obj, env.fast ? "hist_pcpu" : "hist");
 	if (!hist_map) {
-		fprintf(stderr, "ERROR: hist map not found\n");
+		fprintf(stderr, "ERROR: histogram map not found\n");
 		err = 1;
 		goto cleanup;
 	}
-	hist_fd = bpf_map__fd(hist_map);
+	hm.hist_fd = bpf_map__fd(hist_map);
+	if (!env.fast)
+		hm.hist_mem = mmap_hist(hist_map, &hm.hist_len);
 
-	if (env.per_cpu) {
+	if (env.per_cpu || env.fast) {
+		hm.npossible = libbpf_num_possible_cpus();
+		if (hm.npossible < 0) {
+			fprintf(stderr, "ERROR: failed to get CPU count\n");
+			err = 1;
+			goto cleanup;
+		}
+		hm.ncpus = hm.npossible;
+		if (!env.fast && hm.ncpus > MAX_CPUS)
+			hm.ncpus = MAX_CPUS;	/* hist_cpu size */
+		size_t ncpu_slots = (size_t)hm.ncpus * MAX_SLOTS;
+
+		hm.pcpu_vals = calloc((size_t)hm.npossible * MAX_SLOTS,
+				      sizeof(__u64));
+		hm.cur_cpu = calloc(ncpu_slots, sizeof(__u64));
+		hm.prev_cpu = calloc(ncpu_slots, sizeof(__u64));
+		cpu_slots = calloc(ncpu_slots, sizeof(__u64));
+		if (!hm.pcpu_vals || !hm.cur_cpu || !hm.prev_cpu || !cpu_slots) {
+			perror("calloc");
+			err = 1;
+			goto cleanup;
+		}
+	}
+
+	if (env.per_cpu && !env.fast) {
 		hist_cpu_map = bpf_object__find_map_by_name(obj, "hist_cpu");
 		if (!hist_cpu_map) {
 			fprintf(stderr, "ERROR: hist_cpu map not found\n");
 			err = 1;
 			goto cleanup;
 		}
-		hist_cpu_fd = bpf_map__fd(hist_cpu_map);
-		ncpus = libbpf_num_possible_cpus();
-		if (ncpus < 0) {
-			fprintf(stderr, "ERROR: failed to get CPU count\n");
+		hm.hist_cpu_fd = bpf_map__fd(hist_cpu_map);
+		hm.hist_cpu_mem = mmap_hist(hist_cpu_map, &hm.hist_cpu_len);
+	}
+
+	if (env.key_mode) {
+		key_map = bpf_object__find_map_by_name(obj, "hist_by_key");
+		if (!key_map) {
+			fprintf(stderr, "ERROR: hist_by_key map not found\n");
+			err = 1;
+			goto cleanup;
+		}
+		key_fd = bpf_map__fd(key_map);
+		key_rows = calloc(MAX_KEYS, sizeof(key_rows[0]));
+		ks.keys = calloc(MAX_KEYS, sizeof(ks.keys[0]));
+		ks.vals = calloc(MAX_KEYS, sizeof(ks.vals[0]));
+		ks.cur = calloc(MAX_KEYS, sizeof(ks.cur[0]));
+		ks.prev = calloc(MAX_KEYS, sizeof(ks.prev[0]));
+		if (!key_rows || !ks.keys || !ks.vals || !ks.cur || !ks.prev) {
+			perror("calloc");
+			err = 1;
+			goto cleanup;
+		}
+	}
+
+	if (env.min_us) {
+		map = bpf_object__find_map_by_name(obj, "events");
+		rb = map ? ring_buffer__new(bpf_map__fd(map), handle_event,
+					    NULL, NULL) : NULL;
+		if (!rb) {
+			fprintf(stderr, "ERROR: failed to open ring buffer\n");
 			err = 1;
 			goto cleanup;
 		}
-		if (ncpus > MAX_CPUS)
-			ncpus = MAX_CPUS;
+		if (env.stacks)
+			stacks_fd = bpf_map__fd(bpf_object__find_map_by_name(obj,
+								       "stacks"));
 	}
 
 	/* ── Print header ───────────────────────────────────────── */
@@ -413,6 +1419,13 @@ int main(int argc, char **argv)
 	fprintf(stderr, "Tracing run queue latency...");
 	if (env.pid)
 		fprintf(stderr, " PID %u.", env.pid);
+	if (env.key_mode)
+		fprintf(stderr, " Top %d by %s, sorted by %s.", env.top,
+			key_mode_names[env.key_mode],
+			env.sort_total ? "total wait" : "p99");
+	if (env.min_us)
+		fprintf(stderr, " Waits >= %llu us shown as they happen.",
+			(unsigned long long)env.min_us);
 	fprintf(stderr, " Hit Ctrl-C to end.\n");
 
 	if (env.csv)
@@ -421,19 +1434,20 @@ int main(int argc, char **argv)
 	/* ── Main loop ──────────────────────────────────────────── */
 
 	for (int round = 0; !env.count || round < env.count; round++) {
-		sleep(env.interval);
+		wait_interval(rb);
 		if (exiting)
 			break;
 
 		__u64 slots[MAX_SLOTS];
 
+		snapshot(slots, env.per_cpu ? cpu_slots : NULL);
+		json_add_interval(slots);
+
 		if (env.csv) {
-			/* CSV: read global histogram, print row, clear */
-			read_hist(hist_fd, slots, MAX_SLOTS);
-			print_csv_row(slots, MAX_SLOTS);
-			clear_hist(hist_fd, MAX_SLOTS);
-			if (env.per_cpu)
-				clear_hist(hist_cpu_fd, MAX_CPUS * MAX_SLOTS);
+			/* CSV: global (+ per-key) rows for this interval */
+			print_csv_row("all", slots, MAX_SLOTS, HIST_SUB_BITS);
+			if (env.key_mode)
+				print_key_csv(read_key_rows(key_fd));
 			continue;
 		}
 
@@ -441,36 +1455,33 @@ int main(int argc, char **argv)
 
 		if (env.per_cpu) {
 			/* Print per-CPU histograms */
-			for (int cpu = 0; cpu < ncpus; cpu++) {
-				__u64 cpu_slots[MAX_SLOTS];
-				int base = cpu * MAX_SLOTS;
+			for (int cpu = 0; cpu < hm.ncpus; cpu++) {
+				__u64 *cs = &cpu_slots[cpu * MAX_SLOTS];
 				int has_data = 0;
 
-				for (int s = 0; s < MAX_SLOTS; s++) {
-					__u32 key = base + s;
-					__u64 val = 0;
-					bpf_map_lookup_elem(hist_cpu_fd, &key, &val);
-					cpu_slots[s] = val;
-					if (val)
+				for (int s = 0; s < MAX_SLOTS; s++)
+					if (cs[s])
 						has_data = 1;
-				}
 
 				if (!has_data)
 					continue;
 
 				printf("cpu = %d\n", cpu);
-				print_histogram(cpu_slots, MAX_SLOTS,
-						env.milliseconds);
+				print_histogram(cs, MAX_SLOTS, env.milliseconds);
 				printf("\n");
 			}
-			clear_hist(hist_cpu_fd, MAX_CPUS * MAX_SLOTS);
 		} else {
 			/* Print global histogram */
-			read_hist(hist_fd, slots, MAX_SLOTS);
 			print_histogram(slots, MAX_SLOTS, env.milliseconds);
 		}
 
-		clear_hist(hist_fd, MAX_SLOTS);
+		if (env.imbalance)
+			print_imbalance();
+
+		if (env.key_mode) {
+			printf("\n");
+			print_key_table(read_key_rows(key_fd));
+		}
 	}
 
 	/* ── Final histogram on Ctrl-C ──────────────────────────── */
@@ -479,20 +1490,64 @@ int main(int argc, char **argv)
 		__u64 slots[MAX_SLOTS];
 
 		printf("\n");
-		read_hist(hist_fd, slots, MAX_SLOTS);
+		snapshot(slots, NULL);
+		json_add_interval(slots);
 
 		if (env.csv) {
-			print_csv_row(slots, MAX_SLOTS);
+			print_csv_row("all", slots, MAX_SLOTS, HIST_SUB_BITS);
+			if (env.key_mode)
+				print_key_csv(read_key_rows(key_fd));
 		} else {
 			print_histogram(slots, MAX_SLOTS, env.milliseconds);
+			if (env.imbalance)
+				print_imbalance();
+			if (env.key_mode) {
+				printf("\n");
+				print_key_table(read_key_rows(key_fd));
+			}
 		}
 	}
 
+	json_write_run();
+
+	if (rb) {
+		__u32 zero = 0;
+		__u64 drops = 0;
+
+		ring_buffer__consume(rb);
+		map = bpf_object__find_map_by_name(obj, "event_drops");
+		if (map)
+			bpf_map_lookup_elem(bpf_map__fd(map), &zero, &drops);
+		fprintf(stderr, "%llu outlier events", (unsigned long long)events_seen);
+		if (drops)
+			fprintf(stderr, ", %llu dropped (ring buffer full: "
+				"raise --min-us)", (unsigned long long)drops);
+		fprintf(stderr, "\n");
+	}
+
 cleanup:
+	ring_buffer__free(rb);
+	cleanup_imbalance();
+	bpf_link__destroy(link_migrate);
 	bpf_link__destroy(link_switch);
 	bpf_link__destroy(link_wakeup_new);
 	bpf_link__destroy(link_wakeup);
 	bpf_object__close(obj);
+	if (hm.hist_mem)
+		munmap((void *)hm.hist_mem, hm.hist_len);
+	if (hm.hist_cpu_mem)
+		munmap((void *)hm.hist_cpu_mem, hm.hist_cpu_len);
+	free(key_rows);
+	free(ks.keys);
+	free(ks.vals);
+	free(ks.cur);
+	free(ks.prev);
+	free(cpu_slots);
+	free(hm.pcpu_vals);
+	free(hm.cur_cpu);
+	free(hm.prev_cpu);
+	if (env.stacks)
+		sym_cleanup();
 
 	return err != 0;
 }
@@ -3,9 +3,60 @@
 #ifndef RUNQLAT_H
 #define RUNQLAT_H
 
-#define MAX_SLOTS	26	/* log2 histogram: 0ns .. ~33ms */
+#include "hdr_hist.h"	/* 04-memory-allocator-benchmark/src */
+
+/*
+ * Wait histograms are log-linear over nanoseconds (hdr_hist.h): the
+ * global and per-CPU ones keep 2 significant digits, the per-key ones
+ * (up to MAX_KEYS of them in a hash) 1 digit to stay small. Waits of
+ * 2^HIST_MAX_BITS ns (~34 s) or more land in the last slot.
+ */
+#define HIST_MAX_BITS	35
+#define HIST_SUB_BITS	HDR_SUB_BITS(2)	/* <= 0.8% per slot */
+#define MAX_SLOTS	HDR_BUCKETS(HIST_SUB_BITS, HIST_MAX_BITS)	/* 3712 */
+#define KEY_SUB_BITS	3		/* <= 12.5% per slot */
+#define KEY_SLOTS	HDR_BUCKETS(KEY_SUB_BITS, HIST_MAX_BITS)	/* 264 */
 #define MAX_CPUS	128
 #define TASK_COMM_LEN	16
 #define MAX_ENTRIES	10240
+#define MAX_KEYS	4096	/* distinct processes / cgroups / comms */
+#define RQ_MAX_DEPTH	127	/* PERF_MAX_STACK_DEPTH */
+#define RQ_MAX_STACKS	8192
+#define RQ_RINGBUF_SIZE	(256 * 1024)	/* outlier events in flight */
+#define MAX_QDEPTH	16	/* nr_running buckets: 0 .. 15+ */
+
+/* What the per-key histograms are keyed by (--by) */
+enum hist_key_mode {
+	KEY_NONE   = 0,		/* global histogram only */
+	KEY_TGID   = 1,
+	KEY_CGROUP = 2,		/* cgroup v2 ID (= inode of its directory) */
+	KEY_COMM   = 3,
+};
+
+struct hist_key {
+	__u64	id;			/* TGID or cgroup ID; 0 for KEY_COMM */
+	char	comm[TASK_COMM_LEN];	/* KEY_COMM only */
+};
+
+struct hist_val {
+	__u64	slots[KEY_SLOTS];
+	__u64	total_us;		/* sum of all waits */
+	char	comm[TASK_COMM_LEN];	/* process name (first task seen) */
+};
+
+/* One wait longer than --min-us, streamed through the ring buffer */
+struct rq_event {
+	__u64	ts_ns;			/* bpf_ktime_get_ns() at dequeue */
+	__u64	wait_us;
+	__u32	pid;			/* TGID of the waiting task */
+	__u32	tid;
+	__u32	cpu;
+	__u32	prev_pid;		/* task that had the CPU until now */
+	__u32	prev_tid;
+	int	user_stack_id;		/* prev's stacks; < 0: not captured */
+	int	kern_stack_id;
+	char	comm[TASK_COMM_LEN];
+	char	prev_comm[TASK_COMM_LEN];
+};
 
 #endif /* RUNQLAT_H */
@@ -4,8 +4,12 @@ plot_throughput.py — Bar chart comparing allocator throughput across workloads
 
 Reads:  results/single_throughput.csv  (Milestone 1)
         results/realistic.csv          (Milestone 4)
+        results/openloop.csv           (bench_mt --rate)
+        results/openloop_ts.csv        (bench_mt --timeseries)
 Writes: results/throughput_micro.png
         results/throughput_realistic.png
+        results/latency_vs_throughput.png
+        results/latency_timeseries.png
 """
 import sys
 import os
@@ -101,6 +105,92 @@ def plot_grouped_bars(data, output_path, title, value_key="ops_per_sec", ylabel=
     plt.close(fig)
 
 
+def plot_latency_curves(data, output_path):
+    """
+    Open-loop sweep: response-time p99 and p99.9 against achieved ops/sec,
+    one line per allocator, one panel per (workload, threads).
+    """
+    curves = defaultdict(list)
+    for row in data:
+        try:
+            key = (row["workload"], int(row["threads"]))
+            curves[(key, row["allocator"])].append(
+                (float(row["ops_per_sec"]), float(row["p99_ns"]), float(row["p999_ns"])))
+        except (ValueError, KeyError):
+            continue
+    if not curves:
+        print(f"No data to plot for {output_path}", file=sys.stderr)
+        return
+
+    panels = sorted(set(k[0] for k in curves))
+    fig, axes = plt.subplots(1, len(panels), figsize=(6 * len(panels), 5), squeeze=False)
+    for ax, (workload, threads) in zip(axes[0], panels):
+        for (panel, alloc), pts in sorted(curves.items()):
+            if panel != (workload, threads):
+                continue
+            pts.sort()
+            x = [p[0] for p in pts]
+            color = COLORS.get(alloc, "#999")
+            ax.plot(x, [p[1] / 1e3 for p in pts], "o-", color=color, label=f"{alloc} p99")
+            ax.plot(x, [p[2] / 1e3 for p in pts], "s--", color=color, label=f"{alloc} p99.9")
+        ax.set_yscale("log")
+        ax.set_xlabel("Achieved ops / sec")
+        ax.set_ylabel("Response time from scheduled start (µs)")
+        ax.set_title(f"{workload}, {threads} threads")
+        ax.grid(alpha=0.3, which="both")
+        ax.legend(fontsize=7)
+    fig.suptitle("Open-Loop Latency vs Throughput")
+    fig.tight_layout()
+    fig.savefig(output_path, dpi=150)
+    print(f"  Saved: {output_path}")
+    plt.close(fig)
+
+
+def plot_timeseries(data, output_path):
+    """
+    Per-second p99 and max at the highest rate each allocator ran, one
+    panel per (workload, threads): where in the run the stalls happen.
+    """
+    series = defaultdict(list)
+    top_rate = {}
+    for row in data:
+        try:
+            key = (row["workload"], int(row["threads"]), row["allocator"])
+            rate = float(row["target_rate"])
+            series[key + (rate,)].append(
+                (int(row["second"]), float(row["p99_ns"]), float(row["max_ns"])))
+            top_rate[key] = max(top_rate.get(key, 0), rate)
+        except (ValueError, KeyError):
+            continue
+    if not series:
+        print(f"No data to plot for {output_path}", file=sys.stderr)
+        return
+
+    panels = sorted(set(k[:2] for k in top_rate))
+    fig, axes = plt.subplots(1, len(panels), figsize=(6 * len(panels), 5), squeeze=False)
+    for ax, (workload, threads) in zip(axes[0], panels):
+        for (w, t, alloc), rate in sorted(top_rate.items()):
+            if (w, t) != (workload, threads):
+                continue
+            pts = sorted(series[(w, t, alloc, rate)])
+            color = COLORS.get(alloc, "#999")
+            x = [p[0] for p in pts]
+            ax.plot(x, [p[1] / 1e3 for p in pts], "o-", color=color,
+                    label=f"{alloc} p99 @ {rate:.0f}/s/thread")
+            ax.plot(x, [p[2] / 1e3 for p in pts], ":", color=color, label=f"{alloc} max")
+        ax.set_yscale("log")
+        ax.set_xlabel("Second of run")
+        ax.set_ylabel("Response time (µs)")
+        ax.set_title(f"{workload}, {threads} threads")
+        ax.grid(alpha=0.3, which="both")
+        ax.legend(fontsize=7)
+    fig.suptitle("Open-Loop Latency Over Time (highest rate)")
+    fig.tight_layout()
+    fig.savefig(output_path, dpi=150)
+    print(f"  Saved: {output_path}")
+    plt.close(fig)
+
+
 def main():
     # Milestone 1: micro-benchmarks
     single_path = os.path.join(RESULTS_DIR, "single_throughput.csv")
@@ -122,6 +212,14 @@ def main():
             "Realistic Workload Throughput by Allocator"
         )
 
+    # Open-loop latency sweep (bench_mt --rate)
+    ol_data = read_csv(os.path.join(RESULTS_DIR, "openloop.csv"))
+    if ol_data:
+        plot_latency_curves(ol_data, os.path.join(RESULTS_DIR, "latency_vs_throughput.png"))
+    ts_data = read_csv(os.path.join(RESULTS_DIR, "openloop_ts.csv"))
+    if ts_data:
+        plot_timeseries(ts_data, os.path.join(RESULTS_DIR, "latency_timeseries.png"))
+
     # Also plot fragmentation ratios from single_throughput
     if single_data:
         plot_grouped_bars(
@@ -2,7 +2,10 @@
 #
 # run_all.sh — Run all benchmarks across all available allocators
 #
-# Produces CSV files in results/ for plotting.
+# Produces CSV files in results/ for plotting. With TRACE=<file> (recorded
+# with bin/libatrace.so) the trace is also replayed against each allocator.
+# RATES (per-thread ops/sec list), OL_THREADS and DURATION set the
+# open-loop latency sweep.
 #
 set -euo pipefail
 
@@ -84,6 +87,36 @@ for alloc in "${ALLOCATORS[@]}"; do
 done
 echo "  → $MT_CSV"
 
+# ── Milestone 2: Open-loop tail latency (bench_mt --rate) ──────────
+
+echo ""
+echo "════════════════════════════════════════════════════════════"
+echo "  Milestone 2: Open-Loop Latency (bench_mt --rate)"
+echo "════════════════════════════════════════════════════════════"
+
+RATES="${RATES:-25k,50k,100k,200k,400k}"
+OL_THREADS="${OL_THREADS:-$(nproc)}"
+DURATION="${DURATION:-3}"
+OL_CSV="results/openloop.csv"
+OL_TS="results/openloop_ts.csv"
+head_written=0
+for alloc in "${ALLOCATORS[@]}"; do
+    echo "  [$alloc] rates $RATES per thread, $OL_THREADS threads..."
+    output=$(./scripts/run_allocator.sh "$alloc" bin/bench_mt --csv --rate "$RATES" \
+             --duration "$DURATION" --threads "$OL_THREADS" \
+             --timeseries "results/openloop_ts_${alloc}.csv" 2>/dev/null)
+    if [ $head_written -eq 0 ]; then
+        echo "$output" > "$OL_CSV"
+        cp "results/openloop_ts_${alloc}.csv" "$OL_TS"
+        head_written=1
+    else
+        echo "$output" | tail -n +2 >> "$OL_CSV"
+        tail -n +2 "results/openloop_ts_${alloc}.csv" >> "$OL_TS"
+    fi
+    rm -f "results/openloop_ts_${alloc}.csv"
+done
+echo "  → $OL_CSV, $OL_TS"
+
 # ── Milestone 3: Fragmentation ─────────────────────────────────────
 
 echo ""
@@ -121,6 +154,32 @@ for alloc in "${ALLOCATORS[@]}"; do
 done
 echo "  → $REAL_CSV"
 
+# ── Trace replay (TRACE=file recorded with bin/libatrace.so) ───────
+
+if [ -n "${TRACE:-}" ]; then
+    echo ""
+    echo "════════════════════════════════════════════════════════════"
+    echo "  Trace Replay (bench_replay $TRACE)"
+    echo "════════════════════════════════════════════════════════════"
+
+    REPLAY_CSV="results/replay.csv"
+    head_written=0
+    for alloc in "${ALLOCATORS[@]}"; do
+        for run in $(seq 1 "$RUNS"); do
+            echo "  [$alloc] run $run/$RUNS..."
+            output=$(./scripts/run_allocator.sh "$alloc" bin/bench_replay --csv \
+                     --rss "results/replay_rss_${alloc}.csv" "$TRACE" 2>/dev/null)
+            if [ $head_written -eq 0 ]; then
+                echo "$output" > "$REPLAY_CSV"
+                head_written=1
+            else
+                echo "$output" | tail -n +2 >> "$REPLAY_CSV"
+            fi
+        done
+    done
+    echo "  → $REPLAY_CSV, results/replay_rss_<allocator>.csv (last run)"
+fi
+
 # ── Summary ────────────────────────────────────────────────────────
 
 echo ""
@@ -0,0 +1,355 @@
+/*
+ * alloc_trace.c — LD_PRELOAD shim that records every allocation
+ *
+ * Wraps malloc, calloc, realloc, free, memalign, posix_memalign and
+ * aligned_alloc, forwarding to the next allocator in link order (glibc,
+ * or one preloaded after the shim), and logs each call to a binary trace
+ * (alloc_trace.h) that bench_replay replays.
+ *
+ * Usage:
+ *   ATRACE_FILE=svc.trace LD_PRELOAD=bin/libatrace.so ./service
+ *   LD_PRELOAD="bin/libatrace.so /usr/lib/.../libjemalloc.so.2" ./service
+ *   bin/bench_replay svc.trace
+ *
+ * ATRACE_FILE defaults to alloc-<pid>.trace in the current directory.
+ *
+ * Cost per call: one cycle-counter read and a 32-byte store into a
+ * per-thread buffer (512 KB, mmap'd, so the shim never allocates through
+ * itself). A full buffer is written out with one write() under a lock;
+ * that and thread exit are the only synchronization. Buffers of threads
+ * still running at exit are flushed by the destructor; their last few
+ * events can be lost. A forked child stops tracing (its parent keeps the
+ * file). valloc, pvalloc and reallocarray are not wrapped: the replay
+ * drops frees of pointers it never saw allocated.
+ */
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "alloc_trace.h"
+#include "tsc.h"
+
+#define ATRACE_BUF_RECS    16384        /* 512 KB per thread */
+#define BOOT_HEAP          (64 * 1024)
+
+struct atrace_buf {
+    struct atrace_chunk hdr;            /* written together with rec[] */
+    struct atrace_rec   rec[ATRACE_BUF_RECS];
+};
+
+/* Initial-exec TLS: the default model may allocate on first access */
+#define ATRACE_TLS __thread __attribute__((tls_model("initial-exec")))
+
+static ATRACE_TLS struct atrace_buf *tl_buf;
+static ATRACE_TLS int tl_busy;          /* inside the shim: don't trace */
+static ATRACE_TLS int tl_off;           /* thread exited or out of slots */
+
+static void *(*real_malloc)(size_t);
+static void *(*real_calloc)(size_t, size_t);
+static void *(*real_realloc)(void *, size_t);
+static void  (*real_free)(void *);
+static void *(*real_memalign)(size_t, size_t);
+static int   (*real_posix_memalign)(void **, size_t, size_t);
+static void *(*real_aligned_alloc)(size_t, size_t);
+
+static atomic_int        atrace_on;
+static int               atrace_fd = -1;
+static uint64_t          atrace_t0;
+static pthread_key_t     atrace_key;
+static pthread_mutex_t   atrace_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct atrace_buf *atrace_bufs[ATRACE_MAX_THREADS];
+static atomic_uint       atrace_nthreads;
+
+/* ── Bootstrap heap ─────────────────────────────────────────────────── */
+
+/* dlsym() allocates before the real functions are known */
+static _Alignas(16) char boot_heap[BOOT_HEAP];
+static size_t boot_pos;
+
+static void *boot_alloc(size_t size)
+{
+    size = (size + 15) & ~(size_t)15;
+    if (boot_pos + size > BOOT_HEAP)
+        return NULL;
+    void *p = boot_heap + boot_pos;
+    boot_pos += size;
+    return p;
+}
+
+static int is_boot(const void *p)
+{
+    return (const char *)p >= boot_heap && (const char *)p < boot_heap + BOOT_HEAP;
+}
+
+static void atrace_resolve(void)
+{
+    static int resolving;
+    if (real_malloc || resolving)
+        return;
+    resolving = 1;
+    real_malloc         = dlsym(RTLD_NEXT, "malloc");
+    real_calloc         = dlsym(RTLD_NEXT, "calloc");
+    real_realloc        = dlsym(RTLD_NEXT, "realloc");
+    real_free           = dlsym(RTLD_NEXT, "free");
+    real_memalign       = dlsym(RTLD_NEXT, "memalign");
+    real_posix_memalign = dlsym(RTLD_NEXT, "posix_memalign");
+    real_aligned_alloc  = dlsym(RTLD_NEXT, "aligned_alloc");
+    resolving = 0;
+}
+
+/* ── Per-thread buffers ─────────────────────────────────────────────── */
+
+/* Caller holds atrace_lock */
+static void atrace_flush(struct atrace_buf *b)
+{
+    if (b->hdr.n == 0 || atrace_fd < 0)
+        return;
+    const char *p = (const char *)b;
+    size_t left = sizeof(b->hdr) + (size_t)b->hdr.n * sizeof(b->rec[0]);
+    while (left > 0) {
+        ssize_t n = write(atrace_fd, p, left);
+        if (n <= 0) {
+            close(atrace_fd);
+            atrace_fd = -1;     /* disk full or similar: stop, keep the app running */
+            break;
+        }
+        p += n;
+        left -= (size_t)n;
+    }
+    b->hdr.n = 0;
+}
+
+static void atrace_thread_exit(void *arg)
+{
+    struct atrace_buf *b = arg;
+    tl_busy = 1;
+    pthread_mutex_lock(&atrace_lock);
+    if (atomic_load_explicit(&atrace_on, memory_order_relaxed))
+        atrace_flush(b);
+    atrace_bufs[b->hdr.tid] = NULL;
+    pthread_mutex_unlock(&atrace_lock);
+    munmap(b, sizeof(*b));
+    tl_buf = NULL;
+    tl_off = 1;                 /* later frees in thread teardown go untraced */
+    tl_busy = 0;
+}
+
+static struct atrace_buf *atrace_thread_buf(void)
+{
+    unsigned int tid = atomic_fetch_add(&atrace_nthreads, 1);
+    if (tid >= ATRACE_MAX_THREADS) {
+        tl_off = 1;
+        return NULL;
+    }
+    tl_busy = 1;
+    struct atrace_buf *b = mmap(NULL, sizeof(*b), PROT_READ | PROT_WRITE,
+                                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (b == MAP_FAILED) {
+        tl_off = 1;
+        tl_busy = 0;
+        return NULL;
+    }
+    b->hdr.tid = tid;
+    b->hdr.n = 0;
+    pthread_mutex_lock(&atrace_lock);
+    atrace_bufs[tid] = b;
+    pthread_mutex_unlock(&atrace_lock);
+    pthread_setspecific(atrace_key, b);
+    tl_buf = b;
+    tl_busy = 0;
+    return b;
+}
+
+static inline void atrace_log(uint8_t op, const void *ptr, const void *old,
+                              size_t size, size_t align)
+{
+    if (!atomic_load_explicit(&atrace_on, memory_order_relaxed) || tl_busy || tl_off)
+        return;
+    struct atrace_buf *b = tl_buf;
+    if (!b && !(b = atrace_thread_buf()))
+        return;
+
+    struct atrace_rec *r = &b->rec[b->hdr.n];
+    r->ts = tsc_start() - atrace_t0;
+    r->ptr = (uint64_t)(uintptr_t)ptr;
+    r->old = (uint64_t)(uintptr_t)old;
+    r->size = size > UINT32_MAX ? UINT32_MAX : (uint32_t)size;
+    r->op = op;
+    r->align_log2 = align ? (uint8_t)(63 - __builtin_clzll(align)) : 0;
+    r->reserved = 0;
+
+    if (++b->hdr.n == ATRACE_BUF_RECS) {
+        tl_busy = 1;
+        pthread_mutex_lock(&atrace_lock);
+        atrace_flush(b);
+        pthread_mutex_unlock(&atrace_lock);
+        tl_busy = 0;
+    }
+}
+
+/* ── Setup and teardown ─────────────────────────────────────────────── */
+
+static void atrace_atfork_child(void)
+{
+    atomic_store(&atrace_on, 0);
+    if (atrace_fd >= 0)
+        close(atrace_fd);
+    atrace_fd = -1;
+}
+
+__attribute__((constructor))
+static void atrace_init(void)
+{
+    atrace_resolve();
+    tl_busy = 1;
+
+    char def[64];
+    const char *path = getenv("ATRACE_FILE");
+    if (!path || !*path) {
+        snprintf(def, sizeof(def), "alloc-%d.trace", (int)getpid());
+        path = def;
+    }
+    atrace_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (atrace_fd < 0) {
+        fprintf(stderr, "atrace: %s: %s (not tracing)\n", path, strerror(errno));
+        tl_busy = 0;
+        return;
+    }
+
+    tsc_init();
+    struct atrace_header h = {
+        .version = ATRACE_VERSION,
+        .rec_size = sizeof(struct atrace_rec),
+        .ns_per_tick = tsc.ns_per_tick,
+        .pid = (uint32_t)getpid(),
+    };
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    h.start_ns = (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+    memcpy(h.magic, ATRACE_MAGIC, sizeof(ATRACE_MAGIC));
+    if (write(atrace_fd, &h, sizeof(h)) != (ssize_t)sizeof(h)) {
+        close(atrace_fd);
+        atrace_fd = -1;
+        tl_busy = 0;
+        return;
+    }
+
+    pthread_key_create(&atrace_key, atrace_thread_exit);
+    pthread_atfork(NULL, NULL, atrace_atfork_child);
+    atrace_t0 = tsc_start();
+    tl_busy = 0;
+    atomic_store(&atrace_on, 1);
+}
+
+__attribute__((destructor))
+static void atrace_fini(void)
+{
+    if (!atomic_exchange(&atrace_on, 0))
+        return;
+    pthread_mutex_lock(&atrace_lock);
+    for (unsigned int i = 0; i < ATRACE_MAX_THREADS; i++)
+        if (atrace_bufs[i])
+            atrace_flush(atrace_bufs[i]);
+    if (atrace_fd >= 0)
+        close(atrace_fd);
+    atrace_fd = -1;
+    pthread_mutex_unlock(&atrace_lock);
+}
+
+/* ── Wrappers ───────────────────────────────────────────────────────── */
+
+/*
+ * Allocations are stamped after the call returns, frees before, and a
+ * realloc on both sides (alloc_trace.h)
+ */
+
+void *malloc(size_t size)
+{
+    if (!real_malloc) {
+        atrace_resolve();
+        if (!real_malloc)
+            return boot_alloc(size);
+    }
+    void *p = real_malloc(size);
+    if (p)
+        atrace_log(ATRACE_MALLOC, p, NULL, size, 0);
+    return p;
+}
+
+void *calloc(size_t n, size_t size)
+{
+    if (!real_calloc) {
+        atrace_resolve();
+        if (!real_calloc)
+            return boot_alloc(n * size);    /* static: already zero */
+    }
+    void *p = real_calloc(n, size);
+    if (p)
+        atrace_log(ATRACE_CALLOC, p, NULL, n * size, 0);
+    return p;
+}
+
+void *realloc(void *old, size_t size)
+{
+    if (!real_realloc)
+        atrace_resolve();
+    if (is_boot(old)) {
+        /* Never traced: copy out of the bootstrap heap into a traced block */
+        void *p = malloc(size);
+        size_t avail = (size_t)(boot_heap + BOOT_HEAP - (char *)old);
+        if (p)
+            memcpy(p, old, size < avail ? size : avail);
+        return p;
+    }
+    if (old)
+        atrace_log(ATRACE_REALLOC_OLD, old, NULL, 0, 0);
+    void *p = real_realloc(old, size);
+    /* NULL with size 0 freed old; NULL otherwise failed and old is intact */
+    if (p || size == 0 || old)
+        atrace_log(ATRACE_REALLOC, p, old, size, 0);
+    return p;
+}
+
+void free(void *p)
+{
+    if (!p || is_boot(p))
+        return;
+    if (!real_free)
+        atrace_resolve();
+    atrace_log(ATRACE_FREE, p, NULL, 0, 0);
+    real_free(p);
+}
+
+void *memalign(size_t align, size_t size)
+{
+    if (!real_memalign)
+        atrace_resolve();
+    void *p = real_memalign(align, size);
+    if (p)
+        atrace_log(ATRACE_MEMALIGN, p, NULL, size, align);
+    return p;
+}
+
+int posix_memalign(void **memptr, size_t align, size_t size)
+{
+    if (!real_posix_memalign)
+        atrace_resolve();
+    int rc = real_posix_memalign(memptr, align, size);
+    if (rc == 0)
+        atrace_log(ATRACE_MEMALIGN, *memptr, NULL, size, align);
+    return rc;
+}
+
+void *aligned_alloc(size_t align, size_t size)
+{
+    if (!real_aligned_alloc)
+        atrace_resolve();
+    void *p = real_aligned_alloc(align, size);
+    if (p)
+        atrace_log(ATRACE_MEMALIGN, p, NULL, size, align);
+    return p;
+}
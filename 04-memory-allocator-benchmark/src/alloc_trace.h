@@ -0,0 +1,70 @@
+#ifndef ALLOC_TRACE_H
+#define ALLOC_TRACE_H
+
+/*
+ * alloc_trace.h — Binary allocation trace format
+ *
+ * Written by the LD_PRELOAD shim (alloc_trace.c → bin/libatrace.so),
+ * read by bench_replay. Layout, all little-endian, native struct packing:
+ *
+ *   struct atrace_header                      once
+ *   struct atrace_chunk + n × atrace_rec      repeated: one thread's buffer
+ *                                             each time it fills or exits
+ *
+ * Chunks of different threads interleave in flush order; within a thread
+ * records are in program order. Timestamps are cycle-counter ticks since
+ * the shim started (tsc.h), ns_per_tick converts, and they order events
+ * across threads: allocations are stamped after the allocator returns,
+ * frees before it is called, so a free is never stamped before the
+ * allocation it releases and an address is never reused before it was
+ * freed. A realloc does both, so it takes two records: REALLOC_OLD for
+ * the pointer passed in, before the call (a moving realloc frees it
+ * inside), then REALLOC for the result. A failed realloc, which left
+ * the old block in place, is a REALLOC with ptr 0 and a nonzero size.
+ *
+ * Lifetimes are linked by address: a free (or realloc) refers to the
+ * pointer an earlier malloc returned. bench_replay turns addresses into
+ * object ids while reading the trace, so the shim keeps no table.
+ */
+#include <stdint.h>
+
+#define ATRACE_MAGIC    "ATRACE1"
+#define ATRACE_VERSION  2           /* 1: REALLOC only, stamped after the call */
+#define ATRACE_MAX_THREADS 4096     /* threads beyond this go untraced */
+
+enum atrace_op {
+    ATRACE_MALLOC   = 1,
+    ATRACE_CALLOC   = 2,
+    ATRACE_REALLOC  = 3,
+    ATRACE_MEMALIGN = 4,            /* memalign, posix_memalign, aligned_alloc */
+    ATRACE_FREE     = 5,
+    ATRACE_REALLOC_OLD = 6,         /* ptr: realloc's old pointer, released */
+};
+
+struct atrace_header {
+    char     magic[8];              /* ATRACE_MAGIC, NUL-padded */
+    uint32_t version;
+    uint32_t rec_size;              /* sizeof(struct atrace_rec) */
+    double   ns_per_tick;
+    uint64_t start_ns;              /* CLOCK_REALTIME at start, for labels */
+    uint32_t pid;
+    uint32_t reserved;
+};
+
+struct atrace_chunk {
+    uint32_t tid;                   /* shim thread index, 0 = first to allocate */
+    uint32_t n;                     /* records that follow */
+};
+
+struct atrace_rec {                 /* 32 bytes */
+    uint64_t ts;                    /* ticks since start */
+    uint64_t ptr;                   /* returned pointer; for FREE the one freed */
+    uint64_t old;                   /* REALLOC: the pointer passed in */
+    uint32_t size;                  /* requested bytes (calloc: n × size),
+                                       clamped to UINT32_MAX */
+    uint8_t  op;                    /* enum atrace_op */
+    uint8_t  align_log2;            /* MEMALIGN */
+    uint16_t reserved;
+};
+
+#endif /* ALLOC_TRACE_H */
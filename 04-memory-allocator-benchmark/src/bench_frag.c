@@ -8,12 +8,26 @@
  *   Phase 4: Free everything, measure RSS retention
  *
  * Tracks RSS at each step and outputs a time-series CSV for plotting.
+ * Samples read /proc/self/statm through an open fd (mem_stats.h), cheap
+ * enough not to show up in the phase timings. At the end of each phase
+ * the RSS is broken down (smaps_rollup and the allocator's own counters)
+ * into live bytes, allocator rounding, free memory the allocator keeps,
+ * and memory outside the heap.
  *
  * Usage:
- *   ./bench_frag [--csv] [--objects N]
+ *   ./bench_frag [--csv] [--objects N] [--heatmap] [--alloc-stats] [--mem-csv FILE]
+ *                [--json FILE]
  *   LD_PRELOAD=/path/to/libjemalloc.so ./bench_frag
+ *
+ * --heatmap scans /proc/self/pagemap at each phase end: resident pages
+ * by how full of live objects they are, and a strip per large mapping.
+ * --alloc-stats prints the allocator's native report (malloc_stats(),
+ * malloc_stats_print(), ...) on stderr at the end. --mem-csv writes the
+ * per-phase breakdown as CSV.
  */
 #include "common.h"
+#include "mem_stats.h"
+#include <sys/mman.h>
 
 /* ── Configuration ──────────────────────────────────────────────────── */
 
@@ -22,6 +36,8 @@
 
 static int  csv_mode = 0;
 static long num_objects = DEFAULT_OBJECTS;
+static int  heatmap_enabled = 0;
+static const char *mem_csv_path = NULL;
 
 /* ── RSS time-series recording ──────────────────────────────────────── */
 
@@ -37,30 +53,147 @@ typedef struct {
 
 static sample_t samples[MAX_SAMPLES];
 static int      num_samples = 0;
+static uint64_t sample_ns = 0;     /* time spent taking samples */
 
 static void record_sample(long step, const char *phase, long live_bytes)
 {
     if (num_samples >= MAX_SAMPLES) return;
+    uint64_t t0 = now_ns();
     sample_t *s = &samples[num_samples++];
     s->step = step;
     strncpy(s->phase, phase, sizeof(s->phase) - 1);
     s->phase[sizeof(s->phase) - 1] = '\0';
-    s->rss_kb = get_rss_kb();
+    s->rss_kb = mem_rss_kb();
     s->live_bytes = live_bytes;
     s->frag_ratio = (live_bytes > 0)
         ? (double)(s->rss_kb * 1024L) / live_bytes
         : 0.0;
+    sample_ns += now_ns() - t0;
+}
+
+/* ── Per-phase memory breakdown ─────────────────────────────────────── */
+
+#define NUM_PHASES 4
+
+typedef struct {
+    const char        *name;
+    long               rss_kb;
+    long               live_bytes;
+    struct mem_rollup  rollup;
+    struct alloc_stats alloc;
+} phase_mem_t;
+
+static phase_mem_t phase_mem[NUM_PHASES];
+
+static void record_phase(int idx, const char *name, void *const *ptrs,
+                         const size_t *sizes, long n, long live_bytes)
+{
+    phase_mem_t *m = &phase_mem[idx];
+    m->name = name;
+    m->rss_kb = mem_rss_kb();
+    m->live_bytes = live_bytes;
+    mem_rollup(&m->rollup);
+    alloc_stats(&m->alloc);
+
+    if (heatmap_enabled && !csv_mode) {
+        struct mem_heatmap h;
+        if (mem_heatmap_scan(&h, ptrs, sizes, n) == 0) {
+            char buf[32];
+            printf("    Heatmap       : %s resident and empty\n",
+                   format_bytes(h.empty_kb * 1024L, buf, sizeof(buf)));
+            mem_heatmap_print(&h, 4);
+        } else {
+            printf("    Heatmap       : /proc/self/pagemap unavailable\n");
+        }
+        mem_heatmap_free(&h);
+    }
+}
+
+/* KB, or "-" where the allocator doesn't say */
+static const char *kb_or_dash(long bytes, char *buf, size_t len)
+{
+    if (bytes < 0)
+        snprintf(buf, len, "-");
+    else
+        snprintf(buf, len, "%ld", bytes / 1024);
+    return buf;
+}
+
+static void print_breakdown(void)
+{
+    char b[6][24];
+    printf("\n  Memory breakdown (KB; allocator counters: %s):\n",
+           phase_mem[0].alloc.source ? phase_mem[0].alloc.source : "none");
+    print_separator();
+    printf("  %-22s  %8s  %8s  %6s  %8s  %9s  %9s  %9s\n", "Phase", "RSS", "Anon", "THP",
+           "Live", "Rounding", "Free kept", "Non-heap");
+    for (int i = 0; i < NUM_PHASES; i++) {
+        const phase_mem_t *m = &phase_mem[i];
+        long alloc = m->alloc.allocated, heap = m->alloc.heap;
+        long anon = m->rollup.anon_kb >= 0 ? m->rollup.anon_kb * 1024L : -1;
+        printf("  %-22s  %8ld  %8s  %6s  %8ld  %9s  %9s  %9s\n", m->name, m->rss_kb,
+               kb_or_dash(anon, b[0], sizeof(b[0])),
+               kb_or_dash(m->rollup.thp_kb >= 0 ? m->rollup.thp_kb * 1024L : -1, b[1], sizeof(b[1])),
+               m->live_bytes / 1024,
+               kb_or_dash(alloc >= 0 ? alloc - m->live_bytes : -1, b[2], sizeof(b[2])),
+               kb_or_dash(heap >= 0 && alloc >= 0 ? heap - alloc : -1, b[3], sizeof(b[3])),
+               kb_or_dash(anon >= 0 && heap >= 0 ? anon - heap : -1, b[4], sizeof(b[4])));
+    }
+    printf("  Rounding = allocated - live, Free kept = heap - allocated, "
+           "Non-heap = anon - heap\n");
+    printf("  (bench_frag only writes each object's first byte, so live and heap can\n"
+           "   exceed RSS; Non-heap is then \"-\")\n");
+    printf("  Sampling: %d statm reads, %.2f us each\n", num_samples,
+           num_samples ? (double)sample_ns / num_samples / 1000.0 : 0.0);
+}
+
+static void write_mem_csv(const char *path)
+{
+    FILE *f = fopen(path, "w");
+    if (!f) { perror(path); exit(1); }
+    fprintf(f, "allocator,phase,rss_kb,pss_kb,anon_kb,thp_kb,swap_kb,live_bytes,"
+               "alloc_allocated_bytes,alloc_heap_bytes,alloc_metadata_bytes\n");
+    for (int i = 0; i < NUM_PHASES; i++) {
+        const phase_mem_t *m = &phase_mem[i];
+        fprintf(f, "%s,%s,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld\n", detect_allocator(), m->name,
+                m->rss_kb, m->rollup.pss_kb, m->rollup.anon_kb, m->rollup.thp_kb,
+                m->rollup.swap_kb, m->live_bytes, m->alloc.allocated, m->alloc.heap,
+                m->alloc.metadata);
+    }
+    fclose(f);
 }
 
 /* ── Main fragmentation benchmark ───────────────────────────────────── */
 
+/* One --json result per phase; frag < 0: no live bytes to compare against */
+static void json_phase(const char *phase, double ms, long rss_kb, long live, double frag)
+{
+    bj_result(phase);
+    bj_param_int("objects", num_objects);
+    bj_metric("time_ms", ms, "ms", BJ_LOWER);
+    bj_metric("rss_kb", (double)rss_kb, "kB", BJ_LOWER);
+    bj_metric("live_bytes", (double)live, "B", BJ_NONE);
+    if (frag >= 0)
+        bj_metric("frag_ratio", frag, "ratio", BJ_LOWER);
+}
+
+/* The harness's own arrays (16 B per object) come straight from mmap,
+ * so the allocator's counters cover only the benchmark's objects and
+ * Rounding / Free kept are not inflated by bench_frag's bookkeeping */
+static void *harness_alloc(size_t bytes)
+{
+    void *p = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) { perror("mmap"); exit(1); }
+    return p;
+}
+
 static void run_fragmentation_bench(void)
 {
     uint64_t rng = 0xF4A61234DEAD5678ULL;
 
-    void  **ptrs  = calloc(num_objects, sizeof(void *));
-    size_t *sizes = calloc(num_objects, sizeof(size_t));
-    if (!ptrs || !sizes) { perror("calloc"); exit(1); }
+    void  **ptrs  = harness_alloc(num_objects * sizeof(void *));
+    size_t *sizes = harness_alloc(num_objects * sizeof(size_t));
 
     long live_bytes = 0;
     long total_step = 0;
@@ -104,7 +237,7 @@ static void run_fragmentation_bench(void)
     record_sample(total_step, "alloc_done", live_bytes);
 
     live_after_alloc = live_bytes;
-    long rss_after_alloc = get_rss_kb();
+    long rss_after_alloc = mem_rss_kb();
     double frag_after_alloc = (live_bytes > 0)
         ? (double)(rss_after_alloc * 1024L) / live_bytes : 0;
 
@@ -115,6 +248,7 @@ static void run_fragmentation_bench(void)
         printf("    RSS           : %s\n", format_bytes(rss_after_alloc * 1024L, buf2, sizeof(buf2)));
         printf("    Frag ratio    : %.2f\n", frag_after_alloc);
     }
+    record_phase(0, "After initial alloc", ptrs, sizes, num_objects, live_bytes);
 
     /* ── Phase 2: Free every other object (create holes) ─────────── */
 
@@ -141,7 +275,7 @@ static void run_fragmentation_bench(void)
     record_sample(total_step, "holes_done", live_bytes);
 
     live_after_holes = live_bytes;
-    long rss_after_holes = get_rss_kb();
+    long rss_after_holes = mem_rss_kb();
     double frag_after_holes = (live_bytes > 0)
         ? (double)(rss_after_holes * 1024L) / live_bytes : 0;
 
@@ -153,6 +287,7 @@ static void run_fragmentation_bench(void)
         printf("    RSS           : %s\n", format_bytes(rss_after_holes * 1024L, buf2, sizeof(buf2)));
         printf("    Frag ratio    : %.2f  (holes created)\n", frag_after_holes);
     }
+    record_phase(1, "After creating holes", ptrs, sizes, num_objects, live_bytes);
 
     /* ── Phase 3: Re-allocate with DIFFERENT sizes ───────────────── */
 
@@ -192,7 +327,7 @@ static void run_fragmentation_bench(void)
     record_sample(total_step, "realloc_done", live_bytes);
 
     live_after_realloc = live_bytes;
-    long rss_after_realloc = get_rss_kb();
+    long rss_after_realloc = mem_rss_kb();
     double frag_after_realloc = (live_bytes > 0)
         ? (double)(rss_after_realloc * 1024L) / live_bytes : 0;
 
@@ -204,6 +339,7 @@ static void run_fragmentation_bench(void)
         printf("    RSS           : %s\n", format_bytes(rss_after_realloc * 1024L, buf2, sizeof(buf2)));
         printf("    Frag ratio    : %.2f  (can allocator reuse holes?)\n", frag_after_realloc);
     }
+    record_phase(2, "After re-allocation", ptrs, sizes, num_objects, live_bytes);
 
     /* ── Phase 4: Free everything, check RSS retention ───────────── */
 
@@ -226,7 +362,7 @@ static void run_fragmentation_bench(void)
     uint64_t t4_end = now_ns();
     record_sample(total_step, "done", 0);
 
-    long rss_after_free = get_rss_kb();
+    long rss_after_free = mem_rss_kb();
 
     if (!csv_mode) {
         char buf1[32], buf2[32];
@@ -235,7 +371,10 @@ static void run_fragmentation_bench(void)
                format_bytes(rss_after_free * 1024L, buf1, sizeof(buf1)));
         printf("    RSS peak      : %s\n",
                format_bytes(rss_after_realloc * 1024L, buf2, sizeof(buf2)));
+    }
+    record_phase(3, "After free all", ptrs, sizes, num_objects, live_bytes);
 
+    if (!csv_mode) {
         printf("\n  Summary:\n");
         print_separator();
         printf("  %-22s  %10s  %10s  %10s\n", "Phase", "RSS (KB)", "Live (KB)", "Frag Ratio");
@@ -247,10 +386,21 @@ static void run_fragmentation_bench(void)
                rss_after_realloc, live_after_realloc / 1024, frag_after_realloc);
         printf("  %-22s  %10ld  %10ld  %10s\n", "After free all",
                rss_after_free, 0L, "-");
-    }
 
-    free(ptrs);
-    free(sizes);
+        print_breakdown();
+    }
+    if (mem_csv_path)
+        write_mem_csv(mem_csv_path);
+    json_phase("alloc", elapsed_ms(t1_start, t1_end), rss_after_alloc, live_after_alloc,
+               frag_after_alloc);
+    json_phase("holes", elapsed_ms(t2_start, t2_end), rss_after_holes, live_after_holes,
+               frag_after_holes);
+    json_phase("realloc", elapsed_ms(t3_start, t3_end), rss_after_realloc, live_after_realloc,
+               frag_after_realloc);
+    json_phase("free_all", elapsed_ms(t4_start, t4_end), rss_after_free, 0, -1);
+
+    munmap(ptrs, num_objects * sizeof(void *));
+    munmap(sizes, num_objects * sizeof(size_t));
 }
 
 static void print_csv_samples(void)
@@ -268,17 +418,32 @@ static void print_csv_samples(void)
 
 int main(int argc, char *argv[])
 {
+    int dump_stats = 0;
+    const char *json_path = NULL;
+
     for (int i = 1; i < argc; i++) {
         if (strcmp(argv[i], "--csv") == 0)
             csv_mode = 1;
         else if (strcmp(argv[i], "--objects") == 0 && i + 1 < argc) {
             num_objects = atol(argv[++i]);
             if (num_objects <= 0) num_objects = DEFAULT_OBJECTS;
-        } else if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
-            fprintf(stderr, "Usage: %s [--csv] [--objects N]\n", argv[0]);
+        } else if (strcmp(argv[i], "--heatmap") == 0)
+            heatmap_enabled = 1;
+        else if (strcmp(argv[i], "--alloc-stats") == 0)
+            dump_stats = 1;
+        else if (strcmp(argv[i], "--mem-csv") == 0 && i + 1 < argc)
+            mem_csv_path = argv[++i];
+        else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc)
+            json_path = argv[++i];
+        else if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+            fprintf(stderr, "Usage: %s [--csv] [--objects N] [--heatmap] [--alloc-stats] "
+                    "[--mem-csv FILE] [--json FILE]\n", argv[0]);
             return 0;
         }
     }
+    if (bj_open(json_path, "bench_frag", argc, argv) < 0)
+        return 1;
+    bj_meta("allocator", detect_allocator());
 
     if (!csv_mode) {
         printf("Memory Allocator Fragmentation Deep-Dive\n");
@@ -292,6 +457,8 @@ int main(int argc, char *argv[])
 
     if (csv_mode)
         print_csv_samples();
+    if (dump_stats)
+        alloc_stats_dump();
 
     return 0;
 }
@@ -3,17 +3,57 @@
  *
  * Three workload modes:
  *   1. thread_local  — each thread allocs and frees its own memory
- *   2. producer_consumer — thread A allocates, thread B frees (cross-thread free)
+ *   2. producer_consumer — thread A allocates, thread B frees (cross-thread free),
+ *                          pointers passed over a lock-free queue (queue.h)
  *   3. shared_pool  — all threads alloc/free from a shared ring buffer
  *
  * Scales from 1 to N threads (default: 2x core count) and reports
- * throughput for each. CSV output for plotting.
+ * throughput for each. CSV output for plotting. Threads are pinned to the
+ * CPUs this process may use, filling NUMA node 0 first (numa_topo.h).
+ *
+ * Placement workloads, run only when named (or by prefix: "numa", "thp"):
+ *   numa_local_free   producer/consumer pairs, both ends on one node
+ *   numa_remote_free  ... producer on node A, consumer on node B
+ *   numa_first_touch  each thread allocates, touches and uses its memory
+ *   numa_remote_touch ... allocated and touched from the next node over
+ *   numa_interleave   ... with MPOL_INTERLEAVE over all nodes
+ *   thp_always, thp_madvise, thp_never
+ *                     numa_first_touch with the THP mode switched (sysfs,
+ *                     as root; restored afterwards) or prctl for never
+ * and report a per-node breakdown: threads, ops/sec, where their pages
+ * went (move_pages); thp_* also huge pages mapped, THP faults and
+ * fallbacks, khugepaged collapses, compaction stalls and page-touch
+ * latency.
  *
  * Usage:
- *   ./bench_mt [--csv] [--threads 1,2,4,8,16] [workload_name]
+ *   ./bench_mt [--csv] [--perf] [--latency] [--sample N] [--hist FILE] [--threads 1,2,4,8,16] [workload_name]
+ *   ./bench_mt --queue mpmc --batch 1 producer_consumer   # transport for it
+ *   ./bench_mt --node-csv nodes.csv numa                  # placement workloads
+ *   ./bench_mt --rate 50k,100k,200k --timeseries ts.csv   # open loop
+ *   ./bench_mt --json mt.json                             # + common schema (bench_json.h)
  *   LD_PRELOAD=/path/to/libjemalloc.so ./bench_mt
+ *
+ * --perf gives every worker its own counter group (perf_group.h); the
+ * groups are summed per run and reported per alloc/free op.
+ *
+ * --latency times every malloc and free into per-thread histograms
+ * (hdr_hist.h), merged per run into p50/p99/p99.9/max. Two cycle-counter
+ * reads per op (tsc.h): throughput with --latency is lower and not
+ * comparable. --sample N times only 1 in N ops, which keeps throughput
+ * close to the untimed run. --hist appends the merged histograms to FILE.
+ *
+ * --rate switches the three default workloads to open loop: ops issued on
+ * a fixed per-thread schedule, latency from each op's scheduled start, a
+ * run per rate for latency-vs-throughput curves, and --timeseries for
+ * per-second percentiles.
  */
 #include "common.h"
+#include "mem_stats.h"
+#include "numa_topo.h"
+#include "perf_group.h"
+#include "queue.h"
+#include <signal.h>
+#include <sys/prctl.h>
 
 /* ── Configuration ──────────────────────────────────────────────────── */
 
@@ -23,6 +63,209 @@
 
 static long ops_per_thread = DEFAULT_OPS_PER_THREAD;
 static int  csv_mode = 0;
+static struct numa_topo topo;
+
+/* Hardware counters of the last run (--perf), summed over its workers,
+ * and the alloc + free ops they cover */
+static struct pg_counts mt_perf;
+static double mt_ops;
+
+/* Per-op latency of the last run (--latency), merged over its workers */
+static int lat_enabled = 0;
+static lat_histogram_t mt_lat_alloc, mt_lat_free;
+static pthread_mutex_t mt_lat_lock = PTHREAD_MUTEX_INITIALIZER;
+
+typedef struct {
+    lat_histogram_t alloc;
+    lat_histogram_t free;
+} op_lat_t;
+
+static inline void op_lat_begin(op_lat_t *l)
+{
+    if (!lat_enabled)
+        return;
+    lat_hist_init(&l->alloc);
+    lat_hist_init(&l->free);
+}
+
+static inline uint64_t op_lat_start(void)
+{
+    return lat_enabled ? lat_begin() : 0;
+}
+
+static inline void op_lat_stop(lat_histogram_t *h, uint64_t t0)
+{
+    lat_end(h, t0);
+}
+
+/* Merge this thread's histograms into the run's */
+static inline void op_lat_end(op_lat_t *l)
+{
+    if (!lat_enabled)
+        return;
+    pthread_mutex_lock(&mt_lat_lock);
+    lat_hist_merge(&mt_lat_alloc, &l->alloc);
+    lat_hist_merge(&mt_lat_free, &l->free);
+    pthread_mutex_unlock(&mt_lat_lock);
+    lat_hist_free(&l->alloc);
+    lat_hist_free(&l->free);
+}
+
+/* ── Open-loop mode (--rate) ────────────────────────────────────────── */
+
+/*
+ * The workers normally run closed loops: each op starts when the last one
+ * finishes, so a 5 ms stall in madvise() or a trim costs one slow op and
+ * the ops that would have queued up behind it are never issued
+ * (coordinated omission). With --rate, every thread issues ops on a
+ * fixed schedule instead, op i due at start + i / rate, and records the
+ * time from when it was due to when it finished: a stall is charged to
+ * every op scheduled during it. Service time, from when the op actually
+ * started, is kept too; the gap between the two is the queueing a closed
+ * loop hides.
+ *
+ * The schedule is shared by all threads of a run and starts OL_GRACE_NS
+ * after the threads are spawned. An op is "late" when it starts more than
+ * one interval after it was due. Per-second histograms, by due time, keep
+ * one significant digit.
+ */
+#define OL_MAX_RATES    32
+#define OL_MAX_SECONDS  600
+#define OL_GRACE_NS     20000000ULL     /* 20 ms for the threads to start */
+#define OL_SPIN_NS      100000ULL       /* sleep until this close, then spin */
+#define OL_WORKING_SET  4096            /* live objects per thread_local thread */
+
+static double ol_rates[OL_MAX_RATES];   /* per thread */
+static int    ol_nrates = 0;
+static double ol_rate;                  /* the current run's; 0: closed loop */
+static double ol_duration = 5.0;        /* seconds of schedule per run */
+static uint64_t ol_start;
+
+/* Merged over the run's threads */
+static lat_histogram_t ol_resp, ol_serv;
+static struct hdr_hist ol_sec[OL_MAX_SECONDS];
+static int    ol_nsec;
+static long   ol_done_ops, ol_late_ops;
+static int    ol_pacers;                /* threads on the schedule (producers only for p/c) */
+
+typedef struct {
+    double   interval;                  /* ns between due times */
+    uint64_t started;                   /* when the current op began */
+    long     done, late;
+    lat_histogram_t resp, serv;
+    struct hdr_hist *sec;               /* ol_nsec, allocated on first use */
+} ol_thread_t;
+
+static long run_ops(void)
+{
+    return ol_rate > 0 ? (long)(ol_rate * ol_duration) : ops_per_thread;
+}
+
+static void ol_reset(void)
+{
+    ol_nsec = (int)ceil(ol_duration);
+    if (ol_nsec > OL_MAX_SECONDS) ol_nsec = OL_MAX_SECONDS;
+    for (int s = 0; s < ol_nsec; s++) {
+        if (!ol_sec[s].counts && hdr_init(&ol_sec[s], HDR_SUB_BITS(1), LAT_HIST_MAX_BITS) < 0) {
+            perror("hdr_init");
+            exit(1);
+        }
+        hdr_reset(&ol_sec[s]);
+    }
+    hdr_reset(&ol_resp);
+    hdr_reset(&ol_serv);
+    ol_done_ops = ol_late_ops = 0;
+    ol_pacers = 0;
+    ol_start = now_ns() + OL_GRACE_NS;
+}
+
+static void ol_thread_begin(ol_thread_t *o)
+{
+    memset(o, 0, sizeof(*o));
+    if (ol_rate <= 0)
+        return;
+    o->interval = 1e9 / ol_rate;
+    prctl(PR_SET_TIMERSLACK, 1UL, 0, 0, 0);     /* default 50 us would eat the spin margin */
+    lat_hist_init(&o->resp);
+    lat_hist_init(&o->serv);
+    o->sec = calloc(ol_nsec, sizeof(*o->sec));
+    if (!o->sec) { perror("calloc"); exit(1); }
+}
+
+/* Wait for op i's due time; returns it (0 in closed-loop mode) */
+static inline uint64_t ol_wait(ol_thread_t *o, long i)
+{
+    if (ol_rate <= 0)
+        return 0;
+    uint64_t due = ol_start + (uint64_t)((double)i * o->interval);
+    uint64_t now = now_ns();
+    if (due > now + OL_SPIN_NS) {
+        uint64_t wake = due - OL_SPIN_NS;
+        struct timespec ts = { (time_t)(wake / 1000000000ULL), (long)(wake % 1000000000ULL) };
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+        now = now_ns();
+    }
+    unsigned spins = 0;
+    while (now < due) {
+        queue_backoff(&spins);
+        now = now_ns();
+    }
+    o->started = now;
+    return due;
+}
+
+static inline void ol_done(ol_thread_t *o, uint64_t due)
+{
+    if (!due)
+        return;
+    uint64_t end = now_ns();
+    lat_hist_record(&o->resp, end - due);
+    lat_hist_record(&o->serv, end - o->started);
+    o->done++;
+    if (o->started - due > (uint64_t)o->interval)
+        o->late++;
+    long s = (long)((due - ol_start) / 1000000000ULL);
+    if (s < ol_nsec) {
+        if (!o->sec[s].counts && hdr_init(&o->sec[s], HDR_SUB_BITS(1), LAT_HIST_MAX_BITS) < 0) {
+            perror("hdr_init");
+            exit(1);
+        }
+        hdr_record(&o->sec[s], end - due);
+    }
+}
+
+static void ol_thread_end(ol_thread_t *o)
+{
+    if (ol_rate <= 0)
+        return;
+    pthread_mutex_lock(&mt_lat_lock);
+    hdr_merge(&ol_resp, &o->resp);
+    hdr_merge(&ol_serv, &o->serv);
+    for (int s = 0; s < ol_nsec; s++)
+        if (o->sec[s].counts)
+            hdr_merge(&ol_sec[s], &o->sec[s]);
+    ol_done_ops += o->done;
+    ol_late_ops += o->late;
+    ol_pacers++;
+    pthread_mutex_unlock(&mt_lat_lock);
+    for (int s = 0; s < ol_nsec; s++)
+        if (o->sec[s].counts)
+            hdr_free(&o->sec[s]);
+    free(o->sec);
+    lat_hist_free(&o->resp);
+    lat_hist_free(&o->serv);
+}
+
+static void reset_run_stats(void)
+{
+    memset(&mt_perf, 0, sizeof(mt_perf));
+    if (lat_enabled) {
+        hdr_reset(&mt_lat_alloc);
+        hdr_reset(&mt_lat_free);
+    }
+    if (ol_rate > 0)
+        ol_reset();
+}
 
 static long get_ops_env(void)
 {
@@ -45,30 +288,85 @@ typedef struct {
     long    total_frees;
 } thread_result_t;
 
+/* Open loop: a ring of live objects; each op frees the oldest and
+ * allocates its replacement */
+static void *thread_local_open(thread_result_t *res)
+{
+    uint64_t rng = 0xDEAD0000ULL + res->thread_id * 7919ULL;
+    void **ring = malloc(OL_WORKING_SET * sizeof(void *));
+    if (!ring) { perror("malloc"); return NULL; }
+    for (long k = 0; k < OL_WORKING_SET; k++) {
+        ring[k] = malloc(rand_size(&rng, ALLOC_SIZE_MIN, ALLOC_SIZE_MAX));
+        if (ring[k]) ((char *)ring[k])[0] = 1;
+    }
+
+    ol_thread_t o;
+    ol_thread_begin(&o);
+    op_lat_t lat;
+    op_lat_begin(&lat);
+    struct pg_set ps;
+    pg_thread_begin(&ps);
+
+    for (long i = 0; i < res->ops; i++) {
+        uint64_t due = ol_wait(&o, i);
+        long k = i % OL_WORKING_SET;
+        uint64_t a = op_lat_start();
+        free(ring[k]);
+        op_lat_stop(&lat.free, a);
+        size_t sz = rand_size(&rng, ALLOC_SIZE_MIN, ALLOC_SIZE_MAX);
+        a = op_lat_start();
+        ring[k] = malloc(sz);
+        op_lat_stop(&lat.alloc, a);
+        if (ring[k]) ((char *)ring[k])[0] = 1;
+        ol_done(&o, due);
+    }
+
+    pg_thread_end(&ps, &mt_perf);
+    op_lat_end(&lat);
+    ol_thread_end(&o);
+    for (long k = 0; k < OL_WORKING_SET; k++)
+        free(ring[k]);
+    free(ring);
+    res->total_allocs = res->total_frees = res->ops;
+    return NULL;
+}
+
 static void *thread_local_worker(void *arg)
 {
     thread_result_t *res = (thread_result_t *)arg;
     pin_to_core(res->core);
+    if (ol_rate > 0)
+        return thread_local_open(res);
 
     uint64_t rng = 0xDEAD0000ULL + res->thread_id * 7919ULL;
     long ops = res->ops;
     void **ptrs = malloc(ops * sizeof(void *));
     if (!ptrs) { perror("malloc"); return NULL; }
 
+    op_lat_t lat;
+    op_lat_begin(&lat);
+    struct pg_set ps;
+    pg_thread_begin(&ps);
     uint64_t t0 = now_ns();
 
     /* Allocate all */
     for (long i = 0; i < ops; i++) {
         size_t sz = rand_size(&rng, ALLOC_SIZE_MIN, ALLOC_SIZE_MAX);
+        uint64_t a = op_lat_start();
         ptrs[i] = malloc(sz);
+        op_lat_stop(&lat.alloc, a);
         if (ptrs[i]) ((char *)ptrs[i])[0] = 1;
     }
     /* Free all */
     for (long i = 0; i < ops; i++) {
+        uint64_t a = op_lat_start();
         free(ptrs[i]);
+        op_lat_stop(&lat.free, a);
     }
 
     uint64_t t1 = now_ns();
+    pg_thread_end(&ps, &mt_perf);
+    op_lat_end(&lat);
     res->total_allocs = ops;
     res->total_frees = ops;
     res->ops_per_sec = (double)(ops * 2) / elapsed_s(t0, t1);
@@ -80,72 +378,89 @@ static void *thread_local_worker(void *arg)
 /* ── Producer-consumer workload ─────────────────────────────────────── */
 
 /*
- * Shared ring buffer for producer-consumer.
- * Producers push allocated pointers, consumers pop and free them.
+ * Producers allocate, consumers free (cross-thread free). Pointers travel
+ * in batches over a queue from queue.h. The default fan-in gives each
+ * consumer one SPSC lane per producer, so the transport shares no cache
+ * line between producers and the result is dominated by the allocator's
+ * remote-free path rather than by queue contention.
+ *
+ *   fanin  every consumer has a lane from every producer; producers deal
+ *          batches to consumers round-robin
+ *   spsc   producer i hands everything to consumer i (pairs)
+ *   mpmc   one shared Vyukov queue
  */
-#define RING_SIZE (1 << 16)  /* 64K slots */
-#define RING_MASK (RING_SIZE - 1)
-
-typedef struct {
-    void    *buf[RING_SIZE];
-    _Atomic long head;   /* next write position */
-    _Atomic long tail;   /* next read position  */
-    _Atomic int  done;   /* producer finished    */
-} ring_t;
+#define PC_QUEUE_CAPACITY 4096   /* per lane */
+#define PC_MAX_BATCH      256
 
-static ring_t pc_ring;
+static enum queue_kind pc_kind = QUEUE_FANIN;
+static size_t pc_batch = 32;
 
-static void ring_init(ring_t *r)
-{
-    memset(r->buf, 0, sizeof(r->buf));
-    atomic_store(&r->head, 0);
-    atomic_store(&r->tail, 0);
-    atomic_store(&r->done, 0);
-}
+typedef struct {
+    struct queue *queues;       /* one per consumer; mpmc uses queues[0] */
+    int           n_producers;
+    int           n_consumers;
+    _Atomic int   producers_done;
+} pc_ctx_t;
 
 typedef struct {
-    int     thread_id;
-    int     core;
-    long    ops;
-    int     is_producer;  /* 1 = producer, 0 = consumer */
-    ring_t *ring;
-    long    count;        /* ops actually done */
+    int       thread_id;
+    int       core;
+    long      ops;
+    int       index;            /* among the producers, or the consumers */
+    pc_ctx_t *ctx;
+    long      count;            /* ops actually done */
+    double    ops_per_sec;      /* count over this thread's own run time */
 } pc_arg_t;
 
 static void *producer_worker(void *arg)
 {
     pc_arg_t *a = (pc_arg_t *)arg;
     pin_to_core(a->core);
+    op_lat_t lat;
+    op_lat_begin(&lat);
+    struct pg_set ps;
+    pg_thread_begin(&ps);
+    uint64_t t0 = now_ns();
 
     uint64_t rng = 0xABCD0000ULL + (uint64_t)a->thread_id * 6271ULL;
 
-    ring_t *r = a->ring;
-    long produced = 0;
+    pc_ctx_t *ctx = a->ctx;
+    void *batch[PC_MAX_BATCH];
+    size_t nb = 0;
+    long produced = 0, batches = 0;
+    ol_thread_t o;
+    ol_thread_begin(&o);
 
     for (long i = 0; i < a->ops; i++) {
+        /* Open loop paces the producers: an op is a malloc plus, every
+         * batch, the push (a full queue shows up as latency) */
+        uint64_t due = ol_wait(&o, i);
         size_t sz = rand_size(&rng, ALLOC_SIZE_MIN, ALLOC_SIZE_MAX);
+        uint64_t t = op_lat_start();
         void *p = malloc(sz);
-        if (!p) continue;
-        ((char *)p)[0] = 1;
-
-        /* CAS loop to atomically claim a slot */
-        long head;
-        for (;;) {
-            head = atomic_load(&r->head);
-            long tail = atomic_load(&r->tail);
-            if (head - tail >= RING_SIZE) {
-                sched_yield();
-                continue;
-            }
-            if (atomic_compare_exchange_weak(&r->head, &head, head + 1))
-                break;
+        op_lat_stop(&lat.alloc, t);
+        if (p) {
+            ((char *)p)[0] = 1;
+            batch[nb++] = p;
+            produced++;
+        }
+        if (nb && (nb == pc_batch || i == a->ops - 1)) {
+            int q = pc_kind == QUEUE_MPMC ? 0
+                  : pc_kind == QUEUE_SPSC ? a->index
+                  : (int)((a->index + batches++) % ctx->n_consumers);
+            queue_push_all(&ctx->queues[q], a->index, batch, nb);
+            nb = 0;
         }
-        r->buf[head & RING_MASK] = p;
-        produced++;
+        ol_done(&o, due);
     }
 
-    atomic_fetch_add(&r->done, 1);
+    atomic_fetch_add_explicit(&ctx->producers_done, 1, memory_order_release);
+    uint64_t t1 = now_ns();
+    ol_thread_end(&o);
+    pg_thread_end(&ps, &mt_perf);
+    op_lat_end(&lat);
     a->count = produced;
+    a->ops_per_sec = (double)produced / elapsed_s(t0, t1);
     return NULL;
 }
 
@@ -153,38 +468,42 @@ static void *consumer_worker(void *arg)
 {
     pc_arg_t *a = (pc_arg_t *)arg;
     pin_to_core(a->core);
+    op_lat_t lat;
+    op_lat_begin(&lat);
+    struct pg_set ps;
+    pg_thread_begin(&ps);
 
-    ring_t *r = a->ring;
+    uint64_t t0 = now_ns();
+    pc_ctx_t *ctx = a->ctx;
+    struct queue *q = &ctx->queues[pc_kind == QUEUE_MPMC ? 0 : a->index];
+    void *batch[PC_MAX_BATCH];
     long consumed = 0;
-    int n_producers = a->ops; /* repurpose ops field for producer count */
+    unsigned spins = 0;
 
     for (;;) {
-        long tail = atomic_load(&r->tail);
-        long head = atomic_load(&r->head);
-        if (tail < head) {
-            /* CAS to claim this slot for consumption */
-            if (atomic_compare_exchange_weak(&r->tail, &tail, tail + 1)) {
-                void *p = r->buf[tail & RING_MASK];
-                /* Spin-wait until the producer has actually stored the pointer */
-                while (!p) {
-                    p = r->buf[tail & RING_MASK];
-                    __asm__ volatile("pause" ::: "memory");
-                }
-                free(p);
-                r->buf[tail & RING_MASK] = NULL;
-                consumed++;
-            }
-        } else if (atomic_load(&r->done) >= n_producers) {
-            /* All producers done — drain remaining */
-            head = atomic_load(&r->head);
-            tail = atomic_load(&r->tail);
-            if (tail >= head) break;
-        } else {
-            sched_yield();
+        /* Flag first: empty after every producer finished means drained */
+        int done = atomic_load_explicit(&ctx->producers_done, memory_order_acquire)
+                   == ctx->n_producers;
+        size_t n = queue_pop_batch(q, batch, pc_batch);
+        for (size_t i = 0; i < n; i++) {
+            uint64_t t = op_lat_start();
+            free(batch[i]);
+            op_lat_stop(&lat.free, t);
         }
+        consumed += (long)n;
+        if (n)
+            spins = 0;
+        else if (done)
+            break;
+        else
+            queue_backoff(&spins);
     }
 
+    uint64_t t1 = now_ns();
+    pg_thread_end(&ps, &mt_perf);
+    op_lat_end(&lat);
     a->count = consumed;
+    a->ops_per_sec = (double)consumed / elapsed_s(t0, t1);
     return NULL;
 }
 
@@ -241,28 +560,43 @@ static void *shared_pool_worker(void *arg)
 
     uint64_t rng = 0xBEEF0000ULL + (uint64_t)a->thread_id * 3571ULL;
 
+    op_lat_t lat;
+    op_lat_begin(&lat);
+    struct pg_set ps;
+    pg_thread_begin(&ps);
+    ol_thread_t o;
+    ol_thread_begin(&o);
     uint64_t t0 = now_ns();
 
     for (long i = 0; i < a->ops; i++) {
+        uint64_t due = ol_wait(&o, i);
         long idx = (long)(xorshift64(&rng) % POOL_SIZE);
 
         pool_lock(&shared_pool);
         if (shared_pool.slots[idx]) {
             /* Free existing */
+            uint64_t t = op_lat_start();
             free(shared_pool.slots[idx]);
+            op_lat_stop(&lat.free, t);
             shared_pool.slots[idx] = NULL;
             atomic_fetch_add(&shared_pool.free_count, 1);
         }
         /* Allocate new */
         size_t sz = rand_size(&rng, ALLOC_SIZE_MIN, ALLOC_SIZE_MAX);
+        uint64_t t = op_lat_start();
         shared_pool.slots[idx] = malloc(sz);
+        op_lat_stop(&lat.alloc, t);
         if (shared_pool.slots[idx])
             ((char *)shared_pool.slots[idx])[0] = 1;
         atomic_fetch_add(&shared_pool.alloc_count, 1);
         pool_unlock(&shared_pool);
+        ol_done(&o, due);
     }
 
     uint64_t t1 = now_ns();
+    pg_thread_end(&ps, &mt_perf);
+    op_lat_end(&lat);
+    ol_thread_end(&o);
     a->ops_per_sec = (double)(a->ops) / elapsed_s(t0, t1);
 
     return NULL;
@@ -270,13 +604,10 @@ static void *shared_pool_worker(void *arg)
 
 /* ── Run helpers ────────────────────────────────────────────────────── */
 
+/* Usable CPUs node by node, so small thread counts share a node */
 static int *get_core_list(int nthreads)
 {
-    int ncores = get_num_cores();
-    int *cores = malloc(nthreads * sizeof(int));
-    for (int i = 0; i < nthreads; i++)
-        cores[i] = i % ncores;
-    return cores;
+    return numa_core_list(&topo, nthreads, -1);
 }
 
 static double run_thread_local(int nthreads)
@@ -284,21 +615,23 @@ static double run_thread_local(int nthreads)
     pthread_t *tids = malloc(nthreads * sizeof(pthread_t));
     thread_result_t *res = malloc(nthreads * sizeof(thread_result_t));
     int *cores = get_core_list(nthreads);
+    reset_run_stats();
 
     uint64_t t0 = now_ns();
 
     for (int i = 0; i < nthreads; i++) {
         res[i].thread_id = i;
         res[i].core = cores[i];
-        res[i].ops = ops_per_thread;
+        res[i].ops = run_ops();
         pthread_create(&tids[i], NULL, thread_local_worker, &res[i]);
     }
     for (int i = 0; i < nthreads; i++)
         pthread_join(tids[i], NULL);
 
     uint64_t t1 = now_ns();
-    double total_ops = (double)nthreads * ops_per_thread * 2;
+    double total_ops = (double)nthreads * run_ops() * 2;
     double throughput = total_ops / elapsed_s(t0, t1);
+    mt_ops = total_ops;
 
     free(tids);
     free(res);
@@ -306,50 +639,45 @@ static double run_thread_local(int nthreads)
     return throughput;
 }
 
-static double run_producer_consumer(int nthreads)
+/*
+ * One producer/consumer run on the given CPUs: cores[0..n_producers) for
+ * the producers, then the consumers. Per-thread results are left in
+ * *args_out for the caller to free, if it asks.
+ */
+static double run_pc(int n_producers, int n_consumers, const int *cores, pc_arg_t **args_out)
 {
-    /*
-     * Half producers, half consumers (minimum 1 each).
-     * Producers allocate, consumers free (cross-thread free).
-     */
-    int n_producers = nthreads / 2;
-    if (n_producers < 1) n_producers = 1;
-    int n_consumers = nthreads - n_producers;
-    if (n_consumers < 1) n_consumers = 1;
-
-    ring_init(&pc_ring);
-
-    pthread_t *tids = malloc(nthreads * sizeof(pthread_t));
-    pc_arg_t *args = malloc(nthreads * sizeof(pc_arg_t));
-    int *cores = get_core_list(nthreads);
+    pc_ctx_t ctx = { .n_producers = n_producers, .n_consumers = n_consumers };
+    int n_queues = pc_kind == QUEUE_MPMC ? 1 : n_consumers;
+    ctx.queues = calloc(n_queues, sizeof(struct queue));
+    if (!ctx.queues) { perror("calloc"); exit(1); }
+    for (int i = 0; i < n_queues; i++) {
+        size_t cap = pc_kind == QUEUE_MPMC ? (size_t)PC_QUEUE_CAPACITY * n_producers
+                                           : PC_QUEUE_CAPACITY;
+        if (queue_init(&ctx.queues[i], pc_kind, n_producers, cap) < 0) {
+            perror("queue_init");
+            exit(1);
+        }
+    }
 
-    long ops_per_producer = ops_per_thread;
+    int n = n_producers + n_consumers;
+    pthread_t *tids = malloc(n * sizeof(pthread_t));
+    pc_arg_t *args = malloc(n * sizeof(pc_arg_t));
+    reset_run_stats();
 
     uint64_t t0 = now_ns();
 
-    /* Start producers */
-    for (int i = 0; i < n_producers; i++) {
-        args[i].thread_id = i;
-        args[i].core = cores[i];
-        args[i].ops = ops_per_producer;
-        args[i].is_producer = 1;
-        args[i].ring = &pc_ring;
-        args[i].count = 0;
-        pthread_create(&tids[i], NULL, producer_worker, &args[i]);
-    }
-    /* Start consumers */
-    for (int i = 0; i < n_consumers; i++) {
-        int idx = n_producers + i;
-        args[idx].thread_id = idx;
-        args[idx].core = cores[idx];
-        args[idx].ops = n_producers;  /* pass producer count for done check */
-        args[idx].is_producer = 0;
-        args[idx].ring = &pc_ring;
-        args[idx].count = 0;
-        pthread_create(&tids[idx], NULL, consumer_worker, &args[idx]);
-    }
-
-    for (int i = 0; i < n_producers + n_consumers; i++)
+    for (int i = 0; i < n; i++) {
+        int producer = i < n_producers;
+        args[i] = (pc_arg_t){
+            .thread_id = i,
+            .core = cores[i],
+            .ops = run_ops(),
+            .index = producer ? i : i - n_producers,
+            .ctx = &ctx,
+        };
+        pthread_create(&tids[i], NULL, producer ? producer_worker : consumer_worker, &args[i]);
+    }
+    for (int i = 0; i < n; i++)
         pthread_join(tids[i], NULL);
 
     uint64_t t1 = now_ns();
@@ -359,9 +687,34 @@ static double run_producer_consumer(int nthreads)
         total_produced += args[i].count;
 
     double throughput = (double)(total_produced * 2) / elapsed_s(t0, t1);
+    mt_ops = (double)(total_produced * 2);
 
+    for (int i = 0; i < n_queues; i++)
+        queue_destroy(&ctx.queues[i]);
+    free(ctx.queues);
     free(tids);
-    free(args);
+    if (args_out)
+        *args_out = args;
+    else
+        free(args);
+    return throughput;
+}
+
+static double run_producer_consumer(int nthreads)
+{
+    /*
+     * Half producers, half consumers (minimum 1 each); spsc pairs them
+     * up, so an odd thread count leaves one thread out.
+     */
+    int n_producers = nthreads / 2;
+    if (n_producers < 1) n_producers = 1;
+    int n_consumers = nthreads - n_producers;
+    if (n_consumers < 1) n_consumers = 1;
+    if (pc_kind == QUEUE_SPSC)
+        n_consumers = n_producers;
+
+    int *cores = get_core_list(n_producers + n_consumers);
+    double throughput = run_pc(n_producers, n_consumers, cores, NULL);
     free(cores);
     return throughput;
 }
@@ -373,13 +726,14 @@ static double run_shared_pool(int nthreads)
     pthread_t *tids = malloc(nthreads * sizeof(pthread_t));
     pool_arg_t *args = malloc(nthreads * sizeof(pool_arg_t));
     int *cores = get_core_list(nthreads);
+    reset_run_stats();
 
     uint64_t t0 = now_ns();
 
     for (int i = 0; i < nthreads; i++) {
         args[i].thread_id = i;
         args[i].core = cores[i];
-        args[i].ops = ops_per_thread;
+        args[i].ops = run_ops();
         pthread_create(&tids[i], NULL, shared_pool_worker, &args[i]);
     }
     for (int i = 0; i < nthreads; i++)
@@ -390,6 +744,7 @@ static double run_shared_pool(int nthreads)
     long total_ops = atomic_load(&shared_pool.alloc_count) +
                      atomic_load(&shared_pool.free_count);
     double throughput = (double)total_ops / elapsed_s(t0, t1);
+    mt_ops = (double)total_ops;
 
     /* Cleanup pool */
     for (int i = 0; i < POOL_SIZE; i++) {
@@ -405,20 +760,631 @@ static double run_shared_pool(int nthreads)
     return throughput;
 }
 
+/* ── Per-node breakdown (placement workloads) ───────────────────────── */
+
+/* Last run's results by node of the thread's CPU (position in topo) */
+typedef struct {
+    int    threads;
+    double ops_per_sec;         /* summed over its threads */
+    long   pages[NUMA_MAX_NODES];   /* sampled pages of its objects, by node */
+    long   sampled;
+} node_result_t;
+
+static node_result_t mt_node[NUMA_MAX_NODES];
+static int  mt_node_valid;
+static const char *mt_skip;     /* set when a run can't happen here */
+
+/* THP accounting of the last thp_* run */
+static int  mt_thp_valid;
+static struct thp_vmstat mt_thp;
+static long mt_thp_kb, mt_anon_kb;          /* smaps_rollup once all is allocated */
+static lat_histogram_t mt_touch;            /* first touch of each object's pages */
+
+static void node_reset(void)
+{
+    memset(mt_node, 0, sizeof(mt_node));
+    mt_node_valid = 1;
+    mt_thp_valid = 0;
+}
+
+static void node_add(int core, double ops_per_sec)
+{
+    int n = numa_node_of_cpu(&topo, core);
+    if (n < 0) return;
+    mt_node[n].threads++;
+    mt_node[n].ops_per_sec += ops_per_sec;
+}
+
+/* Nodes (positions) that have CPUs to run on */
+static int cpu_nodes(int *out)
+{
+    int n = 0;
+    for (int i = 0; i < topo.nnodes; i++)
+        if (topo.nodes[i].ncpus > 0)
+            out[n++] = i;
+    return n;
+}
+
+/* ── NUMA remote-free workload ──────────────────────────────────────── */
+
+/*
+ * Producer/consumer pairs over SPSC lanes (whatever --queue says), pair i
+ * on the i-th node with CPUs, round-robin. Local: the consumer shares the
+ * producer's node. Remote: it sits on the next node, so every free
+ * returns memory to an arena, thread cache or page on another socket.
+ * Both place the same threads on the same nodes' CPUs, so the two rows
+ * compare like for like.
+ */
+static double run_numa_free(int nthreads, int remote)
+{
+    int nodes[NUMA_MAX_NODES], next[NUMA_MAX_NODES] = {0};
+    int nn = cpu_nodes(nodes);
+    if (remote && nn < 2) {
+        mt_skip = "needs two NUMA nodes with CPUs";
+        return -1;
+    }
+
+    int pairs = nthreads / 2 > 0 ? nthreads / 2 : 1;
+    int *cores = malloc(2 * pairs * sizeof(int));
+    if (!cores) { perror("malloc"); exit(1); }
+    for (int i = 0; i < pairs; i++) {
+        int pn = nodes[i % nn], cn = remote ? nodes[(i + 1) % nn] : pn;
+        const struct numa_node *p = &topo.nodes[pn], *c = &topo.nodes[cn];
+        cores[i] = p->cpus[next[pn]++ % p->ncpus];
+        cores[pairs + i] = c->cpus[next[cn]++ % c->ncpus];
+    }
+
+    enum queue_kind kind = pc_kind;
+    pc_kind = QUEUE_SPSC;
+    pc_arg_t *args;
+    double throughput = run_pc(pairs, pairs, cores, &args);
+    pc_kind = kind;
+
+    node_reset();
+    for (int i = 0; i < 2 * pairs; i++)
+        node_add(cores[i], args[i].ops_per_sec);
+    free(args);
+    free(cores);
+    return throughput;
+}
+
+static double run_numa_local_free(int nthreads)  { return run_numa_free(nthreads, 0); }
+static double run_numa_remote_free(int nthreads) { return run_numa_free(nthreads, 1); }
+
+/* ── Placement workloads (NUMA, THP) ────────────────────────────────── */
+
+/*
+ * Each worker, pinned to alloc_core, allocates its objects and writes
+ * every page of each; then, pinned to run_core, updates them in random
+ * order (one dependent cache miss, and TLB miss, per op) and frees them.
+ * alloc_core == run_core is first touch; alloc_core on another node is
+ * the heap, and the allocator's arena, built by a thread on the wrong
+ * socket. Ops/sec counts the allocs, updates and frees over the time
+ * spent in them; placement sampling between the phases isn't timed.
+ */
+#define PLACE_SAMPLE 4096       /* objects per worker whose page is located */
+
+enum place_mode { PLACE_FIRST_TOUCH, PLACE_REMOTE_TOUCH, PLACE_INTERLEAVE };
+
+typedef struct {
+    int     thread_id;
+    int     alloc_core, run_core;
+    long    ops;
+    int     interleave;
+    pthread_barrier_t *barrier;
+    double  ops_per_sec;
+    long    pages[NUMA_MAX_NODES];
+    long    sampled;
+    lat_histogram_t touch;
+} place_arg_t;
+
+static void place_sample(place_arg_t *a, void **ptrs)
+{
+    long n = a->ops < PLACE_SAMPLE ? a->ops : PLACE_SAMPLE;
+    void **addrs = malloc(n * sizeof(void *));
+    int *status = malloc(n * sizeof(int));
+    if (!addrs || !status) { perror("malloc"); exit(1); }
+    for (long i = 0; i < n; i++)
+        addrs[i] = ptrs[i * (a->ops / n)];
+    if (numa_page_nodes(addrs, n, status) == 0) {
+        for (long i = 0; i < n; i++) {
+            int pos = status[i] >= 0 ? numa_node_pos(&topo, status[i]) : -1;
+            if (pos >= 0) {
+                a->pages[pos]++;
+                a->sampled++;
+            }
+        }
+    }
+    free(addrs);
+    free(status);
+}
+
+static void *place_worker(void *arg)
+{
+    place_arg_t *a = (place_arg_t *)arg;
+    pin_to_core(a->alloc_core);
+    if (a->interleave && numa_set_interleave(&topo) != 0)
+        fprintf(stderr, "warning: set_mempolicy(MPOL_INTERLEAVE): %s\n", strerror(errno));
+
+    uint64_t rng = 0xFACE0000ULL + (uint64_t)a->thread_id * 4099ULL;
+    long ops = a->ops, page = sysconf(_SC_PAGESIZE);
+    void **ptrs = malloc(ops * sizeof(void *));
+    if (!ptrs) { perror("malloc"); exit(1); }
+
+    op_lat_t lat;
+    op_lat_begin(&lat);
+    struct pg_set ps;
+    pg_thread_begin(&ps);
+    uint64_t t0 = now_ns();
+
+    for (long i = 0; i < ops; i++) {
+        size_t sz = rand_size(&rng, ALLOC_SIZE_MIN, ALLOC_SIZE_MAX);
+        uint64_t t = op_lat_start();
+        char *p = malloc(sz);
+        op_lat_stop(&lat.alloc, t);
+        if (!p) { perror("malloc"); exit(1); }
+        /* First touch: this is where the page faults (and THP allocation) happen */
+        uint64_t f = tsc_start();
+        for (size_t off = 0; off < sz; off += page)
+            p[off] = 1;
+        p[sz - 1] = 1;
+        lat_hist_record(&a->touch, tsc_elapsed_ns(f, tsc_stop()));
+        ptrs[i] = p;
+    }
+    uint64_t t1 = now_ns();
+
+    place_sample(a, ptrs);
+    if (a->interleave)
+        numa_set_default();
+    /* Everyone allocated: one thread snapshots the process's huge pages */
+    if (pthread_barrier_wait(a->barrier) == PTHREAD_BARRIER_SERIAL_THREAD) {
+        struct mem_rollup r;
+        if (mem_rollup(&r) == 0) {
+            mt_thp_kb = r.thp_kb;
+            mt_anon_kb = r.anon_kb;
+        }
+    }
+    pthread_barrier_wait(a->barrier);
+    if (a->run_core != a->alloc_core)
+        pin_to_core(a->run_core);
+
+    uint64_t t2 = now_ns();
+    uint64_t sum = 0;
+    for (long i = 0; i < ops; i++) {
+        volatile char *p = ptrs[xorshift64(&rng) % ops];
+        sum += p[0];
+        p[0] = (char)sum;
+    }
+    for (long i = 0; i < ops; i++) {
+        uint64_t t = op_lat_start();
+        free(ptrs[i]);
+        op_lat_stop(&lat.free, t);
+    }
+    uint64_t t3 = now_ns();
+
+    pg_thread_end(&ps, &mt_perf);
+    op_lat_end(&lat);
+    a->ops_per_sec = (double)(ops * 3) / (elapsed_s(t0, t1) + elapsed_s(t2, t3));
+    free(ptrs);
+    return NULL;
+}
+
+static double run_place(int nthreads, enum place_mode mode)
+{
+    int nodes[NUMA_MAX_NODES];
+    int nn = cpu_nodes(nodes);
+    if (mode == PLACE_REMOTE_TOUCH && nn < 2) {
+        mt_skip = "needs two NUMA nodes with CPUs";
+        return -1;
+    }
+
+    pthread_t *tids = malloc(nthreads * sizeof(pthread_t));
+    place_arg_t *args = calloc(nthreads, sizeof(place_arg_t));
+    int *cores = get_core_list(nthreads);
+    if (!tids || !args) { perror("malloc"); exit(1); }
+    pthread_barrier_t barrier;
+    pthread_barrier_init(&barrier, NULL, (unsigned)nthreads);
+    reset_run_stats();
+    node_reset();
+    static int touch_init;
+    if (touch_init)
+        hdr_reset(&mt_touch);
+    else
+        lat_hist_init(&mt_touch);
+    touch_init = 1;
+    mt_thp_kb = mt_anon_kb = -1;
+
+    /* Remote touch: the same-indexed CPU of the next node with CPUs */
+    int next[NUMA_MAX_NODES] = {0};
+
+    uint64_t t0 = now_ns();
+    for (int i = 0; i < nthreads; i++) {
+        place_arg_t *a = &args[i];
+        a->thread_id = i;
+        a->run_core = a->alloc_core = cores[i];
+        if (mode == PLACE_REMOTE_TOUCH) {
+            int n = numa_node_of_cpu(&topo, cores[i]), k = 0;
+            while (k < nn && nodes[k] != n) k++;
+            const struct numa_node *o = &topo.nodes[nodes[(k + 1) % nn]];
+            a->alloc_core = o->cpus[next[nodes[(k + 1) % nn]]++ % o->ncpus];
+        }
+        a->interleave = mode == PLACE_INTERLEAVE;
+        a->ops = ops_per_thread;
+        a->barrier = &barrier;
+        lat_hist_init(&a->touch);
+        pthread_create(&tids[i], NULL, place_worker, a);
+    }
+    for (int i = 0; i < nthreads; i++)
+        pthread_join(tids[i], NULL);
+    uint64_t t1 = now_ns();
+
+    double total_ops = (double)nthreads * ops_per_thread * 3;
+    mt_ops = total_ops;
+    for (int i = 0; i < nthreads; i++) {
+        int n = numa_node_of_cpu(&topo, args[i].run_core);
+        node_add(args[i].run_core, args[i].ops_per_sec);
+        if (n >= 0) {
+            for (int j = 0; j < topo.nnodes; j++)
+                mt_node[n].pages[j] += args[i].pages[j];
+            mt_node[n].sampled += args[i].sampled;
+        }
+        lat_hist_merge(&mt_touch, &args[i].touch);
+        lat_hist_free(&args[i].touch);
+    }
+
+    pthread_barrier_destroy(&barrier);
+    free(tids);
+    free(args);
+    free(cores);
+    return total_ops / elapsed_s(t0, t1);
+}
+
+static double run_numa_first_touch(int nthreads)  { return run_place(nthreads, PLACE_FIRST_TOUCH); }
+static double run_numa_remote_touch(int nthreads) { return run_place(nthreads, PLACE_REMOTE_TOUCH); }
+static double run_numa_interleave(int nthreads)   { return run_place(nthreads, PLACE_INTERLEAVE); }
+
+/*
+ * THP modes. The system-wide mode is switched through sysfs (root only)
+ * for the run and put back afterwards, also on exit and on SIGINT/TERM;
+ * without root, never falls back to prctl(PR_SET_THP_DISABLE) and the
+ * others run only if already the system's mode. For madvise, glibc only
+ * asks for huge pages with GLIBC_TUNABLES=glibc.malloc.hugetlb=1;
+ * jemalloc with MALLOC_CONF=thp:always.
+ */
+static char thp_saved[16];      /* mode to restore, "" if untouched */
+static int  thp_prctl;
+
+static void thp_restore(void)
+{
+    if (thp_saved[0]) {
+        thp_mode_set(thp_saved);
+        thp_saved[0] = '\0';
+    }
+    if (thp_prctl) {
+        prctl(PR_SET_THP_DISABLE, 0, 0, 0, 0);
+        thp_prctl = 0;
+    }
+}
+
+static void thp_signal(int sig)
+{
+    thp_restore();
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+static int thp_apply(const char *mode)
+{
+    static int hooked;
+    char cur[16];
+    if (thp_mode_get(cur, sizeof(cur)) < 0) {
+        mt_skip = "no transparent huge page support";
+        return -1;
+    }
+    if (strcmp(cur, mode) == 0)
+        return 0;
+    if (!hooked) {
+        atexit(thp_restore);
+        signal(SIGINT, thp_signal);
+        signal(SIGTERM, thp_signal);
+        hooked = 1;
+    }
+    snprintf(thp_saved, sizeof(thp_saved), "%s", cur);
+    if (thp_mode_set(mode) == 0)
+        return 0;
+    thp_saved[0] = '\0';
+    if (strcmp(mode, "never") == 0 && prctl(PR_SET_THP_DISABLE, 1, 0, 0, 0) == 0) {
+        thp_prctl = 1;
+        return 0;
+    }
+    mt_skip = "switching the THP mode needs root";
+    return -1;
+}
+
+static double run_thp(int nthreads, const char *mode)
+{
+    if (thp_apply(mode) < 0)
+        return -1;
+    struct thp_vmstat before, after;
+    thp_vmstat_read(&before);
+    double throughput = run_place(nthreads, PLACE_FIRST_TOUCH);
+    thp_vmstat_read(&after);
+    thp_restore();
+    thp_vmstat_delta(&mt_thp, &before, &after);
+    mt_thp_valid = 1;
+    return throughput;
+}
+
+static double run_thp_always(int nthreads)  { return run_thp(nthreads, "always"); }
+static double run_thp_madvise(int nthreads) { return run_thp(nthreads, "madvise"); }
+static double run_thp_never(int nthreads)   { return run_thp(nthreads, "never"); }
+
 /* ── Workload table ─────────────────────────────────────────────────── */
 
 typedef double (*mt_bench_fn)(int nthreads);
 
+/* Returning < 0 means the run can't happen here; mt_skip says why */
 static struct {
     const char  *name;
     mt_bench_fn  fn;
+    int          min_threads;
+    int          opt_in;        /* only when named, or by prefix */
 } mt_workloads[] = {
-    { "thread_local",      run_thread_local },
-    { "producer_consumer", run_producer_consumer },
-    { "shared_pool",       run_shared_pool },
+    { "thread_local",      run_thread_local,      1, 0 },
+    { "producer_consumer", run_producer_consumer, 2, 0 },
+    { "shared_pool",       run_shared_pool,       1, 0 },
+    { "numa_local_free",   run_numa_local_free,   2, 1 },
+    { "numa_remote_free",  run_numa_remote_free,  2, 1 },
+    { "numa_first_touch",  run_numa_first_touch,  1, 1 },
+    { "numa_remote_touch", run_numa_remote_touch, 1, 1 },
+    { "numa_interleave",   run_numa_interleave,   1, 1 },
+    { "thp_always",        run_thp_always,        1, 1 },
+    { "thp_madvise",       run_thp_madvise,       1, 1 },
+    { "thp_never",         run_thp_never,         1, 1 },
 };
 static const int NUM_MT_WORKLOADS = sizeof(mt_workloads) / sizeof(mt_workloads[0]);
 
+/* --queue and --batch change what the queue workloads measure, so they
+ * are --json params of those results (numa_*_free always run SPSC) */
+static void pc_json_params(int w)
+{
+    mt_bench_fn fn = mt_workloads[w].fn;
+    if (fn == run_producer_consumer)
+        bj_param_str("queue", queue_kind_names[pc_kind]);
+    if (fn == run_producer_consumer || fn == run_numa_local_free || fn == run_numa_remote_free)
+        bj_param_int("batch", (long)pc_batch);
+}
+
+/* No filter: the default set. Else the name, or a prefix up to a '_' */
+static int workload_selected(const char *filter, int w)
+{
+    const char *name = mt_workloads[w].name;
+    if (!filter)
+        return !mt_workloads[w].opt_in;
+    size_t len = strlen(filter);
+    return strncmp(name, filter, len) == 0 && (name[len] == '\0' || name[len] == '_');
+}
+
+/* ── Latency reporting (--latency) ──────────────────────────────────── */
+
+#define LAT_CSV_HEADER ",alloc_p50_ns,alloc_p99_ns,alloc_p999_ns,alloc_max_ns," \
+                       "free_p50_ns,free_p99_ns,free_p999_ns,free_max_ns"
+
+/* "p50 85  p99 310  p99.9 1210  max 48000 ns" */
+static const char *lat_format(const lat_histogram_t *h, char *buf, size_t len)
+{
+    snprintf(buf, len, "p50 %lu  p99 %lu  p99.9 %lu  max %lu ns",
+             lat_hist_percentile(h, 50), lat_hist_percentile(h, 99),
+             lat_hist_percentile(h, 99.9), h->max);
+    return buf;
+}
+
+static const char *lat_csv(char *buf, size_t len)
+{
+    snprintf(buf, len, ",%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu",
+             lat_hist_percentile(&mt_lat_alloc, 50), lat_hist_percentile(&mt_lat_alloc, 99),
+             lat_hist_percentile(&mt_lat_alloc, 99.9), mt_lat_alloc.max,
+             lat_hist_percentile(&mt_lat_free, 50), lat_hist_percentile(&mt_lat_free, 99),
+             lat_hist_percentile(&mt_lat_free, 99.9), mt_lat_free.max);
+    return buf;
+}
+
+/* ── Open-loop reporting (--rate) ───────────────────────────────────── */
+
+#define OL_CSV_HEADER "allocator,workload,threads,target_rate,target_total,ops_per_sec,elapsed_ms," \
+                      "p50_ns,p90_ns,p99_ns,p999_ns,max_ns," \
+                      "service_p50_ns,service_p99_ns,service_max_ns,late_pct"
+#define OL_TS_HEADER  "allocator,workload,threads,target_rate,second,ops," \
+                      "p50_ns,p99_ns,p999_ns,max_ns\n"
+
+/* "850 ns", "12.3 us", "5.10 ms" */
+static const char *fmt_ns(uint64_t ns, char *buf, size_t len)
+{
+    if (ns < 10000)
+        snprintf(buf, len, "%lu ns", (unsigned long)ns);
+    else if (ns < 1000000)
+        snprintf(buf, len, "%.1f us", ns / 1e3);
+    else
+        snprintf(buf, len, "%.2f ms", ns / 1e6);
+    return buf;
+}
+
+/* "100000,250k,1M" */
+static void parse_rates(const char *spec)
+{
+    char *buf = strdup(spec);
+    for (char *tok = strtok(buf, ","); tok && ol_nrates < OL_MAX_RATES; tok = strtok(NULL, ",")) {
+        char *end;
+        double r = strtod(tok, &end);
+        if (*end == 'k' || *end == 'K') r *= 1e3;
+        else if (*end == 'm' || *end == 'M') r *= 1e6;
+        if (r > 0) ol_rates[ol_nrates++] = r;
+    }
+    free(buf);
+}
+
+/*
+ * Every rate at one thread count. Achieved counts the scheduled ops done
+ * (producer ops for producer_consumer) over the schedule's run time, summed
+ * over the pacing threads, so it is set against the per-thread rate times
+ * those threads; when it falls short of that the allocator can't keep up,
+ * and latency grows with the backlog instead of being hidden.
+ */
+static void ol_sweep(int w, int nthreads, FILE *ts_out, FILE *hist_out)
+{
+    const char *name = mt_workloads[w].name;
+    if (mt_workloads[w].opt_in) {
+        if (csv_mode)
+            fprintf(stderr, "%s: skipped (no open-loop mode)\n", name);
+        else
+            printf("  %8d  skipped: no open-loop mode\n", nthreads);
+        return;
+    }
+
+    for (int r = 0; r < ol_nrates; r++) {
+        ol_rate = ol_rates[r];
+        mt_workloads[w].fn(nthreads);
+        uint64_t t1 = now_ns();
+        double secs = elapsed_s(ol_start, t1);
+        double achieved = (double)ol_done_ops / secs;
+        double target = ol_rate * ol_pacers;
+        double late = ol_done_ops ? 100.0 * ol_late_ops / ol_done_ops : 0.0;
+
+        bj_result(name);
+        bj_param_int("threads", nthreads);
+        bj_param_int("target_rate", (long)ol_rate);
+        pc_json_params(w);
+        bj_metric("target_ops_per_sec", target, "ops/s", BJ_NONE);
+        bj_metric("ops_per_sec", achieved, "ops/s", BJ_HIGHER);
+        lat_json("resp", &ol_resp);
+        lat_json("serv", &ol_serv);
+        bj_metric("late_pct", late, "%", BJ_LOWER);
+        if (lat_enabled) {
+            lat_json("alloc", &mt_lat_alloc);
+            lat_json("free", &mt_lat_free);
+        }
+
+        char perf[128] = "", lat[192] = "";
+        if (csv_mode) {
+            if (pg_enabled)
+                pg_csv(&mt_perf, mt_ops, perf, sizeof(perf));
+            if (lat_enabled)
+                lat_csv(lat, sizeof(lat));
+            printf("%s,%s,%d,%.0f,%.0f,%.0f,%.1f,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%.2f%s%s\n",
+                   detect_allocator(), name, nthreads, ol_rate, target, achieved, secs * 1e3,
+                   lat_hist_percentile(&ol_resp, 50), lat_hist_percentile(&ol_resp, 90),
+                   lat_hist_percentile(&ol_resp, 99), lat_hist_percentile(&ol_resp, 99.9),
+                   ol_resp.max, lat_hist_percentile(&ol_serv, 50),
+                   lat_hist_percentile(&ol_serv, 99), ol_serv.max, late, perf, lat);
+        } else {
+            char b[9][32];
+            printf("  %8d  %10s  %10s  %10s  %9s  %9s  %9s  %9s  %9s  %5.1f%%\n", nthreads,
+                   format_ops(ol_rate, b[0], sizeof(b[0])),
+                   format_ops(target, b[7], sizeof(b[7])),
+                   format_ops(achieved, b[1], sizeof(b[1])),
+                   fmt_ns(lat_hist_percentile(&ol_resp, 50), b[2], sizeof(b[2])),
+                   fmt_ns(lat_hist_percentile(&ol_resp, 99), b[3], sizeof(b[3])),
+                   fmt_ns(lat_hist_percentile(&ol_resp, 99.9), b[4], sizeof(b[4])),
+                   fmt_ns(ol_resp.max, b[5], sizeof(b[5])),
+                   fmt_ns(lat_hist_percentile(&ol_serv, 99.9), b[6], sizeof(b[6])), late);
+            if (pg_enabled)
+                printf("  %8s  %s\n", "", pg_format(&mt_perf, mt_ops, perf, sizeof(perf)));
+            if (lat_enabled) {
+                printf("  %8s  malloc %s\n", "", lat_format(&mt_lat_alloc, lat, sizeof(lat)));
+                printf("  %8s  free   %s\n", "", lat_format(&mt_lat_free, lat, sizeof(lat)));
+            }
+        }
+        if (ts_out) {
+            for (int s = 0; s < ol_nsec; s++) {
+                const struct hdr_hist *h = &ol_sec[s];
+                fprintf(ts_out, "%s,%s,%d,%.0f,%d,%lu,%lu,%lu,%lu,%lu\n",
+                        detect_allocator(), name, nthreads, ol_rate, s,
+                        (unsigned long)h->count, hdr_percentile(h, 50), hdr_percentile(h, 99),
+                        hdr_percentile(h, 99.9), h->max);
+            }
+        }
+        if (hist_out) {
+            char label[128];
+            snprintf(label, sizeof(label), "%s/%s/%d/rate%.0f/response",
+                     detect_allocator(), name, nthreads, ol_rate);
+            hdr_save(&ol_resp, label, hist_out);
+            snprintf(label, sizeof(label), "%s/%s/%d/rate%.0f/service",
+                     detect_allocator(), name, nthreads, ol_rate);
+            hdr_save(&ol_serv, label, hist_out);
+        }
+        fflush(stdout);
+    }
+    ol_rate = 0;
+}
+
+/* ── Per-node reporting (placement workloads) ───────────────────────── */
+
+#define NODE_CSV_HEADER "allocator,workload,threads,node,node_threads,ops_per_sec," \
+                        "pages_sampled,pages_local_pct,thp_kb,anon_kb,thp_fault_alloc," \
+                        "thp_fault_fallback,thp_collapse_alloc,thp_collapse_alloc_failed," \
+                        "khugepaged_pages_collapsed,compact_stall," \
+                        "touch_p50_ns,touch_p99_ns,touch_max_ns\n"
+
+static double node_local_pct(int n)
+{
+    return mt_node[n].sampled ? 100.0 * mt_node[n].pages[n] / mt_node[n].sampled : 0.0;
+}
+
+static void node_print(void)
+{
+    char buf[32];
+    for (int n = 0; n < topo.nnodes; n++) {
+        const node_result_t *r = &mt_node[n];
+        if (!r->threads)
+            continue;
+        printf("  %8s  node %d: %d threads, %s", "", topo.nodes[n].id, r->threads,
+               format_ops(r->ops_per_sec, buf, sizeof(buf)));
+        if (r->sampled) {
+            printf(", pages %.1f%% local", node_local_pct(n));
+            if (topo.nnodes > 1) {
+                printf(" (");
+                for (int j = 0; j < topo.nnodes; j++)
+                    printf("%sN%d %.0f%%", j ? " " : "", topo.nodes[j].id,
+                           100.0 * r->pages[j] / r->sampled);
+                printf(")");
+            }
+        }
+        printf("\n");
+    }
+    if (mt_thp_valid) {
+        char thp[32];
+        printf("  %8s  THP: %s huge of %s anon, faults %ld huge / %ld fallback, "
+               "collapses %ld / %ld failed (khugepaged %ld pages), compaction stalls %ld\n", "",
+               format_bytes(mt_thp_kb * 1024L, thp, sizeof(thp)),
+               format_bytes(mt_anon_kb * 1024L, buf, sizeof(buf)),
+               mt_thp.fault_alloc, mt_thp.fault_fallback, mt_thp.collapse_alloc,
+               mt_thp.collapse_failed, mt_thp.pages_collapsed, mt_thp.compact_stall);
+        printf("  %8s  page touch: p50 %lu  p99 %lu  p99.9 %lu  max %lu ns\n", "",
+               lat_hist_percentile(&mt_touch, 50), lat_hist_percentile(&mt_touch, 99),
+               lat_hist_percentile(&mt_touch, 99.9), mt_touch.max);
+    }
+}
+
+static void node_csv(FILE *f, const char *workload, int nthreads)
+{
+    for (int n = 0; n < topo.nnodes; n++) {
+        const node_result_t *r = &mt_node[n];
+        if (!r->threads)
+            continue;
+        fprintf(f, "%s,%s,%d,%d,%d,%.0f,%ld,%.1f", detect_allocator(), workload,
+                nthreads, topo.nodes[n].id, r->threads, r->ops_per_sec,
+                r->sampled, node_local_pct(n));
+        if (mt_thp_valid)
+            fprintf(f, ",%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%lu,%lu,%lu\n", mt_thp_kb,
+                    mt_anon_kb, mt_thp.fault_alloc, mt_thp.fault_fallback,
+                    mt_thp.collapse_alloc, mt_thp.collapse_failed, mt_thp.pages_collapsed,
+                    mt_thp.compact_stall, lat_hist_percentile(&mt_touch, 50),
+                    lat_hist_percentile(&mt_touch, 99), mt_touch.max);
+        else
+            fprintf(f, ",,,,,,,,,,,\n");
+    }
+}
+
 /* ── Thread counts ──────────────────────────────────────────────────── */
 
 #define MAX_THREAD_COUNTS 32
@@ -456,24 +1422,85 @@ static void default_thread_counts(void)
 static void usage(const char *prog)
 {
     fprintf(stderr,
-        "Usage: %s [--csv] [--threads 1,2,4,8] [workload]\n\n"
-        "Workloads: thread_local, producer_consumer, shared_pool\n\n"
+        "Usage: %s [--csv] [--perf] [--latency] [--sample N] [--hist FILE] [--threads 1,2,4,8]\n"
+        "          [--queue KIND] [--batch N] [--node-csv FILE]\n"
+        "          [--rate R[,R...]] [--duration S] [--timeseries FILE] [--json FILE] [workload]\n\n"
+        "Workloads: thread_local, producer_consumer, shared_pool\n"
+        "Placement (only when named; \"numa\" or \"thp\" runs the group):\n"
+        "  numa_local_free, numa_remote_free      alloc on node A, free on A / on B\n"
+        "  numa_first_touch, numa_remote_touch    memory built by the thread / from another node\n"
+        "  numa_interleave                        MPOL_INTERLEAVE over all nodes\n"
+        "  thp_always, thp_madvise, thp_never     first touch under each THP mode (root)\n"
+        "  --node-csv FILE                        per-node breakdown as CSV\n\n"
+        "Open loop (thread_local, producer_consumer, shared_pool):\n"
+        "  --rate R[,R...]   per-thread target ops/sec (k, M suffixes); one run per\n"
+        "                    rate, latency measured from each op's scheduled start\n"
+        "  --duration S      seconds of schedule per run (default 5, max %d)\n"
+        "  --timeseries FILE per-second p50/p99/p99.9/max as CSV\n\n"
+        "producer_consumer transport:\n"
+        "  --queue fanin|spsc|mpmc  default fanin (SPSC lane per producer per consumer)\n"
+        "  --batch N                pointers per push/pop (default 32, max %d)\n\n"
         "Environment:\n"
         "  OPS=N          Operations per thread (default: %d)\n"
+        "  LAT_DIGITS=N   --latency histogram significant digits (1-4, default %d)\n"
         "  LD_PRELOAD=... Swap allocator\n",
-        prog, DEFAULT_OPS_PER_THREAD);
+        prog, OL_MAX_SECONDS, PC_MAX_BATCH, DEFAULT_OPS_PER_THREAD, LAT_HIST_DIGITS);
 }
 
 int main(int argc, char *argv[])
 {
-    const char *filter = NULL;
+    const char *filter = NULL, *json_path = NULL;
+    FILE *hist_out = NULL, *node_out = NULL, *ts_out = NULL;
     ops_per_thread = get_ops_env();
 
     for (int i = 1; i < argc; i++) {
         if (strcmp(argv[i], "--csv") == 0)
             csv_mode = 1;
+        else if (strcmp(argv[i], "--perf") == 0)
+            pg_enabled = 1;
+        else if (strcmp(argv[i], "--latency") == 0)
+            lat_enabled = 1;
+        else if (strcmp(argv[i], "--sample") == 0 && i + 1 < argc) {
+            long n = atol(argv[++i]);
+            tsc_sample_every = n > 1 ? (uint32_t)n : 1;
+            lat_enabled = 1;
+        }
+        else if (strcmp(argv[i], "--hist") == 0 && i + 1 < argc) {
+            hist_out = fopen(argv[++i], "a");
+            if (!hist_out) { perror(argv[i]); return 1; }
+            lat_enabled = 1;
+        }
         else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
             parse_thread_counts(argv[++i]);
+        else if (strcmp(argv[i], "--rate") == 0 && i + 1 < argc)
+            parse_rates(argv[++i]);
+        else if (strcmp(argv[i], "--duration") == 0 && i + 1 < argc) {
+            ol_duration = atof(argv[++i]);
+            if (ol_duration <= 0) ol_duration = 5.0;
+            if (ol_duration > OL_MAX_SECONDS) ol_duration = OL_MAX_SECONDS;
+        } else if (strcmp(argv[i], "--timeseries") == 0 && i + 1 < argc) {
+            ts_out = fopen(argv[++i], "w");
+            if (!ts_out) { perror(argv[i]); return 1; }
+            fputs(OL_TS_HEADER, ts_out);
+        }
+        else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc)
+            json_path = argv[++i];
+        else if (strcmp(argv[i], "--node-csv") == 0 && i + 1 < argc) {
+            node_out = fopen(argv[++i], "w");
+            if (!node_out) { perror(argv[i]); return 1; }
+            fputs(NODE_CSV_HEADER, node_out);
+        }
+        else if (strcmp(argv[i], "--queue") == 0 && i + 1 < argc) {
+            int k = queue_kind_from_name(argv[++i]);
+            if (k < 0) {
+                fprintf(stderr, "Unknown queue '%s' (fanin, spsc, mpmc)\n", argv[i]);
+                return 1;
+            }
+            pc_kind = (enum queue_kind)k;
+        } else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            long b = atol(argv[++i]);
+            pc_batch = b < 1 ? 1 : b > PC_MAX_BATCH ? PC_MAX_BATCH : (size_t)b;
+        }
         else if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
             usage(argv[0]);
             return 0;
@@ -481,56 +1508,167 @@ int main(int argc, char *argv[])
             filter = argv[i];
     }
 
+    int placement = 0;
+    for (int w = 0; w < NUM_MT_WORKLOADS; w++)
+        if (workload_selected(filter, w))
+            placement |= mt_workloads[w].opt_in;
+    int known = 0;
+    for (int w = 0; w < NUM_MT_WORKLOADS; w++)
+        known |= workload_selected(filter, w);
+    if (!known) {
+        fprintf(stderr, "Unknown workload '%s'\n", filter);
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (bj_open(json_path, "bench_mt", argc, argv) < 0)
+        return 1;
+    bj_meta("allocator", detect_allocator());
+    numa_topo_load(&topo);
     if (num_thread_counts == 0)
         default_thread_counts();
+    if (lat_enabled || placement)
+        tsc_init();        /* placement workloads time page touches */
+    if (lat_enabled) {
+        lat_hist_init(&mt_lat_alloc);
+        lat_hist_init(&mt_lat_free);
+    }
+    if (ol_nrates) {
+        lat_hist_init(&ol_resp);
+        lat_hist_init(&ol_serv);
+    }
 
     if (csv_mode) {
-        printf("allocator,workload,threads,ops_per_sec,elapsed_ms\n");
+        printf("%s%s%s\n", ol_nrates ? OL_CSV_HEADER : "allocator,workload,threads,ops_per_sec,elapsed_ms",
+               pg_enabled ? PG_CSV_HEADER : "", lat_enabled ? LAT_CSV_HEADER : "");
     } else {
         printf("Memory Allocator Multithreaded Scalability\n");
         print_separator();
         printf("  Allocator      : %s\n", detect_allocator());
         printf("  Cores          : %d\n", get_num_cores());
-        printf("  Ops per thread : %ld\n", ops_per_thread);
+        printf("  NUMA nodes     : %d\n", topo.nnodes);
+        if (placement || topo.nnodes > 1)
+            numa_topo_print(&topo);
+        if (ol_nrates)
+            printf("  Open loop      : %d rates, %.1f s each, latency from scheduled start\n",
+                   ol_nrates, ol_duration);
+        else
+            printf("  Ops per thread : %ld\n", ops_per_thread);
+        printf("  P/C transport  : %s, batch %zu\n", queue_kind_names[pc_kind], pc_batch);
+        if (lat_enabled) {
+            char tbuf[96];
+            printf("  Op timer       : %s", tsc_describe(tbuf, sizeof(tbuf)));
+            if (tsc_sample_every > 1)
+                printf(", 1 in %u ops", tsc_sample_every);
+            printf("\n");
+        }
         printf("  Thread counts  : ");
         for (int i = 0; i < num_thread_counts; i++)
             printf("%d%s", thread_counts[i], i < num_thread_counts - 1 ? "," : "\n");
     }
 
     for (int w = 0; w < NUM_MT_WORKLOADS; w++) {
-        if (filter && strcmp(filter, mt_workloads[w].name) != 0)
+        if (!workload_selected(filter, w))
             continue;
 
         if (!csv_mode) {
             printf("\n  Workload: %s\n", mt_workloads[w].name);
             print_separator();
-            printf("  %8s  %15s  %10s\n", "threads", "ops/sec", "time_ms");
+            if (ol_nrates)
+                printf("  %8s  %10s  %10s  %10s  %9s  %9s  %9s  %9s  %9s  %6s\n", "threads",
+                       "target/thr", "target", "achieved", "p50", "p99", "p99.9", "max", "svc p99.9", "late");
+            else
+                printf("  %8s  %15s  %10s\n", "threads", "ops/sec", "time_ms");
         }
 
         for (int t = 0; t < num_thread_counts; t++) {
             int nthreads = thread_counts[t];
 
-            /* For producer-consumer, need at least 2 threads */
-            if (strcmp(mt_workloads[w].name, "producer_consumer") == 0 && nthreads < 2)
+            /* Producer-consumer pairs need at least 2 threads */
+            if (nthreads < mt_workloads[w].min_threads)
+                continue;
+            if (ol_nrates) {
+                ol_sweep(w, nthreads, ts_out, hist_out);
                 continue;
+            }
 
+            mt_node_valid = 0;
             uint64_t t0 = now_ns();
             double throughput = mt_workloads[w].fn(nthreads);
             uint64_t t1 = now_ns();
             double ms = elapsed_ms(t0, t1);
+            if (throughput < 0) {
+                if (csv_mode)
+                    fprintf(stderr, "%s: skipped (%s)\n", mt_workloads[w].name, mt_skip);
+                else
+                    printf("  %8d  skipped: %s\n", nthreads, mt_skip);
+                break;
+            }
+
+            bj_result(mt_workloads[w].name);
+            bj_param_int("threads", nthreads);
+            pc_json_params(w);
+            bj_metric("ops_per_sec", throughput, "ops/s", BJ_HIGHER);
+            bj_metric("elapsed_ms", ms, "ms", BJ_LOWER);
+            if (lat_enabled) {
+                lat_json("alloc", &mt_lat_alloc);
+                lat_json("free", &mt_lat_free);
+            }
 
+            char perf[128] = "", lat[192] = "";
             if (csv_mode) {
-                printf("%s,%s,%d,%.0f,%.1f\n",
+                if (pg_enabled)
+                    pg_csv(&mt_perf, mt_ops, perf, sizeof(perf));
+                if (lat_enabled)
+                    lat_csv(lat, sizeof(lat));
+                printf("%s,%s,%d,%.0f,%.1f%s%s\n",
                        detect_allocator(), mt_workloads[w].name,
-                       nthreads, throughput, ms);
+                       nthreads, throughput, ms, perf, lat);
             } else {
                 char buf[32];
                 printf("  %8d  %15s  %10.1f\n",
                        nthreads, format_ops(throughput, buf, sizeof(buf)), ms);
+                if (pg_enabled)
+                    printf("  %8s  %s\n", "", pg_format(&mt_perf, mt_ops, perf, sizeof(perf)));
+                if (lat_enabled) {
+                    printf("  %8s  malloc %s\n", "", lat_format(&mt_lat_alloc, lat, sizeof(lat)));
+                    printf("  %8s  free   %s\n", "", lat_format(&mt_lat_free, lat, sizeof(lat)));
+                }
+                if (mt_node_valid)
+                    node_print();
+            }
+            if (node_out && mt_node_valid)
+                node_csv(node_out, mt_workloads[w].name, nthreads);
+            if (hist_out) {
+                char label[96];
+                snprintf(label, sizeof(label), "%s/%s/%d/malloc",
+                         detect_allocator(), mt_workloads[w].name, nthreads);
+                hdr_save(&mt_lat_alloc, label, hist_out);
+                snprintf(label, sizeof(label), "%s/%s/%d/free",
+                         detect_allocator(), mt_workloads[w].name, nthreads);
+                hdr_save(&mt_lat_free, label, hist_out);
             }
             fflush(stdout);
         }
     }
 
+    if (hist_out)
+        fclose(hist_out);
+    if (node_out)
+        fclose(node_out);
+    if (ts_out)
+        fclose(ts_out);
+    if (ol_nrates) {
+        lat_hist_free(&ol_resp);
+        lat_hist_free(&ol_serv);
+        for (int s = 0; s < OL_MAX_SECONDS; s++)
+            if (ol_sec[s].counts)
+                hdr_free(&ol_sec[s]);
+    }
+    numa_topo_free(&topo);
+    if (lat_enabled) {
+        lat_hist_free(&mt_lat_alloc);
+        lat_hist_free(&mt_lat_free);
+    }
     return 0;
 }
@@ -6,11 +6,27 @@
  *   2. Key-value store — random inserts/deletes of variable-size values
  *   3. JSON parser   — tree of small nodes with varying lifetimes
  *
+ * Each workload runs once per allocator contender (contenders.h): the
+ * global malloc, a per-scope arena, a size-class slab and a fixed-object
+ * pool. Every run is a fresh child process, so the RSS peak (VmHWM) and
+ * fragmentation of one contender don't carry into the next.
+ *
  * Usage:
- *   ./bench_realistic [--csv] [workload_name]
+ *   ./bench_realistic [--csv] [--perf] [--alloc LIST] [workload_name]
  *   LD_PRELOAD=/path/to/libjemalloc.so ./bench_realistic
+ *
+ * --alloc picks contenders (comma-separated, default all); in CSV the
+ * allocator column is e.g. "glibc" for malloc and "glibc+arena" for the
+ * arena on top of it. Workloads without a scope to reset (kvstore) skip
+ * the arena.
+ *
+ * --perf reports IPC and cache/dTLB misses per operation (request, KV
+ * op, document) over each workload's timed loop (perf_group.h).
  */
 #include "common.h"
+#include "contenders.h"
+#include "perf_group.h"
+#include <sys/wait.h>
 
 /* ── Configuration ──────────────────────────────────────────────────── */
 
@@ -28,14 +44,30 @@ static long get_ops(long default_ops)
 
 typedef struct {
     const char *name;
+    char    allocator[32];      /* "glibc", "glibc+arena", ... */
     long    ops;
     double  elapsed_ms;
     double  ops_per_sec;
     long    rss_peak_kb;
     long    peak_live_bytes;
     double  frag_ratio;
+    struct pg_counts perf;      /* timed loop, with --perf */
 } realistic_result_t;
 
+/* Counter group for the run's process; all workloads run on its main thread */
+static struct pg_set perf_set = { .leader = -1 };
+
+static void finish_result(realistic_result_t *r, long ops, uint64_t t0, uint64_t t1,
+                          long peak_live)
+{
+    r->ops = ops;
+    r->elapsed_ms = elapsed_ms(t0, t1);
+    r->ops_per_sec = (double)ops / elapsed_s(t0, t1);
+    r->rss_peak_kb = get_peak_rss_kb();
+    r->peak_live_bytes = peak_live;
+    r->frag_ratio = (peak_live > 0) ? (double)(r->rss_peak_kb * 1024L) / peak_live : 0;
+}
+
 /* ── 1. Web server simulation ───────────────────────────────────────── */
 
 /*
@@ -46,67 +78,70 @@ typedef struct {
  *   - Free everything (request complete)
  *
  * This creates a burst-allocate-then-free-all pattern common in
- * request-scoped memory usage.
+ * request-scoped memory usage. The arena gets one reset per request.
  */
-static realistic_result_t bench_webserver(long ops)
+#define MAX_HEADERS 20
+
+static realistic_result_t bench_webserver(long ops, const struct contender *a)
 {
     realistic_result_t r = { .name = "webserver" };
 
     uint64_t rng = 0xEB000001234ULL;
     long live_bytes = 0, peak_live = 0;
+    size_t ksz[MAX_HEADERS], vsz[MAX_HEADERS];
+
+    void *ctx = a->create(128);     /* pool: header strings */
 
-    (void)get_rss_kb();  /* baseline RSS read */
     uint64_t t0 = now_ns();
+    pg_start(&perf_set);
 
     for (long req = 0; req < ops; req++) {
         /* Request buffer */
         size_t req_sz = rand_size(&rng, 2048, 8192);
-        char *req_buf = malloc(req_sz);
+        char *req_buf = a->alloc(ctx, req_sz);
         if (req_buf) { req_buf[0] = 'G'; live_bytes += req_sz; }
 
         /* Headers: 5-20 key-value pairs */
         int nheaders = 5 + (int)(xorshift64(&rng) % 16);
-        char **hdr_keys = malloc(nheaders * sizeof(char *));
-        char **hdr_vals = malloc(nheaders * sizeof(char *));
-        size_t hdr_total = nheaders * sizeof(char *) * 2;
-        live_bytes += hdr_total;
+        size_t arr_sz = nheaders * sizeof(char *);
+        char **hdr_keys = a->alloc(ctx, arr_sz);
+        char **hdr_vals = a->alloc(ctx, arr_sz);
+        if (!hdr_keys || !hdr_vals) { perror("alloc"); exit(1); }
+        live_bytes += 2 * arr_sz;
 
         for (int h = 0; h < nheaders; h++) {
-            size_t ksz = rand_size(&rng, 16, 64);
-            size_t vsz = rand_size(&rng, 16, 128);
-            hdr_keys[h] = malloc(ksz);
-            hdr_vals[h] = malloc(vsz);
-            if (hdr_keys[h]) { hdr_keys[h][0] = 'K'; live_bytes += ksz; }
-            if (hdr_vals[h]) { hdr_vals[h][0] = 'V'; live_bytes += vsz; }
+            ksz[h] = rand_size(&rng, 16, 64);
+            vsz[h] = rand_size(&rng, 16, 128);
+            hdr_keys[h] = a->alloc(ctx, ksz[h]);
+            hdr_vals[h] = a->alloc(ctx, vsz[h]);
+            if (hdr_keys[h]) { hdr_keys[h][0] = 'K'; live_bytes += ksz[h]; }
+            if (hdr_vals[h]) { hdr_vals[h][0] = 'V'; live_bytes += vsz[h]; }
         }
 
         /* Response body */
         size_t resp_sz = rand_size(&rng, 1024, 32768);
-        char *resp_buf = malloc(resp_sz);
+        char *resp_buf = a->alloc(ctx, resp_sz);
         if (resp_buf) { resp_buf[0] = '<'; live_bytes += resp_sz; }
 
         if (live_bytes > peak_live) peak_live = live_bytes;
 
         /* Free everything (request done) */
-        free(resp_buf); live_bytes -= resp_sz;
+        a->free(ctx, resp_buf, resp_sz);
         for (int h = 0; h < nheaders; h++) {
-            if (hdr_keys[h]) { size_t ksz = rand_size(&rng, 16, 64); (void)ksz; free(hdr_keys[h]); }
-            if (hdr_vals[h]) { free(hdr_vals[h]); }
+            a->free(ctx, hdr_keys[h], ksz[h]);
+            a->free(ctx, hdr_vals[h], vsz[h]);
         }
-        /* We can't perfectly track sizes since we're using random, so approximate */
-        live_bytes = 0;  /* simplification: per-request all freed */
-        free(hdr_keys);
-        free(hdr_vals);
-        free(req_buf);
+        a->free(ctx, hdr_keys, arr_sz);
+        a->free(ctx, hdr_vals, arr_sz);
+        a->free(ctx, req_buf, req_sz);
+        a->reset(ctx);
+        live_bytes = 0;
     }
 
+    pg_stop(&perf_set, &r.perf);
     uint64_t t1 = now_ns();
-    r.ops = ops;
-    r.elapsed_ms = elapsed_ms(t0, t1);
-    r.ops_per_sec = (double)ops / elapsed_s(t0, t1);
-    r.rss_peak_kb = get_rss_kb();
-    r.peak_live_bytes = peak_live;
-    r.frag_ratio = (peak_live > 0) ? (double)(r.rss_peak_kb * 1024L) / peak_live : 0;
+    finish_result(&r, ops, t0, t1, peak_live);
+    a->destroy(ctx);
 
     return r;
 }
@@ -128,11 +163,12 @@ typedef struct {
     size_t  val_sz;
 } kv_entry_t;
 
-static realistic_result_t bench_kvstore(long ops)
+static realistic_result_t bench_kvstore(long ops, const struct contender *a)
 {
     realistic_result_t r = { .name = "kvstore" };
 
     uint64_t rng = 0xAB57000012ULL;
+    void *ctx = a->create(64);      /* pool: keys */
 
     kv_entry_t *table = calloc(KV_SLOTS, sizeof(kv_entry_t));
     if (!table) { perror("calloc"); exit(1); }
@@ -141,6 +177,7 @@ static realistic_result_t bench_kvstore(long ops)
     long inserts = 0, deletes = 0, lookups = 0;
 
     uint64_t t0 = now_ns();
+    pg_start(&perf_set);
 
     for (long i = 0; i < ops; i++) {
         long idx = (long)(xorshift64(&rng) % KV_SLOTS);
@@ -150,13 +187,13 @@ static realistic_result_t bench_kvstore(long ops)
             /* INSERT / UPDATE */
             if (table[idx].key) {
                 live_bytes -= table[idx].key_sz + table[idx].val_sz;
-                free(table[idx].key);
-                free(table[idx].value);
+                a->free(ctx, table[idx].key, table[idx].key_sz);
+                a->free(ctx, table[idx].value, table[idx].val_sz);
             }
             table[idx].key_sz = rand_size(&rng, 16, 64);
             table[idx].val_sz = rand_size(&rng, 64, 8192);
-            table[idx].key = malloc(table[idx].key_sz);
-            table[idx].value = malloc(table[idx].val_sz);
+            table[idx].key = a->alloc(ctx, table[idx].key_sz);
+            table[idx].value = a->alloc(ctx, table[idx].val_sz);
             if (table[idx].key) table[idx].key[0] = 'k';
             if (table[idx].value) table[idx].value[0] = 'v';
             live_bytes += table[idx].key_sz + table[idx].val_sz;
@@ -174,8 +211,8 @@ static realistic_result_t bench_kvstore(long ops)
             /* DELETE */
             if (table[idx].key) {
                 live_bytes -= table[idx].key_sz + table[idx].val_sz;
-                free(table[idx].key);
-                free(table[idx].value);
+                a->free(ctx, table[idx].key, table[idx].key_sz);
+                a->free(ctx, table[idx].value, table[idx].val_sz);
                 table[idx].key = NULL;
                 table[idx].value = NULL;
                 table[idx].key_sz = 0;
@@ -187,21 +224,17 @@ static realistic_result_t bench_kvstore(long ops)
         if (live_bytes > peak_live) peak_live = live_bytes;
     }
 
+    pg_stop(&perf_set, &r.perf);
     uint64_t t1 = now_ns();
+    finish_result(&r, ops, t0, t1, peak_live);
 
     /* Cleanup */
     for (long i = 0; i < KV_SLOTS; i++) {
-        free(table[i].key);
-        free(table[i].value);
+        a->free(ctx, table[i].key, table[i].key_sz);
+        a->free(ctx, table[i].value, table[i].val_sz);
     }
     free(table);
-
-    r.ops = ops;
-    r.elapsed_ms = elapsed_ms(t0, t1);
-    r.ops_per_sec = (double)ops / elapsed_s(t0, t1);
-    r.rss_peak_kb = get_rss_kb();
-    r.peak_live_bytes = peak_live;
-    r.frag_ratio = (peak_live > 0) ? (double)(r.rss_peak_kb * 1024L) / peak_live : 0;
+    a->destroy(ctx);
 
     return r;
 }
@@ -215,6 +248,9 @@ static realistic_result_t bench_kvstore(long ops)
  *   - Trees have 50-500 nodes
  *   - Parse a document, process it, then free the whole tree
  *   - Multiple documents alive simultaneously (pipeline)
+ *
+ * The arena gets one context per pipeline slot, reset when that slot's
+ * document is freed; the others share one context.
  */
 
 typedef struct json_node {
@@ -225,10 +261,11 @@ typedef struct json_node {
     int               type;          /* 0=object, 1=array, 2=string, 3=number */
 } json_node_t;
 
-static json_node_t *make_json_tree(uint64_t *rng, int depth, int max_depth,
-                                    long *live_bytes)
+static json_node_t *make_json_tree(const struct contender *a, void *ctx,
+                                   uint64_t *rng, int depth, int max_depth,
+                                   long *live_bytes)
 {
-    json_node_t *node = malloc(sizeof(json_node_t));
+    json_node_t *node = a->alloc(ctx, sizeof(json_node_t));
     if (!node) return NULL;
     *live_bytes += sizeof(json_node_t);
 
@@ -238,7 +275,7 @@ static json_node_t *make_json_tree(uint64_t *rng, int depth, int max_depth,
     /* String values for ~60% of nodes */
     if (xorshift64(rng) % 100 < 60) {
         node->str_len = rand_size(rng, 8, 256);
-        node->str_value = malloc(node->str_len);
+        node->str_value = a->alloc(ctx, node->str_len);
         if (node->str_value) {
             node->str_value[0] = '"';
             *live_bytes += node->str_len;
@@ -250,27 +287,29 @@ static json_node_t *make_json_tree(uint64_t *rng, int depth, int max_depth,
         int nc = 1 + (int)(xorshift64(rng) % 4);
         node->nchildren = nc;
         for (int i = 0; i < nc; i++) {
-            node->children[i] = make_json_tree(rng, depth + 1, max_depth, live_bytes);
+            node->children[i] = make_json_tree(a, ctx, rng, depth + 1, max_depth,
+                                               live_bytes);
         }
     }
 
     return node;
 }
 
-static void free_json_tree(json_node_t *node, long *live_bytes)
+static void free_json_tree(const struct contender *a, void *ctx, json_node_t *node,
+                           long *live_bytes)
 {
     if (!node) return;
     for (int i = 0; i < node->nchildren; i++)
-        free_json_tree(node->children[i], live_bytes);
+        free_json_tree(a, ctx, node->children[i], live_bytes);
     if (node->str_value) {
         *live_bytes -= node->str_len;
-        free(node->str_value);
+        a->free(ctx, node->str_value, node->str_len);
     }
     *live_bytes -= sizeof(json_node_t);
-    free(node);
+    a->free(ctx, node, sizeof(json_node_t));
 }
 
-static realistic_result_t bench_json_parser(long ops)
+static realistic_result_t bench_json_parser(long ops, const struct contender *a)
 {
     realistic_result_t r = { .name = "json_parser" };
 
@@ -281,20 +320,27 @@ static realistic_result_t bench_json_parser(long ops)
     /* Keep a pipeline of N documents alive simultaneously */
     #define PIPELINE_SIZE 8
     json_node_t *pipeline[PIPELINE_SIZE] = {0};
+    void *ctx[PIPELINE_SIZE];
     int pipe_idx = 0;
 
+    for (int i = 0; i < PIPELINE_SIZE; i++)    /* pool: nodes */
+        ctx[i] = (a->scoped || i == 0) ? a->create(sizeof(json_node_t)) : ctx[0];
+
     uint64_t t0 = now_ns();
+    pg_start(&perf_set);
 
     for (long i = 0; i < ops; i++) {
         /* Free the oldest document in the pipeline */
         if (pipeline[pipe_idx]) {
-            free_json_tree(pipeline[pipe_idx], &live_bytes);
+            free_json_tree(a, ctx[pipe_idx], pipeline[pipe_idx], &live_bytes);
+            a->reset(ctx[pipe_idx]);
             pipeline[pipe_idx] = NULL;
         }
 
         /* Parse a new document (create tree) */
         int max_depth = 3 + (int)(xorshift64(&rng) % 4); /* depth 3-6 */
-        pipeline[pipe_idx] = make_json_tree(&rng, 0, max_depth, &live_bytes);
+        pipeline[pipe_idx] = make_json_tree(a, ctx[pipe_idx], &rng, 0, max_depth,
+                                            &live_bytes);
 
         if (live_bytes > peak_live) peak_live = live_bytes;
 
@@ -304,84 +350,175 @@ static realistic_result_t bench_json_parser(long ops)
     /* Cleanup remaining pipeline */
     for (int i = 0; i < PIPELINE_SIZE; i++) {
         if (pipeline[i])
-            free_json_tree(pipeline[i], &live_bytes);
+            free_json_tree(a, ctx[i], pipeline[i], &live_bytes);
     }
 
+    pg_stop(&perf_set, &r.perf);
     uint64_t t1 = now_ns();
+    finish_result(&r, ops, t0, t1, peak_live);
 
-    r.ops = ops;
-    r.elapsed_ms = elapsed_ms(t0, t1);
-    r.ops_per_sec = (double)ops / elapsed_s(t0, t1);
-    r.rss_peak_kb = get_rss_kb();
-    r.peak_live_bytes = peak_live;
-    r.frag_ratio = (peak_live > 0) ? (double)(r.rss_peak_kb * 1024L) / peak_live : 0;
+    for (int i = 0; i < PIPELINE_SIZE; i++)
+        if (a->scoped || i == 0)
+            a->destroy(ctx[i]);
 
     return r;
 }
 
 /* ── Output ─────────────────────────────────────────────────────────── */
 
-static void print_result(const realistic_result_t *r)
+static void print_result(const realistic_result_t *r, double base_ops)
 {
+    char perf[128] = "";
+
+    bj_result(r->name);
+    bj_param_str("contender", r->allocator);
+    bj_param_int("ops", r->ops);
+    bj_metric("ops_per_sec", r->ops_per_sec, "ops/s", BJ_HIGHER);
+    bj_metric("elapsed_ms", r->elapsed_ms, "ms", BJ_LOWER);
+    bj_metric("rss_peak_kb", (double)r->rss_peak_kb, "kB", BJ_LOWER);
+    bj_metric("frag_ratio", r->frag_ratio, "ratio", BJ_LOWER);
+
     if (csv_mode) {
-        printf("%s,%s,%ld,%.1f,%.0f,%ld,%ld,%.2f\n",
-               detect_allocator(), r->name, r->ops,
+        if (pg_enabled)
+            pg_csv(&r->perf, (double)r->ops, perf, sizeof(perf));
+        printf("%s,%s,%ld,%.1f,%.0f,%ld,%ld,%.2f%s\n",
+               r->allocator, r->name, r->ops,
                r->elapsed_ms, r->ops_per_sec,
-               r->rss_peak_kb, r->peak_live_bytes, r->frag_ratio);
+               r->rss_peak_kb, r->peak_live_bytes, r->frag_ratio, perf);
         return;
     }
 
-    char buf1[32], buf2[32], buf3[32];
-    printf("\n  Workload: %s\n", r->name);
-    print_separator();
-    printf("  Operations        : %ld\n", r->ops);
-    printf("  Total time        : %.1f ms\n", r->elapsed_ms);
-    printf("  Throughput        : %s ops/sec\n", format_ops(r->ops_per_sec, buf1, sizeof(buf1)));
-    printf("  RSS peak          : %s\n", format_bytes(r->rss_peak_kb * 1024L, buf2, sizeof(buf2)));
-    printf("  Peak live bytes   : %s\n", format_bytes(r->peak_live_bytes, buf3, sizeof(buf3)));
-    printf("  Frag ratio        : %.2f\n", r->frag_ratio);
+    char buf1[32], buf2[32], buf3[32], rel[16] = "-";
+    if (base_ops > 0)
+        snprintf(rel, sizeof(rel), "%.2fx", r->ops_per_sec / base_ops);
+    printf("  %-18s %12s %9s %10s %10s %6.2f\n", r->allocator,
+           format_ops(r->ops_per_sec, buf1, sizeof(buf1)), rel,
+           format_bytes(r->rss_peak_kb * 1024L, buf2, sizeof(buf2)),
+           format_bytes(r->peak_live_bytes, buf3, sizeof(buf3)), r->frag_ratio);
+    if (pg_enabled)
+        printf("  %-18s %s\n", "", pg_format(&r->perf, (double)r->ops, perf, sizeof(perf)));
 }
 
 static void print_csv_header(void)
 {
     printf("allocator,workload,ops,elapsed_ms,ops_per_sec,"
-           "rss_peak_kb,peak_live_bytes,frag_ratio\n");
+           "rss_peak_kb,peak_live_bytes,frag_ratio%s\n",
+           pg_enabled ? PG_CSV_HEADER : "");
 }
 
 /* ── Main ───────────────────────────────────────────────────────────── */
 
-typedef realistic_result_t (*realistic_fn)(long ops);
+typedef realistic_result_t (*realistic_fn)(long ops, const struct contender *a);
 
 static struct {
     const char     *name;
     realistic_fn    fn;
     long            default_ops;
+    int             scoped;         /* has a scope for the arena to reset */
 } realistic_workloads[] = {
-    { "webserver",    bench_webserver,    100000 },
-    { "kvstore",      bench_kvstore,     2000000 },
-    { "json_parser",  bench_json_parser,  100000 },
+    { "webserver",    bench_webserver,    100000, 1 },
+    { "kvstore",      bench_kvstore,     2000000, 0 },
+    { "json_parser",  bench_json_parser,  100000, 1 },
 };
 static const int NUM_WORKLOADS = sizeof(realistic_workloads) / sizeof(realistic_workloads[0]);
 
+/*
+ * One workload against one contender in a child process: the heap, the
+ * slab pages and VmHWM all start from the same clean state every time.
+ * Returns 0 and fills *r, or -1 if the child failed.
+ */
+static int run_contender(int w, const struct contender *a, long ops,
+                         realistic_result_t *r)
+{
+    int fds[2];
+    if (pipe(fds) < 0) { perror("pipe"); exit(1); }
+    fflush(stdout);
+
+    pid_t pid = fork();
+    if (pid < 0) { perror("fork"); exit(1); }
+    if (pid == 0) {
+        close(fds[0]);
+        pg_open(&perf_set, pg_default_events, PG_DEFAULT_N);
+        realistic_result_t res = realistic_workloads[w].fn(ops, a);
+        if (a->alloc == sys_alloc)
+            snprintf(res.allocator, sizeof(res.allocator), "%s", detect_allocator());
+        else
+            snprintf(res.allocator, sizeof(res.allocator), "%s+%s",
+                     detect_allocator(), a->name);
+        pg_close(&perf_set);
+        _exit(write(fds[1], &res, sizeof(res)) == (ssize_t)sizeof(res) ? 0 : 1);
+    }
+
+    close(fds[1]);
+    ssize_t n = read(fds[0], r, sizeof(*r));
+    close(fds[0]);
+    int status;
+    waitpid(pid, &status, 0);
+    if (n != (ssize_t)sizeof(*r) || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "warning: %s with %s failed\n", realistic_workloads[w].name, a->name);
+        return -1;
+    }
+    return 0;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [--csv] [--perf] [--alloc LIST] [--json FILE] [workload_name]\n",
+            prog);
+    fprintf(stderr, "Workloads:   webserver, kvstore, json_parser\n");
+    fprintf(stderr, "Contenders:  ");
+    for (int i = 0; i < NUM_CONTENDERS; i++)
+        fprintf(stderr, "%s%s", contenders[i].name, i + 1 < NUM_CONTENDERS ? ", " : "\n");
+    fprintf(stderr, "  --alloc LIST  comma-separated contenders to run (default: all)\n");
+}
+
 int main(int argc, char *argv[])
 {
-    const char *filter = NULL;
+    const char *filter = NULL, *json_path = NULL;
+    int selected[NUM_CONTENDERS];
+
+    for (int i = 0; i < NUM_CONTENDERS; i++)
+        selected[i] = 1;
 
     for (int i = 1; i < argc; i++) {
         if (strcmp(argv[i], "--csv") == 0)
             csv_mode = 1;
-        else if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
-            fprintf(stderr, "Usage: %s [--csv] [workload_name]\n", argv[0]);
-            fprintf(stderr, "Workloads: webserver, kvstore, json_parser\n");
+        else if (strcmp(argv[i], "--perf") == 0)
+            pg_enabled = 1;
+        else if (strcmp(argv[i], "--alloc") == 0 && i + 1 < argc) {
+            char list[256];
+            snprintf(list, sizeof(list), "%s", argv[++i]);
+            memset(selected, 0, sizeof(selected));
+            for (char *tok = strtok(list, ","); tok; tok = strtok(NULL, ",")) {
+                const struct contender *a = find_contender(tok);
+                if (!a) {
+                    fprintf(stderr, "Unknown contender: %s\n", tok);
+                    usage(argv[0]);
+                    return 1;
+                }
+                selected[a - contenders] = 1;
+            }
+        } else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+            json_path = argv[++i];
+        } else if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+            usage(argv[0]);
             return 0;
         } else
             filter = argv[i];
     }
+    if (bj_open(json_path, "bench_realistic", argc, argv) < 0)
+        return 1;
+    bj_meta("allocator", detect_allocator());
 
     if (!csv_mode) {
         printf("Memory Allocator Realistic Workloads\n");
         print_separator();
         printf("  Allocator : %s\n", detect_allocator());
+        printf("  Contenders:");
+        for (int i = 0; i < NUM_CONTENDERS; i++)
+            if (selected[i])
+                printf(" %s", contenders[i].name);
+        printf("\n");
         printf("  Cores     : %d\n", get_num_cores());
         printf("  PID       : %d\n", getpid());
     } else {
@@ -392,8 +529,31 @@ int main(int argc, char *argv[])
         if (filter && strcmp(filter, realistic_workloads[i].name) != 0)
             continue;
         long ops = get_ops(realistic_workloads[i].default_ops);
-        realistic_result_t r = realistic_workloads[i].fn(ops);
-        print_result(&r);
+
+        if (!csv_mode) {
+            printf("\n  Workload: %s (%ld ops)\n", realistic_workloads[i].name, ops);
+            print_separator();
+            printf("  %-18s %12s %9s %10s %10s %6s\n",
+                   "Allocator", "Ops/sec", "vs malloc", "RSS peak", "Peak live", "Frag");
+        }
+
+        double base_ops = 0;
+        for (int c = 0; c < NUM_CONTENDERS; c++) {
+            const struct contender *a = &contenders[c];
+            if (!selected[c])
+                continue;
+            if (a->scoped && !realistic_workloads[i].scoped) {
+                if (!csv_mode)
+                    printf("  %-18s n/a: entries have no common lifetime to reset\n", a->name);
+                continue;
+            }
+            realistic_result_t r;
+            if (run_contender(i, a, ops, &r) < 0)
+                continue;
+            if (a->alloc == sys_alloc)
+                base_ops = r.ops_per_sec;
+            print_result(&r, a->alloc == sys_alloc ? 0 : base_ops);
+        }
     }
 
     return 0;
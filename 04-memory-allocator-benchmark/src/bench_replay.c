@@ -0,0 +1,720 @@
+/*
+ * bench_replay.c — Replay a recorded allocation trace
+ *
+ * Replays a trace captured with the LD_PRELOAD shim (alloc_trace.c,
+ * bin/libatrace.so) against whatever allocator this process runs on: one
+ * replay thread per traced thread, each issuing its thread's calls in
+ * their original order with the original sizes. A free of an object
+ * another thread allocated is issued by the thread that freed it in the
+ * trace, after waiting for the allocation: the cross-thread free pattern
+ * is preserved, the original timing is not (the replay runs flat out).
+ *
+ * Usage:
+ *   ./bench_replay [--csv] [--sample N] [--no-touch] [--rss FILE] [--interval MS]
+ *                  [--json FILE] TRACE
+ *   ./bench_replay --info TRACE               # trace summary only
+ *   ./scripts/run_allocator.sh jemalloc bin/bench_replay svc.trace
+ *
+ * Reports throughput (replayed calls per second), malloc/free/realloc
+ * latency (hdr_hist.h, timed with tsc.h) and RSS over time: a sampler
+ * thread reads VmRSS every --interval ms (default 10); --rss writes the
+ * samples as CSV. The replay's own tables (~30 bytes per call) are in
+ * RSS before it starts: reported as the baseline, and the peak is the
+ * highest sample, not VmHWM (which loading the trace would set). Each
+ * new block is written once per 4 KB page, as the traced program
+ * presumably did, so RSS means something; --no-touch skips that.
+ */
+#include "common.h"
+#include "alloc_trace.h"
+#include <stdatomic.h>
+#include <sched.h>
+
+/* ── Configuration ──────────────────────────────────────────────────── */
+
+#define NO_OBJ       UINT32_MAX
+#define MAX_SAMPLES  100000
+#define TOUCH_STRIDE 4096
+
+static int  csv_mode = 0;
+static int  touch_enabled = 1;
+static long interval_ms = 10;
+
+/* ── Loading ────────────────────────────────────────────────────────── */
+
+/* One traced thread's records, in program order */
+typedef struct {
+    struct atrace_rec *recs;
+    long               n, cap;
+} rec_stream_t;
+
+/* A replay op: addresses resolved to object ids */
+typedef struct {
+    uint32_t id;            /* object allocated, or freed */
+    uint32_t old;           /* REALLOC: object it replaces, or NO_OBJ */
+    uint32_t size;          /* bytes allocated, or freed */
+    uint32_t old_size;      /* REALLOC */
+    uint8_t  op;            /* enum atrace_op */
+    uint8_t  align_log2;
+} rop_t;
+
+typedef struct {
+    _Alignas(64) rop_t *ops;
+    long            nops, cap;
+    atomic_long     done;           /* ops issued, read by the sampler */
+    atomic_long     live;           /* bytes this thread allocated - freed */
+    lat_histogram_t lat_alloc, lat_free, lat_realloc;
+    pthread_t       thread;
+} replay_thread_t;
+
+static struct {
+    double           ns_per_tick;
+    uint64_t         span_ticks;
+    int              nthreads;
+    replay_thread_t *threads;
+    uint32_t         nobjs;
+    long             nops;
+    long             op_count[ATRACE_FREE + 1];
+    long             cross_frees;   /* freed (or realloc'd) by another thread */
+    long             dropped;       /* frees of pointers never seen allocated */
+    struct hdr_hist  sizes;         /* requested sizes */
+} trace;
+
+static void **objs;                 /* object id → current block */
+static _Atomic unsigned char *ready;
+
+/* Open-addressing map from a live address to its object id */
+typedef struct {
+    uint64_t *keys;                 /* 0 = empty */
+    uint32_t *vals;
+    size_t    mask, used;
+} addr_map_t;
+
+static inline size_t amap_slot(const addr_map_t *m, uint64_t key)
+{
+    return (size_t)((key >> 4) * 0x9E3779B97F4A7C15ULL >> 20) & m->mask;
+}
+
+static void amap_init(addr_map_t *m, size_t cap)
+{
+    m->keys = calloc(cap, sizeof(m->keys[0]));
+    m->vals = malloc(cap * sizeof(m->vals[0]));
+    if (!m->keys || !m->vals) { perror("amap_init"); exit(1); }
+    m->mask = cap - 1;
+    m->used = 0;
+}
+
+static void amap_put(addr_map_t *m, uint64_t key, uint32_t val);
+
+static void amap_grow(addr_map_t *m)
+{
+    addr_map_t old = *m;
+    amap_init(m, (old.mask + 1) * 2);
+    for (size_t i = 0; i <= old.mask; i++)
+        if (old.keys[i])
+            amap_put(m, old.keys[i], old.vals[i]);
+    free(old.keys);
+    free(old.vals);
+}
+
+static void amap_put(addr_map_t *m, uint64_t key, uint32_t val)
+{
+    if (2 * (m->used + 1) > m->mask + 1)
+        amap_grow(m);
+    size_t i = amap_slot(m, key);
+    while (m->keys[i] && m->keys[i] != key)
+        i = (i + 1) & m->mask;
+    if (!m->keys[i])
+        m->used++;
+    m->keys[i] = key;
+    m->vals[i] = val;
+}
+
+/* Remove key; returns its value or NO_OBJ */
+static uint32_t amap_take(addr_map_t *m, uint64_t key)
+{
+    size_t i = amap_slot(m, key);
+    while (m->keys[i] && m->keys[i] != key)
+        i = (i + 1) & m->mask;
+    if (!m->keys[i])
+        return NO_OBJ;
+    uint32_t val = m->vals[i];
+
+    /* Backward-shift deletion: no tombstones */
+    size_t j = i;
+    for (;;) {
+        j = (j + 1) & m->mask;
+        if (!m->keys[j])
+            break;
+        size_t home = amap_slot(m, m->keys[j]);
+        if ((j > i && (home <= i || home > j)) || (j < i && home <= i && home > j)) {
+            m->keys[i] = m->keys[j];
+            m->vals[i] = m->vals[j];
+            i = j;
+        }
+    }
+    m->keys[i] = 0;
+    m->used--;
+    return val;
+}
+
+static void push_op(replay_thread_t *t, rop_t op)
+{
+    if (t->nops == t->cap) {
+        t->cap = t->cap ? t->cap * 2 : 4096;
+        t->ops = realloc(t->ops, t->cap * sizeof(rop_t));
+        if (!t->ops) { perror("realloc"); exit(1); }
+    }
+    t->ops[t->nops++] = op;
+    trace.nops++;
+    trace.op_count[op.op]++;
+}
+
+/* Min-heap of stream indices by head timestamp (ties: lower index) */
+static inline int head_before(const rec_stream_t *st, const long *pos, int a, int b)
+{
+    uint64_t ta = st[a].recs[pos[a]].ts, tb = st[b].recs[pos[b]].ts;
+    return ta < tb || (ta == tb && a < b);
+}
+
+static void heap_down(int *heap, int n, int i, const rec_stream_t *st, const long *pos)
+{
+    for (;;) {
+        int l = 2 * i + 1, r = l + 1, m = i;
+        if (l < n && head_before(st, pos, heap[l], heap[m])) m = l;
+        if (r < n && head_before(st, pos, heap[r], heap[m])) m = r;
+        if (m == i)
+            return;
+        int tmp = heap[i]; heap[i] = heap[m]; heap[m] = tmp;
+        i = m;
+    }
+}
+
+static rec_stream_t *read_trace(const char *path, int *nstreams)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) { perror(path); exit(1); }
+
+    struct atrace_header h;
+    if (fread(&h, sizeof(h), 1, f) != 1 || memcmp(h.magic, ATRACE_MAGIC, sizeof(ATRACE_MAGIC)) != 0) {
+        fprintf(stderr, "%s: not an allocation trace\n", path);
+        exit(1);
+    }
+    if (h.version < 1 || h.version > ATRACE_VERSION || h.rec_size != sizeof(struct atrace_rec)) {
+        fprintf(stderr, "%s: trace version %u with %u-byte records; this build reads "
+                "versions 1 to %d with %zu-byte records\n", path, h.version, h.rec_size,
+                ATRACE_VERSION, sizeof(struct atrace_rec));
+        exit(1);
+    }
+    trace.ns_per_tick = h.ns_per_tick > 0 ? h.ns_per_tick : 1.0;
+
+    /* Shim thread index → dense stream index, in order of appearance */
+    static int stream_of[ATRACE_MAX_THREADS];
+    memset(stream_of, -1, sizeof(stream_of));
+    rec_stream_t *streams = calloc(ATRACE_MAX_THREADS, sizeof(rec_stream_t));
+    if (!streams) { perror("calloc"); exit(1); }
+    int n = 0;
+
+    struct atrace_chunk c;
+    while (fread(&c, sizeof(c), 1, f) == 1) {
+        if (c.tid >= ATRACE_MAX_THREADS) {
+            fprintf(stderr, "%s: corrupt chunk (thread %u)\n", path, c.tid);
+            exit(1);
+        }
+        if (stream_of[c.tid] < 0)
+            stream_of[c.tid] = n++;
+        rec_stream_t *s = &streams[stream_of[c.tid]];
+        if (s->n + c.n > s->cap) {
+            while (s->n + c.n > s->cap)
+                s->cap = s->cap ? s->cap * 2 : 16384;
+            s->recs = realloc(s->recs, s->cap * sizeof(struct atrace_rec));
+            if (!s->recs) { perror("realloc"); exit(1); }
+        }
+        size_t got = fread(s->recs + s->n, sizeof(struct atrace_rec), c.n, f);
+        s->n += (long)got;
+        if (got != c.n) {
+            fprintf(stderr, "warning: %s: truncated, replaying what was read\n", path);
+            break;
+        }
+    }
+    fclose(f);
+    *nstreams = n;
+    return streams;
+}
+
+/*
+ * Merge the threads' streams by timestamp (each kept in program order,
+ * its timestamps forced non-decreasing in case the counter stepped back
+ * on a migration) and resolve addresses to object ids in that order.
+ * Every free then refers to an allocation earlier in the merged order,
+ * so the replay's waits cannot deadlock.
+ */
+static void build_replay(const char *path)
+{
+    int nstreams;
+    rec_stream_t *streams = read_trace(path, &nstreams);
+    if (nstreams == 0) {
+        fprintf(stderr, "%s: no events\n", path);
+        exit(1);
+    }
+
+    for (int s = 0; s < nstreams; s++)
+        for (long i = 1; i < streams[s].n; i++)
+            if (streams[s].recs[i].ts < streams[s].recs[i - 1].ts)
+                streams[s].recs[i].ts = streams[s].recs[i - 1].ts;
+
+    trace.nthreads = nstreams;
+    trace.threads = calloc(nstreams, sizeof(replay_thread_t));
+    long *pos = calloc(nstreams, sizeof(long));
+    int *heap = malloc(nstreams * sizeof(int));
+    if (!trace.threads || !pos || !heap) { perror("calloc"); exit(1); }
+    int nheap = 0;
+    for (int k = 0; k < nstreams; k++)
+        if (streams[k].n)
+            heap[nheap++] = k;
+    for (int i = nheap / 2 - 1; i >= 0; i--)
+        heap_down(heap, nheap, i, streams, pos);
+    if (hdr_init(&trace.sizes, HDR_SUB_BITS(2), 33) < 0) { perror("hdr_init"); exit(1); }
+
+    /* Owner and size per object, for cross-thread counts and frees */
+    size_t ocap = 1 << 16;
+    uint32_t *owner = malloc(ocap * sizeof(uint32_t));
+    uint32_t *osize = malloc(ocap * sizeof(uint32_t));
+    if (!owner || !osize) { perror("malloc"); exit(1); }
+
+    addr_map_t live;
+    amap_init(&live, 1 << 16);
+
+    /* Per stream: the object its realloc in flight released (REALLOC_OLD), -1 if none */
+    int64_t *pend = malloc(nstreams * sizeof(int64_t));
+    if (!pend) { perror("malloc"); exit(1); }
+    for (int k = 0; k < nstreams; k++)
+        pend[k] = -1;
+
+    while (nheap > 0) {
+        /* Next event: the earliest head of all streams */
+        int s = heap[0];
+        const struct atrace_rec *r = &streams[s].recs[pos[s]++];
+        if (pos[s] == streams[s].n)
+            heap[0] = heap[--nheap];
+        heap_down(heap, nheap, 0, streams, pos);
+        replay_thread_t *t = &trace.threads[s];
+        if (r->ts > trace.span_ticks)
+            trace.span_ticks = r->ts;
+
+        rop_t op = { .id = NO_OBJ, .old = NO_OBJ, .op = r->op, .align_log2 = r->align_log2 };
+
+        if (r->op == ATRACE_REALLOC_OLD) {
+            /* Taken now: another thread may get the address before REALLOC */
+            pend[s] = amap_take(&live, r->ptr);
+            continue;
+        }
+        if (r->op == ATRACE_FREE || (r->op == ATRACE_REALLOC && r->old)) {
+            uint32_t id;
+            if (r->op == ATRACE_REALLOC && pend[s] >= 0) {
+                id = (uint32_t)pend[s];
+                pend[s] = -1;
+            } else {
+                id = amap_take(&live, r->old ? r->old : r->ptr);     /* version 1 */
+            }
+            if (!r->ptr && r->size) {
+                /* Failed realloc: the block stayed where it was */
+                if (id != NO_OBJ)
+                    amap_put(&live, r->old, id);
+                continue;
+            }
+            if (id == NO_OBJ && r->op == ATRACE_FREE) {
+                trace.dropped++;
+                continue;
+            }
+            if (id != NO_OBJ && owner[id] != (uint32_t)s)
+                trace.cross_frees++;
+            if (r->op == ATRACE_FREE) {
+                op.id = id;
+                op.size = osize[id];
+                push_op(t, op);
+                continue;
+            }
+            op.old = id;
+            op.old_size = id != NO_OBJ ? osize[id] : 0;
+            if (!r->ptr) {
+                /* realloc(p, 0) that freed p */
+                if (id == NO_OBJ)
+                    continue;
+                op = (rop_t){ .id = id, .old = NO_OBJ, .size = op.old_size, .op = ATRACE_FREE };
+                push_op(t, op);
+                continue;
+            }
+        } else if (!r->ptr) {
+            continue;
+        }
+
+        /* An allocation (or the new half of a realloc): a new object */
+        if (trace.nobjs == NO_OBJ) {
+            fprintf(stderr, "%s: more than %u allocations\n", path, NO_OBJ - 1);
+            exit(1);
+        }
+        if (trace.nobjs == ocap) {
+            ocap *= 2;
+            owner = realloc(owner, ocap * sizeof(uint32_t));
+            osize = realloc(osize, ocap * sizeof(uint32_t));
+            if (!owner || !osize) { perror("realloc"); exit(1); }
+        }
+        op.id = trace.nobjs++;
+        op.size = r->size;
+        owner[op.id] = (uint32_t)s;
+        osize[op.id] = r->size;
+        amap_put(&live, r->ptr, op.id);     /* overwrites a free we missed */
+        hdr_record(&trace.sizes, r->size);
+        push_op(t, op);
+    }
+
+    for (int s = 0; s < nstreams; s++)
+        free(streams[s].recs);
+    free(streams);
+    free(pos);
+    free(heap);
+    free(owner);
+    free(osize);
+    free(live.keys);
+    free(live.vals);
+    free(pend);
+
+    objs = calloc(trace.nobjs ? trace.nobjs : 1, sizeof(void *));
+    ready = calloc(trace.nobjs ? trace.nobjs : 1, 1);
+    if (!objs || !ready) { perror("calloc"); exit(1); }
+}
+
+/* ── Replay ─────────────────────────────────────────────────────────── */
+
+static pthread_barrier_t start_barrier;
+
+static inline void touch(void *p, size_t from, size_t size)
+{
+    if (!touch_enabled || !p)
+        return;
+    for (size_t off = from; off < size; off += TOUCH_STRIDE)
+        ((volatile char *)p)[off] = 1;
+}
+
+/* Wait until another thread has made object id */
+static inline void wait_ready(uint32_t id)
+{
+    for (int spins = 0; !atomic_load_explicit(&ready[id], memory_order_acquire); spins++)
+        if (spins > 64)
+            sched_yield();      /* more replay threads than cores */
+}
+
+static void *replay_worker(void *arg)
+{
+    replay_thread_t *t = arg;
+    lat_hist_init(&t->lat_alloc);
+    lat_hist_init(&t->lat_free);
+    lat_hist_init(&t->lat_realloc);
+    long live = 0;
+
+    pthread_barrier_wait(&start_barrier);
+
+    for (long i = 0; i < t->nops; i++) {
+        const rop_t *o = &t->ops[i];
+        void *p = NULL;
+        uint64_t t0;
+
+        switch (o->op) {
+        case ATRACE_MALLOC:
+        case ATRACE_CALLOC:
+        case ATRACE_MEMALIGN:
+            t0 = lat_begin();
+            if (o->op == ATRACE_MALLOC)
+                p = malloc(o->size);
+            else if (o->op == ATRACE_CALLOC)
+                p = calloc(1, o->size);
+            else {
+                size_t align = (size_t)1 << o->align_log2;
+                if (posix_memalign(&p, align < sizeof(void *) ? sizeof(void *) : align, o->size) != 0)
+                    p = NULL;
+            }
+            lat_end(&t->lat_alloc, t0);
+            touch(p, 0, o->size);
+            objs[o->id] = p;
+            atomic_store_explicit(&ready[o->id], 1, memory_order_release);
+            live += o->size;
+            break;
+        case ATRACE_REALLOC:
+            if (o->old != NO_OBJ) {
+                wait_ready(o->old);
+                p = objs[o->old];
+            }
+            t0 = lat_begin();
+            p = realloc(p, o->size);
+            lat_end(&t->lat_realloc, t0);
+            touch(p, o->old_size, o->size);
+            if (o->old != NO_OBJ)
+                objs[o->old] = NULL;
+            objs[o->id] = p;
+            atomic_store_explicit(&ready[o->id], 1, memory_order_release);
+            live += (long)o->size - (long)o->old_size;
+            break;
+        case ATRACE_FREE:
+            wait_ready(o->id);
+            t0 = lat_begin();
+            free(objs[o->id]);
+            lat_end(&t->lat_free, t0);
+            objs[o->id] = NULL;
+            live -= o->size;
+            break;
+        }
+        atomic_store_explicit(&t->live, live, memory_order_relaxed);
+        atomic_store_explicit(&t->done, i + 1, memory_order_relaxed);
+    }
+    return NULL;
+}
+
+/* ── RSS sampling ───────────────────────────────────────────────────── */
+
+typedef struct {
+    double  time_ms;
+    long    rss_kb;
+    long    live_bytes;
+    long    ops_done;
+} rss_sample_t;
+
+static rss_sample_t rss_samples[MAX_SAMPLES];
+static int          num_rss_samples;
+static atomic_int   sampler_stop;
+static uint64_t     replay_t0;
+
+static void take_rss_sample(void)
+{
+    if (num_rss_samples >= MAX_SAMPLES)
+        return;
+    rss_sample_t *s = &rss_samples[num_rss_samples++];
+    s->time_ms = elapsed_ms(replay_t0, now_ns());
+    s->rss_kb = get_rss_kb();
+    s->live_bytes = s->ops_done = 0;
+    for (int i = 0; i < trace.nthreads; i++) {
+        s->live_bytes += atomic_load_explicit(&trace.threads[i].live, memory_order_relaxed);
+        s->ops_done += atomic_load_explicit(&trace.threads[i].done, memory_order_relaxed);
+    }
+}
+
+static void *rss_sampler(void *arg)
+{
+    (void)arg;
+    struct timespec ts = { interval_ms / 1000, (interval_ms % 1000) * 1000000L };
+    while (!atomic_load(&sampler_stop)) {
+        take_rss_sample();
+        nanosleep(&ts, NULL);
+    }
+    return NULL;
+}
+
+/* ── Output ─────────────────────────────────────────────────────────── */
+
+static void print_trace_info(const char *path)
+{
+    char b1[32], b2[32], b3[32];
+    double span_s = (double)trace.span_ticks * trace.ns_per_tick / 1e9;
+    long frees = trace.op_count[ATRACE_FREE] + trace.op_count[ATRACE_REALLOC];
+
+    printf("  Trace     : %s\n", path);
+    printf("  Threads   : %d\n", trace.nthreads);
+    printf("  Span      : %.3f s traced, %ld calls (%s calls/sec)\n", span_s, trace.nops,
+           format_ops(span_s > 0 ? (double)trace.nops / span_s : 0, b1, sizeof(b1)));
+    printf("  Calls     : malloc %ld  calloc %ld  realloc %ld  memalign %ld  free %ld\n",
+           trace.op_count[ATRACE_MALLOC], trace.op_count[ATRACE_CALLOC],
+           trace.op_count[ATRACE_REALLOC], trace.op_count[ATRACE_MEMALIGN],
+           trace.op_count[ATRACE_FREE]);
+    printf("  Sizes     : p50 %s  p99 %s  max %s\n",
+           format_bytes((long)hdr_percentile(&trace.sizes, 50), b1, sizeof(b1)),
+           format_bytes((long)hdr_percentile(&trace.sizes, 99), b2, sizeof(b2)),
+           format_bytes((long)trace.sizes.max, b3, sizeof(b3)));
+    printf("  Cross-thread frees: %ld (%.1f%%)", trace.cross_frees,
+           frees ? 100.0 * trace.cross_frees / frees : 0.0);
+    if (trace.dropped)
+        printf("  (%ld frees of untraced pointers dropped)", trace.dropped);
+    printf("\n");
+}
+
+static void write_rss_csv(const char *path)
+{
+    FILE *f = fopen(path, "w");
+    if (!f) { perror(path); exit(1); }
+    fprintf(f, "allocator,time_ms,rss_kb,live_bytes,ops_done\n");
+    for (int i = 0; i < num_rss_samples; i++)
+        fprintf(f, "%s,%.1f,%ld,%ld,%ld\n", detect_allocator(), rss_samples[i].time_ms,
+                rss_samples[i].rss_kb, rss_samples[i].live_bytes, rss_samples[i].ops_done);
+    fclose(f);
+}
+
+/* ",p50,p99,p99.9,max" in ns */
+static void lat_csv_cols(const lat_histogram_t *h, char *buf, size_t len)
+{
+    snprintf(buf, len, ",%lu,%lu,%lu,%lu",
+             lat_hist_percentile(h, 50), lat_hist_percentile(h, 99),
+             lat_hist_percentile(h, 99.9), h->max);
+}
+
+/* ── Main ───────────────────────────────────────────────────────────── */
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [--csv] [--sample N] [--no-touch] [--rss FILE] "
+            "[--interval MS] [--json FILE] [--info] TRACE\n", prog);
+    fprintf(stderr, "Record a trace: ATRACE_FILE=app.trace LD_PRELOAD=bin/libatrace.so ./app\n");
+    fprintf(stderr, "Env: LAT_DIGITS=1..4 (histogram precision, default %d), "
+            "TSC_TIMER=clock (time with clock_gettime)\n", LAT_HIST_DIGITS);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *path = NULL, *rss_path = NULL, *json_path = NULL;
+    int info_only = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--csv") == 0)
+            csv_mode = 1;
+        else if (strcmp(argv[i], "--info") == 0)
+            info_only = 1;
+        else if (strcmp(argv[i], "--no-touch") == 0)
+            touch_enabled = 0;
+        else if (strcmp(argv[i], "--sample") == 0 && i + 1 < argc)
+            tsc_sample_every = (uint32_t)atol(argv[++i]);
+        else if (strcmp(argv[i], "--rss") == 0 && i + 1 < argc)
+            rss_path = argv[++i];
+        else if (strcmp(argv[i], "--interval") == 0 && i + 1 < argc)
+            interval_ms = atol(argv[++i]) > 0 ? atol(argv[i]) : 10;
+        else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc)
+            json_path = argv[++i];
+        else if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+            usage(argv[0]);
+            return 0;
+        } else
+            path = argv[i];
+    }
+    if (!path) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    build_replay(path);
+
+    if (!csv_mode || info_only) {
+        printf("Allocation Trace Replay\n");
+        print_separator();
+        printf("  Allocator : %s\n", detect_allocator());
+        print_trace_info(path);
+    }
+    if (info_only)
+        return 0;
+    if (bj_open(json_path, "bench_replay", argc, argv) < 0)
+        return 1;
+    bj_meta("allocator", detect_allocator());
+
+    tsc_init();
+    if (!csv_mode) {
+        char timer[96];
+        printf("  Timer     : %s\n", tsc_describe(timer, sizeof(timer)));
+        if (tsc_sample_every > 1)
+            printf("  Sampling  : 1 in %u ops timed\n", tsc_sample_every);
+    }
+
+    pthread_barrier_init(&start_barrier, NULL, trace.nthreads + 1);
+    for (int i = 0; i < trace.nthreads; i++)
+        if (pthread_create(&trace.threads[i].thread, NULL, replay_worker, &trace.threads[i]) != 0) {
+            perror("pthread_create");
+            exit(1);
+        }
+
+    pthread_t sampler;
+    long rss_base_kb = get_rss_kb();
+    pthread_barrier_wait(&start_barrier);
+    replay_t0 = now_ns();
+    pthread_create(&sampler, NULL, rss_sampler, NULL);
+
+    for (int i = 0; i < trace.nthreads; i++)
+        pthread_join(trace.threads[i].thread, NULL);
+    uint64_t t1 = now_ns();
+    atomic_store(&sampler_stop, 1);
+    pthread_join(sampler, NULL);
+    take_rss_sample();
+
+    long rss_peak_kb = rss_base_kb, peak_live = 0;
+    for (int i = 0; i < num_rss_samples; i++) {
+        if (rss_samples[i].rss_kb > rss_peak_kb)
+            rss_peak_kb = rss_samples[i].rss_kb;
+        if (rss_samples[i].live_bytes > peak_live)
+            peak_live = rss_samples[i].live_bytes;
+    }
+
+    lat_histogram_t lat_alloc, lat_free, lat_realloc;
+    lat_hist_init(&lat_alloc);
+    lat_hist_init(&lat_free);
+    lat_hist_init(&lat_realloc);
+    for (int i = 0; i < trace.nthreads; i++) {
+        lat_hist_merge(&lat_alloc, &trace.threads[i].lat_alloc);
+        lat_hist_merge(&lat_free, &trace.threads[i].lat_free);
+        lat_hist_merge(&lat_realloc, &trace.threads[i].lat_realloc);
+    }
+
+    double ms = elapsed_ms(replay_t0, t1);
+    double ops_sec = (double)trace.nops / elapsed_s(replay_t0, t1);
+    const char *trace_name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+
+    bj_result("replay");
+    bj_param_str("trace", trace_name);
+    bj_param_int("threads", trace.nthreads);
+    bj_metric("ops_per_sec", ops_sec, "ops/s", BJ_HIGHER);
+    bj_metric("elapsed_ms", ms, "ms", BJ_LOWER);
+    bj_metric("rss_peak_kb", (double)rss_peak_kb, "kB", BJ_LOWER);
+    bj_metric("peak_live_bytes", (double)peak_live, "B", BJ_NONE);
+    lat_json("malloc", &lat_alloc);
+    lat_json("free", &lat_free);
+    lat_json("realloc", &lat_realloc);
+
+    if (csv_mode) {
+        char a[64], f[64], r[64];
+        lat_csv_cols(&lat_alloc, a, sizeof(a));
+        lat_csv_cols(&lat_free, f, sizeof(f));
+        lat_csv_cols(&lat_realloc, r, sizeof(r));
+        printf("allocator,trace,threads,ops,elapsed_ms,ops_per_sec,rss_base_kb,rss_peak_kb,"
+               "peak_live_bytes,cross_frees,malloc_p50_ns,malloc_p99_ns,malloc_p999_ns,malloc_max_ns,"
+               "free_p50_ns,free_p99_ns,free_p999_ns,free_max_ns,"
+               "realloc_p50_ns,realloc_p99_ns,realloc_p999_ns,realloc_max_ns\n");
+        printf("%s,%s,%d,%ld,%.1f,%.0f,%ld,%ld,%ld,%ld%s%s%s\n", detect_allocator(),
+               trace_name, trace.nthreads, trace.nops, ms, ops_sec,
+               rss_base_kb, rss_peak_kb, peak_live, trace.cross_frees, a, f, r);
+    } else {
+        char b1[32], b2[32], b3[32];
+        printf("\n  Replay\n");
+        print_separator();
+        printf("  Total time        : %.1f ms\n", ms);
+        printf("  Throughput        : %s calls/sec\n", format_ops(ops_sec, b1, sizeof(b1)));
+        printf("  RSS peak          : %s", format_bytes(rss_peak_kb * 1024L, b2, sizeof(b2)));
+        printf(" (baseline %s: the replay's own tables)\n",
+               format_bytes(rss_base_kb * 1024L, b3, sizeof(b3)));
+        printf("  Peak live bytes   : %s (sampled)\n", format_bytes(peak_live, b3, sizeof(b3)));
+        lat_hist_print(&lat_alloc, "malloc");
+        lat_hist_print(&lat_free, "free");
+        if (lat_realloc.count)
+            lat_hist_print(&lat_realloc, "realloc");
+
+        /* RSS over time: ~10 evenly spaced samples */
+        printf("\n  %10s %12s %12s %12s\n", "time_ms", "RSS", "live", "calls done");
+        int step = num_rss_samples > 10 ? num_rss_samples / 10 : 1;
+        for (int i = 0; i < num_rss_samples; i += step) {
+            rss_sample_t *s = &rss_samples[i];
+            if (i + step >= num_rss_samples)
+                s = &rss_samples[num_rss_samples - 1];
+            printf("  %10.1f %12s %12s %12ld\n", s->time_ms,
+                   format_bytes(s->rss_kb * 1024L, b1, sizeof(b1)),
+                   format_bytes(s->live_bytes, b2, sizeof(b2)), s->ops_done);
+        }
+    }
+    if (rss_path)
+        write_rss_csv(rss_path);
+
+    /* Blocks the trace never freed */
+    for (uint32_t i = 0; i < trace.nobjs; i++)
+        free(objs[i]);
+    return 0;
+}
@@ -10,13 +10,25 @@
  *   5. Alloc/free churn (fragment-inducing pattern)
  *
  * Usage:
- *   ./bench_single [--csv] [workload_name]
+ *   ./bench_single [--csv] [--perf] [--hist FILE] [--sample N] [--json FILE] [workload_name]
  *   LD_PRELOAD=/path/to/libjemalloc.so ./bench_single
  *
  * Environment:
  *   OPS=N  — override number of operations per workload (default varies)
+ *   LAT_DIGITS=N — latency histogram precision, significant digits (default 2)
+ *
+ * --perf counts cycles, instructions, cache and dTLB misses over each
+ * workload's timed region (perf_group.h) and reports them per op.
+ * --hist appends every workload's malloc and free histograms to FILE
+ * (hdr_hist.h text format), for merging or comparing runs later.
+ *
+ * Per-op latency is read from the cycle counter (tsc.h), with the timer's
+ * own cost subtracted; clock_gettime() pairs cost about as much as a
+ * small malloc. --sample N times only 1 in N ops (at random), so the
+ * timing barely perturbs the caches and branch predictors the op uses.
  */
 #include "common.h"
+#include "perf_group.h"
 
 /* ── Workload parameters ────────────────────────────────────────────── */
 
@@ -44,8 +56,12 @@ typedef struct {
     double      frag_ratio;       /* peak RSS / live_bytes */
     lat_histogram_t lat_alloc;
     lat_histogram_t lat_free;
+    struct pg_counts perf;        /* timed region, with --perf */
 } bench_result_t;
 
+/* Counter group for the main thread; all workloads run on it */
+static struct pg_set perf_set = { .leader = -1 };
+
 /* ── 1. Small allocations (8–64 bytes) ──────────────────────────────── */
 
 static bench_result_t bench_small_allocs(long ops)
@@ -62,13 +78,13 @@ static bench_result_t bench_small_allocs(long ops)
 
     /* Allocate */
     uint64_t t0 = now_ns();
+    pg_start(&perf_set);
     long total_bytes = 0;
     for (long i = 0; i < ops; i++) {
         size_t sz = rand_size(&rng, 8, 64);
-        uint64_t a = now_ns();
+        uint64_t a = lat_begin();
         ptrs[i] = malloc(sz);
-        uint64_t b = now_ns();
-        lat_hist_record(&r.lat_alloc, b - a);
+        lat_end(&r.lat_alloc, a);
         if (!ptrs[i]) { fprintf(stderr, "malloc failed at op %ld\n", i); break; }
         /* Touch the memory to ensure it's mapped */
         ((char *)ptrs[i])[0] = (char)i;
@@ -81,11 +97,11 @@ static bench_result_t bench_small_allocs(long ops)
 
     /* Free */
     for (long i = 0; i < ops; i++) {
-        uint64_t a = now_ns();
+        uint64_t a = lat_begin();
         free(ptrs[i]);
-        uint64_t b = now_ns();
-        lat_hist_record(&r.lat_free, b - a);
+        lat_end(&r.lat_free, a);
     }
+    pg_stop(&perf_set, &r.perf);
     uint64_t t1 = now_ns();
 
     r.rss_after_kb = get_rss_kb();
@@ -111,13 +127,13 @@ static bench_result_t bench_medium_allocs(long ops)
     r.rss_before_kb = get_rss_kb();
 
     uint64_t t0 = now_ns();
+    pg_start(&perf_set);
     long total_bytes = 0;
     for (long i = 0; i < ops; i++) {
         size_t sz = rand_size(&rng, 1024, 65536);
-        uint64_t a = now_ns();
+        uint64_t a = lat_begin();
         ptrs[i] = malloc(sz);
-        uint64_t b = now_ns();
-        lat_hist_record(&r.lat_alloc, b - a);
+        lat_end(&r.lat_alloc, a);
         if (!ptrs[i]) { fprintf(stderr, "malloc failed at op %ld\n", i); break; }
         ((char *)ptrs[i])[0] = (char)i;
         total_bytes += sz;
@@ -128,11 +144,11 @@ static bench_result_t bench_medium_allocs(long ops)
         r.frag_ratio = (double)(r.rss_peak_kb * 1024L) / total_bytes;
 
     for (long i = 0; i < ops; i++) {
-        uint64_t a = now_ns();
+        uint64_t a = lat_begin();
         free(ptrs[i]);
-        uint64_t b = now_ns();
-        lat_hist_record(&r.lat_free, b - a);
+        lat_end(&r.lat_free, a);
     }
+    pg_stop(&perf_set, &r.perf);
     uint64_t t1 = now_ns();
 
     r.rss_after_kb = get_rss_kb();
@@ -158,13 +174,13 @@ static bench_result_t bench_large_allocs(long ops)
     r.rss_before_kb = get_rss_kb();
 
     uint64_t t0 = now_ns();
+    pg_start(&perf_set);
     long total_bytes = 0;
     for (long i = 0; i < ops; i++) {
         size_t sz = rand_size(&rng, 1024 * 1024, 4 * 1024 * 1024);
-        uint64_t a = now_ns();
+        uint64_t a = lat_begin();
         ptrs[i] = malloc(sz);
-        uint64_t b = now_ns();
-        lat_hist_record(&r.lat_alloc, b - a);
+        lat_end(&r.lat_alloc, a);
         if (!ptrs[i]) { fprintf(stderr, "malloc failed at op %ld\n", i); break; }
         /* Touch first and last page to force mapping */
         ((char *)ptrs[i])[0] = (char)i;
@@ -177,11 +193,11 @@ static bench_result_t bench_large_allocs(long ops)
         r.frag_ratio = (double)(r.rss_peak_kb * 1024L) / total_bytes;
 
     for (long i = 0; i < ops; i++) {
-        uint64_t a = now_ns();
+        uint64_t a = lat_begin();
         free(ptrs[i]);
-        uint64_t b = now_ns();
-        lat_hist_record(&r.lat_free, b - a);
+        lat_end(&r.lat_free, a);
     }
+    pg_stop(&perf_set, &r.perf);
     uint64_t t1 = now_ns();
 
     r.rss_after_kb = get_rss_kb();
@@ -212,14 +228,14 @@ static bench_result_t bench_mixed_allocs(long ops)
      * This mimics real application allocation patterns.
      */
     uint64_t t0 = now_ns();
+    pg_start(&perf_set);
     long total_bytes = 0;
     for (long i = 0; i < ops; i++) {
         size_t sz = rand_size_lognormal(&rng, 6.0, 2.0);
         if (sz > 256 * 1024) sz = 256 * 1024;  /* cap at 256 KB */
-        uint64_t a = now_ns();
+        uint64_t a = lat_begin();
         ptrs[i] = malloc(sz);
-        uint64_t b = now_ns();
-        lat_hist_record(&r.lat_alloc, b - a);
+        lat_end(&r.lat_alloc, a);
         if (!ptrs[i]) { fprintf(stderr, "malloc failed at op %ld\n", i); break; }
         ((char *)ptrs[i])[0] = (char)i;
         total_bytes += sz;
@@ -230,11 +246,11 @@ static bench_result_t bench_mixed_allocs(long ops)
         r.frag_ratio = (double)(r.rss_peak_kb * 1024L) / total_bytes;
 
     for (long i = 0; i < ops; i++) {
-        uint64_t a = now_ns();
+        uint64_t a = lat_begin();
         free(ptrs[i]);
-        uint64_t b = now_ns();
-        lat_hist_record(&r.lat_free, b - a);
+        lat_end(&r.lat_free, a);
     }
+    pg_stop(&perf_set, &r.perf);
     uint64_t t1 = now_ns();
 
     r.rss_after_kb = get_rss_kb();
@@ -263,6 +279,7 @@ static bench_result_t bench_churn(long ops)
     r.rss_before_kb = get_rss_kb();
 
     uint64_t t0 = now_ns();
+    pg_start(&perf_set);
     long total_allocs = 0;
     long total_frees = 0;
     long live_bytes = 0;
@@ -272,10 +289,9 @@ static bench_result_t bench_churn(long ops)
     for (long i = 0; i < pool_size / 2; i++) {
         size_t sz = rand_size_lognormal(&rng, 5.5, 1.5);
         if (sz > 64 * 1024) sz = 64 * 1024;
-        uint64_t a = now_ns();
+        uint64_t a = lat_begin();
         ptrs[i] = malloc(sz);
-        uint64_t b = now_ns();
-        lat_hist_record(&r.lat_alloc, b - a);
+        lat_end(&r.lat_alloc, a);
         if (ptrs[i]) {
             ((char *)ptrs[i])[0] = 1;
             sizes[i] = sz;
@@ -288,10 +304,9 @@ static bench_result_t bench_churn(long ops)
     for (long i = 0; i < ops; i++) {
         long idx = (long)(xorshift64(&rng) % pool_size);
         if (ptrs[idx]) {
-            uint64_t a = now_ns();
+            uint64_t a = lat_begin();
             free(ptrs[idx]);
-            uint64_t b = now_ns();
-            lat_hist_record(&r.lat_free, b - a);
+            lat_end(&r.lat_free, a);
             live_bytes -= sizes[idx];
             ptrs[idx] = NULL;
             sizes[idx] = 0;
@@ -300,10 +315,9 @@ static bench_result_t bench_churn(long ops)
         /* Re-allocate with a different size */
         size_t sz = rand_size_lognormal(&rng, 5.5, 1.5);
         if (sz > 64 * 1024) sz = 64 * 1024;
-        uint64_t a = now_ns();
+        uint64_t a = lat_begin();
         ptrs[idx] = malloc(sz);
-        uint64_t b = now_ns();
-        lat_hist_record(&r.lat_alloc, b - a);
+        lat_end(&r.lat_alloc, a);
         if (ptrs[idx]) {
             ((char *)ptrs[idx])[0] = 1;
             sizes[idx] = sz;
@@ -325,6 +339,7 @@ static bench_result_t bench_churn(long ops)
             total_frees++;
         }
     }
+    pg_stop(&perf_set, &r.perf);
     uint64_t t1 = now_ns();
 
     r.rss_after_kb = get_rss_kb();
@@ -342,24 +357,40 @@ static int csv_mode = 0;
 
 static void print_result(const bench_result_t *r)
 {
+    double total_ops = r->ops_per_sec * r->elapsed_ms / 1000.0;
+    char perf[128] = "";
+
+    bj_result(r->name);
+    bj_param_int("ops", r->ops);
+    bj_metric("ops_per_sec", r->ops_per_sec, "ops/s", BJ_HIGHER);
+    bj_metric("elapsed_ms", r->elapsed_ms, "ms", BJ_LOWER);
+    bj_metric("rss_peak_kb", (double)r->rss_peak_kb, "kB", BJ_LOWER);
+    bj_metric("frag_ratio", r->frag_ratio, "ratio", BJ_LOWER);
+    lat_json("alloc", &r->lat_alloc);
+    lat_json("free", &r->lat_free);
+
     if (csv_mode) {
+        if (pg_enabled)
+            pg_csv(&r->perf, total_ops, perf, sizeof(perf));
         printf("%s,%s,%ld,%.1f,%.0f,%ld,%ld,%ld,%ld,%.2f,"
-               "%lu,%lu,%lu,%lu,%lu,"
-               "%lu,%lu,%lu,%lu,%lu\n",
+               "%lu,%lu,%lu,%lu,%lu,%lu,"
+               "%lu,%lu,%lu,%lu,%lu,%lu%s\n",
                detect_allocator(), r->name, r->ops,
                r->elapsed_ms, r->ops_per_sec,
                r->rss_before_kb, r->rss_peak_kb, r->rss_after_kb,
                r->live_bytes, r->frag_ratio,
-               r->lat_alloc.min_ns,
+               hdr_min(&r->lat_alloc),
                lat_hist_percentile(&r->lat_alloc, 50),
                lat_hist_percentile(&r->lat_alloc, 95),
                lat_hist_percentile(&r->lat_alloc, 99),
-               r->lat_alloc.max_ns,
-               r->lat_free.min_ns,
+               lat_hist_percentile(&r->lat_alloc, 99.9),
+               r->lat_alloc.max,
+               hdr_min(&r->lat_free),
                lat_hist_percentile(&r->lat_free, 50),
                lat_hist_percentile(&r->lat_free, 95),
                lat_hist_percentile(&r->lat_free, 99),
-               r->lat_free.max_ns);
+               lat_hist_percentile(&r->lat_free, 99.9),
+               r->lat_free.max, perf);
         return;
     }
 
@@ -374,6 +405,8 @@ static void print_result(const bench_result_t *r)
     printf("  RSS after free    : %s\n", format_bytes(r->rss_after_kb * 1024L, buf4, sizeof(buf4)));
     printf("  Live bytes (peak) : %s\n", format_bytes(r->live_bytes, buf1, sizeof(buf1)));
     printf("  Frag ratio        : %.2f  (RSS / live bytes; 1.0 = perfect)\n", r->frag_ratio);
+    if (pg_enabled)
+        printf("  HW counters       : %s\n", pg_format(&r->perf, total_ops, perf, sizeof(perf)));
     printf("  Alloc latency:\n");
     lat_hist_print(&r->lat_alloc, "malloc");
     printf("  Free latency:\n");
@@ -384,8 +417,9 @@ static void print_csv_header(void)
 {
     printf("allocator,workload,ops,elapsed_ms,ops_per_sec,"
            "rss_before_kb,rss_peak_kb,rss_after_kb,live_bytes,frag_ratio,"
-           "alloc_min_ns,alloc_p50_ns,alloc_p95_ns,alloc_p99_ns,alloc_max_ns,"
-           "free_min_ns,free_p50_ns,free_p95_ns,free_p99_ns,free_max_ns\n");
+           "alloc_min_ns,alloc_p50_ns,alloc_p95_ns,alloc_p99_ns,alloc_p999_ns,alloc_max_ns,"
+           "free_min_ns,free_p50_ns,free_p95_ns,free_p99_ns,free_p999_ns,free_max_ns%s\n",
+           pg_enabled ? PG_CSV_HEADER : "");
 }
 
 /* ── Main ───────────────────────────────────────────────────────────── */
@@ -407,22 +441,37 @@ static const int NUM_WORKLOADS = sizeof(workloads) / sizeof(workloads[0]);
 
 static void usage(const char *prog)
 {
-    fprintf(stderr, "Usage: %s [--csv] [workload_name]\n\n", prog);
+    fprintf(stderr, "Usage: %s [--csv] [--perf] [--hist FILE] [--sample N] [--json FILE] "
+            "[workload_name]\n\n", prog);
     fprintf(stderr, "Workloads: ");
     for (int i = 0; i < NUM_WORKLOADS; i++)
         fprintf(stderr, "%s%s", workloads[i].name, i < NUM_WORKLOADS - 1 ? ", " : "\n");
     fprintf(stderr, "\nEnvironment:\n");
     fprintf(stderr, "  OPS=N          Override operation count\n");
+    fprintf(stderr, "  LAT_DIGITS=N   Latency histogram significant digits (1-4, default %d)\n",
+            LAT_HIST_DIGITS);
+    fprintf(stderr, "  TSC_TIMER=clock Time ops with clock_gettime instead of the cycle counter\n");
     fprintf(stderr, "  LD_PRELOAD=... Swap allocator\n");
 }
 
 int main(int argc, char *argv[])
 {
-    const char *filter = NULL;
+    const char *filter = NULL, *json_path = NULL;
+    FILE *hist_out = NULL;
 
     for (int i = 1; i < argc; i++) {
         if (strcmp(argv[i], "--csv") == 0)
             csv_mode = 1;
+        else if (strcmp(argv[i], "--perf") == 0)
+            pg_enabled = 1;
+        else if (strcmp(argv[i], "--hist") == 0 && i + 1 < argc) {
+            hist_out = fopen(argv[++i], "a");
+            if (!hist_out) { perror(argv[i]); return 1; }
+        } else if (strcmp(argv[i], "--sample") == 0 && i + 1 < argc) {
+            long n = atol(argv[++i]);
+            tsc_sample_every = n > 1 ? (uint32_t)n : 1;
+        } else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc)
+            json_path = argv[++i];
         else if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
             usage(argv[0]);
             return 0;
@@ -430,12 +479,22 @@ int main(int argc, char *argv[])
             filter = argv[i];
     }
 
+    if (bj_open(json_path, "bench_single", argc, argv) < 0)
+        return 1;
+    bj_meta("allocator", detect_allocator());
+    pg_open(&perf_set, pg_default_events, PG_DEFAULT_N);
+    tsc_init();
+
     if (!csv_mode) {
         printf("Memory Allocator Micro-Benchmark\n");
         print_separator();
         printf("  Allocator: %s\n", detect_allocator());
         printf("  Cores    : %d\n", get_num_cores());
         printf("  PID      : %d\n", getpid());
+        char tbuf[96];
+        printf("  Timer    : %s\n", tsc_describe(tbuf, sizeof(tbuf)));
+        if (tsc_sample_every > 1)
+            printf("  Sampling : 1 in %u ops timed\n", tsc_sample_every);
     } else {
         print_csv_header();
     }
@@ -447,7 +506,20 @@ int main(int argc, char *argv[])
         long ops = get_ops(workloads[i].default_ops);
         bench_result_t r = workloads[i].fn(ops);
         print_result(&r);
+
+        if (hist_out) {
+            char label[96];
+            snprintf(label, sizeof(label), "%s/%s/malloc", detect_allocator(), r.name);
+            hdr_save(&r.lat_alloc, label, hist_out);
+            snprintf(label, sizeof(label), "%s/%s/free", detect_allocator(), r.name);
+            hdr_save(&r.lat_free, label, hist_out);
+        }
+        lat_hist_free(&r.lat_alloc);
+        lat_hist_free(&r.lat_free);
     }
 
+    if (hist_out)
+        fclose(hist_out);
+    pg_close(&perf_set);
     return 0;
 }
@@ -15,6 +15,10 @@
 #include <errno.h>
 #include <math.h>
 
+#include "hdr_hist.h"
+#include "tsc.h"       /* 02-cache-line-false-sharing/src */
+#include "bench_json.h"    /* 20-perf-regression-ci/src */
+
 /* ── Timing ─────────────────────────────────────────────────────────── */
 
 static inline uint64_t now_ns(void)
@@ -53,20 +57,33 @@ static inline int get_num_cores(void)
 
 /* ── RSS measurement (/proc/self/status → VmRSS) ───────────────────── */
 
-static inline long get_rss_kb(void)
+/* A "Field:  N kB" line of /proc/self/status, in KB (-1 if missing) */
+static inline long proc_status_kb(const char *field)
 {
     FILE *f = fopen("/proc/self/status", "r");
     if (!f) return -1;
     char line[256];
-    long rss = -1;
+    size_t len = strlen(field);
+    long kb = -1;
     while (fgets(line, sizeof(line), f)) {
-        if (strncmp(line, "VmRSS:", 6) == 0) {
-            sscanf(line + 6, " %ld", &rss);
+        if (strncmp(line, field, len) == 0 && line[len] == ':') {
+            sscanf(line + len + 1, " %ld", &kb);
             break;
         }
     }
     fclose(f);
-    return rss;  /* in KB */
+    return kb;
+}
+
+static inline long get_rss_kb(void)
+{
+    return proc_status_kb("VmRSS");
+}
+
+/* High-water mark of RSS over the life of the process */
+static inline long get_peak_rss_kb(void)
+{
+    return proc_status_kb("VmHWM");
 }
 
 static inline long get_rss_bytes(void)
@@ -75,54 +92,49 @@ static inline long get_rss_bytes(void)
     return (kb > 0) ? kb * 1024L : -1;
 }
 
-/* ── Latency histogram (log2-based buckets) ─────────────────────────── */
+/* ── Latency histogram (log-linear, hdr_hist.h) ─────────────────────── */
 
 /*
- * Records latencies in nanoseconds into log2 buckets.
- * Bucket i covers [2^i, 2^(i+1)) ns.
- * MAX_LAT_BUCKETS=32 covers up to ~4 seconds.
+ * Records latencies in nanoseconds with LAT_DIGITS significant digits
+ * (default 2: every percentile is at most 1% above the true value, not
+ * up to 2x like power-of-two buckets). Values up to 2^36 ns (~68 s).
  */
-#define MAX_LAT_BUCKETS 32
+#define LAT_HIST_DIGITS   2
+#define LAT_HIST_MAX_BITS 36
 
-typedef struct {
-    uint64_t buckets[MAX_LAT_BUCKETS];
-    uint64_t count;
-    uint64_t sum_ns;
-    uint64_t min_ns;
-    uint64_t max_ns;
-} lat_histogram_t;
+typedef struct hdr_hist lat_histogram_t;
 
 static inline void lat_hist_init(lat_histogram_t *h)
 {
-    memset(h, 0, sizeof(*h));
-    h->min_ns = UINT64_MAX;
+    static int digits;
+    if (!digits) {
+        const char *env = getenv("LAT_DIGITS");
+        digits = env && atoi(env) >= 1 && atoi(env) <= 4 ? atoi(env) : LAT_HIST_DIGITS;
+    }
+    if (hdr_init(h, HDR_SUB_BITS(digits), LAT_HIST_MAX_BITS) < 0) {
+        perror("lat_hist_init");
+        exit(1);
+    }
+}
+
+static inline void lat_hist_free(lat_histogram_t *h)
+{
+    hdr_free(h);
 }
 
 static inline void lat_hist_record(lat_histogram_t *h, uint64_t latency_ns)
 {
-    int bucket = 0;
-    uint64_t v = latency_ns;
-    while (v > 1 && bucket < MAX_LAT_BUCKETS - 1) {
-        v >>= 1;
-        bucket++;
-    }
-    h->buckets[bucket]++;
-    h->count++;
-    h->sum_ns += latency_ns;
-    if (latency_ns < h->min_ns) h->min_ns = latency_ns;
-    if (latency_ns > h->max_ns) h->max_ns = latency_ns;
+    hdr_record(h, latency_ns);
+}
+
+static inline void lat_hist_merge(lat_histogram_t *dst, const lat_histogram_t *src)
+{
+    hdr_merge(dst, src);
 }
 
 static inline uint64_t lat_hist_percentile(const lat_histogram_t *h, double pct)
 {
-    uint64_t target = (uint64_t)(h->count * pct / 100.0);
-    uint64_t cumulative = 0;
-    for (int i = 0; i < MAX_LAT_BUCKETS; i++) {
-        cumulative += h->buckets[i];
-        if (cumulative >= target)
-            return (1ULL << i);  /* lower bound of bucket */
-    }
-    return h->max_ns;
+    return hdr_percentile(h, pct);
 }
 
 static inline void lat_hist_print(const lat_histogram_t *h, const char *label)
@@ -131,15 +143,48 @@ static inline void lat_hist_print(const lat_histogram_t *h, const char *label)
         printf("  %-20s (no samples)\n", label);
         return;
     }
-    double avg_ns = (double)h->sum_ns / h->count;
     printf("  %-20s  count=%-10lu  avg=%7.0f ns  "
-           "min=%lu  p50=%lu  p95=%lu  p99=%lu  max=%lu ns\n",
-           label, h->count, avg_ns,
-           h->min_ns,
+           "min=%lu  p50=%lu  p95=%lu  p99=%lu  p99.9=%lu  max=%lu ns\n",
+           label, h->count, hdr_mean(h),
+           hdr_min(h),
            lat_hist_percentile(h, 50),
            lat_hist_percentile(h, 95),
            lat_hist_percentile(h, 99),
-           h->max_ns);
+           lat_hist_percentile(h, 99.9),
+           h->max);
+}
+
+/* "<op>_p50_ns", _p99_ns, _p999_ns, _max_ns metrics of the current --json result */
+static inline void lat_json(const char *op, const lat_histogram_t *h)
+{
+    char key[48];
+    if (h->count == 0)
+        return;
+    snprintf(key, sizeof(key), "%s_p50_ns", op);
+    bj_metric(key, (double)lat_hist_percentile(h, 50), "ns", BJ_LOWER);
+    snprintf(key, sizeof(key), "%s_p99_ns", op);
+    bj_metric(key, (double)lat_hist_percentile(h, 99), "ns", BJ_LOWER);
+    snprintf(key, sizeof(key), "%s_p999_ns", op);
+    bj_metric(key, (double)lat_hist_percentile(h, 99.9), "ns", BJ_LOWER);
+    snprintf(key, sizeof(key), "%s_max_ns", op);
+    bj_metric(key, (double)h->max, "ns", BJ_LOWER);
+}
+
+/*
+ * Per-op timing: t = lat_begin(); op; lat_end(h, t). Reads the cycle
+ * counter (tsc.h, after tsc_init()) and records the op minus the timer's
+ * own overhead, for the ops tsc_sample() picks; the rest cost one
+ * predictable branch.
+ */
+static inline uint64_t lat_begin(void)
+{
+    return tsc_sample() ? tsc_start() : 0;
+}
+
+static inline void lat_end(lat_histogram_t *h, uint64_t t0)
+{
+    if (t0)
+        lat_hist_record(h, tsc_elapsed_ns(t0, tsc_stop()));
 }
 
 /* ── Random size generators ─────────────────────────────────────────── */
@@ -220,6 +265,8 @@ static inline const char *detect_allocator(void)
         return "tcmalloc";
     if (strstr(preload, "mimalloc"))
         return "mimalloc";
+    if (strstr(preload, "libatrace"))
+        return "glibc";         /* only the trace shim (libatrace.so) */
     return "unknown";
 }
 
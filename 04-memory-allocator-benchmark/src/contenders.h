@@ -0,0 +1,378 @@
+#ifndef CONTENDERS_H
+#define CONTENDERS_H
+
+/*
+ * contenders.h — Custom allocators to race against the global malloc
+ *
+ * The realistic workloads are the textbook cases for replacing malloc in
+ * application code; these are the three usual replacements, behind one
+ * interface so every workload runs unchanged against each:
+ *
+ *   malloc  the global allocator (glibc, or whatever LD_PRELOAD put there)
+ *   arena   bump pointer over 256 KB chunks; free is a no-op and reset()
+ *           drops everything at once (the chunks are kept for the next
+ *           scope). One arena per scope: a request, a document.
+ *   slab    size classes of 16 B .. 32 KB (4 per power of two, the
+ *           hdr_hist.h layout over 16-byte units) carved from 64 KB
+ *           pages, or 8 objects' worth for the big classes. Each thread
+ *           keeps its own free list per class and trades batches of 32
+ *           with a locked per-class depot, so the common path takes no
+ *           lock. Memory never goes back to the OS.
+ *   pool    one object size, fixed at create(): a free list over 64 KB
+ *           chunks. Other sizes fall through to malloc. Single-threaded.
+ *
+ * Everything above 32 KB (the arena: above 64 KB) goes to malloc. The
+ * free is sized, as in C++14 sized delete: the workloads know what they
+ * allocated, and slab/pool would otherwise need a header per object.
+ *
+ *   const struct contender *a = find_contender("slab");
+ *   void *ctx = a->create(sizeof(struct node));
+ *   void *p = a->alloc(ctx, n);  ...  a->free(ctx, p, n);
+ *   a->reset(ctx);                     (end of scope; arena only)
+ *   a->destroy(ctx);
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "hdr_hist.h"
+
+struct contender {
+    const char *name;
+    int         scoped;     /* free() is a no-op: one ctx per scope, reset() it */
+    void     *(*create)(size_t obj_size);   /* obj_size: the workload's hot object */
+    void      (*destroy)(void *ctx);
+    void     *(*alloc)(void *ctx, size_t size);
+    void      (*free)(void *ctx, void *p, size_t size);
+    void      (*reset)(void *ctx);
+};
+
+/* ── malloc ─────────────────────────────────────────────────────────── */
+
+static void *sys_create(size_t obj_size) { (void)obj_size; return NULL; }
+static void  sys_destroy(void *ctx) { (void)ctx; }
+static void *sys_alloc(void *ctx, size_t size) { (void)ctx; return malloc(size); }
+static void  sys_free(void *ctx, void *p, size_t size) { (void)ctx; (void)size; free(p); }
+static void  sys_reset(void *ctx) { (void)ctx; }
+
+/* ── arena ──────────────────────────────────────────────────────────── */
+
+#define ARENA_CHUNK (256 * 1024)
+#define ARENA_LARGE (ARENA_CHUNK / 4)   /* bigger: own malloc, freed at reset */
+
+typedef struct arena_chunk {
+    struct arena_chunk *next;
+    size_t              size;
+    _Alignas(16) char   data[];
+} arena_chunk_t;
+
+typedef struct {
+    arena_chunk_t *chunks;      /* all regular chunks, in carving order */
+    arena_chunk_t *cur;
+    size_t         pos;         /* next free byte in cur */
+    arena_chunk_t *large;       /* oversized blocks */
+} arena_t;
+
+static arena_chunk_t *arena_chunk_new(size_t size)
+{
+    arena_chunk_t *c = malloc(sizeof(*c) + size);
+    if (!c) return NULL;
+    c->next = NULL;
+    c->size = size;
+    return c;
+}
+
+static void *arena_create(size_t obj_size)
+{
+    (void)obj_size;
+    arena_t *a = calloc(1, sizeof(*a));
+    if (!a) return NULL;
+    a->chunks = a->cur = arena_chunk_new(ARENA_CHUNK);
+    if (!a->chunks) { free(a); return NULL; }
+    return a;
+}
+
+static void *arena_alloc(void *ctx, size_t size)
+{
+    arena_t *a = ctx;
+    size = (size + 15) & ~(size_t)15;
+
+    if (size > ARENA_LARGE) {
+        arena_chunk_t *c = arena_chunk_new(size);
+        if (!c) return NULL;
+        c->next = a->large;
+        a->large = c;
+        return c->data;
+    }
+    if (a->pos + size > a->cur->size) {
+        /* Next chunk: one kept from before the last reset, or a new one */
+        if (!a->cur->next && !(a->cur->next = arena_chunk_new(ARENA_CHUNK)))
+            return NULL;
+        a->cur = a->cur->next;
+        a->pos = 0;
+    }
+    void *p = a->cur->data + a->pos;
+    a->pos += size;
+    return p;
+}
+
+static void arena_free(void *ctx, void *p, size_t size)
+{
+    (void)ctx; (void)p; (void)size;
+}
+
+static void arena_reset(void *ctx)
+{
+    arena_t *a = ctx;
+    while (a->large) {
+        arena_chunk_t *next = a->large->next;
+        free(a->large);
+        a->large = next;
+    }
+    a->cur = a->chunks;
+    a->pos = 0;
+}
+
+static void arena_destroy(void *ctx)
+{
+    arena_t *a = ctx;
+    if (!a) return;
+    arena_reset(a);
+    while (a->chunks) {
+        arena_chunk_t *next = a->chunks->next;
+        free(a->chunks);
+        a->chunks = next;
+    }
+    free(a);
+}
+
+/* ── slab ───────────────────────────────────────────────────────────── */
+
+#define SLAB_PAGE     (64 * 1024)
+#define SLAB_MAX      (32 * 1024)
+#define SLAB_SUB_BITS 2
+#define SLAB_CLASSES  40            /* slab_class_of(SLAB_MAX) + 1 */
+#define SLAB_BATCH    32
+
+typedef struct slab_obj { struct slab_obj *next; } slab_obj_t;
+
+typedef struct slab_page { struct slab_page *next; } slab_page_t;
+
+static struct {
+    pthread_mutex_t lock;
+    slab_obj_t     *depot[SLAB_CLASSES];    /* objects flushed by threads */
+    long            ndepot[SLAB_CLASSES];
+    char           *bump[SLAB_CLASSES];     /* uncarved tail of the newest page */
+    char           *end[SLAB_CLASSES];
+    slab_page_t    *pages;
+} slab = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static __thread slab_obj_t *slab_tl[SLAB_CLASSES];
+static __thread int         slab_tl_n[SLAB_CLASSES];
+
+/* 16-byte units 1..8 exact, then 4 classes per doubling: 160, 192, 224, 256, 320 ... */
+static inline unsigned int slab_class_of(size_t size)
+{
+    return hdr_index((size + 15) / 16 - 1, SLAB_SUB_BITS);
+}
+
+static inline size_t slab_class_size(unsigned int cls)
+{
+    return (hdr_highest(cls, SLAB_SUB_BITS) + 1) * 16;
+}
+
+static void *slab_create(size_t obj_size)
+{
+    (void)obj_size;
+    return &slab;
+}
+
+/* Fill this thread's list for cls: a batch from the depot, else carve */
+static int slab_refill(unsigned int cls)
+{
+    size_t sz = slab_class_size(cls);
+    size_t page = 8 * sz + 16 > SLAB_PAGE ? 8 * sz + 16 : SLAB_PAGE;
+    int n = 0;
+
+    pthread_mutex_lock(&slab.lock);
+    while (n < SLAB_BATCH && slab.depot[cls]) {
+        slab_obj_t *o = slab.depot[cls];
+        slab.depot[cls] = o->next;
+        slab.ndepot[cls]--;
+        o->next = slab_tl[cls];
+        slab_tl[cls] = o;
+        n++;
+    }
+    while (n < SLAB_BATCH) {
+        if (slab.bump[cls] + sz > slab.end[cls]) {
+            slab_page_t *pg = malloc(page);
+            if (!pg) break;
+            pg->next = slab.pages;
+            slab.pages = pg;
+            slab.bump[cls] = (char *)pg + 16;
+            slab.end[cls] = (char *)pg + page;
+        }
+        slab_obj_t *o = (slab_obj_t *)slab.bump[cls];
+        slab.bump[cls] += sz;
+        o->next = slab_tl[cls];
+        slab_tl[cls] = o;
+        n++;
+    }
+    pthread_mutex_unlock(&slab.lock);
+    slab_tl_n[cls] += n;
+    return n;
+}
+
+static void *slab_alloc(void *ctx, size_t size)
+{
+    (void)ctx;
+    if (size > SLAB_MAX)
+        return malloc(size);
+    unsigned int cls = slab_class_of(size ? size : 1);
+    if (!slab_tl[cls] && !slab_refill(cls))
+        return NULL;
+    slab_obj_t *o = slab_tl[cls];
+    slab_tl[cls] = o->next;
+    slab_tl_n[cls]--;
+    return o;
+}
+
+static void slab_free(void *ctx, void *p, size_t size)
+{
+    (void)ctx;
+    if (!p) return;
+    if (size > SLAB_MAX) {
+        free(p);
+        return;
+    }
+    unsigned int cls = slab_class_of(size ? size : 1);
+    slab_obj_t *o = p;
+    o->next = slab_tl[cls];
+    slab_tl[cls] = o;
+
+    /* Cap what one thread hoards: hand a batch back to the depot */
+    if (++slab_tl_n[cls] > 2 * SLAB_BATCH) {
+        slab_obj_t *head = slab_tl[cls], *tail = head;
+        for (int i = 1; i < SLAB_BATCH; i++)
+            tail = tail->next;
+        slab_tl[cls] = tail->next;
+        slab_tl_n[cls] -= SLAB_BATCH;
+        pthread_mutex_lock(&slab.lock);
+        tail->next = slab.depot[cls];
+        slab.depot[cls] = head;
+        slab.ndepot[cls] += SLAB_BATCH;
+        pthread_mutex_unlock(&slab.lock);
+    }
+}
+
+static void slab_reset(void *ctx) { (void)ctx; }
+
+/* Release every page; only valid once no thread holds slab objects */
+static void slab_destroy(void *ctx)
+{
+    (void)ctx;
+    pthread_mutex_lock(&slab.lock);
+    while (slab.pages) {
+        slab_page_t *next = slab.pages->next;
+        free(slab.pages);
+        slab.pages = next;
+    }
+    for (int i = 0; i < SLAB_CLASSES; i++) {
+        slab.depot[i] = NULL;
+        slab.ndepot[i] = 0;
+        slab.bump[i] = slab.end[i] = NULL;
+    }
+    pthread_mutex_unlock(&slab.lock);
+    memset(slab_tl, 0, sizeof(slab_tl));
+    memset(slab_tl_n, 0, sizeof(slab_tl_n));
+}
+
+/* ── pool ───────────────────────────────────────────────────────────── */
+
+#define POOL_CHUNK (64 * 1024)
+
+typedef struct {
+    size_t       obj_size;
+    slab_obj_t  *free_list;
+    slab_page_t *chunks;
+    char        *bump, *end;
+} pool_t;
+
+static void *pool_create(size_t obj_size)
+{
+    pool_t *p = calloc(1, sizeof(*p));
+    if (!p) return NULL;
+    p->obj_size = obj_size < sizeof(slab_obj_t) ? sizeof(slab_obj_t)
+                                                : (obj_size + 15) & ~(size_t)15;
+    return p;
+}
+
+static void *pool_alloc(void *ctx, size_t size)
+{
+    pool_t *p = ctx;
+    if (size > p->obj_size)
+        return malloc(size);
+    if (p->free_list) {
+        slab_obj_t *o = p->free_list;
+        p->free_list = o->next;
+        return o;
+    }
+    if (p->bump + p->obj_size > p->end) {
+        slab_page_t *c = malloc(POOL_CHUNK);
+        if (!c) return NULL;
+        c->next = p->chunks;
+        p->chunks = c;
+        p->bump = (char *)c + 16;
+        p->end = (char *)c + POOL_CHUNK;
+    }
+    void *o = p->bump;
+    p->bump += p->obj_size;
+    return o;
+}
+
+static void pool_free(void *ctx, void *ptr, size_t size)
+{
+    pool_t *p = ctx;
+    if (!ptr) return;
+    if (size > p->obj_size) {
+        free(ptr);
+        return;
+    }
+    slab_obj_t *o = ptr;
+    o->next = p->free_list;
+    p->free_list = o;
+}
+
+static void pool_reset(void *ctx) { (void)ctx; }
+
+static void pool_destroy(void *ctx)
+{
+    pool_t *p = ctx;
+    if (!p) return;
+    while (p->chunks) {
+        slab_page_t *next = p->chunks->next;
+        free(p->chunks);
+        p->chunks = next;
+    }
+    free(p);
+}
+
+/* ── Registry ───────────────────────────────────────────────────────── */
+
+static const struct contender contenders[] = {
+    { "malloc", 0, sys_create,   sys_destroy,   sys_alloc,   sys_free,   sys_reset   },
+    { "arena",  1, arena_create, arena_destroy, arena_alloc, arena_free, arena_reset },
+    { "slab",   0, slab_create,  slab_destroy,  slab_alloc,  slab_free,  slab_reset  },
+    { "pool",   0, pool_create,  pool_destroy,  pool_alloc,  pool_free,  pool_reset  },
+};
+#define NUM_CONTENDERS ((int)(sizeof(contenders) / sizeof(contenders[0])))
+
+static inline const struct contender *find_contender(const char *name)
+{
+    for (int i = 0; i < NUM_CONTENDERS; i++)
+        if (strcmp(contenders[i].name, name) == 0)
+            return &contenders[i];
+    return NULL;
+}
+
+#endif /* CONTENDERS_H */
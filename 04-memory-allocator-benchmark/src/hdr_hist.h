@@ -0,0 +1,312 @@
+#ifndef HDR_HIST_H
+#define HDR_HIST_H
+
+/*
+ * hdr_hist.h — Log-linear ("HDR-style") histogram of integer values
+ *
+ * Values below 2^sub_bits get a bucket each. Above that, every power of
+ * two [2^e, 2^(e+1)) is split into 2^sub_bits equal buckets of width
+ * 2^(e - sub_bits), so a bucket is never wider than 2^-sub_bits of the
+ * values in it: HDR_SUB_BITS(2) = 7 keeps 2 significant digits (0.8%),
+ * HDR_SUB_BITS(3) = 10 keeps 3 (0.1%). Values of 2^max_bits and above
+ * share the last bucket.
+ *
+ *   sub_bits 2:  0 1 2 3 | 4 5 6 7 | 8 10 12 14 | 16 20 24 28 | 32 ...
+ *
+ * The index math (hdr_index, hdr_lowest, hdr_highest, HDR_BUCKETS) has
+ * no loops, no floating point and no libc, and is also compiled into BPF
+ * programs (03-scheduler-latency-monitor records into plain count
+ * arrays with it). struct hdr_hist and everything after it is userspace:
+ *
+ *   struct hdr_hist h;
+ *   hdr_init(&h, HDR_SUB_BITS(2), 36);     (ns: up to ~68 s)
+ *   hdr_record(&h, ns); ...
+ *   hdr_percentile(&h, 99.9);              (never below the true value,
+ *                                           at most 2^-sub_bits above)
+ *   hdr_merge(&total, &h);                 (e.g. per-thread → global)
+ *   hdr_save(&h, "label", f); hdr_load(&h, label, len, f);
+ *   hdr_free(&h);
+ */
+
+#ifdef __bpf__
+#define HDR_INLINE static __always_inline
+#else
+#define HDR_INLINE static inline
+#endif
+
+/* Smallest sub_bits with 2^-sub_bits <= 10^-digits (1 → 4, 2 → 7, 3 → 10) */
+#define HDR_SUB_BITS(digits)            (((digits) * 3322 + 999) / 1000)
+
+/* Buckets needed for values below 2^max_bits */
+#define HDR_BUCKETS(sub_bits, max_bits) (((max_bits) - (sub_bits) + 1) << (sub_bits))
+
+/* floor(log2(v)) for v > 0 */
+HDR_INLINE int hdr_log2(unsigned long long v)
+{
+#ifdef __bpf__
+    /* No clz instruction in BPF: binary search, six shift-and-or steps */
+    unsigned int r, shift;
+
+    r = (v > 0xFFFFFFFFULL) << 5; v >>= r;
+    shift = (v > 0xFFFF) << 4; v >>= shift; r |= shift;
+    shift = (v > 0xFF) << 3;   v >>= shift; r |= shift;
+    shift = (v > 0xF) << 2;    v >>= shift; r |= shift;
+    shift = (v > 0x3) << 1;    v >>= shift; r |= shift;
+    r |= (unsigned int)(v >> 1);
+    return (int)r;
+#else
+    return 63 - __builtin_clzll(v);
+#endif
+}
+
+/* Bucket of v (callers clamp it to HDR_BUCKETS - 1) */
+HDR_INLINE unsigned int hdr_index(unsigned long long v, int sub_bits)
+{
+    unsigned long long sub = 1ULL << sub_bits;
+    int e;
+
+    if (v < sub)
+        return (unsigned int)v;
+    e = hdr_log2(v);
+    return ((unsigned int)(e - sub_bits + 1) << sub_bits) +
+           (unsigned int)((v >> (e - sub_bits)) - sub);
+}
+
+/* Smallest value that lands in bucket idx */
+HDR_INLINE unsigned long long hdr_lowest(unsigned int idx, int sub_bits)
+{
+    unsigned int octave = idx >> sub_bits;
+    unsigned long long m = idx & ((1U << sub_bits) - 1);
+
+    if (octave == 0)
+        return m;
+    return ((1ULL << sub_bits) + m) << (octave - 1);
+}
+
+/* Largest value that lands in bucket idx */
+HDR_INLINE unsigned long long hdr_highest(unsigned int idx, int sub_bits)
+{
+    return hdr_lowest(idx + 1, sub_bits) - 1;
+}
+
+#ifndef __bpf__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+
+struct hdr_hist {
+    int       sub_bits;
+    int       max_bits;
+    int       nbuckets;
+    uint64_t *counts;
+    uint64_t  count;
+    uint64_t  sum;              /* bucket midpoints for hdr_add() */
+    uint64_t  min, max;         /* UINT64_MAX, 0 while empty */
+};
+
+static inline void hdr_reset(struct hdr_hist *h)
+{
+    memset(h->counts, 0, (size_t)h->nbuckets * sizeof(h->counts[0]));
+    h->count = h->sum = h->max = 0;
+    h->min = UINT64_MAX;
+}
+
+/* Returns 0, or -1 (errno set) for a bad layout or out of memory */
+static inline int hdr_init(struct hdr_hist *h, int sub_bits, int max_bits)
+{
+    memset(h, 0, sizeof(*h));
+    if (sub_bits < 1 || sub_bits > 16 || max_bits <= sub_bits || max_bits > 63) {
+        errno = EINVAL;
+        return -1;
+    }
+    h->sub_bits = sub_bits;
+    h->max_bits = max_bits;
+    h->nbuckets = HDR_BUCKETS(sub_bits, max_bits);
+    h->counts = calloc(h->nbuckets, sizeof(h->counts[0]));
+    if (!h->counts)
+        return -1;
+    hdr_reset(h);
+    return 0;
+}
+
+static inline void hdr_free(struct hdr_hist *h)
+{
+    free(h->counts);
+    h->counts = NULL;
+    h->nbuckets = 0;
+}
+
+static inline unsigned int hdr_bucket(const struct hdr_hist *h, uint64_t v)
+{
+    unsigned int i = hdr_index(v, h->sub_bits);
+    return i < (unsigned int)h->nbuckets ? i : (unsigned int)h->nbuckets - 1;
+}
+
+static inline void hdr_record(struct hdr_hist *h, uint64_t v)
+{
+    h->counts[hdr_bucket(h, v)]++;
+    h->count++;
+    h->sum += v;
+    if (v < h->min) h->min = v;
+    if (v > h->max) h->max = v;
+}
+
+/*
+ * Add n values known only by their bucket (counts from a BPF map, or a
+ * bucket of another layout): min and max become bucket bounds and the
+ * sum uses the midpoint.
+ */
+static inline void hdr_add(struct hdr_hist *h, unsigned int idx, uint64_t n)
+{
+    if (n == 0 || idx >= (unsigned int)h->nbuckets)
+        return;
+    uint64_t lo = hdr_lowest(idx, h->sub_bits);
+    uint64_t hi = hdr_highest(idx, h->sub_bits);
+    h->counts[idx] += n;
+    h->count += n;
+    h->sum += n * (lo + (hi - lo) / 2);
+    if (lo < h->min) h->min = lo;
+    if (hi > h->max) h->max = hi;
+}
+
+/* dst += src; a different layout is re-bucketed (within its precision) */
+static inline void hdr_merge(struct hdr_hist *dst, const struct hdr_hist *src)
+{
+    if (src->count == 0)
+        return;
+    if (dst->sub_bits == src->sub_bits && dst->max_bits == src->max_bits) {
+        for (int i = 0; i < src->nbuckets; i++)
+            dst->counts[i] += src->counts[i];
+    } else {
+        for (int i = 0; i < src->nbuckets; i++) {
+            if (!src->counts[i])
+                continue;
+            uint64_t lo = hdr_lowest(i, src->sub_bits);
+            uint64_t hi = hdr_highest(i, src->sub_bits);
+            dst->counts[hdr_bucket(dst, lo + (hi - lo) / 2)] += src->counts[i];
+        }
+    }
+    dst->count += src->count;
+    dst->sum += src->sum;
+    if (src->min < dst->min) dst->min = src->min;
+    if (src->max > dst->max) dst->max = src->max;
+}
+
+/*
+ * Value at percentile pct (0..100]: the upper bound of the bucket holding
+ * the ceil(count * pct / 100)-th smallest value, clamped to [min, max].
+ * 100 is the exact maximum; 0 when empty.
+ */
+static inline uint64_t hdr_percentile(const struct hdr_hist *h, double pct)
+{
+    if (h->count == 0)
+        return 0;
+    double want = (double)h->count * pct / 100.0;
+    uint64_t rank = (uint64_t)want;
+    if ((double)rank < want) rank++;
+    if (rank < 1) rank = 1;
+    if (rank >= h->count)
+        return h->max;
+
+    uint64_t cum = 0;
+    for (int i = 0; i < h->nbuckets; i++) {
+        cum += h->counts[i];
+        if (cum >= rank) {
+            uint64_t v = hdr_highest(i, h->sub_bits);
+            return v < h->min ? h->min : v > h->max ? h->max : v;
+        }
+    }
+    return h->max;
+}
+
+static inline uint64_t hdr_min(const struct hdr_hist *h)
+{
+    return h->count ? h->min : 0;
+}
+
+static inline double hdr_mean(const struct hdr_hist *h)
+{
+    return h->count ? (double)h->sum / (double)h->count : 0.0;
+}
+
+/* ── Serialization ── */
+
+/*
+ * Text, one histogram per block, sparse, so files concatenate and
+ * histograms of separate runs can be loaded and merged later:
+ *
+ *   hdr1 LABEL sub_bits=7 max_bits=36 count=N sum=S min=M max=X
+ *   BUCKET COUNT                       (non-empty buckets only)
+ *   end
+ *
+ * LABEL is one word (spaces are written as '_').
+ */
+static inline int hdr_save(const struct hdr_hist *h, const char *label, FILE *f)
+{
+    fputs("hdr1 ", f);
+    for (const char *c = label; *c; c++)
+        fputc(*c == ' ' || *c == '\n' ? '_' : *c, f);
+    fprintf(f, " sub_bits=%d max_bits=%d count=%lu sum=%lu min=%lu max=%lu\n",
+            h->sub_bits, h->max_bits, (unsigned long)h->count,
+            (unsigned long)h->sum, (unsigned long)hdr_min(h), (unsigned long)h->max);
+    for (int i = 0; i < h->nbuckets; i++)
+        if (h->counts[i])
+            fprintf(f, "%d %lu\n", i, (unsigned long)h->counts[i]);
+    fputs("end\n", f);
+    return ferror(f) ? -1 : 0;
+}
+
+/*
+ * Read the next block into h (initialized here; hdr_free() it) and its
+ * label. Returns 0, 1 at end of file, -1 on a malformed block.
+ */
+static inline int hdr_load(struct hdr_hist *h, char *label, size_t len, FILE *f)
+{
+    char line[256], name[128];
+    int sub_bits, max_bits;
+    unsigned long count, sum, min, max;
+
+    do {
+        if (!fgets(line, sizeof(line), f))
+            return 1;
+    } while (line[0] == '\n' || line[0] == '#');
+
+    if (sscanf(line, "hdr1 %127s sub_bits=%d max_bits=%d count=%lu sum=%lu min=%lu max=%lu",
+               name, &sub_bits, &max_bits, &count, &sum, &min, &max) != 7)
+        return -1;
+    if (hdr_init(h, sub_bits, max_bits) < 0)
+        return -1;
+    if (label && len) {
+        size_t n = strlen(name) < len ? strlen(name) : len - 1;
+        memcpy(label, name, n);
+        label[n] = '\0';
+    }
+
+    uint64_t seen = 0;
+    while (fgets(line, sizeof(line), f)) {
+        int idx;
+        unsigned long n;
+        if (strncmp(line, "end", 3) == 0) {
+            if (seen != count)
+                break;
+            h->count = count;
+            h->sum = sum;
+            h->min = count ? min : UINT64_MAX;
+            h->max = max;
+            return 0;
+        }
+        if (sscanf(line, "%d %lu", &idx, &n) != 2 || idx < 0 || idx >= h->nbuckets)
+            break;
+        h->counts[idx] += n;
+        seen += n;
+    }
+    hdr_free(h);
+    return -1;
+}
+
+#endif /* !__bpf__ */
+
+#endif /* HDR_HIST_H */
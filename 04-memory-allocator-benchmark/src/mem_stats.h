@@ -0,0 +1,384 @@
+#ifndef MEM_STATS_H
+#define MEM_STATS_H
+
+/*
+ * mem_stats.h — Where the resident memory goes
+ *
+ * VmRSS says how much is resident, not why. These split it up:
+ *
+ *   mem_rss_kb()           resident set from /proc/self/statm, through an fd
+ *                          kept open: one pread(), no fopen/fgets/sscanf.
+ *                          Cheap enough to call every few thousand ops.
+ *   mem_rollup(&r)         /proc/self/smaps_rollup: Rss, Pss, anonymous,
+ *                          transparent huge pages, swap. Walks every VMA,
+ *                          so once per phase, not per sample.
+ *   alloc_stats(&s)        the running allocator's own counters, whichever
+ *                          it is (looked up with dlsym, nothing to link):
+ *                            jemalloc  mallctl("stats.allocated" / "resident" / "metadata")
+ *                            tcmalloc  MallocExtension_GetNumericProperty()
+ *                            mimalloc  mi_process_info() (committed only)
+ *                            glibc     mallinfo2()
+ *   alloc_stats_dump()     the allocator's own full report, on stderr
+ *   mem_heatmap_scan()     /proc/self/pagemap over the anonymous mappings:
+ *                          resident pages by how full of live objects they are
+ *
+ * With live = bytes the program asked for:
+ *
+ *   allocated - live       size-class rounding and per-block headers
+ *   heap - allocated       free memory the allocator holds on to
+ *   anon - heap            not the heap: the program's own arrays, stacks,
+ *                          allocator metadata outside its counters
+ *
+ * Include after common.h (RTLD_DEFAULT needs its _GNU_SOURCE).
+ */
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+/* ── statm ──────────────────────────────────────────────────────────── */
+
+static inline long mem_rss_kb(void)
+{
+    static int fd = -2;
+    static long page_kb;
+    char buf[128];
+
+    if (fd == -2) {
+        fd = open("/proc/self/statm", O_RDONLY | O_CLOEXEC);
+        page_kb = sysconf(_SC_PAGESIZE) / 1024;
+    }
+    if (fd < 0)
+        return -1;
+    ssize_t n = pread(fd, buf, sizeof(buf) - 1, 0);
+    if (n <= 0)
+        return -1;
+    buf[n] = '\0';
+    /* "size resident shared text lib data 0", in pages */
+    char *p = strchr(buf, ' ');
+    return p ? strtol(p + 1, NULL, 10) * page_kb : -1;
+}
+
+/* ── smaps_rollup ───────────────────────────────────────────────────── */
+
+struct mem_rollup {
+    long rss_kb, pss_kb, anon_kb, thp_kb, swap_kb;    /* -1: unavailable */
+};
+
+static inline int mem_rollup(struct mem_rollup *r)
+{
+    static const struct { const char *key; size_t off; } fields[] = {
+        { "Rss:",           offsetof(struct mem_rollup, rss_kb) },
+        { "Pss:",           offsetof(struct mem_rollup, pss_kb) },
+        { "Anonymous:",     offsetof(struct mem_rollup, anon_kb) },
+        { "AnonHugePages:", offsetof(struct mem_rollup, thp_kb) },
+        { "Swap:",          offsetof(struct mem_rollup, swap_kb) },
+    };
+    r->rss_kb = r->pss_kb = r->anon_kb = r->thp_kb = r->swap_kb = -1;
+
+    FILE *f = fopen("/proc/self/smaps_rollup", "r");   /* Linux 4.14+ */
+    if (!f)
+        return -1;
+    char line[256];
+    while (fgets(line, sizeof(line), f))
+        for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++)
+            if (strncmp(line, fields[i].key, strlen(fields[i].key)) == 0)
+                *(long *)((char *)r + fields[i].off) = atol(line + strlen(fields[i].key));
+    fclose(f);
+    return 0;
+}
+
+/* ── Allocator statistics ───────────────────────────────────────────── */
+
+struct alloc_stats {
+    const char *source;         /* "jemalloc mallctl", ..., or NULL */
+    long allocated;             /* bytes in blocks handed out (-1: unknown) */
+    long heap;                  /* bytes the allocator has resident or committed */
+    long metadata;              /* its own bookkeeping, where reported */
+};
+
+typedef int  (*mallctl_fn)(const char *, void *, size_t *, void *, size_t);
+typedef int  (*tc_property_fn)(const char *, size_t *);
+typedef void (*mi_process_info_fn)(size_t *, size_t *, size_t *, size_t *, size_t *,
+                                   size_t *, size_t *, size_t *);
+
+static inline long mallctl_size(mallctl_fn ctl, const char *name)
+{
+    size_t v, sz = sizeof(v);
+    return ctl(name, &v, &sz, NULL, 0) == 0 ? (long)v : -1;
+}
+
+static inline long tc_property(tc_property_fn get, const char *name)
+{
+    size_t v;
+    return get(name, &v) ? (long)v : -1;
+}
+
+static inline int alloc_stats(struct alloc_stats *s)
+{
+    s->source = NULL;
+    s->allocated = s->heap = s->metadata = -1;
+
+    mallctl_fn ctl = (mallctl_fn)dlsym(RTLD_DEFAULT, "mallctl");
+    if (ctl) {
+        /* Counters are snapshots, refreshed by writing the epoch */
+        uint64_t epoch = 1;
+        size_t sz = sizeof(epoch);
+        ctl("epoch", &epoch, &sz, &epoch, sz);
+        s->source = "jemalloc mallctl";
+        s->allocated = mallctl_size(ctl, "stats.allocated");
+        s->heap = mallctl_size(ctl, "stats.resident");
+        s->metadata = mallctl_size(ctl, "stats.metadata");
+        return 0;
+    }
+
+    tc_property_fn tc = (tc_property_fn)dlsym(RTLD_DEFAULT, "MallocExtension_GetNumericProperty");
+    if (tc) {
+        long heap = tc_property(tc, "generic.heap_size");
+        long unmapped = tc_property(tc, "tcmalloc.pageheap_unmapped_bytes");
+        s->source = "tcmalloc MallocExtension";
+        s->allocated = tc_property(tc, "generic.current_allocated_bytes");
+        s->heap = heap >= 0 && unmapped >= 0 ? heap - unmapped : heap;
+        return 0;
+    }
+
+    mi_process_info_fn mi = (mi_process_info_fn)dlsym(RTLD_DEFAULT, "mi_process_info");
+    if (mi) {
+        size_t elapsed, utime, stime, rss, peak_rss, commit, peak_commit, faults;
+        mi(&elapsed, &utime, &stime, &rss, &peak_rss, &commit, &peak_commit, &faults);
+        s->source = "mimalloc mi_process_info";
+        s->heap = (long)commit;
+        return 0;
+    }
+
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+    struct mallinfo2 mi2 = mallinfo2();
+    s->source = "glibc mallinfo2";
+    s->allocated = (long)(mi2.uordblks + mi2.hblkhd);
+    s->heap = (long)(mi2.arena + mi2.hblkhd);
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+/* The allocator's native report (stderr) */
+static inline void alloc_stats_dump(void)
+{
+    void (*je)(void *, void *, const char *) =
+        (void (*)(void *, void *, const char *))dlsym(RTLD_DEFAULT, "malloc_stats_print");
+    void (*tc)(char *, int) = (void (*)(char *, int))dlsym(RTLD_DEFAULT, "MallocExtension_GetStats");
+    void (*mi)(void *) = (void (*)(void *))dlsym(RTLD_DEFAULT, "mi_stats_print");
+
+    if (je)
+        je(NULL, NULL, NULL);
+    else if (tc) {
+        static char buf[64 * 1024];
+        tc(buf, sizeof(buf));
+        fputs(buf, stderr);
+    } else if (mi)
+        mi(NULL);
+    else
+        malloc_stats();
+}
+
+/* ── pagemap heatmap ────────────────────────────────────────────────── */
+
+#define HEAT_BINS       5       /* resident pages 0%, <25%, <50%, <75%, <=100% live */
+#define HEAT_MAX_PAGES  (16L << 20)     /* 64 GB of mappings */
+#define HEAT_REGIONS    256
+#define HEAT_WIDTH      64
+
+struct heat_region {
+    uintptr_t start, end;
+    long      first;            /* index of its first page in live[] */
+};
+
+struct mem_heatmap {
+    long  resident;             /* resident pages in anonymous mappings */
+    long  bins[HEAT_BINS];      /* ... by the share of their bytes that are live */
+    long  live_absent;          /* pages holding live bytes, not resident */
+    long  empty_kb;             /* resident, no live byte: retained free memory */
+    int   nregions;
+    struct heat_region regions[HEAT_REGIONS];
+    uint32_t *live;             /* live bytes per page */
+    uint8_t  *present;          /* pagemap bit 63 per page */
+    long  npages;
+};
+
+static const char heat_chars[] = " .:-=#";   /* absent, then the HEAT_BINS */
+
+static inline int heat_bin(uint32_t live, long page)
+{
+    if (live == 0) return 0;
+    if (live * 4 < page) return 1;
+    if (live * 2 < page) return 2;
+    if (live * 4 < page * 3) return 3;
+    return 4;
+}
+
+static inline void heat_add(struct mem_heatmap *h, uintptr_t p, size_t size, long page)
+{
+    int lo = 0, hi = h->nregions - 1;
+    uintptr_t end = p + size;
+
+    while (lo <= hi) {          /* region holding p */
+        int mid = (lo + hi) / 2;
+        if (p < h->regions[mid].start) hi = mid - 1;
+        else if (p >= h->regions[mid].end) lo = mid + 1;
+        else {
+            const struct heat_region *r = &h->regions[mid];
+            if (end > r->end) end = r->end;
+            while (p < end) {
+                uintptr_t next = (p & ~(uintptr_t)(page - 1)) + page;
+                uintptr_t stop = next < end ? next : end;
+                h->live[r->first + (long)((p - r->start) / page)] += (uint32_t)(stop - p);
+                p = stop;
+            }
+            return;
+        }
+    }
+}
+
+/*
+ * Scan the private anonymous mappings (heap and mmap'd, not stacks): for
+ * each page, whether it is resident and how many bytes of the n live
+ * objects ptrs[i], sizes[i] lie on it. Returns 0, -1 if /proc is closed
+ * to us; mem_heatmap_free() it.
+ */
+static inline int mem_heatmap_scan(struct mem_heatmap *h, void *const *ptrs,
+                                   const size_t *sizes, long n)
+{
+    long page = sysconf(_SC_PAGESIZE);
+    memset(h, 0, sizeof(*h));
+
+    FILE *maps = fopen("/proc/self/maps", "r");
+    if (!maps)
+        return -1;
+    char line[512];
+    while (fgets(line, sizeof(line), maps) && h->nregions < HEAT_REGIONS) {
+        unsigned long start, end, inode;
+        char perms[8], path[256] = "";
+        if (sscanf(line, "%lx-%lx %7s %*s %*s %lu %255s", &start, &end, perms, &inode, path) < 4)
+            continue;
+        if (perms[0] != 'r' || perms[1] != 'w' || perms[3] != 'p' || inode != 0)
+            continue;
+        if (path[0] && strcmp(path, "[heap]") != 0)
+            continue;           /* [stack], [vvar], ... */
+        long pages = (long)((end - start) / page);
+        if (h->npages + pages > HEAT_MAX_PAGES)
+            continue;           /* huge reservations (mostly unbacked) */
+        h->regions[h->nregions++] = (struct heat_region){ start, end, h->npages };
+        h->npages += pages;
+    }
+    fclose(maps);
+
+    h->live = calloc(h->npages ? h->npages : 1, sizeof(h->live[0]));
+    h->present = calloc(h->npages ? h->npages : 1, 1);
+    if (!h->live || !h->present)
+        return -1;
+
+    for (long i = 0; i < n; i++)
+        if (ptrs[i])
+            heat_add(h, (uintptr_t)ptrs[i], sizes[i], page);
+
+    int fd = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    uint64_t buf[4096];
+    for (int r = 0; r < h->nregions; r++) {
+        long pages = (long)((h->regions[r].end - h->regions[r].start) / page);
+        off_t off = (off_t)(h->regions[r].start / page) * 8;
+        for (long done = 0; done < pages; ) {
+            long want = pages - done < 4096 ? pages - done : 4096;
+            ssize_t got = pread(fd, buf, want * 8, off + done * 8);
+            if (got <= 0)
+                break;
+            for (long k = 0; k < got / 8; k++)
+                h->present[h->regions[r].first + done + k] = (uint8_t)(buf[k] >> 63);
+            done += got / 8;
+        }
+    }
+    close(fd);
+
+    for (long i = 0; i < h->npages; i++) {
+        if (h->present[i]) {
+            h->resident++;
+            h->bins[heat_bin(h->live[i], page)]++;
+        } else if (h->live[i]) {
+            h->live_absent++;
+        }
+    }
+    h->empty_kb = h->bins[0] * page / 1024;
+    return 0;
+}
+
+static inline void mem_heatmap_free(struct mem_heatmap *h)
+{
+    free(h->live);
+    free(h->present);
+    h->live = NULL;
+    h->present = NULL;
+}
+
+/*
+ * Pages by fill, then the largest mappings as strips of HEAT_WIDTH cells,
+ * each the most common state of its pages:
+ *   ' ' not resident  '.' resident, empty  ':' <25%  '-' <50%  '=' <75%  '#' full
+ */
+static inline void mem_heatmap_print(const struct mem_heatmap *h, int max_regions)
+{
+    long page = sysconf(_SC_PAGESIZE);
+    double res = h->resident ? (double)h->resident : 1.0;
+
+    printf("    Resident pages: %ld   empty %.1f%%  <25%% %.1f%%  <50%% %.1f%%  "
+           "<75%% %.1f%%  full %.1f%%   (live but not resident: %ld)\n",
+           h->resident, 100.0 * h->bins[0] / res, 100.0 * h->bins[1] / res,
+           100.0 * h->bins[2] / res, 100.0 * h->bins[3] / res, 100.0 * h->bins[4] / res,
+           h->live_absent);
+
+    int used[HEAT_REGIONS] = {0};
+    for (int shown = 0; shown < max_regions; shown++) {
+        /* Next largest mapping with anything resident */
+        int best = -1;
+        long best_res = 0;
+        for (int r = 0; r < h->nregions; r++) {
+            if (used[r]) continue;
+            long pages = (long)((h->regions[r].end - h->regions[r].start) / page), nres = 0;
+            for (long i = 0; i < pages; i++)
+                nres += h->present[h->regions[r].first + i];
+            if (nres > best_res) { best = r; best_res = nres; }
+        }
+        if (best < 0)
+            break;
+        used[best] = 1;
+
+        const struct heat_region *r = &h->regions[best];
+        long pages = (long)((r->end - r->start) / page);
+        long per = (pages + HEAT_WIDTH - 1) / HEAT_WIDTH;
+        char strip[HEAT_WIDTH + 1];
+        int cells = 0;
+        for (long c = 0; c < pages; c += per) {
+            long count[HEAT_BINS + 1] = {0};
+            for (long i = c; i < c + per && i < pages; i++) {
+                long idx = r->first + i;
+                count[h->present[idx] ? 1 + heat_bin(h->live[idx], page) : 0]++;
+            }
+            /* Most common resident class; blank only if nothing is resident */
+            int m = 0;
+            for (int b = 1; b <= HEAT_BINS; b++)
+                if (count[b] > (m ? count[m] : 0)) m = b;
+            strip[cells++] = heat_chars[m];
+        }
+        strip[cells] = '\0';
+        printf("    %012lx %7ld KB |%s|\n", (unsigned long)r->start,
+               (long)((r->end - r->start) / 1024), strip);
+    }
+}
+
+#endif /* MEM_STATS_H */
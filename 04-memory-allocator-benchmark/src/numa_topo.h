@@ -0,0 +1,336 @@
+#ifndef NUMA_TOPO_H
+#define NUMA_TOPO_H
+
+/*
+ * numa_topo.h — NUMA topology, page placement and THP controls
+ *
+ * For bench_mt's placement workloads. Straight system calls and sysfs,
+ * nothing to link (no libnuma):
+ *
+ *   numa_topo_load(&t)       online nodes from /sys/devices/system/node:
+ *                            the CPUs of each this process may run on
+ *                            (sched_getaffinity), memory, distances. One
+ *                            pseudo-node holding every usable CPU when
+ *                            there is no NUMA sysfs.
+ *   numa_core_list(&t,n,nd)  n CPUs to pin to: node nd's, or all of them
+ *                            node by node (nd = -1), wrapping around
+ *   numa_set_interleave(&t)  set_mempolicy(MPOL_INTERLEAVE) over every
+ *   numa_set_default()       node with memory, and back; calling thread only
+ *   numa_page_nodes()        move_pages() without moving: the node each
+ *                            page is on
+ *
+ *   thp_mode_get/set()       /sys/kernel/mm/transparent_hugepage/enabled
+ *   thp_vmstat_read()        THP fault and collapse counters (/proc/vmstat,
+ *                            khugepaged/) and compaction stalls
+ *
+ * Node arguments and results are positions in numa_topo.nodes, not the
+ * kernel's node ids (those can have holes).
+ *
+ * Include after common.h.
+ */
+#include <fcntl.h>
+#include <linux/mempolicy.h>
+#include <sys/syscall.h>
+
+#define NUMA_MAX_NODES 64
+#define NUMA_SYSFS     "/sys/devices/system/node"
+#define THP_SYSFS      "/sys/kernel/mm/transparent_hugepage"
+
+struct numa_node {
+    int   id;                           /* kernel node id */
+    int   ncpus;
+    int  *cpus;                         /* usable CPUs, ascending */
+    long  mem_kb;                       /* MemTotal, 0 if memory-less */
+    int   distance[NUMA_MAX_NODES];     /* SLIT, to each node by position */
+};
+
+struct numa_topo {
+    int              nnodes;
+    int              ncpus;             /* usable, over all nodes */
+    struct numa_node nodes[NUMA_MAX_NODES];
+};
+
+/* ── Topology ───────────────────────────────────────────────────────── */
+
+static inline int numa_read_file(const char *path, char *buf, size_t len)
+{
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+    size_t n = fread(buf, 1, len - 1, f);
+    fclose(f);
+    buf[n] = '\0';
+    return (int)n;
+}
+
+/* "0-3,8,10-11" → 0 1 2 3 8 10 11 */
+static inline int numa_parse_list(const char *s, int *out, int max)
+{
+    int n = 0;
+    while (*s && *s != '\n') {
+        char *end;
+        long lo = strtol(s, &end, 10), hi = lo;
+        if (end == s) break;
+        if (*end == '-') hi = strtol(end + 1, &end, 10);
+        for (long i = lo; i <= hi && n < max; i++)
+            out[n++] = (int)i;
+        s = *end == ',' ? end + 1 : end;
+    }
+    return n;
+}
+
+static inline void numa_topo_free(struct numa_topo *t)
+{
+    for (int i = 0; i < t->nnodes; i++)
+        free(t->nodes[i].cpus);
+    t->nnodes = t->ncpus = 0;
+}
+
+static inline void numa_topo_load(struct numa_topo *t)
+{
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        CPU_ZERO(&allowed);
+        for (int c = 0; c < get_num_cores() && c < CPU_SETSIZE; c++)
+            CPU_SET(c, &allowed);
+    }
+
+    memset(t, 0, sizeof(*t));
+    char buf[4096], path[128];
+    int ids[NUMA_MAX_NODES], list[CPU_SETSIZE];
+    int nids = 0;
+    if (numa_read_file(NUMA_SYSFS "/online", buf, sizeof(buf)) > 0)
+        nids = numa_parse_list(buf, ids, NUMA_MAX_NODES);
+
+    for (int i = 0; i < nids; i++) {
+        struct numa_node *nd = &t->nodes[t->nnodes++];
+        nd->id = ids[i];
+        nd->cpus = malloc(CPU_SETSIZE * sizeof(int));
+        if (!nd->cpus) { perror("malloc"); exit(1); }
+
+        snprintf(path, sizeof(path), NUMA_SYSFS "/node%d/cpulist", nd->id);
+        int n = numa_read_file(path, buf, sizeof(buf)) > 0
+              ? numa_parse_list(buf, list, CPU_SETSIZE) : 0;
+        for (int j = 0; j < n; j++)
+            if (list[j] < CPU_SETSIZE && CPU_ISSET(list[j], &allowed))
+                nd->cpus[nd->ncpus++] = list[j];
+        t->ncpus += nd->ncpus;
+
+        snprintf(path, sizeof(path), NUMA_SYSFS "/node%d/meminfo", nd->id);
+        if (numa_read_file(path, buf, sizeof(buf)) > 0) {
+            char *m = strstr(buf, "MemTotal:");
+            if (m) nd->mem_kb = atol(m + strlen("MemTotal:"));
+        }
+
+        snprintf(path, sizeof(path), NUMA_SYSFS "/node%d/distance", nd->id);
+        if (numa_read_file(path, buf, sizeof(buf)) > 0) {
+            char *s = buf, *end;
+            for (int j = 0; j < nids; j++, s = end) {
+                nd->distance[j] = (int)strtol(s, &end, 10);
+                if (end == s) break;
+            }
+        }
+    }
+
+    if (t->ncpus == 0) {
+        /* No NUMA sysfs (or none of its CPUs usable): one node, every CPU */
+        numa_topo_free(t);
+        struct numa_node *nd = &t->nodes[t->nnodes++];
+        nd->cpus = malloc(CPU_SETSIZE * sizeof(int));
+        if (!nd->cpus) { perror("malloc"); exit(1); }
+        for (int c = 0; c < CPU_SETSIZE; c++)
+            if (CPU_ISSET(c, &allowed))
+                nd->cpus[nd->ncpus++] = c;
+        nd->distance[0] = 10;
+        t->ncpus = nd->ncpus;
+    }
+}
+
+/* Position of the node CPU cpu belongs to, -1 if not a usable CPU */
+static inline int numa_node_of_cpu(const struct numa_topo *t, int cpu)
+{
+    for (int i = 0; i < t->nnodes; i++)
+        for (int j = 0; j < t->nodes[i].ncpus; j++)
+            if (t->nodes[i].cpus[j] == cpu)
+                return i;
+    return -1;
+}
+
+/* Position of the node of a kernel node id, -1 if not online */
+static inline int numa_node_pos(const struct numa_topo *t, int id)
+{
+    for (int i = 0; i < t->nnodes; i++)
+        if (t->nodes[i].id == id)
+            return i;
+    return -1;
+}
+
+/*
+ * n CPUs to pin n threads to: node's (a node without CPUs counts as -1),
+ * or with node = -1 every usable CPU, node 0's first. Wraps around when
+ * n exceeds the CPUs, so thread counts above the core count oversubscribe
+ * evenly. Caller frees.
+ */
+static inline int *numa_core_list(const struct numa_topo *t, int n, int node)
+{
+    int *cores = malloc((n > 0 ? n : 1) * sizeof(int));
+    if (!cores) { perror("malloc"); exit(1); }
+    if (node >= 0 && node < t->nnodes && t->nodes[node].ncpus > 0) {
+        const struct numa_node *nd = &t->nodes[node];
+        for (int i = 0; i < n; i++)
+            cores[i] = nd->cpus[i % nd->ncpus];
+        return cores;
+    }
+    for (int i = 0; i < n; i++) {
+        int k = i % t->ncpus;
+        for (int j = 0; j < t->nnodes; j++) {
+            if (k < t->nodes[j].ncpus) {
+                cores[i] = t->nodes[j].cpus[k];
+                break;
+            }
+            k -= t->nodes[j].ncpus;
+        }
+    }
+    return cores;
+}
+
+static inline void numa_topo_print(const struct numa_topo *t)
+{
+    for (int i = 0; i < t->nnodes; i++) {
+        const struct numa_node *nd = &t->nodes[i];
+        char mem[32];
+        printf("  Node %-2d        : %d CPUs (", nd->id, nd->ncpus);
+        /* CPU list back in range form */
+        for (int j = 0; j < nd->ncpus; j++) {
+            int k = j;
+            while (k + 1 < nd->ncpus && nd->cpus[k + 1] == nd->cpus[k] + 1)
+                k++;
+            printf("%s%d", j ? "," : "", nd->cpus[j]);
+            if (k > j) printf("-%d", nd->cpus[k]);
+            j = k;
+        }
+        printf("), %s, distance", format_bytes(nd->mem_kb * 1024L, mem, sizeof(mem)));
+        for (int j = 0; j < t->nnodes; j++)
+            printf(" %d", nd->distance[j]);
+        printf("\n");
+    }
+}
+
+/* ── Memory policy and placement ────────────────────────────────────── */
+
+#define NUMA_MASK_LONGS (NUMA_MAX_NODES / (8 * sizeof(unsigned long)) + 1)
+
+/* Interleave the calling thread's new pages over every node with memory */
+static inline int numa_set_interleave(const struct numa_topo *t)
+{
+    unsigned long mask[NUMA_MASK_LONGS] = {0};
+    const int bits = 8 * sizeof(unsigned long);
+    int n = 0;
+    for (int i = 0; i < t->nnodes; i++) {
+        int id = t->nodes[i].id;
+        if (t->nodes[i].mem_kb > 0 || t->nnodes == 1) {
+            mask[id / bits] |= 1UL << (id % bits);
+            n++;
+        }
+    }
+    if (n == 0)
+        return -1;
+    /* maxnode counts one past the last bit the kernel reads */
+    return (int)syscall(SYS_set_mempolicy, MPOL_INTERLEAVE, mask,
+                        (unsigned long)(sizeof(mask) * 8));
+}
+
+static inline int numa_set_default(void)
+{
+    return (int)syscall(SYS_set_mempolicy, MPOL_DEFAULT, NULL, 0UL);
+}
+
+/*
+ * Node (kernel id) of the page holding each address in status[], or a
+ * negative errno (-ENOENT: not faulted in yet). move_pages() with no
+ * target nodes only looks.
+ */
+static inline int numa_page_nodes(void **addrs, long n, int *status)
+{
+    long page = sysconf(_SC_PAGESIZE);
+    for (long i = 0; i < n; i++)
+        addrs[i] = (void *)((uintptr_t)addrs[i] & ~(uintptr_t)(page - 1));
+    return (int)syscall(SYS_move_pages, 0, (unsigned long)n, addrs, NULL, status, 0);
+}
+
+/* ── Transparent huge pages ─────────────────────────────────────────── */
+
+/* The bracketed mode of enabled: "always", "madvise" or "never" */
+static inline int thp_mode_get(char *mode, size_t len)
+{
+    char buf[128];
+    if (numa_read_file(THP_SYSFS "/enabled", buf, sizeof(buf)) <= 0)
+        return -1;
+    char *l = strchr(buf, '['), *r = l ? strchr(l, ']') : NULL;
+    if (!r) return -1;
+    snprintf(mode, len, "%.*s", (int)(r - l - 1), l + 1);
+    return 0;
+}
+
+/* System-wide: needs root. 0 on success */
+static inline int thp_mode_set(const char *mode)
+{
+    int fd = open(THP_SYSFS "/enabled", O_WRONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    ssize_t n = write(fd, mode, strlen(mode));
+    close(fd);
+    return n == (ssize_t)strlen(mode) ? 0 : -1;
+}
+
+struct thp_vmstat {
+    long fault_alloc;           /* huge page allocated at fault */
+    long fault_fallback;        /* ... wanted, fell back to 4K pages */
+    long collapse_alloc;        /* khugepaged collapsed 4K pages into one */
+    long collapse_failed;       /* ... no huge page to collapse into */
+    long compact_stall;         /* direct compaction in an allocation */
+    long compact_fail;
+    long full_scans;            /* khugepaged passes over all mms */
+    long pages_collapsed;       /* khugepaged's own count, in huge pages */
+};
+
+static inline long thp_sysfs_long(const char *path)
+{
+    char buf[32];
+    return numa_read_file(path, buf, sizeof(buf)) > 0 ? atol(buf) : 0;
+}
+
+static inline void thp_vmstat_read(struct thp_vmstat *v)
+{
+    static const struct { const char *key; size_t off; } fields[] = {
+        { "thp_fault_alloc",           offsetof(struct thp_vmstat, fault_alloc) },
+        { "thp_fault_fallback",        offsetof(struct thp_vmstat, fault_fallback) },
+        { "thp_collapse_alloc",        offsetof(struct thp_vmstat, collapse_alloc) },
+        { "thp_collapse_alloc_failed", offsetof(struct thp_vmstat, collapse_failed) },
+        { "compact_stall",             offsetof(struct thp_vmstat, compact_stall) },
+        { "compact_fail",              offsetof(struct thp_vmstat, compact_fail) },
+    };
+    memset(v, 0, sizeof(*v));
+    FILE *f = fopen("/proc/vmstat", "r");
+    if (f) {
+        char key[64];
+        long val;
+        while (fscanf(f, "%63s %ld", key, &val) == 2)
+            for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++)
+                if (strcmp(key, fields[i].key) == 0)
+                    *(long *)((char *)v + fields[i].off) = val;
+        fclose(f);
+    }
+    v->full_scans = thp_sysfs_long(THP_SYSFS "/khugepaged/full_scans");
+    v->pages_collapsed = thp_sysfs_long(THP_SYSFS "/khugepaged/pages_collapsed");
+}
+
+/* after - before, field by field */
+static inline void thp_vmstat_delta(struct thp_vmstat *d, const struct thp_vmstat *before,
+                                    const struct thp_vmstat *after)
+{
+    const long *b = (const long *)before, *a = (const long *)after;
+    long *o = (long *)d;
+    for (size_t i = 0; i < sizeof(*d) / sizeof(long); i++)
+        o[i] = a[i] - b[i];
+}
+
+#endif /* NUMA_TOPO_H */
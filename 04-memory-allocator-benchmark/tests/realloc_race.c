@@ -0,0 +1,73 @@
+/*
+ * realloc_race.c — Two threads racing a moving realloc against malloc
+ *
+ * Thread A grows one block through realloc after realloc; thread B
+ * allocates and frees blocks of the same sizes. Both above the mmap
+ * threshold, so a moving realloc returns the old range to the kernel
+ * (mremap) and B's next mmap can land on it while A is still inside
+ * realloc. Each thread frees only what it allocated: a correct trace
+ * replays with no cross-thread frees and no dropped frees. `make check`
+ * records it through bin/libatrace.so and checks exactly that.
+ *
+ * Usage: ATRACE_FILE=t.trace LD_PRELOAD=bin/libatrace.so ./realloc_race [rounds]
+ */
+#define _GNU_SOURCE
+#include <malloc.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define BLOCK   (128 * 1024)
+#define STEPS   4               /* BLOCK, 2x, ..., STEPS x per chain */
+
+static long rounds = 50000;
+
+static void *grower(void *arg)
+{
+    (void)arg;
+    for (long i = 0; i < rounds; i++) {
+        char *p = malloc(BLOCK);
+        if (!p) { perror("malloc"); exit(1); }
+        p[0] = 1;
+        for (int s = 2; s <= STEPS; s++) {
+            char *q = realloc(p, (size_t)s * BLOCK);
+            if (!q) { perror("realloc"); exit(1); }
+            p = q;
+            p[(size_t)s * BLOCK - 1] = 1;
+        }
+        free(p);
+    }
+    return NULL;
+}
+
+static void *churner(void *arg)
+{
+    (void)arg;
+    for (long i = 0; i < rounds * STEPS; i++) {
+        char *p = malloc((size_t)(i % STEPS + 1) * BLOCK);
+        if (!p) { perror("malloc"); exit(1); }
+        p[0] = 1;
+        free(p);
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    pthread_t a, b;
+
+    if (argc > 1)
+        rounds = atol(argv[1]);
+    /* Fixed threshold: glibc would otherwise raise it after the first free */
+    mallopt(M_MMAP_THRESHOLD, BLOCK / 2);
+
+    if (pthread_create(&a, NULL, grower, NULL) != 0 ||
+        pthread_create(&b, NULL, churner, NULL) != 0) {
+        perror("pthread_create");
+        return 1;
+    }
+    pthread_join(a, NULL);
+    pthread_join(b, NULL);
+    printf("realloc_race: %ld rounds of %d reallocs\n", rounds, STEPS - 1);
+    return 0;
+}
@@ -0,0 +1,370 @@
+#ifndef BENCH_JSON_H
+#define BENCH_JSON_H
+
+/*
+ * bench_json.h — Common JSON result file for every benchmark binary
+ *
+ * Each project prints its own table or CSV; with --json FILE (or
+ * BENCH_JSON=FILE in the environment, which is how benchrun collects
+ * repetitions) a binary also writes its results in one shared schema:
+ *
+ *   {
+ *     "schema": "perf-bench-result/1",
+ *     "benchmark": "bench_mt",
+ *     "argv": ["bench_mt", "--threads", "1,2"],
+ *     "results": [
+ *       { "name": "thread_local", "params": { "threads": 2 },
+ *         "metrics": { "ops_per_sec": { "value": 3.1e7, "unit": "ops/s",
+ *                                       "better": "higher" } } }, ...
+ *     ],
+ *     "meta": { "timestamp", "host", "kernel", "arch", "cpu_model",
+ *               "cpus_online", "cpus_allowed", "numa_nodes", "governor",
+ *               "thp", "allocator", "commit", "run" }
+ *   }
+ *
+ * A result is one row of the binary's CSV: name and params identify it
+ * (the same name and params in another run are the same measurement),
+ * metrics are what was measured. "better" tells a comparison which way
+ * is a regression; "none" marks a metric that is only context.
+ *
+ *   bj_open(json_path, "scaling", argc, argv);     (NULL path: $BENCH_JSON)
+ *   bj_meta("allocator", detect_allocator());
+ *   bj_result("padded");
+ *   bj_param_int("threads", 4);
+ *   bj_metric("ops_per_sec", ops, "ops/s", BJ_HIGHER);
+ *   bj_close();                                    (also runs at exit)
+ *
+ * Every call is a no-op when no file was asked for. Results are streamed
+ * as they are reported; the metadata is gathered at close, after the
+ * measurements, so reading sysfs or running git never lands inside a
+ * timed region. Params must come before the result's first metric.
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/utsname.h>
+#include "json.h"
+
+#define BJ_SCHEMA    "perf-bench-result/1"
+#define BJ_MAX_META  16
+
+enum bj_better { BJ_NONE, BJ_HIGHER, BJ_LOWER };
+
+static const char *const bj_better_names[] = { "none", "higher", "lower" };
+
+static struct {
+    FILE       *f;
+    int         nresults;
+    int         nfields;        /* params or metrics so far in this result */
+    int         state;          /* 0 no result open, 1 in params, 2 in metrics */
+    int         nmeta;
+    const char *meta_key[BJ_MAX_META];
+    char        meta_val[BJ_MAX_META][128];
+} bj;
+
+/* ── Host metadata ──────────────────────────────────────────────────── */
+
+/* First line of a (sysfs) file, newline stripped; "" if unreadable */
+static inline char *bj_read_line(const char *path, char *buf, size_t len)
+{
+    FILE *f = fopen(path, "r");
+    buf[0] = '\0';
+    if (f) {
+        if (fgets(buf, (int)len, f))
+            buf[strcspn(buf, "\n")] = '\0';
+        fclose(f);
+    }
+    return buf;
+}
+
+/* "always [madvise] never" → "madvise" */
+static inline char *bj_bracketed(char *s)
+{
+    char *l = strchr(s, '['), *r = l ? strchr(l, ']') : NULL;
+    if (!r)
+        return s;
+    *r = '\0';
+    return l + 1;
+}
+
+/* CPUs in a cpu_set_t as a range list: "0-3,8" */
+static inline char *bj_cpu_list(const cpu_set_t *set, char *buf, size_t len)
+{
+    size_t pos = 0;
+    buf[0] = '\0';
+    for (int c = 0; c < CPU_SETSIZE && pos < len; c++) {
+        if (!CPU_ISSET(c, set))
+            continue;
+        int e = c;
+        while (e + 1 < CPU_SETSIZE && CPU_ISSET(e + 1, set))
+            e++;
+        pos += (size_t)snprintf(buf + pos, len - pos, e > c ? "%s%d-%d" : "%s%d",
+                                pos ? "," : "", c, e);
+        c = e;
+    }
+    return buf;
+}
+
+/* Entries in a sysfs range list: "0-1,4" → 3 */
+static inline int bj_list_count(const char *s)
+{
+    int n = 0;
+    while (*s) {
+        char *end;
+        long a = strtol(s, &end, 10), b = a;
+        if (end == s)
+            break;
+        if (*end == '-')
+            b = strtol(end + 1, &end, 10);
+        n += (int)(b - a + 1);
+        s = *end == ',' ? end + 1 : end;
+    }
+    return n;
+}
+
+static inline char *bj_cpu_model(char *buf, size_t len)
+{
+    char line[256];
+    FILE *f = fopen("/proc/cpuinfo", "r");
+    snprintf(buf, len, "unknown");
+    while (f && fgets(line, sizeof(line), f)) {
+        char *colon = strchr(line, ':');
+        if (colon && (strncmp(line, "model name", 10) == 0 ||
+                      strncmp(line, "Processor", 9) == 0)) {
+            colon += strspn(colon + 1, " \t") + 1;
+            colon[strcspn(colon, "\n")] = '\0';
+            snprintf(buf, len, "%s", colon);
+            break;
+        }
+    }
+    if (f)
+        fclose(f);
+    return buf;
+}
+
+/* $BENCH_COMMIT, else the enclosing checkout ("1a2b3c4d5e6f[-dirty]") */
+static inline char *bj_commit(char *buf, size_t len)
+{
+    const char *env = getenv("BENCH_COMMIT");
+    snprintf(buf, len, "%s", env && *env ? env : "unknown");
+    if (env && *env)
+        return buf;
+    FILE *p = popen("git describe --always --dirty --abbrev=12 2>/dev/null", "r");
+    if (p) {
+        char line[128];
+        if (fgets(line, sizeof(line), p) && line[0] != '\n') {
+            line[strcspn(line, "\n")] = '\0';
+            snprintf(buf, len, "%s", line);
+        }
+        pclose(p);
+    }
+    return buf;
+}
+
+/* LD_PRELOAD basenames ("libjemalloc.so.2"), else the C library's own */
+static inline char *bj_allocator(char *buf, size_t len)
+{
+    const char *pre = getenv("LD_PRELOAD");
+    size_t pos = 0;
+    snprintf(buf, len, "glibc");
+    while (pre && *pre && pos < len) {
+        size_t n = strcspn(pre, " :");
+        const char *base = pre;
+        for (size_t i = 0; i < n; i++)
+            if (pre[i] == '/')
+                base = pre + i + 1;
+        if (n)
+            pos += (size_t)snprintf(buf + pos, len - pos, "%s%.*s", pos ? "+" : "",
+                                    (int)(pre + n - base), base);
+        pre += n;
+        pre += strspn(pre, " :");
+    }
+    return buf;
+}
+
+static inline void bj_kv(const char *key, const char *val, int *first)
+{
+    fprintf(bj.f, "%s\n    ", *first ? "" : ",");
+    json_write_str(bj.f, key);
+    fputs(": ", bj.f);
+    json_write_str(bj.f, val);
+    *first = 0;
+}
+
+/* Built-in value unless bj_meta() set the key */
+static inline void bj_kv_default(const char *key, const char *val, int *first)
+{
+    for (int i = 0; i < bj.nmeta; i++)
+        if (strcmp(bj.meta_key[i], key) == 0)
+            return;
+    bj_kv(key, val, first);
+}
+
+static inline void bj_write_meta(void)
+{
+    char buf[256], path[64];
+    struct utsname u;
+    cpu_set_t set;
+    int first = 1;
+
+    time_t now = time(NULL);
+    strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+    bj_kv_default("timestamp", buf, &first);
+    if (gethostname(buf, sizeof(buf)) != 0)
+        snprintf(buf, sizeof(buf), "unknown");
+    buf[sizeof(buf) - 1] = '\0';
+    bj_kv_default("host", buf, &first);
+    if (uname(&u) == 0) {
+        bj_kv_default("kernel", u.release, &first);
+        bj_kv_default("arch", u.machine, &first);
+    }
+    bj_kv_default("cpu_model", bj_cpu_model(buf, sizeof(buf)), &first);
+    snprintf(buf, sizeof(buf), "%ld", sysconf(_SC_NPROCESSORS_ONLN));
+    bj_kv_default("cpus_online", buf, &first);
+    CPU_ZERO(&set);
+    sched_getaffinity(0, sizeof(set), &set);
+    bj_kv_default("cpus_allowed", bj_cpu_list(&set, buf, sizeof(buf)), &first);
+    bj_read_line("/sys/devices/system/node/online", buf, sizeof(buf));
+    snprintf(buf, sizeof(buf), "%d", buf[0] ? bj_list_count(buf) : 1);
+    bj_kv_default("numa_nodes", buf, &first);
+
+    /* The first allowed CPU's governor stands for all; benchrun checks each */
+    int cpu = 0;
+    while (cpu < CPU_SETSIZE - 1 && !CPU_ISSET(cpu, &set))
+        cpu++;
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_governor", cpu);
+    bj_kv_default("governor", bj_read_line(path, buf, sizeof(buf))[0] ? buf : "none", &first);
+    bj_read_line("/sys/kernel/mm/transparent_hugepage/enabled", buf, sizeof(buf));
+    bj_kv_default("thp", buf[0] ? bj_bracketed(buf) : "none", &first);
+    bj_kv_default("allocator", bj_allocator(buf, sizeof(buf)), &first);
+    bj_kv_default("commit", bj_commit(buf, sizeof(buf)), &first);
+    const char *run = getenv("BENCH_RUN");
+    if (run && *run)
+        bj_kv_default("run", run, &first);
+    for (int i = 0; i < bj.nmeta; i++)
+        bj_kv(bj.meta_key[i], bj.meta_val[i], &first);
+}
+
+/* ── Results ────────────────────────────────────────────────────────── */
+
+static inline void bj_end_result(void)
+{
+    if (bj.state == 0)
+        return;
+    fputs(bj.state == 1 ? " }, \"metrics\": { } }" : " } }", bj.f);
+    bj.state = 0;
+}
+
+static inline void bj_close(void)
+{
+    if (!bj.f)
+        return;
+    bj_end_result();
+    fputs("\n  ],\n  \"meta\": {", bj.f);
+    bj_write_meta();
+    fputs("\n  }\n}\n", bj.f);
+    if (fclose(bj.f) != 0)
+        perror("bench json");
+    bj.f = NULL;
+}
+
+/* Starts the file; 0 if writing (or nothing asked for), -1 if it can't be opened */
+static inline int bj_open(const char *path, const char *benchmark, int argc, char **argv)
+{
+    if (!path)
+        path = getenv("BENCH_JSON");
+    if (!path || !*path)
+        return 0;
+    if (!(bj.f = fopen(path, "w"))) {
+        perror(path);
+        return -1;
+    }
+    fprintf(bj.f, "{\n  \"schema\": \"%s\",\n  \"benchmark\": ", BJ_SCHEMA);
+    json_write_str(bj.f, benchmark);
+    fputs(",\n  \"argv\": [", bj.f);
+    for (int i = 0; i < argc; i++) {
+        const char *a = argv[i];
+        if (i == 0 && strrchr(a, '/'))
+            a = strrchr(a, '/') + 1;
+        fputs(i ? ", " : "", bj.f);
+        json_write_str(bj.f, a);
+    }
+    fputs("],\n  \"results\": [", bj.f);
+    atexit(bj_close);
+    return 0;
+}
+
+/* Overrides a built-in metadata key (e.g. "allocator"), or adds one */
+static inline void bj_meta(const char *key, const char *val)
+{
+    for (int i = 0; i < bj.nmeta; i++)
+        if (strcmp(bj.meta_key[i], key) == 0) {
+            snprintf(bj.meta_val[i], sizeof(bj.meta_val[i]), "%s", val);
+            return;
+        }
+    if (bj.nmeta < BJ_MAX_META) {
+        bj.meta_key[bj.nmeta] = key;
+        snprintf(bj.meta_val[bj.nmeta++], sizeof(bj.meta_val[0]), "%s", val);
+    }
+}
+
+static inline void bj_result(const char *name)
+{
+    if (!bj.f)
+        return;
+    bj_end_result();
+    fprintf(bj.f, "%s\n    { \"name\": ", bj.nresults++ ? "," : "");
+    json_write_str(bj.f, name);
+    fputs(", \"params\": {", bj.f);
+    bj.state = 1;
+    bj.nfields = 0;
+}
+
+static inline void bj_field(const char *key)
+{
+    fprintf(bj.f, "%s ", bj.nfields++ ? "," : "");
+    json_write_str(bj.f, key);
+    fputs(": ", bj.f);
+}
+
+static inline void bj_param_str(const char *key, const char *val)
+{
+    if (!bj.f || bj.state != 1)
+        return;
+    bj_field(key);
+    json_write_str(bj.f, val);
+}
+
+static inline void bj_param_int(const char *key, long val)
+{
+    if (!bj.f || bj.state != 1)
+        return;
+    bj_field(key);
+    fprintf(bj.f, "%ld", val);
+}
+
+static inline void bj_metric(const char *key, double value, const char *unit,
+                             enum bj_better better)
+{
+    if (!bj.f || bj.state == 0)
+        return;
+    if (bj.state == 1) {
+        fputs(" }, \"metrics\": {", bj.f);
+        bj.state = 2;
+        bj.nfields = 0;
+    }
+    bj_field(key);
+    fputs("{ \"value\": ", bj.f);
+    json_write_num(bj.f, value);
+    fputs(", \"unit\": ", bj.f);
+    json_write_str(bj.f, unit);
+    fprintf(bj.f, ", \"better\": \"%s\" }", bj_better_names[better]);
+}
+
+#endif /* BENCH_JSON_H */
@@ -0,0 +1,978 @@
+/*
+ * benchrun.c — Repeat a benchmark, summarize it, compare it to a baseline
+ *
+ * A single run of any benchmark in this repository moves by several
+ * percent from one invocation to the next (frequency, placement, page
+ * cache, what else the machine is doing), so one number before and one
+ * after a change can't tell a 3% regression from noise. benchrun runs the
+ * command N times after a warmup, collects every metric it reports in
+ * the common result schema (bench_json.h), and prints each metric's mean
+ * with a 95% confidence interval. Given a baseline from an earlier run it
+ * tests every metric with Mann-Whitney U and calls a regression only when
+ * the difference is both significant (p < --alpha) and large enough to
+ * matter (|change| >= --threshold) in the metric's worse direction.
+ *
+ * Usage:
+ *   benchrun [options] -- command [args...]
+ *   benchrun [options] --suite FILE [name...]
+ *
+ *   -n N             measured runs (default 10)
+ *   -w N             warmup runs, discarded (default 1)
+ *   --cpus LIST      run the benchmark on these CPUs ("2-3", "4,6")
+ *   --strict         refuse to run when a host check fails
+ *   --drop-caches    drop the page cache before every run (root)
+ *   -o FILE          write every value and summary (perf-bench-run/1);
+ *                    the file is a baseline for later runs
+ *   --baseline FILE  compare against a saved -o file; exit 2 on regression
+ *   --alpha P        significance level (default 0.01)
+ *   --threshold PCT  smallest change worth reporting (default 2%)
+ *   --metric SUBSTR  only report metrics whose name contains SUBSTR
+ *   -v               show the benchmark's own output
+ *
+ * Each run gets BENCH_JSON (a temporary file the benchmark writes its
+ * results to), BENCH_RUN (the run index) and BENCH_COMMIT. A command that
+ * writes no JSON still gets the "process" metrics benchrun measures
+ * itself: wall time, CPU time and peak RSS.
+ *
+ * Suite files list one benchmark per line, "name dir command...", with
+ * dir relative to the suite file; the command runs under /bin/sh.
+ *
+ * Before running, the host is checked for the usual sources of run-to-run
+ * noise: CPU frequency governor, turbo/boost, SMT siblings, CPU isolation
+ * and load average. Failed checks are warnings unless --strict.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "bench_json.h"
+#include "json.h"
+#include "stats.h"
+
+#define RUN_SCHEMA      "perf-bench-run/1"
+#define MAX_BENCHES     64
+#define MAX_WARNINGS    16
+
+/* ── Options ────────────────────────────────────────────────────────── */
+
+static int          opt_reps = 10;
+static int          opt_warmup = 1;
+static int          opt_strict;
+static int          opt_drop_caches;
+static int          opt_verbose;
+static double       opt_alpha = 0.01;
+static double       opt_threshold = 2.0;        /* percent */
+static const char  *opt_cpus;
+static const char  *opt_out;
+static const char  *opt_baseline;
+static const char  *opt_metric;
+static cpu_set_t    run_cpus;                   /* --cpus, else our own affinity */
+
+static char        *warnings[MAX_WARNINGS];
+static int          nwarnings;
+
+/* ── Series: every value of one metric of one result ────────────────── */
+
+struct series {
+    char           *result;
+    char           *params;         /* compact JSON object: part of the identity */
+    char           *label;          /* "result k=v ..." for the tables */
+    char           *metric;
+    char           *unit;
+    enum bj_better  better;
+    double         *v;
+    int             n, cap;
+};
+
+struct bench {
+    const char     *name;
+    const char     *dir;            /* suite: working directory, else NULL */
+    const char     *command;        /* suite: shell command */
+    char          **argv;           /* direct: exec'd as is */
+    struct json    *first;          /* first measured run's JSON, for its meta */
+    struct series  *s;
+    int             ns, cap;
+    int             runs_ok, runs_failed;
+};
+
+static struct bench benches[MAX_BENCHES];
+static int          nbenches;
+
+/* params as compact JSON, written the same way for runs and baselines */
+static char *params_key(const struct json *params)
+{
+    char *buf = NULL;
+    size_t len = 0;
+    FILE *f = open_memstream(&buf, &len);
+    if (!f) {
+        perror("open_memstream");
+        exit(1);
+    }
+    if (params)
+        json_write(f, params);
+    else
+        fputs("{}", f);
+    fclose(f);
+    return buf;
+}
+
+static char *series_label(const char *result, const struct json *params)
+{
+    char *buf = NULL;
+    size_t len = 0;
+    FILE *f = open_memstream(&buf, &len);
+    if (!f) {
+        perror("open_memstream");
+        exit(1);
+    }
+    fputs(result, f);
+    for (int i = 0; params && params->type == JSON_OBJ && i < params->n; i++) {
+        const struct json *v = params->items[i];
+        fprintf(f, " %s=", params->keys[i]);
+        if (v->type == JSON_STR)
+            fputs(v->str, f);
+        else
+            json_write(f, v);
+    }
+    fclose(f);
+    return buf;
+}
+
+static struct series *series_find(const struct bench *b, const char *result, const char *params,
+                                  const char *metric)
+{
+    for (int i = 0; i < b->ns; i++)
+        if (strcmp(b->s[i].result, result) == 0 && strcmp(b->s[i].params, params) == 0 &&
+            strcmp(b->s[i].metric, metric) == 0)
+            return &b->s[i];
+    return NULL;
+}
+
+static void series_add(struct bench *b, const char *result, const struct json *params,
+                       const char *metric, const char *unit, enum bj_better better, double v)
+{
+    char *key = params_key(params);
+    struct series *s = series_find(b, result, key, metric);
+    if (s) {
+        free(key);
+    } else {
+        if (b->ns == b->cap) {
+            b->cap = b->cap ? b->cap * 2 : 16;
+            b->s = realloc(b->s, (size_t)b->cap * sizeof(*b->s));
+            if (!b->s) {
+                perror("realloc");
+                exit(1);
+            }
+        }
+        s = &b->s[b->ns++];
+        memset(s, 0, sizeof(*s));
+        s->result = strdup(result);
+        s->params = key;
+        s->label = series_label(result, params);
+        s->metric = strdup(metric);
+        s->unit = strdup(unit);
+        s->better = better;
+    }
+    if (s->n == s->cap) {
+        s->cap = s->cap ? s->cap * 2 : 16;
+        s->v = realloc(s->v, (size_t)s->cap * sizeof(*s->v));
+        if (!s->v) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    s->v[s->n++] = v;
+}
+
+static enum bj_better better_from_name(const char *s)
+{
+    if (s && strcmp(s, "higher") == 0)
+        return BJ_HIGHER;
+    if (s && strcmp(s, "lower") == 0)
+        return BJ_LOWER;
+    return BJ_NONE;
+}
+
+/* Every metric of every result in one run's perf-bench-result/1 file */
+static void collect(struct bench *b, const struct json *root)
+{
+    const struct json *results = json_get(root, "results");
+    for (int i = 0; results && results->type == JSON_ARR && i < results->n; i++) {
+        const struct json *r = results->items[i];
+        const char *name = json_str(json_get(r, "name"), "?");
+        const struct json *params = json_get(r, "params");
+        const struct json *metrics = json_get(r, "metrics");
+        for (int m = 0; metrics && metrics->type == JSON_OBJ && m < metrics->n; m++) {
+            const struct json *mv = metrics->items[m];
+            const struct json *val = json_get(mv, "value");
+            if (!val || val->type != JSON_NUM)
+                continue;                       /* null: not measured this run */
+            series_add(b, name, params, metrics->keys[m],
+                       json_str(json_get(mv, "unit"), ""),
+                       better_from_name(json_str(json_get(mv, "better"), NULL)), val->num);
+        }
+    }
+}
+
+/* ── Host checks ────────────────────────────────────────────────────── */
+
+/* sysfs range list ("0-3,8") into a set; number of CPUs, -1 if malformed */
+static int parse_cpu_list(const char *s, cpu_set_t *set)
+{
+    int n = 0;
+    CPU_ZERO(set);
+    while (*s && *s != '\n') {
+        char *end;
+        long a = strtol(s, &end, 10), b = a;
+        if (end == s || a < 0)
+            return -1;
+        if (*end == '-')
+            b = strtol(end + 1, &end, 10);
+        if (b < a || b >= CPU_SETSIZE)
+            return -1;
+        for (long c = a; c <= b; c++, n++)
+            CPU_SET((int)c, set);
+        if (*end == ',')
+            end++;
+        else if (*end && *end != '\n')
+            return -1;
+        s = end;
+    }
+    return n;
+}
+
+static void warn(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+static void warn(const char *fmt, ...)
+{
+    char buf[256];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    printf("  WARN  %s\n", buf);
+    if (nwarnings < MAX_WARNINGS)
+        warnings[nwarnings++] = strdup(buf);
+}
+
+static void check_governor(void)
+{
+    char path[96], buf[64], which[64] = "", list[256];
+    cpu_set_t bad;
+    int have = 0, nbad = 0;
+
+    CPU_ZERO(&bad);
+    for (int c = 0; c < CPU_SETSIZE; c++) {
+        if (!CPU_ISSET(c, &run_cpus))
+            continue;
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_governor", c);
+        if (!bj_read_line(path, buf, sizeof(buf))[0])
+            continue;
+        have++;
+        if (strcmp(buf, "performance") != 0) {
+            CPU_SET(c, &bad);
+            if (nbad++ == 0)
+                snprintf(which, sizeof(which), "%s", buf);
+        }
+    }
+    if (!have)
+        printf("  ok    governor: no cpufreq (frequency not under OS control)\n");
+    else if (nbad)
+        warn("governor '%s' on cpu %s (cpupower frequency-set -g performance)",
+             which, bj_cpu_list(&bad, list, sizeof(list)));
+    else
+        printf("  ok    governor: performance\n");
+
+    if (strcmp(bj_read_line("/sys/devices/system/cpu/intel_pstate/no_turbo", buf, sizeof(buf)),
+               "0") == 0)
+        warn("turbo on (echo 1 > /sys/devices/system/cpu/intel_pstate/no_turbo)");
+    else if (strcmp(bj_read_line("/sys/devices/system/cpu/cpufreq/boost", buf, sizeof(buf)),
+                    "1") == 0)
+        warn("boost on (echo 0 > /sys/devices/system/cpu/cpufreq/boost)");
+    else
+        printf("  ok    turbo/boost: off or not reported\n");
+}
+
+/*
+ * A benchmark CPU's hyperthread sibling shares its core's caches and
+ * execution units: fine if it is another benchmark CPU or isolated (idle),
+ * noise if the rest of the system can run there.
+ */
+static void check_smt(const cpu_set_t *isolated)
+{
+    char path[96], buf[256], list[256];
+    cpu_set_t sib, busy;
+    CPU_ZERO(&busy);
+    for (int c = 0; c < CPU_SETSIZE; c++) {
+        if (!CPU_ISSET(c, &run_cpus))
+            continue;
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", c);
+        if (parse_cpu_list(bj_read_line(path, buf, sizeof(buf)), &sib) <= 0)
+            continue;
+        for (int s = 0; s < CPU_SETSIZE; s++)
+            if (CPU_ISSET(s, &sib) && !CPU_ISSET(s, &run_cpus) && !CPU_ISSET(s, isolated))
+                CPU_SET(s, &busy);
+    }
+    if (CPU_COUNT(&busy))
+        warn("SMT: siblings %s of the benchmark CPUs run other work "
+             "(include or isolate them, or disable SMT)", bj_cpu_list(&busy, list, sizeof(list)));
+    else
+        printf("  ok    SMT: no shared cores with other work\n");
+}
+
+static void check_host(void)
+{
+    char buf[256], list[256];
+    cpu_set_t isolated, open;
+
+    printf("Host checks (cpu %s)\n", bj_cpu_list(&run_cpus, list, sizeof(list)));
+    check_governor();
+
+    if (parse_cpu_list(bj_read_line("/sys/devices/system/cpu/isolated", buf, sizeof(buf)),
+                       &isolated) < 0)
+        CPU_ZERO(&isolated);
+    check_smt(&isolated);
+
+    CPU_ZERO(&open);
+    for (int c = 0; c < CPU_SETSIZE; c++)
+        if (CPU_ISSET(c, &run_cpus) && !CPU_ISSET(c, &isolated))
+            CPU_SET(c, &open);
+    if (!opt_cpus)
+        warn("no --cpus: runs share and migrate across every CPU");
+    else if (CPU_COUNT(&open))
+        warn("cpu %s not isolated (boot with isolcpus=/nohz_full=, or a cpuset shield)",
+             bj_cpu_list(&open, list, sizeof(list)));
+    else
+        printf("  ok    isolation: cpu %s isolated\n", opt_cpus);
+
+    double load = atof(bj_read_line("/proc/loadavg", buf, sizeof(buf)));
+    if (load >= 0.5)
+        warn("load average %.2f: other work is running", load);
+    else
+        printf("  ok    load average %.2f\n", load);
+}
+
+/* ── Runs ───────────────────────────────────────────────────────────── */
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void drop_caches(void)
+{
+    static int failed;
+    sync();
+    int fd = open("/proc/sys/vm/drop_caches", O_WRONLY);
+    if (fd < 0 || write(fd, "3", 1) != 1) {
+        if (!failed++)
+            fprintf(stderr, "benchrun: can't drop caches: %s\n", strerror(errno));
+    }
+    if (fd >= 0)
+        close(fd);
+}
+
+static void child_exec(const struct bench *b, const char *json_path, const char *run)
+{
+    setenv("BENCH_JSON", json_path, 1);
+    setenv("BENCH_RUN", run, 1);
+    if (opt_cpus && sched_setaffinity(0, sizeof(run_cpus), &run_cpus) != 0) {
+        perror("sched_setaffinity");
+        _exit(127);
+    }
+    if (b->dir && chdir(b->dir) != 0) {
+        perror(b->dir);
+        _exit(127);
+    }
+    if (!opt_verbose) {
+        int null = open("/dev/null", O_WRONLY);
+        if (null >= 0) {
+            dup2(null, STDOUT_FILENO);
+            close(null);
+        }
+    }
+    if (b->argv) {
+        execvp(b->argv[0], b->argv);
+        perror(b->argv[0]);
+    } else {
+        execl("/bin/sh", "sh", "-c", b->command, (char *)NULL);
+        perror("/bin/sh");
+    }
+    _exit(127);
+}
+
+/* One run; measured runs add their values. 0 on success. */
+static int run_once(struct bench *b, int index, int measured)
+{
+    char path[] = "/tmp/benchrun-XXXXXX.json", run[16];
+    int fd = mkstemps(path, 5);
+    if (fd < 0) {
+        perror("mkstemps");
+        exit(1);
+    }
+    close(fd);
+    snprintf(run, sizeof(run), measured ? "%d" : "warmup%d", index);
+    if (opt_drop_caches)
+        drop_caches();
+    fflush(stdout);
+
+    uint64_t t0 = now_ns();
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(1);
+    }
+    if (pid == 0)
+        child_exec(b, path, run);
+
+    int status;
+    struct rusage ru;
+    while (wait4(pid, &status, 0, &ru) < 0) {
+        if (errno != EINTR) {
+            perror("wait4");
+            exit(1);
+        }
+    }
+    uint64_t t1 = now_ns();
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        if (WIFSIGNALED(status))
+            fprintf(stderr, "\n%s: run %s killed by signal %d\n", b->name, run, WTERMSIG(status));
+        else
+            fprintf(stderr, "\n%s: run %s exited with status %d\n", b->name, run,
+                    WEXITSTATUS(status));
+        unlink(path);
+        return -1;
+    }
+
+    struct stat st;
+    struct json *root = NULL;
+    if (stat(path, &st) == 0 && st.st_size > 0 && !(root = json_load(path))) {
+        unlink(path);
+        return -1;
+    }
+    unlink(path);
+    if (!measured) {
+        json_free(root);
+        return 0;
+    }
+
+    double cpu_ms = (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1e3 +
+                    (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e3;
+    series_add(b, "process", NULL, "wall_ms", "ms", BJ_LOWER, (double)(t1 - t0) / 1e6);
+    series_add(b, "process", NULL, "cpu_ms", "ms", BJ_LOWER, cpu_ms);
+    series_add(b, "process", NULL, "max_rss_kb", "kB", BJ_LOWER, (double)ru.ru_maxrss);
+    if (root) {
+        collect(b, root);
+        if (!b->first)
+            b->first = root;
+        else
+            json_free(root);
+    }
+    return 0;
+}
+
+static void run_bench(struct bench *b)
+{
+    fprintf(stderr, "%s: ", b->name);
+    for (int i = 0; i < opt_warmup; i++) {
+        fputc(run_once(b, i, 0) == 0 ? 'w' : 'x', stderr);
+    }
+    for (int i = 0; i < opt_reps; i++) {
+        int ok = run_once(b, i, 1) == 0;
+        if (ok)
+            b->runs_ok++;
+        else
+            b->runs_failed++;
+        fputc(ok ? '.' : 'x', stderr);
+    }
+    fputc('\n', stderr);
+}
+
+/* ── Reporting ──────────────────────────────────────────────────────── */
+
+static int metric_shown(const struct series *s)
+{
+    return !opt_metric || strstr(s->metric, opt_metric);
+}
+
+/* 4 significant digits, k/M/G for large values */
+static const char *fmt_val(double v, char *buf, size_t len)
+{
+    double a = fabs(v);
+    if (v != v)
+        snprintf(buf, len, "-");
+    else if (a >= 1e9)
+        snprintf(buf, len, "%.4gG", v / 1e9);
+    else if (a >= 1e6)
+        snprintf(buf, len, "%.4gM", v / 1e6);
+    else if (a >= 1e4)
+        snprintf(buf, len, "%.4gk", v / 1e3);
+    else
+        snprintf(buf, len, "%.4g", v);
+    return buf;
+}
+
+static int label_width(const struct bench *b)
+{
+    int w = 6;
+    for (int i = 0; i < b->ns; i++)
+        if (metric_shown(&b->s[i]) && (int)strlen(b->s[i].label) > w)
+            w = (int)strlen(b->s[i].label);
+    return w > 48 ? 48 : w;
+}
+
+static void print_summary(const struct bench *b)
+{
+    int w = label_width(b);
+    printf("\n%s: %d run%s", b->name, b->runs_ok, b->runs_ok == 1 ? "" : "s");
+    if (b->runs_failed)
+        printf(", %d FAILED", b->runs_failed);
+    printf(" (+%d warmup)\n", opt_warmup);
+    printf("  %-*s  %-16s %10s %8s %7s %10s %10s %10s\n", w, "result", "metric", "mean",
+           "±95%", "cv", "median", "min", "max");
+    for (int i = 0; i < b->ns; i++) {
+        const struct series *s = &b->s[i];
+        if (!metric_shown(s))
+            continue;
+        struct summary m = summarize(s->v, s->n);
+        char v[4][24];
+        double half = (m.ci_hi - m.ci_lo) / 2;
+        printf("  %-*.*s  %-16s %10s %7.1f%% %6.1f%% %10s %10s %10s %s\n", w, w, s->label,
+               s->metric, fmt_val(m.mean, v[0], sizeof(v[0])),
+               m.mean ? 100 * half / fabs(m.mean) : 0.0, 100 * m.cv,
+               fmt_val(m.median, v[1], sizeof(v[1])), fmt_val(m.min, v[2], sizeof(v[2])),
+               fmt_val(m.max, v[3], sizeof(v[3])), s->unit);
+    }
+}
+
+/* Metadata that makes two runs incomparable when it differs */
+static const char *const meta_compared[] = {
+    "host", "cpu_model", "kernel", "arch", "cpus_allowed", "numa_nodes",
+    "governor", "thp", "allocator",
+};
+
+static void meta_diff(const struct json *base, const struct json *cur)
+{
+    for (size_t i = 0; i < sizeof(meta_compared) / sizeof(meta_compared[0]); i++) {
+        const char *a = json_str(json_get(base, meta_compared[i]), NULL);
+        const char *b = json_str(json_get(cur, meta_compared[i]), NULL);
+        if (a && b && strcmp(a, b) != 0)
+            printf("  note: %s differs: baseline '%s', now '%s'\n", meta_compared[i], a, b);
+    }
+}
+
+static const struct json *baseline_bench(const struct json *base, const char *name)
+{
+    const struct json *bl = json_get(base, "benchmarks");
+    for (int i = 0; bl && bl->type == JSON_ARR && i < bl->n; i++)
+        if (strcmp(json_str(json_get(bl->items[i], "name"), ""), name) == 0)
+            return bl->items[i];
+    return NULL;
+}
+
+/* Values of one baseline series into a malloc'd array */
+static double *baseline_values(const struct json *bb, const struct series *s, int *n)
+{
+    const struct json *sl = json_get(bb, "series");
+    *n = 0;
+    for (int i = 0; sl && sl->type == JSON_ARR && i < sl->n; i++) {
+        const struct json *e = sl->items[i];
+        if (strcmp(json_str(json_get(e, "result"), ""), s->result) != 0 ||
+            strcmp(json_str(json_get(e, "metric"), ""), s->metric) != 0)
+            continue;
+        char *key = params_key(json_get(e, "params"));
+        int same = strcmp(key, s->params) == 0;
+        free(key);
+        if (!same)
+            continue;
+        const struct json *vals = json_get(e, "values");
+        if (!vals || vals->type != JSON_ARR || vals->n == 0)
+            return NULL;
+        double *v = malloc((size_t)vals->n * sizeof(*v));
+        if (!v)
+            return NULL;
+        for (int k = 0; k < vals->n; k++)
+            if (vals->items[k]->type == JSON_NUM)
+                v[(*n)++] = vals->items[k]->num;
+        return v;
+    }
+    return NULL;
+}
+
+/*
+ * Regression: significant (p < alpha) and at least --threshold in the
+ * worse direction. Significant but smaller changes are "small"; metrics
+ * without a direction are shown but never judged.
+ */
+static const char *verdict(const struct series *s, double p, double change)
+{
+    if (s->better == BJ_NONE)
+        return "-";
+    if (p != p || p >= opt_alpha)
+        return "same";
+    if (fabs(change) * 100 < opt_threshold)
+        return "small";
+    int worse = s->better == BJ_HIGHER ? change < 0 : change > 0;
+    return worse ? "REGRESSION" : "improved";
+}
+
+/* Number of regressions; *missing counts baseline series not in this run */
+static int print_comparison(const struct bench *b, const struct json *base, int *missing)
+{
+    const struct json *bb = baseline_bench(base, b->name);
+    if (!bb) {
+        printf("\n%s: not in baseline\n", b->name);
+        return 0;
+    }
+
+    int w = label_width(b), regressions = 0;
+    printf("\n%s vs baseline (alpha %g, threshold %g%%)\n", b->name, opt_alpha, opt_threshold);
+    if (b->first)
+        meta_diff(json_get(bb, "meta"), json_get(b->first, "meta"));
+    if (b->runs_failed)
+        printf("  note: %d of %d runs FAILED; compared over the %d that finished\n",
+               b->runs_failed, b->runs_failed + b->runs_ok, b->runs_ok);
+    printf("  %-*s  %-16s %10s %10s %8s %19s %8s  %s\n", w, "result", "metric", "baseline",
+           "now", "change", "95% CI", "p", "verdict");
+
+    for (int i = 0; i < b->ns; i++) {
+        const struct series *s = &b->s[i];
+        if (!metric_shown(s))
+            continue;
+        int nb;
+        double *bv = baseline_values(bb, s, &nb);
+        struct summary now = summarize(s->v, s->n);
+        char v[2][24], ci[40];
+        if (!bv) {
+            printf("  %-*.*s  %-16s %10s %10s %8s %19s %8s  new\n", w, w, s->label, s->metric,
+                   "-", fmt_val(now.mean, v[1], sizeof(v[1])), "", "", "");
+            continue;
+        }
+        struct summary was = summarize(bv, nb);
+        double lo, hi;
+        double change = welch_change(bv, nb, s->v, s->n, &lo, &hi);
+        double p = mann_whitney(bv, nb, s->v, s->n);
+        const char *vd = verdict(s, p, change);
+        regressions += strcmp(vd, "REGRESSION") == 0;
+        snprintf(ci, sizeof(ci), "[%+.1f%%, %+.1f%%]", 100 * lo, 100 * hi);
+        printf("  %-*.*s  %-16s %10s %10s %+7.1f%% %19s %8.2g  %s\n", w, w, s->label, s->metric,
+               fmt_val(was.mean, v[0], sizeof(v[0])), fmt_val(now.mean, v[1], sizeof(v[1])),
+               100 * change, ci, p, vd);
+        if (strcmp(vd, "REGRESSION") == 0 || strcmp(vd, "improved") == 0)
+            printf("  %-*s  %-16s Cohen's d %.2f, %d vs %d runs\n", w, "", "",
+                   cohens_d(bv, nb, s->v, s->n), nb, s->n);
+        free(bv);
+    }
+
+    /* A metric that stops being reported must not pass as unchanged */
+    const struct json *sl = json_get(bb, "series");
+    for (int i = 0; sl && sl->type == JSON_ARR && i < sl->n; i++) {
+        const struct json *e = sl->items[i];
+        const char *result = json_str(json_get(e, "result"), "");
+        const char *metric = json_str(json_get(e, "metric"), "");
+        if (opt_metric && !strstr(metric, opt_metric))
+            continue;
+        char *key = params_key(json_get(e, "params"));
+        int found = series_find(b, result, key, metric) != NULL;
+        free(key);
+        if (found)
+            continue;
+        char *label = series_label(result, json_get(e, "params"));
+        char v[24];
+        printf("  %-*.*s  %-16s %10s %10s %8s %19s %8s  missing\n", w, w, label, metric,
+               fmt_val(json_num(json_get(e, "mean"), NAN), v, sizeof(v)), "-", "", "", "");
+        free(label);
+        (*missing)++;
+    }
+    return regressions;
+}
+
+/* ── Output file (perf-bench-run/1) ─────────────────────────────────── */
+
+static void write_run(const char *path)
+{
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        perror(path);
+        exit(1);
+    }
+    fprintf(f, "{\n  \"schema\": \"%s\",\n  \"runner\": { \"runs\": %d, \"warmup\": %d, "
+            "\"cpus\": ", RUN_SCHEMA, opt_reps, opt_warmup);
+    json_write_str(f, opt_cpus ? opt_cpus : "");
+    fputs(", \"host_warnings\": [", f);
+    for (int i = 0; i < nwarnings; i++) {
+        fputs(i ? ", " : "", f);
+        json_write_str(f, warnings[i]);
+    }
+    fputs("] },\n  \"benchmarks\": [", f);
+
+    for (int bi = 0; bi < nbenches; bi++) {
+        const struct bench *b = &benches[bi];
+        fprintf(f, "%s\n    { \"name\": ", bi ? "," : "");
+        json_write_str(f, b->name);
+        fputs(", \"command\": ", f);
+        if (b->argv) {
+            char *cmd = NULL;
+            size_t len = 0;
+            FILE *m = open_memstream(&cmd, &len);
+            for (int i = 0; m && b->argv[i]; i++)
+                fprintf(m, "%s%s", i ? " " : "", b->argv[i]);
+            if (m)
+                fclose(m);
+            json_write_str(f, cmd);
+            free(cmd);
+        } else {
+            json_write_str(f, b->command);
+        }
+        fprintf(f, ", \"runs_ok\": %d, \"runs_failed\": %d,\n      \"meta\": ",
+                b->runs_ok, b->runs_failed);
+        json_write(f, b->first ? json_get(b->first, "meta") : NULL);
+        fputs(",\n      \"series\": [", f);
+        for (int i = 0; i < b->ns; i++) {
+            const struct series *s = &b->s[i];
+            struct summary m = summarize(s->v, s->n);
+            fprintf(f, "%s\n        { \"result\": ", i ? "," : "");
+            json_write_str(f, s->result);
+            fprintf(f, ", \"params\": %s, \"metric\": ", s->params);
+            json_write_str(f, s->metric);
+            fputs(", \"unit\": ", f);
+            json_write_str(f, s->unit);
+            fprintf(f, ", \"better\": \"%s\",\n          \"values\": [", bj_better_names[s->better]);
+            for (int k = 0; k < s->n; k++) {
+                fputs(k ? ", " : "", f);
+                json_write_num(f, s->v[k]);
+            }
+            fprintf(f, "],\n          \"n\": %d", m.n);
+            const char *names[] = { "mean", "median", "stddev", "min", "max", "cv",
+                                    "ci95_lo", "ci95_hi" };
+            double vals[] = { m.mean, m.median, m.stddev, m.min, m.max, m.cv, m.ci_lo, m.ci_hi };
+            for (int k = 0; k < 8; k++) {
+                fprintf(f, ", \"%s\": ", names[k]);
+                json_write_num(f, vals[k]);
+            }
+            fputs(" }", f);
+        }
+        fputs("\n      ] }", f);
+    }
+    fputs("\n  ]\n}\n", f);
+    if (fclose(f) != 0) {
+        perror(path);
+        exit(1);
+    }
+}
+
+/* ── Suite files ────────────────────────────────────────────────────── */
+
+/* "name dir command..." per line; '#' comments; selected names only */
+static void load_suite(const char *path, char **names, int nnames)
+{
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        exit(1);
+    }
+    char *copy = strdup(path);
+    char *base = strdup(dirname(copy));
+    free(copy);
+
+    char line[1024];
+    int lineno = 0;
+    while (fgets(line, sizeof(line), f)) {
+        lineno++;
+        line[strcspn(line, "#\n")] = '\0';
+        char *name = strtok(line, " \t");
+        char *dir = name ? strtok(NULL, " \t") : NULL;
+        char *cmd = dir ? strtok(NULL, "") : NULL;
+        if (!name)
+            continue;
+        cmd = cmd ? cmd + strspn(cmd, " \t") : NULL;
+        if (!cmd || !*cmd) {
+            fprintf(stderr, "%s:%d: expected 'name dir command'\n", path, lineno);
+            exit(1);
+        }
+        int wanted = nnames == 0;
+        for (int i = 0; i < nnames; i++)
+            wanted |= strcmp(names[i], name) == 0;
+        if (!wanted)
+            continue;
+        if (nbenches == MAX_BENCHES) {
+            fprintf(stderr, "%s: more than %d benchmarks\n", path, MAX_BENCHES);
+            exit(1);
+        }
+        struct bench *b = &benches[nbenches++];
+        char *full = NULL;
+        if (dir[0] == '/' || asprintf(&full, "%s/%s", base, dir) < 0)
+            full = strdup(dir);
+        b->name = strdup(name);
+        b->dir = full;
+        b->command = strdup(cmd);
+    }
+    fclose(f);
+    free(base);
+
+    for (int i = 0; i < nnames; i++) {
+        int found = 0;
+        for (int k = 0; k < nbenches; k++)
+            found |= strcmp(benches[k].name, names[i]) == 0;
+        if (!found) {
+            fprintf(stderr, "%s: no benchmark '%s'\n", path, names[i]);
+            exit(1);
+        }
+    }
+}
+
+/* ── Main ───────────────────────────────────────────────────────────── */
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [options] -- command [args...]\n"
+            "       %s [options] --suite FILE [name...]\n\n"
+            "  -n N             measured runs (default %d)\n"
+            "  -w N             warmup runs (default %d)\n"
+            "  --cpus LIST      run on these CPUs (e.g. 2-3)\n"
+            "  --strict         refuse to run when a host check fails\n"
+            "  --drop-caches    drop the page cache before every run (root)\n"
+            "  -o FILE          save values and summaries (usable as a baseline)\n"
+            "  --baseline FILE  compare against a saved -o file; exit 2 on regression\n"
+            "  --alpha P        significance level (default %g)\n"
+            "  --threshold PCT  smallest change that counts (default %g%%)\n"
+            "  --metric SUBSTR  only report metrics whose name contains SUBSTR\n"
+            "  -v               show the benchmark's output\n",
+            prog, prog, opt_reps, opt_warmup, opt_alpha, opt_threshold);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *suite = NULL;
+    char **names = calloc((size_t)argc, sizeof(*names));
+    int i, nnames = 0;
+
+    if (!names) {
+        perror("calloc");
+        return 1;
+    }
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            opt_reps = atoi(argv[++i]);
+            if (opt_reps < 1) opt_reps = 1;
+        } else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+            opt_warmup = atoi(argv[++i]);
+            if (opt_warmup < 0) opt_warmup = 0;
+        } else if (strcmp(argv[i], "--cpus") == 0 && i + 1 < argc) {
+            opt_cpus = argv[++i];
+        } else if (strcmp(argv[i], "--strict") == 0) {
+            opt_strict = 1;
+        } else if (strcmp(argv[i], "--drop-caches") == 0) {
+            opt_drop_caches = 1;
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            opt_out = argv[++i];
+        } else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc) {
+            opt_baseline = argv[++i];
+        } else if (strcmp(argv[i], "--alpha") == 0 && i + 1 < argc) {
+            opt_alpha = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc) {
+            opt_threshold = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--metric") == 0 && i + 1 < argc) {
+            opt_metric = argv[++i];
+        } else if (strcmp(argv[i], "--suite") == 0 && i + 1 < argc) {
+            suite = argv[++i];
+        } else if (strcmp(argv[i], "-v") == 0) {
+            opt_verbose = 1;
+        } else if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+            usage(argv[0]);
+            return 0;
+        } else if (suite && argv[i][0] != '-') {
+            names[nnames++] = argv[i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (suite) {
+        load_suite(suite, names, nnames);
+    } else if (i < argc) {
+        struct bench *b = &benches[nbenches++];
+        b->argv = argv + i;
+        b->name = strrchr(argv[i], '/') ? strrchr(argv[i], '/') + 1 : argv[i];
+    }
+    if (nbenches == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (opt_cpus) {
+        if (parse_cpu_list(opt_cpus, &run_cpus) <= 0) {
+            fprintf(stderr, "benchrun: bad --cpus '%s'\n", opt_cpus);
+            return 1;
+        }
+    } else if (sched_getaffinity(0, sizeof(run_cpus), &run_cpus) != 0) {
+        perror("sched_getaffinity");
+        return 1;
+    }
+
+    struct json *base = NULL;
+    if (opt_baseline) {
+        if (!(base = json_load(opt_baseline)))
+            return 1;
+        if (strcmp(json_str(json_get(base, "schema"), ""), RUN_SCHEMA) != 0) {
+            fprintf(stderr, "%s: not a benchrun -o file (%s)\n", opt_baseline, RUN_SCHEMA);
+            return 1;
+        }
+    }
+
+    /* One commit id for every run, and the benchmarks agree with it */
+    char commit[128];
+    setenv("BENCH_COMMIT", bj_commit(commit, sizeof(commit)), 0);
+
+    check_host();
+    if (opt_strict && nwarnings) {
+        fprintf(stderr, "benchrun: %d host check%s failed (--strict)\n", nwarnings,
+                nwarnings > 1 ? "s" : "");
+        return 1;
+    }
+    printf("Commit %s, %d run%s + %d warmup per benchmark\n\n", getenv("BENCH_COMMIT"),
+           opt_reps, opt_reps == 1 ? "" : "s", opt_warmup);
+    fflush(stdout);
+
+    int failed = 0, regressions = 0, missing = 0;
+    for (int b = 0; b < nbenches; b++) {
+        run_bench(&benches[b]);
+        failed |= benches[b].runs_failed > 0;
+    }
+    for (int b = 0; b < nbenches; b++) {
+        if (benches[b].runs_ok == 0) {
+            printf("\n%s: every run failed\n", benches[b].name);
+            continue;
+        }
+        print_summary(&benches[b]);
+    }
+    if (base) {
+        for (int b = 0; b < nbenches; b++)
+            if (benches[b].runs_ok)
+                regressions += print_comparison(&benches[b], base, &missing);
+        printf("\n%d regression%s", regressions, regressions == 1 ? "" : "s");
+        if (missing)
+            printf(", %d baseline metric%s missing", missing, missing == 1 ? "" : "s");
+        printf("\n");
+        json_free(base);
+    }
+    if (opt_out) {
+        write_run(opt_out);
+        printf("\nSaved %s\n", opt_out);
+    }
+    return regressions || missing ? 2 : failed ? 1 : 0;
+}
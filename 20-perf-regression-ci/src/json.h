@@ -0,0 +1,372 @@
+#ifndef JSON_H
+#define JSON_H
+
+/*
+ * json.h — Minimal JSON reader and string writer
+ *
+ * Just enough JSON for benchmark results (bench_json.h) and the runner
+ * that aggregates them (benchrun.c): a recursive-descent parser into a
+ * small tree, lookups by key, and a writer that copies a tree back out.
+ *
+ *   struct json *root = json_load("result.json");
+ *   struct json *r = json_get(root, "results");
+ *   for (int i = 0; r && i < r->n; i++)
+ *       printf("%s\n", json_str(json_get(r->items[i], "name"), "?"));
+ *   json_free(root);
+ *
+ * Numbers are doubles; \u escapes outside ASCII become '?'. Objects keep
+ * their keys in file order and lookups are linear: results have tens of
+ * keys, not thousands.
+ */
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum json_type { JSON_NULL, JSON_BOOL, JSON_NUM, JSON_STR, JSON_ARR, JSON_OBJ };
+
+struct json {
+    enum json_type  type;
+    double          num;        /* JSON_NUM, JSON_BOOL (0 or 1) */
+    char           *str;        /* JSON_STR */
+    int             n;          /* JSON_ARR, JSON_OBJ: element count */
+    struct json   **items;      /* elements, or member values */
+    char          **keys;       /* JSON_OBJ: member names */
+};
+
+/* ── Writer ─────────────────────────────────────────────────────────── */
+
+static inline void json_write_str(FILE *f, const char *s)
+{
+    fputc('"', f);
+    for (; s && *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\')
+            fprintf(f, "\\%c", c);
+        else if (c == '\n')
+            fputs("\\n", f);
+        else if (c == '\t')
+            fputs("\\t", f);
+        else if (c < 0x20)
+            fprintf(f, "\\u%04x", c);
+        else
+            fputc(c, f);
+    }
+    fputc('"', f);
+}
+
+/* 15 digits, more than any measurement has; NaN and infinities have no JSON spelling */
+static inline void json_write_num(FILE *f, double v)
+{
+    if (v != v || v > 1.7976931348623157e308 || v < -1.7976931348623157e308)
+        fputs("null", f);
+    else if (v < 1e15 && v > -1e15 && v == (double)(long long)v)
+        fprintf(f, "%lld", (long long)v);
+    else
+        fprintf(f, "%.15g", v);
+}
+
+/* Compact, on one line */
+static inline void json_write(FILE *f, const struct json *v)
+{
+    if (!v) {
+        fputs("null", f);
+        return;
+    }
+    switch (v->type) {
+    case JSON_NULL: fputs("null", f); break;
+    case JSON_BOOL: fputs(v->num ? "true" : "false", f); break;
+    case JSON_NUM:  json_write_num(f, v->num); break;
+    case JSON_STR:  json_write_str(f, v->str); break;
+    case JSON_ARR:
+    case JSON_OBJ:
+        fputc(v->type == JSON_ARR ? '[' : '{', f);
+        for (int i = 0; i < v->n; i++) {
+            if (i)
+                fputs(", ", f);
+            if (v->type == JSON_OBJ) {
+                json_write_str(f, v->keys[i]);
+                fputs(": ", f);
+            }
+            json_write(f, v->items[i]);
+        }
+        fputc(v->type == JSON_ARR ? ']' : '}', f);
+        break;
+    }
+}
+
+/* ── Parser ─────────────────────────────────────────────────────────── */
+
+struct json_parser {
+    const char *p;
+    const char *err;            /* first error, NULL if none */
+};
+
+static inline void json_free(struct json *v)
+{
+    if (!v)
+        return;
+    for (int i = 0; i < v->n; i++) {
+        json_free(v->items[i]);
+        if (v->keys)
+            free(v->keys[i]);
+    }
+    free(v->items);
+    free(v->keys);
+    free(v->str);
+    free(v);
+}
+
+static inline void json_ws(struct json_parser *jp)
+{
+    while (isspace((unsigned char)*jp->p))
+        jp->p++;
+}
+
+static inline char *json_parse_str(struct json_parser *jp)
+{
+    size_t cap = 16, len = 0;
+    char *s = malloc(cap);
+    if (!s) {
+        jp->err = "out of memory";
+        return NULL;
+    }
+    jp->p++;                                    /* opening quote */
+    while (*jp->p && *jp->p != '"') {
+        char c = *jp->p++;
+        if (c == '\\') {
+            c = *jp->p++;
+            switch (c) {
+            case 'n': c = '\n'; break;
+            case 't': c = '\t'; break;
+            case 'r': c = '\r'; break;
+            case 'b': c = '\b'; break;
+            case 'f': c = '\f'; break;
+            case 'u': {
+                unsigned int u = 0;
+                for (int i = 0; i < 4 && isxdigit((unsigned char)*jp->p); i++, jp->p++)
+                    u = u * 16 + (unsigned int)(isdigit((unsigned char)*jp->p) ?
+                        *jp->p - '0' : (tolower((unsigned char)*jp->p) - 'a' + 10));
+                c = u < 0x80 ? (char)u : '?';
+                break;
+            }
+            case '\0':
+                jp->err = "unterminated string";
+                free(s);
+                return NULL;
+            default: break;                     /* \" \\ \/ */
+            }
+        }
+        if (len + 1 >= cap) {
+            char *t = realloc(s, cap *= 2);
+            if (!t) {
+                jp->err = "out of memory";
+                free(s);
+                return NULL;
+            }
+            s = t;
+        }
+        s[len++] = c;
+    }
+    if (*jp->p != '"') {
+        jp->err = "unterminated string";
+        free(s);
+        return NULL;
+    }
+    jp->p++;
+    s[len] = '\0';
+    return s;
+}
+
+static inline struct json *json_parse_value(struct json_parser *jp, int depth);
+
+/* Append to an array or object; key is taken over (NULL for arrays) */
+static inline int json_push(struct json_parser *jp, struct json *v, char *key, struct json *item)
+{
+    if ((v->n & (v->n - 1)) == 0) {             /* full at 0, 1, 2, 4, ... */
+        int cap = v->n ? v->n * 2 : 1;
+        struct json **items = realloc(v->items, (size_t)cap * sizeof(*items));
+        if (items)
+            v->items = items;
+        if (items && v->type == JSON_OBJ) {
+            char **keys = realloc(v->keys, (size_t)cap * sizeof(*keys));
+            if (keys)
+                v->keys = keys;
+            else
+                items = NULL;
+        }
+        if (!items) {
+            jp->err = "out of memory";
+            json_free(item);
+            free(key);
+            return -1;
+        }
+    }
+    if (v->type == JSON_OBJ)
+        v->keys[v->n] = key;
+    v->items[v->n++] = item;
+    return 0;
+}
+
+static inline struct json *json_parse_value(struct json_parser *jp, int depth)
+{
+    json_ws(jp);
+    if (depth > 64) {
+        jp->err = "nested too deeply";
+        return NULL;
+    }
+    struct json *v = calloc(1, sizeof(*v));
+    if (!v) {
+        jp->err = "out of memory";
+        return NULL;
+    }
+
+    char c = *jp->p;
+    if (c == '{' || c == '[') {
+        char close = c == '{' ? '}' : ']';
+        v->type = c == '{' ? JSON_OBJ : JSON_ARR;
+        jp->p++;
+        json_ws(jp);
+        if (*jp->p == close) {
+            jp->p++;
+            return v;
+        }
+        for (;;) {
+            char *key = NULL;
+            if (v->type == JSON_OBJ) {
+                json_ws(jp);
+                if (*jp->p != '"') {
+                    jp->err = "expected member name";
+                    break;
+                }
+                if (!(key = json_parse_str(jp)))
+                    break;
+                json_ws(jp);
+                if (*jp->p != ':') {
+                    jp->err = "expected ':'";
+                    free(key);
+                    break;
+                }
+                jp->p++;
+            }
+            struct json *item = json_parse_value(jp, depth + 1);
+            if (!item) {
+                free(key);
+                break;
+            }
+            if (json_push(jp, v, key, item) < 0)
+                break;
+            json_ws(jp);
+            if (*jp->p == ',') {
+                jp->p++;
+                continue;
+            }
+            if (*jp->p == close) {
+                jp->p++;
+                return v;
+            }
+            jp->err = v->type == JSON_OBJ ? "expected ',' or '}'" : "expected ',' or ']'";
+            break;
+        }
+        json_free(v);
+        return NULL;
+    }
+
+    if (c == '"') {
+        v->type = JSON_STR;
+        if (!(v->str = json_parse_str(jp))) {
+            free(v);
+            return NULL;
+        }
+    } else if (strncmp(jp->p, "true", 4) == 0 || strncmp(jp->p, "false", 5) == 0) {
+        v->type = JSON_BOOL;
+        v->num = c == 't';
+        jp->p += c == 't' ? 4 : 5;
+    } else if (strncmp(jp->p, "null", 4) == 0) {
+        v->type = JSON_NULL;
+        jp->p += 4;
+    } else {
+        char *end;
+        v->type = JSON_NUM;
+        v->num = strtod(jp->p, &end);
+        if (end == jp->p) {
+            jp->err = "unexpected character";
+            free(v);
+            return NULL;
+        }
+        jp->p = end;
+    }
+    return v;
+}
+
+/* NULL on error, with a message and byte offset on stderr naming what */
+static inline struct json *json_parse(const char *text, const char *what)
+{
+    struct json_parser jp = { text, NULL };
+    struct json *v = json_parse_value(&jp, 0);
+    if (v) {
+        json_ws(&jp);
+        if (*jp.p) {
+            jp.err = "trailing characters";
+            json_free(v);
+            v = NULL;
+        }
+    }
+    if (!v)
+        fprintf(stderr, "%s: JSON error at byte %ld: %s\n", what,
+                (long)(jp.p - text), jp.err ? jp.err : "unexpected end");
+    return v;
+}
+
+static inline struct json *json_load(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        return NULL;
+    }
+    size_t cap = 65536, len = 0, n;
+    char *buf = malloc(cap);
+    while (buf && (n = fread(buf + len, 1, cap - len - 1, f)) > 0) {
+        len += n;
+        if (len + 1 == cap) {
+            char *t = realloc(buf, cap *= 2);
+            if (!t)
+                free(buf);
+            buf = t;
+        }
+    }
+    fclose(f);
+    if (!buf) {
+        fprintf(stderr, "%s: out of memory\n", path);
+        return NULL;
+    }
+    buf[len] = '\0';
+    struct json *v = json_parse(buf, path);
+    free(buf);
+    return v;
+}
+
+/* ── Lookups ────────────────────────────────────────────────────────── */
+
+static inline struct json *json_get(const struct json *obj, const char *key)
+{
+    if (!obj || obj->type != JSON_OBJ)
+        return NULL;
+    for (int i = 0; i < obj->n; i++)
+        if (strcmp(obj->keys[i], key) == 0)
+            return obj->items[i];
+    return NULL;
+}
+
+static inline const char *json_str(const struct json *v, const char *def)
+{
+    return v && v->type == JSON_STR ? v->str : def;
+}
+
+static inline double json_num(const struct json *v, double def)
+{
+    return v && (v->type == JSON_NUM || v->type == JSON_BOOL) ? v->num : def;
+}
+
+#endif /* JSON_H */
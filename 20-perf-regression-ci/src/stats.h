@@ -0,0 +1,270 @@
+#ifndef STATS_H
+#define STATS_H
+
+/*
+ * stats.h — Summary statistics and two-sample tests for benchmark runs
+ *
+ *   struct summary s = summarize(v, n);    mean, median, stddev, CV, and
+ *                                          a 95% confidence interval on
+ *                                          the mean (Student's t)
+ *   mann_whitney(a, na, b, nb)             two-sided p that both samples
+ *                                          come from one distribution
+ *   welch_change(a, na, b, nb, &lo, &hi)   relative change of b's mean
+ *                                          over a's, with a 95% interval
+ *
+ * Mann-Whitney is rank-based: it assumes nothing about the shape of the
+ * distribution, so a few slow outlier runs (a timer interrupt, a page
+ * cache miss) do not swamp it the way they swamp a t-test. Small samples
+ * without ties get the exact p (all orderings counted); otherwise the
+ * normal approximation with tie and continuity correction. With 5 runs
+ * a side the smallest possible exact p is 0.008, so alpha 0.01 needs at
+ * least 5 runs; 10 (the benchrun default) resolves p down to 1e-5.
+ *
+ * The t quantile uses exact forms for 1 and 2 degrees of freedom and
+ * the Cornish-Fisher expansion above that (0.12% low at df 3, under
+ * 0.01% from df 6); the normal quantile is Acklam's rational fit.
+ */
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct summary {
+    int     n;
+    double  mean, median, stddev, min, max;
+    double  cv;                 /* stddev / mean */
+    double  ci_lo, ci_hi;       /* 95% interval on the mean */
+};
+
+/* ── Quantiles ──────────────────────────────────────────────────────── */
+
+/* Inverse standard normal CDF, |relative error| < 1.2e-9 (P. Acklam) */
+static inline double norm_quantile(double p)
+{
+    static const double a[] = { -3.969683028665376e+01, 2.209460984245205e+02,
+        -2.759285104469687e+02, 1.383577518672690e+02, -3.066479806614716e+01,
+        2.506628277459239e+00 };
+    static const double b[] = { -5.447609879822406e+01, 1.615858368580409e+02,
+        -1.556989798598866e+02, 6.680131188771972e+01, -1.328068155288572e+01 };
+    static const double c[] = { -7.784894002430293e-03, -3.223964580411365e-01,
+        -2.400758277161838e+00, -2.549732539343734e+00, 4.374664141464968e+00,
+        2.938163982698783e+00 };
+    static const double d[] = { 7.784695709041462e-03, 3.224671290700398e-01,
+        2.445134137142996e+00, 3.754408661907416e+00 };
+
+    if (p <= 0) return -INFINITY;
+    if (p >= 1) return INFINITY;
+    if (p < 0.02425 || p > 1 - 0.02425) {
+        double q = sqrt(-2 * log(p < 0.5 ? p : 1 - p));
+        double x = (((((c[0] * q + c[1]) * q + c[2]) * q + c[3]) * q + c[4]) * q + c[5]) /
+                   ((((d[0] * q + d[1]) * q + d[2]) * q + d[3]) * q + 1);
+        return p < 0.5 ? x : -x;
+    }
+    double q = p - 0.5, r = q * q;
+    return (((((a[0] * r + a[1]) * r + a[2]) * r + a[3]) * r + a[4]) * r + a[5]) * q /
+           (((((b[0] * r + b[1]) * r + b[2]) * r + b[3]) * r + b[4]) * r + 1);
+}
+
+/* Student's t quantile for df degrees of freedom. A fractional (Welch)
+ * df is rounded down: the quantile only grows as df falls, so the
+ * interval is never narrower than it should be */
+static inline double t_quantile(double p, double df)
+{
+    df = floor(df);
+    if (df < 1)
+        return NAN;
+    if (df == 1)
+        return tan(M_PI * (p - 0.5));
+    if (df == 2)
+        return (2 * p - 1) / sqrt(2 * p * (1 - p));
+
+    double z = norm_quantile(p), z2 = z * z;
+    double g1 = (z2 + 1) * z / 4;
+    double g2 = ((5 * z2 + 16) * z2 + 3) * z / 96;
+    double g3 = (((3 * z2 + 19) * z2 + 17) * z2 - 15) * z / 384;
+    double g4 = ((((79 * z2 + 776) * z2 + 1482) * z2 - 1920) * z2 - 945) * z / 92160;
+    return z + g1 / df + g2 / (df * df) + g3 / (df * df * df) + g4 / (df * df * df * df);
+}
+
+/* ── Summary ────────────────────────────────────────────────────────── */
+
+static inline int stats_cmp(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static inline struct summary summarize(const double *v, int n)
+{
+    struct summary s;
+    memset(&s, 0, sizeof(s));
+    s.n = n;
+    if (n == 0) {
+        s.mean = s.median = s.stddev = s.min = s.max = s.cv = s.ci_lo = s.ci_hi = NAN;
+        return s;
+    }
+
+    double *sorted = malloc((size_t)n * sizeof(*sorted));
+    if (!sorted)
+        return s;
+    memcpy(sorted, v, (size_t)n * sizeof(*sorted));
+    qsort(sorted, (size_t)n, sizeof(*sorted), stats_cmp);
+    s.min = sorted[0];
+    s.max = sorted[n - 1];
+    s.median = n % 2 ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+    free(sorted);
+
+    double sum = 0, ss = 0;
+    for (int i = 0; i < n; i++)
+        sum += v[i];
+    s.mean = sum / n;
+    for (int i = 0; i < n; i++)
+        ss += (v[i] - s.mean) * (v[i] - s.mean);
+    s.stddev = n > 1 ? sqrt(ss / (n - 1)) : 0;
+    s.cv = s.mean != 0 ? s.stddev / fabs(s.mean) : 0;
+
+    double half = n > 1 ? t_quantile(0.975, n - 1) * s.stddev / sqrt(n) : 0;
+    s.ci_lo = s.mean - half;
+    s.ci_hi = s.mean + half;
+    return s;
+}
+
+/* ── Mann-Whitney U ─────────────────────────────────────────────────── */
+
+#define MW_EXACT_MAX 20         /* both samples at most this: exact p */
+
+struct mw_rank {
+    double  v;
+    int     from_a;
+};
+
+static inline int mw_rank_cmp(const void *x, const void *y)
+{
+    return stats_cmp(&((const struct mw_rank *)x)->v, &((const struct mw_rank *)y)->v);
+}
+
+/*
+ * P(U <= u) under the null, counting the orderings of na a's and nb b's
+ * whose U is each value: f(i, j, u) = f(i-1, j, u-j) + f(i, j-1, u).
+ * Computed over j for each i, one layer of (nb+1) x (u+1) counts at a time.
+ */
+static inline double mw_exact_cdf(int na, int nb, int u)
+{
+    int umax = na * nb, w = umax + 1;
+    double *prev = calloc((size_t)(nb + 1) * (size_t)w, sizeof(double));
+    double *cur = calloc((size_t)(nb + 1) * (size_t)w, sizeof(double));
+    if (!prev || !cur) {
+        free(prev);
+        free(cur);
+        return NAN;
+    }
+    for (int j = 0; j <= nb; j++)
+        prev[j * w] = 1;                        /* i = 0: U is 0 */
+    for (int i = 1; i <= na; i++) {
+        memset(cur, 0, (size_t)(nb + 1) * (size_t)w * sizeof(double));
+        cur[0] = 1;                             /* j = 0: U is 0 */
+        for (int j = 1; j <= nb; j++)
+            for (int k = 0; k <= i * j; k++)
+                cur[j * w + k] = (k >= j ? prev[j * w + k - j] : 0) + cur[(j - 1) * w + k];
+        double *t = prev; prev = cur; cur = t;
+    }
+    double below = 0, total = 0;
+    for (int k = 0; k <= umax; k++) {
+        total += prev[nb * w + k];
+        if (k <= u)
+            below += prev[nb * w + k];
+    }
+    free(prev);
+    free(cur);
+    return below / total;
+}
+
+/* Two-sided p; 1 when either sample is empty */
+static inline double mann_whitney(const double *a, int na, const double *b, int nb)
+{
+    if (na == 0 || nb == 0)
+        return 1;
+    int n = na + nb;
+    struct mw_rank *r = malloc((size_t)n * sizeof(*r));
+    if (!r)
+        return NAN;
+    for (int i = 0; i < na; i++)
+        r[i] = (struct mw_rank){ a[i], 1 };
+    for (int i = 0; i < nb; i++)
+        r[na + i] = (struct mw_rank){ b[i], 0 };
+    qsort(r, (size_t)n, sizeof(*r), mw_rank_cmp);
+
+    /* Midranks for ties; tie_term is sum(t^3 - t) over tie groups */
+    double rank_a = 0, tie_term = 0;
+    for (int i = 0; i < n;) {
+        int j = i;
+        while (j + 1 < n && r[j + 1].v == r[i].v)
+            j++;
+        double mid = (i + j) / 2.0 + 1;
+        for (int k = i; k <= j; k++)
+            if (r[k].from_a)
+                rank_a += mid;
+        double t = j - i + 1;
+        tie_term += t * t * t - t;
+        i = j + 1;
+    }
+    free(r);
+
+    double ua = rank_a - (double)na * (na + 1) / 2, ub = (double)na * nb - ua;
+    double umin = ua < ub ? ua : ub;
+
+    if (tie_term == 0 && na <= MW_EXACT_MAX && nb <= MW_EXACT_MAX) {
+        double p = 2 * mw_exact_cdf(na, nb, (int)umin);
+        return p > 1 ? 1 : p;
+    }
+
+    double mu = (double)na * nb / 2;
+    double var = (double)na * nb / 12 * ((n + 1) - tie_term / ((double)n * (n - 1)));
+    if (var <= 0)
+        return 1;                               /* every value tied */
+    double z = (fabs(ua - mu) - 0.5) / sqrt(var);
+    if (z < 0)
+        z = 0;
+    return erfc(z / M_SQRT2);
+}
+
+/* ── Effect size ────────────────────────────────────────────────────── */
+
+/*
+ * Relative change of b's mean over a's, (mean_b - mean_a) / mean_a, with
+ * a 95% Welch interval (unequal variances, Welch-Satterthwaite df).
+ */
+static inline double welch_change(const double *a, int na, const double *b, int nb,
+                                  double *lo, double *hi)
+{
+    struct summary sa = summarize(a, na), sb = summarize(b, nb);
+    *lo = *hi = NAN;
+    if (na == 0 || nb == 0 || sa.mean == 0)
+        return NAN;
+    double change = (sb.mean - sa.mean) / sa.mean;
+    double va = na > 1 ? sa.stddev * sa.stddev / na : 0;
+    double vb = nb > 1 ? sb.stddev * sb.stddev / nb : 0;
+    double se = sqrt(va + vb);
+    if (se == 0) {
+        *lo = *hi = change;
+        return change;
+    }
+    double den = (na > 1 ? va * va / (na - 1) : 0) + (nb > 1 ? vb * vb / (nb - 1) : 0);
+    double df = den > 0 ? (va + vb) * (va + vb) / den : 1;
+    double half = t_quantile(0.975, df) * se / fabs(sa.mean);
+    *lo = change - half;
+    *hi = change + half;
+    return change;
+}
+
+/* Cohen's d: difference of means in pooled standard deviations */
+static inline double cohens_d(const double *a, int na, const double *b, int nb)
+{
+    struct summary sa = summarize(a, na), sb = summarize(b, nb);
+    if (na + nb <= 2)
+        return NAN;
+    double pooled = sqrt(((na - 1) * sa.stddev * sa.stddev +
+                          (nb - 1) * sb.stddev * sb.stddev) / (na + nb - 2));
+    return pooled > 0 ? (sb.mean - sa.mean) / pooled : 0;
+}
+
+#endif /* STATS_H */